@@ -0,0 +1,393 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures the size and throughput of transformations between the old, v1 and
+// compact v1 wire formats, over a generated corpus for each struct type of
+// `tables.h`, as well as the size of its storage encoding and the throughput of
+// dumping it as JSON. Usage:
+//
+//     ./bench [--messages N] [--iterations N] [--max-count N] [--ir FILE]
+//             [--calibrate GHZ] [name-substring]
+//
+// For each type, prints the average message size in each wire format and in
+// storage, and the time per message (and source throughput) of each
+// transformation, of `fidl_view_dump_json` on v1 messages, of detecting that
+// they are v1 (see `fidl_detect_wire_format`), and of handling them after the
+// wire format was wrongly cached as old (a failed transformation, then
+// detection and the transformation from v1).
+//
+// With `--ir`, the coding tables are loaded from the JSON IR FILE (see `ir.h`)
+// instead of using the compiled-in ones, after printing the time taken to load
+// them and the memory used per coding table.
+//
+// With `--calibrate`, the nodes and operations of each transformation are also
+// counted from its trace events (see `transformer.h`), and a cost model for
+// `fidl_transform_explain` is fitted to them and the times measured, on a core
+// running at GHZ gigahertz (see `fidl_transform_cost_model_fit`). This needs
+// tracing, which is compiled out of `bench` unless built with
+// `make bench BENCH_TRACE=1`. Corpora whose messages take more steps than the
+// trace retains are left out of the fit, so a small `--max-count` keeps more of
+// them.
+
+#include <lib/fidl/detect.h>
+#include <lib/fidl/explain.h>
+#include <lib/fidl/ir.h>
+#include <lib/fidl/json.h>
+#include <lib/fidl/storage.h>
+#include <lib/fidl/transformer.h>
+#include <lib/fidl/view.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "message_generator.h"
+#include "tables_catalog.h"
+
+namespace {
+
+// A set of messages of one type, in one wire format.
+struct Corpus {
+  std::vector<uint8_t> bytes;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> sizes;
+
+  void Add(const uint8_t* message, uint32_t size) {
+    offsets.push_back(static_cast<uint32_t>(bytes.size()));
+    sizes.push_back(size);
+    bytes.insert(bytes.end(), message, message + size);
+    // Keep messages 8-byte aligned, as they would be in a channel buffer.
+    bytes.resize(FIDL_ALIGN(bytes.size()));
+  }
+
+  double AverageSize() const {
+    return sizes.empty() ? 0 : static_cast<double>(bytes.size()) / static_cast<double>(sizes.size());
+  }
+};
+
+struct Result {
+  double ns_per_message;
+  double src_mb_per_s;
+};
+
+bool Transform(fidl_transformation_t transformation, const fidl_type_t* type,
+               const Corpus& src, uint8_t* dst_bytes, Corpus* out_dst) {
+  for (size_t i = 0; i < src.sizes.size(); i++) {
+    uint32_t dst_num_bytes;
+    const char* error = nullptr;
+    if (fidl_transform(transformation, type, &src.bytes[src.offsets[i]], src.sizes[i], dst_bytes,
+                       &dst_num_bytes, &error) != ZX_OK) {
+      fprintf(stderr, "transformation %u failed: %s\n", transformation, error);
+      return false;
+    }
+    if (out_dst) {
+      out_dst->Add(dst_bytes, dst_num_bytes);
+    }
+  }
+  return true;
+}
+
+bool DumpJson(const fidl_type_t* type, const Corpus& src, std::vector<char>* json) {
+  for (size_t i = 0; i < src.sizes.size(); i++) {
+    fidl_view_t message;
+    uint32_t size;
+    const char* error = nullptr;
+    if (fidl_view_init(FIDL_WIRE_FORMAT_V1, type, &src.bytes[src.offsets[i]], src.sizes[i],
+                       &message, &error) != ZX_OK ||
+        fidl_view_dump_json(&message, nullptr, nullptr, json->data(),
+                            static_cast<uint32_t>(json->size()), &size, &error) != ZX_OK) {
+      fprintf(stderr, "dumping JSON failed: %s\n", error);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Detect(const fidl_type_t* old_type, const fidl_type_t* v1_type, const Corpus& src) {
+  for (size_t i = 0; i < src.sizes.size(); i++) {
+    fidl_wire_format_t wire_format;
+    const char* error = nullptr;
+    if (fidl_detect_wire_format(old_type, v1_type, 0, &src.bytes[src.offsets[i]], src.sizes[i],
+                                &wire_format, &error) != ZX_OK) {
+      fprintf(stderr, "detecting the wire format failed: %s\n", error);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Transforms v1 messages to the old wire format on a connection whose cached
+// wire format is wrongly old: each is first transformed from the old wire
+// format, and when that fails, detected again and transformed from v1.
+// Messages whose leading bytes happen to transform from the old wire format
+// (which does not check that the whole message was consumed) only cost that
+// transformation, and go unnoticed.
+void Misdetect(const fidl_type_t* old_type, const fidl_type_t* v1_type, const Corpus& src,
+               uint8_t* dst_bytes) {
+  for (size_t i = 0; i < src.sizes.size(); i++) {
+    const uint8_t* bytes = &src.bytes[src.offsets[i]];
+    fidl_wire_format_t wire_format;
+    uint32_t dst_num_bytes;
+    if (fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, old_type, bytes, src.sizes[i], dst_bytes,
+                       &dst_num_bytes, nullptr) == ZX_OK) {
+      continue;
+    }
+    if (fidl_detect_wire_format(old_type, v1_type, 0, bytes, src.sizes[i], &wire_format,
+                                nullptr) == ZX_OK &&
+        wire_format == FIDL_WIRE_FORMAT_V1) {
+      fidl_transform(FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, bytes, src.sizes[i], dst_bytes,
+                     &dst_num_bytes, nullptr);
+    }
+  }
+}
+
+// Checks the messages as transforming them would, without writing anything.
+bool Validate(fidl_transformation_t transformation, const fidl_type_t* type, const Corpus& src) {
+  const fidl_transform_options_t options = {};
+  for (size_t i = 0; i < src.sizes.size(); i++) {
+    uint32_t dst_num_bytes;
+    const char* error = nullptr;
+    if (fidl_transform_validate(transformation, &options, type, &src.bytes[src.offsets[i]],
+                                src.sizes[i], &dst_num_bytes, &error) != ZX_OK) {
+      fprintf(stderr, "validating failed: %s\n", error);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Counts the nodes entered and the operations performed (and the bytes they
+// cover) per message when transforming |src|, from the trace events. Returns
+// false if the events of a message did not fit in the trace.
+bool Count(fidl_transformation_t transformation, const fidl_type_t* type, const Corpus& src,
+           uint8_t* dst_bytes, fidl_transform_cost_sample_t* out_sample) {
+  fidl_transform_trace_event_t events[FIDL_TRANSFORM_TRACE_CAPACITY];
+  *out_sample = {};
+  for (size_t i = 0; i < src.sizes.size(); i++) {
+    uint32_t dst_num_bytes;
+    fidl_transform_trace_clear();
+    fidl_transform(transformation, type, &src.bytes[src.offsets[i]], src.sizes[i], dst_bytes,
+                   &dst_num_bytes, nullptr);
+    const uint32_t num_events =
+        fidl_transform_trace_snapshot(events, FIDL_TRANSFORM_TRACE_CAPACITY);
+    if (num_events == 0 || events[0].kind != FIDL_TRANSFORM_TRACE_BEGIN) {
+      return false;
+    }
+    for (uint32_t j = 0; j < num_events; j++) {
+      switch (events[j].kind) {
+        case FIDL_TRANSFORM_TRACE_NODE:
+          out_sample->num_nodes++;
+          break;
+        case FIDL_TRANSFORM_TRACE_COPY:
+        case FIDL_TRANSFORM_TRACE_PAD:
+        case FIDL_TRANSFORM_TRACE_WRITE:
+          out_sample->num_ops++;
+          out_sample->op_bytes += events[j].arg0;
+          break;
+      }
+    }
+  }
+  const double messages = static_cast<double>(src.sizes.size());
+  out_sample->num_nodes /= messages;
+  out_sample->num_ops /= messages;
+  out_sample->op_bytes /= messages;
+  return !src.sizes.empty();
+}
+
+template <typename Run>
+Result Time(const Corpus& src, uint32_t iterations, Run run) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    run();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  double messages = static_cast<double>(src.sizes.size()) * iterations;
+  double bytes = static_cast<double>(src.bytes.size()) * iterations;
+  return Result{ns / messages, bytes / ns * 1e3};
+}
+
+Result Measure(fidl_transformation_t transformation, const fidl_type_t* type, const Corpus& src,
+               uint8_t* dst_bytes, uint32_t iterations) {
+  return Time(src, iterations, [&] { Transform(transformation, type, src, dst_bytes, nullptr); });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t num_messages = 1000;
+  uint32_t iterations = 20;
+  uint32_t max_count = 16;
+  const char* filter = nullptr;
+  const char* ir_path = nullptr;
+  double ghz = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--messages") && has_value) {
+      num_messages = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--iterations") && has_value) {
+      iterations = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--max-count") && has_value) {
+      max_count = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--ir") && has_value) {
+      ir_path = argv[++i];
+    } else if (!strcmp(argv[i], "--calibrate") && has_value) {
+      ghz = strtod(argv[++i], nullptr);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr,
+              "usage: %s [--messages N] [--iterations N] [--max-count N] [--ir FILE] "
+              "[--calibrate GHZ] [filter]\n",
+              argv[0]);
+      return 1;
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  if (ghz > 0 && !FIDL_TRANSFORMER_TRACE) {
+    fprintf(stderr, "--calibrate needs tracing, build with `make bench BENCH_TRACE=1`\n");
+    return 1;
+  }
+
+  fidl_ir_library_t* library = nullptr;
+  if (ir_path) {
+    std::ifstream file(ir_path);
+    const std::string ir((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const char* error = nullptr;
+    if (fidl_ir_load(ir.data(), static_cast<uint32_t>(ir.size()), &library, &error) != ZX_OK) {
+      fprintf(stderr, "loading %s failed: %s\n", ir_path, error);
+      return 1;
+    }
+    fidl_ir_stats_t stats;
+    fidl_ir_stats(library, &stats);
+    printf("loaded %u declarations (%u coding tables) in %.1f us, %u bytes (%.1f per table)\n\n",
+           stats.num_declarations, stats.num_types, static_cast<double>(stats.load_ns) / 1e3,
+           stats.arena_size,
+           static_cast<double>(stats.arena_size) / static_cast<double>(stats.num_types));
+  }
+
+  std::vector<uint8_t> message(ZX_CHANNEL_MAX_MSG_BYTES);
+  std::vector<uint8_t> dst_bytes(16 * ZX_CHANNEL_MAX_MSG_BYTES);
+  std::vector<char> json(16 * ZX_CHANNEL_MAX_MSG_BYTES);
+
+  printf("%-36s %8s %8s %8s %8s | %19s %19s | %19s %19s %19s | %19s | %19s %19s\n", "type",
+         "old", "v1", "compact", "storage", "old->v1 ns (MB/s)", "old->compact", "v1->old",
+         "compact->old", "validate v1", "v1->json", "detect v1", "misdetected v1");
+
+  MessageGenerator generator(1, max_count);
+  std::vector<fidl_transform_cost_sample_t> samples;
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct ||
+        (filter && !strstr(entry.name, filter))) {
+      continue;
+    }
+    const fidl_type_t* old_type = entry.old_type;
+    const fidl_type_t* v1_type = entry.v1_type;
+    if (library && (fidl_ir_lookup(library, FIDL_WIRE_FORMAT_OLD, entry.name, &old_type) != ZX_OK ||
+                    fidl_ir_lookup(library, FIDL_WIRE_FORMAT_V1, entry.name, &v1_type) != ZX_OK)) {
+      continue;
+    }
+
+    Corpus old_corpus, v1_corpus, compact_corpus;
+    uint64_t storage_bytes = 0;
+    for (uint32_t i = 0; i < num_messages; i++) {
+      uint32_t num_bytes, num_handles, storage_num_bytes;
+      if (!generator.Generate(entry.old_type, message.data(), ZX_CHANNEL_MAX_MSG_BYTES,
+                              &num_bytes, &num_handles)) {
+        continue;
+      }
+      old_corpus.Add(message.data(), num_bytes);
+      const char* error = nullptr;
+      if (fidl_storage_encode(FIDL_WIRE_FORMAT_OLD, entry.old_type, message.data(), num_bytes,
+                              dst_bytes.data(), static_cast<uint32_t>(dst_bytes.size()),
+                              &storage_num_bytes, &error) != ZX_OK) {
+        fprintf(stderr, "storage encoding failed: %s\n", error);
+        return 1;
+      }
+      storage_bytes += storage_num_bytes;
+    }
+    if (!Transform(FIDL_TRANSFORMATION_OLD_TO_V1, old_type, old_corpus, dst_bytes.data(),
+                   &v1_corpus) ||
+        !Transform(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, old_type, old_corpus, dst_bytes.data(),
+                   &compact_corpus) ||
+        !Validate(FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, v1_corpus) ||
+        !DumpJson(v1_type, v1_corpus, &json) || !Detect(old_type, v1_type, v1_corpus)) {
+      return 1;
+    }
+
+    const Result results[] = {
+        Measure(FIDL_TRANSFORMATION_OLD_TO_V1, old_type, old_corpus, dst_bytes.data(),
+                iterations),
+        Measure(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, old_type, old_corpus, dst_bytes.data(),
+                iterations),
+        Measure(FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, v1_corpus, dst_bytes.data(), iterations),
+        Measure(FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, v1_type, compact_corpus, dst_bytes.data(),
+                iterations),
+        Time(v1_corpus, iterations,
+             [&] { Validate(FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, v1_corpus); }),
+        Time(v1_corpus, iterations, [&] { DumpJson(v1_type, v1_corpus, &json); }),
+        Time(v1_corpus, iterations, [&] { Detect(old_type, v1_type, v1_corpus); }),
+        Time(v1_corpus, iterations,
+             [&] { Misdetect(old_type, v1_type, v1_corpus, dst_bytes.data()); }),
+    };
+
+    if (ghz > 0) {
+      // The first results are those of these transformations.
+      const struct {
+        fidl_transformation_t transformation;
+        const fidl_type_t* type;
+        const Corpus& src;
+      } measured[] = {
+          {FIDL_TRANSFORMATION_OLD_TO_V1, old_type, old_corpus},
+          {FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, old_type, old_corpus},
+          {FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, v1_corpus},
+          {FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, v1_type, compact_corpus},
+      };
+      for (size_t i = 0; i < sizeof(measured) / sizeof(measured[0]); i++) {
+        fidl_transform_cost_sample_t sample;
+        if (Count(measured[i].transformation, measured[i].type, measured[i].src,
+                  dst_bytes.data(), &sample)) {
+          sample.cycles = results[i].ns_per_message * ghz;
+          samples.push_back(sample);
+        }
+      }
+    }
+
+    printf("%-36s %8.1f %8.1f %8.1f %8.1f |", entry.name, old_corpus.AverageSize(),
+           v1_corpus.AverageSize(), compact_corpus.AverageSize(),
+           old_corpus.sizes.empty()
+               ? 0
+               : static_cast<double>(storage_bytes) / static_cast<double>(old_corpus.sizes.size()));
+    for (const auto& result : results) {
+      printf(" %8.1f (%8.1f)", result.ns_per_message, result.src_mb_per_s);
+    }
+    printf("\n");
+  }
+  if (library) {
+    fidl_ir_free(library);
+  }
+
+  if (ghz > 0) {
+    fidl_transform_cost_model_t model;
+    const char* error = nullptr;
+    if (fidl_transform_cost_model_fit(samples.data(), static_cast<uint32_t>(samples.size()),
+                                      &model, &error) != ZX_OK) {
+      fprintf(stderr, "calibration failed: %s\n", error);
+      return 1;
+    }
+    printf("\ncost model fitted to %zu samples at %.2f GHz: %.2f cycles per node, %.2f cycles "
+           "per op, %.4f cycles per byte\n",
+           samples.size(), ghz, model.cycles_per_node, model.cycles_per_op,
+           model.cycles_per_byte);
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "capture.h"
+
+#include <unistd.h>
+
+#include <cstring>
+
+namespace {
+
+constexpr char kMagic[8] = {'F', 'I', 'D', 'L', 'C', 'A', 'P', '1'};
+constexpr uint8_t kZeros[FIDL_ALIGNMENT] = {};
+
+bool WritePadded(FILE* file, const void* data, uint32_t size) {
+  return fwrite(data, 1, size, file) == size &&
+         fwrite(kZeros, 1, FIDL_ALIGN(size) - size, file) == FIDL_ALIGN(size) - size;
+}
+
+bool ReadPadded(FILE* file, void* data, uint32_t size) {
+  uint8_t padding[FIDL_ALIGNMENT];
+  return fread(data, 1, size, file) == size &&
+         fread(padding, 1, FIDL_ALIGN(size) - size, file) == FIDL_ALIGN(size) - size;
+}
+
+}  // namespace
+
+CaptureWriter::~CaptureWriter() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool CaptureWriter::Open(const char* path) {
+  file_ = fopen(path, "wb");
+  return file_ && fwrite(kMagic, 1, sizeof(kMagic), file_) == sizeof(kMagic);
+}
+
+bool CaptureWriter::Write(uint32_t wire_format, const char* name, const uint8_t* bytes,
+                          uint32_t num_bytes, uint32_t num_handles) {
+  CaptureRecordHeader header = {
+      wire_format,
+      static_cast<uint32_t>(strlen(name)),
+      num_bytes,
+      num_handles,
+  };
+  return file_ && fwrite(&header, sizeof(header), 1, file_) == 1 &&
+         WritePadded(file_, name, header.name_size) && WritePadded(file_, bytes, num_bytes);
+}
+
+bool CaptureWriter::Close() {
+  if (!file_) {
+    return false;
+  }
+  bool ok = fflush(file_) == 0 && fsync(fileno(file_)) == 0;
+  ok = fclose(file_) == 0 && ok;
+  file_ = nullptr;
+  return ok;
+}
+
+CaptureReader::~CaptureReader() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool CaptureReader::Open(const char* path) {
+  file_ = fopen(path, "rb");
+  if (!file_) {
+    error_ = "cannot open capture";
+    return false;
+  }
+  char magic[sizeof(kMagic)];
+  if (fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    error_ = "not a capture";
+    return false;
+  }
+  return true;
+}
+
+bool CaptureReader::Next(CaptureRecord* out_record) {
+  if (!file_ || error_) {
+    return false;
+  }
+
+  CaptureRecordHeader header;
+  size_t read = fread(&header, 1, sizeof(header), file_);
+  if (read == 0 && feof(file_)) {
+    return false;
+  }
+  if (read != sizeof(header)) {
+    error_ = "truncated record header";
+    return false;
+  }
+  if (header.wire_format != kCaptureWireFormatOld && header.wire_format != kCaptureWireFormatV1) {
+    error_ = "unknown wire format";
+    return false;
+  }
+  if (header.num_bytes > ZX_CHANNEL_MAX_MSG_BYTES || header.name_size > 1024) {
+    error_ = "record too large";
+    return false;
+  }
+
+  out_record->wire_format = header.wire_format;
+  out_record->num_handles = header.num_handles;
+  out_record->name.resize(header.name_size);
+  out_record->bytes.resize(header.num_bytes);
+  if (!ReadPadded(file_, &out_record->name[0], header.name_size) ||
+      !ReadPadded(file_, out_record->bytes.data(), header.num_bytes)) {
+    error_ = "truncated record";
+    return false;
+  }
+  return true;
+}
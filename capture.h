@@ -0,0 +1,85 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+// Reading and writing of message captures, i.e. files of encoded messages
+// recorded from live traffic (or generated), which tools replay through the
+// transformer.
+//
+// A capture starts with the 8-byte magic "FIDLCAP1", followed by records. Each
+// record is a `CaptureRecordHeader`, the type name (|name_size| bytes, not
+// NUL-terminated) and the message (|num_bytes| bytes), both padded with zeros
+// to a multiple of 8 bytes. All integers are little-endian.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "fidl.h"
+
+struct CaptureRecordHeader {
+  // One of `kCaptureWireFormat*`.
+  uint32_t wire_format;
+  uint32_t name_size;
+  uint32_t num_bytes;
+  uint32_t num_handles;
+};
+
+constexpr uint32_t kCaptureWireFormatOld = 0;
+constexpr uint32_t kCaptureWireFormatV1 = 1;
+
+struct CaptureRecord {
+  uint32_t wire_format = kCaptureWireFormatOld;
+  // Fully qualified name of the message's type, e.g. "example/Sandwich1".
+  std::string name;
+  std::vector<uint8_t> bytes;
+  uint32_t num_handles = 0;
+};
+
+class CaptureWriter final {
+ public:
+  CaptureWriter() = default;
+  ~CaptureWriter();
+  CaptureWriter(const CaptureWriter&) = delete;
+  CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+  // Creates (or truncates) the capture at |path|. Returns false on failure.
+  bool Open(const char* path);
+
+  bool Write(uint32_t wire_format, const char* name, const uint8_t* bytes, uint32_t num_bytes,
+             uint32_t num_handles);
+
+  // Flushes the capture to storage and closes it. Returns false if any write
+  // failed to reach storage.
+  bool Close();
+
+ private:
+  FILE* file_ = nullptr;
+};
+
+class CaptureReader final {
+ public:
+  CaptureReader() = default;
+  ~CaptureReader();
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator=(const CaptureReader&) = delete;
+
+  // Opens the capture at |path| and checks its magic. Returns false on failure.
+  bool Open(const char* path);
+
+  // Reads the next record into |out_record|. Returns false at the end of the
+  // capture, or if the capture is truncated or malformed (see |error|).
+  bool Next(CaptureRecord* out_record);
+
+  // Set when reading stopped because of a malformed capture.
+  const char* error() const { return error_; }
+
+ private:
+  FILE* file_ = nullptr;
+  const char* error_ = nullptr;
+};
+
+#endif  // CAPTURE_H_
@@ -0,0 +1,253 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/columns.h>
+#include <lib/fidl/view_internal.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+using fidl::internal::InlineSize;
+using fidl::internal::VectorShape;
+using fidl::internal::ViewReader;
+using fidl::internal::WireFormat;
+
+// Number of elements whose member columns are copied at a time.
+constexpr uint32_t kColumnBlock = 64;
+
+// Exports the elements of a vector or array of structs (or unions) into
+// columns, in a single pass over the elements, a block of elements at a time.
+// Primitive members are copied one column at a time over each block, and union
+// variants are read element by element.
+class ColumnExporter final {
+ public:
+  ColumnExporter(const fidl_view_t& view, const fidl_column_t* columns, uint32_t num_columns)
+      : reader_(view),
+        view_(view),
+        wire_format_(view.wire_format == FIDL_WIRE_FORMAT_V1 ? WireFormat::kV1
+                                                              : WireFormat::kOld),
+        columns_(columns),
+        num_columns_(num_columns),
+        member_offsets_(num_columns) {}
+
+  bool Export(uint32_t capacity, uint32_t* out_count) {
+    uint32_t count, data_offset, out_of_line_offset;
+    if (!Elements(&count, &data_offset, &out_of_line_offset)) {
+      return false;
+    }
+    bool has_variants = false;
+    for (uint32_t c = 0; c < num_columns_; c++) {
+      if (!CheckColumn(columns_[c], &member_offsets_[c])) {
+        return false;
+      }
+      has_variants = has_variants || columns_[c].kind != FIDL_COLUMN_MEMBER;
+    }
+    if (count > capacity) {
+      return reader_.Fail(ZX_ERR_BUFFER_TOO_SMALL, "columns are too small for the elements");
+    }
+
+    for (uint32_t start = 0; start < count; start += kColumnBlock) {
+      const uint32_t block = std::min(kColumnBlock, count - start);
+      for (uint32_t c = 0; c < num_columns_; c++) {
+        if (columns_[c].kind == FIDL_COLUMN_MEMBER) {
+          CopyMembers(columns_[c], &view_.bytes[data_offset + start * element_size_ +
+                                                member_offsets_[c]],
+                      start, block);
+        }
+      }
+      for (uint32_t i = start; has_variants && i < start + block; i++) {
+        const uint32_t element_offset = data_offset + i * element_size_;
+        fidl_view_t element;
+        if (!reader_.View(element_, InlineSize(element_, wire_format_), element_offset,
+                          out_of_line_offset, &element) ||
+            !ExportVariants(element, i) ||
+            !reader_.Skip(element_, element_offset, &out_of_line_offset, 0)) {
+          return false;
+        }
+      }
+    }
+    *out_count = count;
+    return true;
+  }
+
+  zx_status_t Result(const char** out_error_msg) const { return reader_.Result(out_error_msg); }
+
+ private:
+  // Locates the elements of the viewed vector or array, and the out-of-line
+  // objects of the first one.
+  bool Elements(uint32_t* out_count, uint32_t* out_data_offset, uint32_t* out_of_line_offset) {
+    const fidl_type_t* type = view_.type;
+    if (type && type->type_tag == fidl::kFidlTypeArray) {
+      element_ = type->coded_array.element;
+      element_size_ = type->coded_array.element_size;
+      *out_count = type->coded_array.array_size / element_size_;
+      *out_data_offset = view_.offset;
+      *out_of_line_offset = view_.out_of_line_offset;
+      return true;
+    }
+    if (!type || type->type_tag != fidl::kFidlTypeVector) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "view is not a vector or array");
+    }
+    bool nullable;
+    uint32_t max_count, data_size;
+    VectorShape(type, &element_, &element_size_, &nullable, &max_count);
+    if (!reader_.VectorData(out_data_offset, &data_size, out_count)) {
+      return false;
+    }
+    *out_of_line_offset = *out_data_offset + static_cast<uint32_t>(fidl::FidlAlign(data_size));
+    return true;
+  }
+
+  // Checks that |column| applies to the elements, and stores the offset of the
+  // primitive members of member columns within elements into |out_offset|.
+  bool CheckColumn(const fidl_column_t& column, uint32_t* out_offset) {
+    switch (column.kind) {
+      case FIDL_COLUMN_MEMBER:
+        if (column.size == 0) {
+          return reader_.Fail(ZX_ERR_INVALID_ARGS, "column is empty");
+        }
+        if (!element_) {
+          // Elements without a coding table are structs of primitive members,
+          // laid out the same in both wire formats.
+          if (static_cast<uint64_t>(column.offset) + column.size > element_size_) {
+            return reader_.Fail(ZX_ERR_INVALID_ARGS, "column is past the end of the elements");
+          }
+          *out_offset = column.offset;
+          return true;
+        }
+        if (element_->type_tag != fidl::kFidlTypeStruct) {
+          return reader_.Fail(ZX_ERR_INVALID_ARGS, "member column of elements not structs");
+        }
+        return reader_.MemberOffset(element_->coded_struct, column.offset, column.size,
+                                    out_offset);
+      case FIDL_COLUMN_VARIANT:
+      case FIDL_COLUMN_VARIANT_DATA: {
+        const fidl_type_t* type = element_;
+        if (column.field != FIDL_COLUMN_ELEMENT) {
+          type = nullptr;
+          if (element_ && element_->type_tag == fidl::kFidlTypeStruct) {
+            const auto& coded_struct = element_->coded_struct;
+            for (uint32_t i = 0, index = 0; i < coded_struct.field_count && !type; i++) {
+              if (coded_struct.fields[i].type && index++ == column.field) {
+                type = coded_struct.fields[i].type;
+              }
+            }
+          }
+        }
+        // Union pointer elements are not supported, as absent ones have no view.
+        if (!type ||
+            (type->type_tag != fidl::kFidlTypeUnion && type->type_tag != fidl::kFidlTypeXUnion &&
+             (column.field == FIDL_COLUMN_ELEMENT ||
+              type->type_tag != fidl::kFidlTypeUnionPointer))) {
+          return reader_.Fail(ZX_ERR_INVALID_ARGS, "variant column of a field not a union");
+        }
+        if (column.kind == FIDL_COLUMN_VARIANT_DATA && column.size == 0) {
+          return reader_.Fail(ZX_ERR_INVALID_ARGS, "column is empty");
+        }
+        return true;
+      }
+    }
+    return reader_.Fail(ZX_ERR_INVALID_ARGS, "unknown column kind");
+  }
+
+  void CopyMembers(const fidl_column_t& column, const uint8_t* src, uint32_t start,
+                   uint32_t block) {
+    uint8_t* dst = static_cast<uint8_t*>(column.data) + start * column.size;
+    switch (column.size) {
+      case 1:
+        return CopyStrided<1>(src, element_size_, dst, block);
+      case 2:
+        return CopyStrided<2>(src, element_size_, dst, block);
+      case 4:
+        return CopyStrided<4>(src, element_size_, dst, block);
+      case 8:
+        return CopyStrided<8>(src, element_size_, dst, block);
+    }
+    for (uint32_t i = 0; i < block; i++) {
+      memcpy(&dst[i * column.size], &src[i * element_size_], column.size);
+    }
+  }
+
+  // Copies |count| values of |Size| bytes, |stride| bytes apart, with loads and
+  // stores of a constant size.
+  template <uint32_t Size>
+  static void CopyStrided(const uint8_t* src, uint32_t stride, uint8_t* dst, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+      memcpy(&dst[i * Size], &src[i * stride], Size);
+    }
+  }
+
+  // Writes the values of the variant columns for the |index|-th element.
+  bool ExportVariants(const fidl_view_t& element, uint32_t index) {
+    for (uint32_t c = 0; c < num_columns_; c++) {
+      const fidl_column_t& column = columns_[c];
+      if (column.kind == FIDL_COLUMN_MEMBER) {
+        continue;
+      }
+      uint32_t variant = FIDL_COLUMN_NO_VARIANT;
+      fidl_view_t the_union = element, data = {};
+      ViewReader element_reader(element);
+      if (column.field != FIDL_COLUMN_ELEMENT &&
+          !element_reader.Field(column.field, &the_union)) {
+        if (!Absent(element_reader)) {
+          return false;
+        }
+      } else {
+        ViewReader union_reader(the_union);
+        if (!union_reader.Variant(&variant, &data)) {
+          if (!Absent(union_reader)) {
+            return false;
+          }
+          variant = FIDL_COLUMN_NO_VARIANT;
+        }
+      }
+      uint8_t* dst = static_cast<uint8_t*>(column.data);
+      if (column.kind == FIDL_COLUMN_VARIANT) {
+        memcpy(&dst[index * sizeof(uint32_t)], &variant, sizeof(uint32_t));
+        continue;
+      }
+      dst += index * column.size;
+      if (variant != column.variant) {
+        memset(dst, 0, column.size);
+        continue;
+      }
+      ViewReader data_reader(data);
+      if (!data_reader.ReadData(column.offset, dst, column.size)) {
+        Absent(data_reader);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns whether |nested| failed because the object it looked for is absent,
+  // and otherwise fails with the failure of |nested|.
+  bool Absent(const ViewReader& nested) {
+    const char* error = nullptr;
+    zx_status_t status = nested.Result(&error);
+    return status == ZX_ERR_NOT_FOUND || reader_.Fail(status, error);
+  }
+
+  ViewReader reader_;
+  const fidl_view_t view_;
+  const WireFormat wire_format_;
+  const fidl_column_t* const columns_;
+  const uint32_t num_columns_;
+  std::vector<uint32_t> member_offsets_;
+  const fidl_type_t* element_ = nullptr;
+  uint32_t element_size_ = 0;
+};
+
+}  // namespace
+
+zx_status_t fidl_view_export_columns(const fidl_view_t* view, const fidl_column_t* columns,
+                                     uint32_t num_columns, uint32_t capacity, uint32_t* out_count,
+                                     const char** out_error_msg) {
+  ColumnExporter exporter(*view, columns, num_columns);
+  exporter.Export(capacity, out_count);
+  return exporter.Result(out_error_msg);
+}
@@ -0,0 +1,63 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_COLUMNS_H_
+#define LIB_FIDL_COLUMNS_H_
+
+#include "fidl.h"
+#include "view.h"
+
+// __BEGIN_CDECLS
+
+// Columns of a vector or array of structs (or of unions) hold one value per
+// element, contiguously, whichever wire format the message is in.
+typedef uint32_t fidl_column_kind_t;
+
+// The |size| bytes at |offset| of each element, a struct, which must lie within
+// primitive members (as in `fidl_view_read`).
+#define FIDL_COLUMN_MEMBER ((fidl_column_kind_t)1u)
+
+// The variant (as in `fidl_view_variant`) of the union or xunion field |field|
+// of each element, as a `uint32_t`, or `FIDL_COLUMN_NO_VARIANT` if the union
+// is absent or the xunion empty.
+#define FIDL_COLUMN_VARIANT ((fidl_column_kind_t)2u)
+
+// The |size| bytes at |offset| of the data of variant |variant| of the union or
+// xunion field |field| of each element (as in `fidl_view_read`), or zeros for
+// elements which hold another variant.
+#define FIDL_COLUMN_VARIANT_DATA ((fidl_column_kind_t)3u)
+
+// The |field| of variant columns which select the elements themselves, for
+// vectors and arrays of (non-nullable) unions and xunions.
+#define FIDL_COLUMN_ELEMENT UINT32_MAX
+
+#define FIDL_COLUMN_NO_VARIANT UINT32_MAX
+
+typedef struct {
+  fidl_column_kind_t kind;
+  // Index of a field of the elements (as in `fidl_view_field`), or
+  // `FIDL_COLUMN_ELEMENT`.
+  uint32_t field;
+  uint32_t variant;
+  uint32_t offset;
+  uint32_t size;
+  // Room for one value per element: |size| bytes, or a `uint32_t` for variant
+  // columns.
+  void* data;
+} fidl_column_t;
+
+// Writes the |num_columns| |columns| of the elements of the viewed vector or
+// array, which has room for |capacity| elements, in a single pass over the
+// elements, and stores their number into |out_count|. Fails with
+// `ZX_ERR_BUFFER_TOO_SMALL` if there are more elements than |capacity|.
+//
+// Member columns are copied over blocks of elements at a time, without walking
+// the elements. Variant columns walk each element, as views do.
+zx_status_t fidl_view_export_columns(const fidl_view_t* view, const fidl_column_t* columns,
+                                     uint32_t num_columns, uint32_t capacity, uint32_t* out_count,
+                                     const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_COLUMNS_H_
@@ -0,0 +1,76 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/detect.h>
+#include <lib/fidl/view_internal.h>
+
+namespace {
+
+using fidl::internal::ViewReader;
+
+// Detects the wire format of a message, storing into |*out_ambiguous| whether
+// it is valid in both.
+zx_status_t DetectWireFormat(const fidl_type_t* old_type, const fidl_type_t* v1_type,
+                             fidl_wire_format_t hint, const uint8_t* bytes, uint32_t num_bytes,
+                             fidl_wire_format_t* out_wire_format, bool* out_ambiguous,
+                             const char** out_error_msg) {
+  fidl_view_t message = {};
+  message.bytes = bytes;
+  message.num_bytes = num_bytes;
+  message.wire_format = FIDL_WIRE_FORMAT_OLD;
+  ViewReader old_reader(message);
+  const bool old_valid = old_reader.Check(old_type);
+  message.wire_format = FIDL_WIRE_FORMAT_V1;
+  ViewReader v1_reader(message);
+  const bool v1_valid = v1_reader.Check(v1_type);
+
+  *out_ambiguous = old_valid && v1_valid;
+  if (*out_ambiguous) {
+    *out_wire_format = hint == FIDL_WIRE_FORMAT_OLD ? FIDL_WIRE_FORMAT_OLD : FIDL_WIRE_FORMAT_V1;
+  } else if (old_valid || v1_valid) {
+    *out_wire_format = old_valid ? FIDL_WIRE_FORMAT_OLD : FIDL_WIRE_FORMAT_V1;
+  } else {
+    // Report why the message is not in the format it most likely is in.
+    return hint == FIDL_WIRE_FORMAT_OLD ? old_reader.Result(out_error_msg)
+                                        : v1_reader.Result(out_error_msg);
+  }
+  return ZX_OK;
+}
+
+}  // namespace
+
+zx_status_t fidl_detect_wire_format(const fidl_type_t* old_type, const fidl_type_t* v1_type,
+                                    fidl_wire_format_t hint, const uint8_t* bytes,
+                                    uint32_t num_bytes, fidl_wire_format_t* out_wire_format,
+                                    const char** out_error_msg) {
+  bool ambiguous;
+  return DetectWireFormat(old_type, v1_type, hint, bytes, num_bytes, out_wire_format, &ambiguous,
+                          out_error_msg);
+}
+
+zx_status_t fidl_detect_wire_format_cached(fidl_wire_format_cache_t* cache,
+                                           const fidl_type_t* old_type,
+                                           const fidl_type_t* v1_type, fidl_wire_format_t hint,
+                                           const uint8_t* bytes, uint32_t num_bytes,
+                                           fidl_wire_format_t* out_wire_format,
+                                           const char** out_error_msg) {
+  if (cache->wire_format != 0) {
+    cache->num_cached++;
+    *out_wire_format = cache->wire_format;
+    return ZX_OK;
+  }
+  cache->num_detected++;
+  bool ambiguous;
+  const zx_status_t status = DetectWireFormat(old_type, v1_type, hint, bytes, num_bytes,
+                                              out_wire_format, &ambiguous, out_error_msg);
+  if (status == ZX_OK && !ambiguous) {
+    cache->wire_format = *out_wire_format;
+  }
+  return status;
+}
+
+void fidl_wire_format_cache_reset(fidl_wire_format_cache_t* cache) {
+  cache->wire_format = 0;
+  cache->num_resets++;
+}
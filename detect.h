@@ -0,0 +1,59 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_DETECT_H_
+#define LIB_FIDL_DETECT_H_
+
+#include "fidl.h"
+#include "transformer.h"
+
+// __BEGIN_CDECLS
+
+// Peers which do not say which wire format they send messages in can be
+// detected from the messages themselves, by checking their structure as views
+// do, against the coding tables of both wire formats: presence markers, union
+// tags (old) and ordinals (v1), and that the out-of-line objects end where the
+// message does. Static unions are the only objects encoded differently in the
+// two wire formats, so messages which hold none are valid in both.
+
+// Stores into |out_wire_format| the wire format of the message |bytes| of
+// top-level struct |old_type| (in the old wire format) or |v1_type| (in v1).
+// Messages valid in both wire formats are taken to be in |hint| (e.g. derived
+// from the flags of the message header), or v1 without one (if |hint| is 0).
+// Fails with `ZX_ERR_INVALID_ARGS` if the message is valid in neither, with
+// the error message of the |hint| (or v1) wire format.
+zx_status_t fidl_detect_wire_format(const fidl_type_t* old_type, const fidl_type_t* v1_type,
+                                    fidl_wire_format_t hint, const uint8_t* bytes,
+                                    uint32_t num_bytes, fidl_wire_format_t* out_wire_format,
+                                    const char** out_error_msg);
+
+// The wire format of a connection, detected once. Zero-initialized caches have
+// not detected it yet.
+typedef struct {
+  // Private.
+  fidl_wire_format_t wire_format;
+  // Number of messages whose wire format was detected, or taken from the cache,
+  // and of resets.
+  uint64_t num_detected;
+  uint64_t num_cached;
+  uint64_t num_resets;
+} fidl_wire_format_cache_t;
+
+// Same as `fidl_detect_wire_format`, except that once a message of the
+// connection is valid in a single wire format, the following messages are
+// taken to be in that format without being checked.
+zx_status_t fidl_detect_wire_format_cached(fidl_wire_format_cache_t* cache,
+                                           const fidl_type_t* old_type,
+                                           const fidl_type_t* v1_type, fidl_wire_format_t hint,
+                                           const uint8_t* bytes, uint32_t num_bytes,
+                                           fidl_wire_format_t* out_wire_format,
+                                           const char** out_error_msg);
+
+// Forgets the wire format of the connection, so that it is detected again, e.g.
+// after a message failed to transform from the cached wire format.
+void fidl_wire_format_cache_reset(fidl_wire_format_cache_t* cache);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_DETECT_H_
@@ -0,0 +1,224 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "engine.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Messages of at most `ZX_CHANNEL_MAX_MSG_BYTES` are compared, whose output
+// (like in `inflation_report`) is assumed to fit in 16 times as many bytes.
+constexpr uint32_t kCandidateCapacity = 16 * ZX_CHANNEL_MAX_MSG_BYTES;
+
+zx_status_t TransformLarge(fidl_transformation_t transformation, const fidl_type_t* type,
+                           const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
+                           uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  uint64_t dst_num_bytes = 0;
+  const zx_status_t status = fidl_transform_large(transformation, type, src_bytes, src_num_bytes,
+                                                  dst_bytes, &dst_num_bytes, out_error_msg);
+  *out_dst_num_bytes = static_cast<uint32_t>(dst_num_bytes);
+  return status;
+}
+
+uint64_t NowNs() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+size_t RatioBucket(uint64_t selected_ns, uint64_t candidate_ns) {
+  const double ratio =
+      static_cast<double>(candidate_ns + 1) / static_cast<double>(selected_ns + 1);
+  const double bucket =
+      std::floor(2 * std::log2(ratio)) + static_cast<double>(EngineSelector::kRatioBucketEven);
+  if (bucket < 0) {
+    return 0;
+  }
+  if (bucket >= static_cast<double>(EngineSelector::kRatioBuckets)) {
+    return EngineSelector::kRatioBuckets - 1;
+  }
+  return static_cast<size_t>(bucket);
+}
+
+}  // namespace
+
+const TransformEngine kTransformEngine = {"transform", fidl_transform};
+const TransformEngine kLargeTransformEngine = {"large", TransformLarge};
+
+constexpr size_t EngineSelector::kRatioBuckets;
+constexpr size_t EngineSelector::kRatioBucketEven;
+
+EngineSelector::EngineSelector(const TransformEngine* default_engine, const Options& options)
+    : default_engine_(default_engine),
+      options_(options),
+      slots_(new Slot[options.max_types]) {
+  for (uint32_t i = 0; i < options_.max_types; i++) {
+    ClearCounters(&slots_[i]);
+  }
+}
+
+EngineSelector::Slot* EngineSelector::Find(const fidl_type_t* type, bool claim) const {
+  if (options_.max_types == 0) {
+    return nullptr;
+  }
+  // Open addressing with linear probing. Slots are never released, so a probe
+  // can stop at the first free slot.
+  const size_t start = (reinterpret_cast<uintptr_t>(type) >> 4) % options_.max_types;
+  for (size_t n = 0; n < options_.max_types; n++) {
+    Slot* slot = &slots_[(start + n) % options_.max_types];
+    const fidl_type_t* slot_type = slot->type.load(std::memory_order_acquire);
+    if (slot_type == type) {
+      return slot;
+    }
+    if (slot_type == nullptr) {
+      if (!claim) {
+        return nullptr;
+      }
+      if (slot->type.compare_exchange_strong(slot_type, type, std::memory_order_acq_rel) ||
+          slot_type == type) {
+        return slot;
+      }
+    }
+  }
+  return nullptr;
+}
+
+void EngineSelector::ClearCounters(Slot* slot) {
+  slot->transformed.store(0, std::memory_order_relaxed);
+  slot->compared.store(0, std::memory_order_relaxed);
+  slot->mismatches.store(0, std::memory_order_relaxed);
+  slot->selected_ns.store(0, std::memory_order_relaxed);
+  slot->candidate_ns.store(0, std::memory_order_relaxed);
+  for (auto& count : slot->ratio_histogram) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool EngineSelector::Select(const fidl_type_t* type, const TransformEngine* engine) {
+  Slot* slot = Find(type, true);
+  if (!slot) {
+    return false;
+  }
+  slot->candidate.store(nullptr, std::memory_order_release);
+  slot->selected.store(engine, std::memory_order_release);
+  return true;
+}
+
+bool EngineSelector::Compare(const fidl_type_t* type, const TransformEngine* candidate) {
+  Slot* slot = Find(type, true);
+  if (!slot) {
+    return false;
+  }
+  slot->candidate.store(nullptr, std::memory_order_release);
+  ClearCounters(slot);
+  slot->candidate.store(candidate, std::memory_order_release);
+  return true;
+}
+
+bool EngineSelector::Promote(const fidl_type_t* type, uint64_t min_compared) {
+  const Comparison stats = comparison(type);
+  if (!stats.candidate || stats.compared == 0 || stats.compared < min_compared ||
+      stats.mismatches != 0 || stats.candidate_ns >= stats.selected_ns) {
+    return false;
+  }
+  return Select(type, stats.candidate);
+}
+
+zx_status_t EngineSelector::Transform(fidl_transformation_t transformation,
+                                      const fidl_type_t* type, const uint8_t* src_bytes,
+                                      uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                      uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  Slot* slot = Find(type, false);
+  if (!slot) {
+    return default_engine_->transform(transformation, type, src_bytes, src_num_bytes, dst_bytes,
+                                      out_dst_num_bytes, out_error_msg);
+  }
+  const TransformEngine* selected = slot->selected.load(std::memory_order_acquire);
+  if (!selected) {
+    selected = default_engine_;
+  }
+  const TransformEngine* candidate = slot->candidate.load(std::memory_order_acquire);
+  const uint64_t transformed = slot->transformed.fetch_add(1, std::memory_order_relaxed);
+  if (!candidate || options_.compare_every == 0 || transformed % options_.compare_every != 0 ||
+      src_num_bytes > ZX_CHANNEL_MAX_MSG_BYTES) {
+    return selected->transform(transformation, type, src_bytes, src_num_bytes, dst_bytes,
+                               out_dst_num_bytes, out_error_msg);
+  }
+  return TransformCompared(slot, selected, candidate, transformation, type, src_bytes,
+                           src_num_bytes, dst_bytes, out_dst_num_bytes, out_error_msg);
+}
+
+zx_status_t EngineSelector::TransformCompared(Slot* slot, const TransformEngine* selected,
+                                              const TransformEngine* candidate,
+                                              fidl_transformation_t transformation,
+                                              const fidl_type_t* type, const uint8_t* src_bytes,
+                                              uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                              uint32_t* out_dst_num_bytes,
+                                              const char** out_error_msg) {
+  thread_local std::vector<uint8_t> candidate_bytes;
+  candidate_bytes.resize(kCandidateCapacity);
+
+  // The engine which runs second finds the source in cache, so the engines
+  // take turns running first.
+  const uint64_t compared = slot->compared.fetch_add(1, std::memory_order_relaxed);
+  const bool candidate_first = compared % 2 == 1;
+
+  zx_status_t selected_status = ZX_OK;
+  zx_status_t candidate_status = ZX_OK;
+  uint32_t candidate_num_bytes = 0;
+  uint64_t selected_ns = 0;
+  uint64_t candidate_ns = 0;
+  for (int run = 0; run < 2; run++) {
+    const uint64_t start = NowNs();
+    if ((run == 0) == candidate_first) {
+      candidate_status =
+          candidate->transform(transformation, type, src_bytes, src_num_bytes,
+                               candidate_bytes.data(), &candidate_num_bytes, nullptr);
+      candidate_ns = NowNs() - start;
+    } else {
+      selected_status = selected->transform(transformation, type, src_bytes, src_num_bytes,
+                                            dst_bytes, out_dst_num_bytes, out_error_msg);
+      selected_ns = NowNs() - start;
+    }
+  }
+
+  const bool match = selected_status == candidate_status &&
+                     (selected_status != ZX_OK ||
+                      (candidate_num_bytes == *out_dst_num_bytes &&
+                       memcmp(candidate_bytes.data(), dst_bytes, candidate_num_bytes) == 0));
+  if (!match) {
+    slot->mismatches.fetch_add(1, std::memory_order_relaxed);
+  }
+  slot->selected_ns.fetch_add(selected_ns, std::memory_order_relaxed);
+  slot->candidate_ns.fetch_add(candidate_ns, std::memory_order_relaxed);
+  slot->ratio_histogram[RatioBucket(selected_ns, candidate_ns)].fetch_add(
+      1, std::memory_order_relaxed);
+  return selected_status;
+}
+
+EngineSelector::Comparison EngineSelector::comparison(const fidl_type_t* type) const {
+  Comparison stats;
+  const Slot* slot = Find(type, false);
+  if (!slot) {
+    return stats;
+  }
+  stats.selected = slot->selected.load(std::memory_order_acquire);
+  if (!stats.selected) {
+    stats.selected = default_engine_;
+  }
+  stats.candidate = slot->candidate.load(std::memory_order_acquire);
+  stats.transformed = slot->transformed.load(std::memory_order_relaxed);
+  stats.compared = slot->compared.load(std::memory_order_relaxed);
+  stats.mismatches = slot->mismatches.load(std::memory_order_relaxed);
+  stats.selected_ns = slot->selected_ns.load(std::memory_order_relaxed);
+  stats.candidate_ns = slot->candidate_ns.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < kRatioBuckets; i++) {
+    stats.ratio_histogram[i] = slot->ratio_histogram[i].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
@@ -0,0 +1,130 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+// Runtime selection of transform engines, per top-level struct.
+//
+// A `TransformEngine` is any function with the signature of `fidl_transform`.
+// An `EngineSelector` transforms each message with the engine selected for its
+// type (or a default engine), and can compare a candidate engine against it on
+// live traffic: for 1 in N messages of a type, both engines transform the
+// message, their outputs are checked to be byte-identical, and the ratio of
+// their latencies is recorded into a histogram of that type. Once a candidate
+// has shown on enough messages that it is correct and faster, `Promote` selects
+// it for the type.
+//
+// The foreground path is lock-free: types live in a fixed number of slots,
+// which are claimed when a type is first configured and never released.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "fidl.h"
+#include "transformer.h"
+
+struct TransformEngine {
+  const char* name;
+  zx_status_t (*transform)(fidl_transformation_t transformation, const fidl_type_t* type,
+                           const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
+                           uint32_t* out_dst_num_bytes, const char** out_error_msg);
+};
+
+// `fidl_transform`.
+extern const TransformEngine kTransformEngine;
+// `fidl_transform_large`, with 64-bit offsets.
+extern const TransformEngine kLargeTransformEngine;
+
+class EngineSelector final {
+ public:
+  // Bucket |i| of a latency histogram counts messages on which the candidate
+  // took between 2^((i - 8) / 2) and 2^((i - 7) / 2) times as long as the
+  // selected engine; the first and last buckets also count ratios beyond.
+  // Buckets below `kRatioBucketEven` are those on which the candidate was
+  // faster.
+  static constexpr size_t kRatioBuckets = 17;
+  static constexpr size_t kRatioBucketEven = 8;
+
+  struct Options {
+    // Compares 1 in |compare_every| messages of types with a candidate.
+    uint32_t compare_every = 100;
+    // Number of types which can be configured.
+    uint32_t max_types = 64;
+  };
+
+  struct Comparison {
+    const TransformEngine* selected = nullptr;
+    const TransformEngine* candidate = nullptr;
+    uint64_t transformed = 0;
+    uint64_t compared = 0;
+    // Comparisons on which the engines disagreed on the status or the output.
+    uint64_t mismatches = 0;
+    uint64_t selected_ns = 0;
+    uint64_t candidate_ns = 0;
+    uint64_t ratio_histogram[kRatioBuckets] = {};
+  };
+
+  EngineSelector(const TransformEngine* default_engine, const Options& options);
+  EngineSelector(const EngineSelector&) = delete;
+  EngineSelector& operator=(const EngineSelector&) = delete;
+
+  // Selects |engine| for messages of |type|, and stops any comparison.
+  // Returns false if |max_types| types are already configured.
+  bool Select(const fidl_type_t* type, const TransformEngine* engine);
+
+  // Compares |candidate| against the engine selected for |type|, from now on,
+  // with a cleared histogram. Returns false if |max_types| types are already
+  // configured.
+  bool Compare(const fidl_type_t* type, const TransformEngine* candidate);
+
+  // Selects the candidate compared for |type| if it was compared on at least
+  // |min_compared| messages, without mismatches, and took less time in total
+  // than the selected engine. Returns whether it was selected.
+  bool Promote(const fidl_type_t* type, uint64_t min_compared);
+
+  // Same as `fidl_transform`, with the engine selected for |type|. When the
+  // message is compared, the output and status are those of the selected
+  // engine. Thread safe.
+  zx_status_t Transform(fidl_transformation_t transformation, const fidl_type_t* type,
+                        const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
+                        uint32_t* out_dst_num_bytes, const char** out_error_msg);
+
+  // Returns the engines and counters of |type| (all zero if it was never
+  // configured). Counters are read one at a time while messages may still be
+  // transformed, so they need not add up exactly.
+  Comparison comparison(const fidl_type_t* type) const;
+
+ private:
+  struct Slot {
+    std::atomic<const fidl_type_t*> type{nullptr};
+    std::atomic<const TransformEngine*> selected{nullptr};
+    std::atomic<const TransformEngine*> candidate{nullptr};
+    std::atomic<uint64_t> transformed{0};
+    std::atomic<uint64_t> compared{0};
+    std::atomic<uint64_t> mismatches{0};
+    std::atomic<uint64_t> selected_ns{0};
+    std::atomic<uint64_t> candidate_ns{0};
+    std::atomic<uint64_t> ratio_histogram[kRatioBuckets];
+  };
+
+  // Returns the slot of |type|, claiming a free one if |claim| is set, or
+  // nullptr.
+  Slot* Find(const fidl_type_t* type, bool claim) const;
+  static void ClearCounters(Slot* slot);
+
+  zx_status_t TransformCompared(Slot* slot, const TransformEngine* selected,
+                                const TransformEngine* candidate,
+                                fidl_transformation_t transformation, const fidl_type_t* type,
+                                const uint8_t* src_bytes, uint32_t src_num_bytes,
+                                uint8_t* dst_bytes, uint32_t* out_dst_num_bytes,
+                                const char** out_error_msg);
+
+  const TransformEngine* const default_engine_;
+  const Options options_;
+  const std::unique_ptr<Slot[]> slots_;
+};
+
+#endif  // ENGINE_H_
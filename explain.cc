@@ -0,0 +1,843 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/explain.h>
+#include <lib/fidl/internal.h>
+#include <lib/fidl/transformer_internal.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// See transformer.cc on why implicit fallthrough is allowed here.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+
+namespace {
+
+using fidl::internal::AlignedInlineSize;
+using fidl::internal::CompactInlineSize;
+using fidl::internal::WireFormat;
+
+constexpr uint32_t kMaxDepth = 32;
+
+// Cost of a node of the coding table graph, including all the out-of-line
+// objects it owns.
+struct NodeCost {
+  uint64_t src_size = 0;
+  uint64_t dst_size = 0;
+  uint32_t num_unions = 0;
+  uint32_t num_envelopes = 0;
+  uint64_t bulk_bytes = 0;
+  uint32_t num_nodes = 0;
+  uint32_t num_ops = 0;
+  uint64_t op_bytes = 0;
+
+  NodeCost& operator+=(const NodeCost& rhs) {
+    src_size += rhs.src_size;
+    dst_size += rhs.dst_size;
+    num_unions += rhs.num_unions;
+    num_envelopes += rhs.num_envelopes;
+    bulk_bytes += rhs.bulk_bytes;
+    num_nodes += rhs.num_nodes;
+    num_ops += rhs.num_ops;
+    op_bytes += rhs.op_bytes;
+    return *this;
+  }
+
+  void Op(uint64_t size) {
+    num_ops++;
+    op_bytes += size;
+  }
+
+  NodeCost Times(uint32_t count) const {
+    NodeCost result;
+    result.src_size = src_size * count;
+    result.dst_size = dst_size * count;
+    result.num_unions = num_unions * count;
+    result.num_envelopes = num_envelopes * count;
+    result.bulk_bytes = bulk_bytes * count;
+    result.num_nodes = num_nodes * count;
+    result.num_ops = num_ops * count;
+    result.op_bytes = op_bytes * count;
+    return result;
+  }
+};
+
+// Whether |type| is encoded identically in the old and v1 wire formats, i.e. it
+// does not contain any static union.
+bool IsIdentity(const fidl_type_t* type, uint32_t depth) {
+  if (!type) {
+    return true;
+  }
+  if (depth > kMaxDepth) {
+    return false;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypePrimitive:
+    case fidl::kFidlTypeEnum:
+    case fidl::kFidlTypeBits:
+    case fidl::kFidlTypeHandle:
+    case fidl::kFidlTypeString:
+      return true;
+    case fidl::kFidlTypeStruct: {
+      const auto& coded_struct = type->coded_struct;
+      for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+        if (!IsIdentity(coded_struct.fields[i].type, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeStructPointer: {
+      const fidl_type_t struct_type(*type->coded_struct_pointer.struct_type);
+      return IsIdentity(&struct_type, depth + 1);
+    }
+    case fidl::kFidlTypeUnion:
+    case fidl::kFidlTypeUnionPointer:
+      return false;
+    case fidl::kFidlTypeArray:
+      return IsIdentity(type->coded_array.element, depth + 1);
+    case fidl::kFidlTypeVector:
+      return IsIdentity(type->coded_vector.element, depth + 1);
+    case fidl::kFidlTypeTable: {
+      const auto& coded_table = type->coded_table;
+      for (uint32_t i = 0; i < coded_table.field_count; i++) {
+        if (!IsIdentity(coded_table.fields[i].type, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeXUnion: {
+      const auto& coded_xunion = type->coded_xunion;
+      for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
+        if (!IsIdentity(coded_xunion.fields[i].type, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+
+  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+  return false;
+}
+
+// Whether messages of |type| (a coding table of |wire_format|) may hold
+// envelopes which are inlined in the compact v1 wire format.
+bool HasInlinedEnvelopes(const fidl_type_t* type, WireFormat wire_format, uint32_t depth) {
+  if (!type) {
+    return false;
+  }
+  if (depth > kMaxDepth) {
+    return true;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypePrimitive:
+    case fidl::kFidlTypeEnum:
+    case fidl::kFidlTypeBits:
+    case fidl::kFidlTypeHandle:
+    case fidl::kFidlTypeString:
+      return false;
+    case fidl::kFidlTypeStruct: {
+      const auto& coded_struct = type->coded_struct;
+      for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+        if (HasInlinedEnvelopes(coded_struct.fields[i].type, wire_format, depth + 1)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    case fidl::kFidlTypeStructPointer: {
+      const fidl_type_t struct_type(*type->coded_struct_pointer.struct_type);
+      return HasInlinedEnvelopes(&struct_type, wire_format, depth + 1);
+    }
+    case fidl::kFidlTypeUnion:
+    case fidl::kFidlTypeUnionPointer: {
+      const auto& coded_union = type->type_tag == fidl::kFidlTypeUnion
+                                    ? type->coded_union
+                                    : *type->coded_union_pointer.union_type;
+      const auto& old_coded_union =
+          wire_format == WireFormat::kOld ? coded_union : *coded_union.alt_type;
+      for (uint32_t i = 0; i < coded_union.field_count; i++) {
+        const auto& field = coded_union.fields[i];
+        const uint32_t data_size =
+            old_coded_union.size - old_coded_union.data_offset - old_coded_union.fields[i].padding;
+        if (CompactInlineSize(field.type, data_size) != 0 ||
+            HasInlinedEnvelopes(field.type, wire_format, depth + 1)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    case fidl::kFidlTypeArray:
+      return HasInlinedEnvelopes(type->coded_array.element, wire_format, depth + 1);
+    case fidl::kFidlTypeVector:
+      return HasInlinedEnvelopes(type->coded_vector.element, wire_format, depth + 1);
+    case fidl::kFidlTypeTable: {
+      const auto& coded_table = type->coded_table;
+      for (uint32_t i = 0; i < coded_table.field_count; i++) {
+        const fidl_type_t* field_type = coded_table.fields[i].type;
+        if (CompactInlineSize(field_type, 0) != 0 ||
+            HasInlinedEnvelopes(field_type, wire_format, depth + 1)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    case fidl::kFidlTypeXUnion: {
+      const auto& coded_xunion = type->coded_xunion;
+      for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
+        const fidl_type_t* field_type = coded_xunion.fields[i].type;
+        if (CompactInlineSize(field_type, 0) != 0 ||
+            HasInlinedEnvelopes(field_type, wire_format, depth + 1)) {
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+
+  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+  return true;
+}
+
+// Orders the variants of unions and xunions, to pick the worst one.
+bool IsWorse(const NodeCost& lhs, const NodeCost& rhs) {
+  if (lhs.dst_size != rhs.dst_size) {
+    return lhs.dst_size > rhs.dst_size;
+  }
+  if (lhs.op_bytes != rhs.op_bytes) {
+    return lhs.op_bytes > rhs.op_bytes;
+  }
+  return lhs.num_ops > rhs.num_ops;
+}
+
+// Walks a coding table graph mirroring the operations `fidl_transform` performs
+// on the worst-case shape of a message (see `fidl_transform_cost_t`), between
+// the old and v1 wire formats. If |compact| is set, the v1 side uses the
+// compact v1 wire format.
+class CostWalker final {
+ public:
+  CostWalker(WireFormat from, WireFormat to, bool compact)
+      : from_(from), to_(to), compact_(compact) {}
+
+  // Cost of a node with the given inline sizes in the source and destination.
+  NodeCost Walk(const fidl_type_t* type, uint32_t src_inline_size, uint32_t dst_inline_size,
+                uint32_t depth) const {
+    NodeCost cost;
+    cost.num_nodes = 1;
+    cost.src_size = src_inline_size;
+    cost.dst_size = dst_inline_size;
+    if (depth > kMaxDepth) {
+      return cost;
+    }
+
+    if (!type) {
+      cost.Op(dst_inline_size);
+      cost.bulk_bytes = src_inline_size;
+      return cost;
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+      case fidl::kFidlTypeHandle:
+        cost.Op(dst_inline_size);
+        cost.bulk_bytes = src_inline_size;
+        return cost;
+      case fidl::kFidlTypeStruct:
+        WalkStruct(type->coded_struct, depth, &cost);
+        break;
+      case fidl::kFidlTypeStructPointer: {
+        const auto& src_coded_struct = *type->coded_struct_pointer.struct_type;
+        const fidl_type_t struct_type(src_coded_struct);
+        cost.Op(sizeof(uint64_t));
+        cost += Walk(&struct_type, FIDL_ALIGN(src_coded_struct.size),
+                     FIDL_ALIGN(src_coded_struct.alt_type->size), depth + 1);
+        break;
+      }
+      case fidl::kFidlTypeUnion:
+        WalkUnion(type->coded_union, depth, &cost);
+        break;
+      case fidl::kFidlTypeUnionPointer: {
+        const auto& src_coded_union = *type->coded_union_pointer.union_type;
+        const auto& dst_coded_union = *src_coded_union.alt_type;
+        const fidl_type_t union_type(src_coded_union);
+        if (from_ == WireFormat::kOld) {
+          // Presence becomes an inline xunion, the union is moved inline.
+          NodeCost union_cost = Walk(&union_type, FIDL_ALIGN(src_coded_union.size),
+                                     AlignedInlineSize(&union_type, to_), depth + 1);
+          union_cost.dst_size -= AlignedInlineSize(&union_type, to_);
+          cost += union_cost;
+        } else {
+          // Inline xunion becomes a presence, the union is moved out-of-line.
+          NodeCost union_cost = Walk(&union_type, AlignedInlineSize(&union_type, from_),
+                                     FIDL_ALIGN(dst_coded_union.size), depth + 1);
+          union_cost.src_size -= AlignedInlineSize(&union_type, from_);
+          cost.Op(sizeof(uint64_t));
+          cost += union_cost;
+        }
+        break;
+      }
+      case fidl::kFidlTypeArray: {
+        const auto& src_coded_array = type->coded_array;
+        const auto& dst_coded_array = *src_coded_array.alt_type;
+        if (!src_coded_array.element) {
+          cost.Op(dst_inline_size);
+          break;
+        }
+        const uint32_t count = src_coded_array.array_size / src_coded_array.element_size;
+        NodeCost element = Walk(src_coded_array.element, src_coded_array.element_size,
+                                dst_coded_array.element_size, depth + 1);
+        element.num_ops++;  // Element padding.
+        cost += element.Times(count);
+        cost.src_size -= static_cast<uint64_t>(count) * src_coded_array.element_size;
+        cost.dst_size -= static_cast<uint64_t>(count) * dst_coded_array.element_size;
+        cost.Op(0);  // Array padding.
+        break;
+      }
+      case fidl::kFidlTypeString:
+        cost.Op(sizeof(fidl_string_t));
+        cost.Op(FIDL_ALIGNMENT);
+        cost.src_size += FIDL_ALIGNMENT;
+        cost.dst_size += FIDL_ALIGNMENT;
+        break;
+      case fidl::kFidlTypeVector: {
+        const auto& src_coded_vector = type->coded_vector;
+        const auto& dst_coded_vector = *src_coded_vector.alt_type;
+        cost.Op(sizeof(fidl_vector_t));
+        const uint32_t src_element_size = FIDL_ALIGN(src_coded_vector.element_size);
+        const uint32_t dst_element_size = FIDL_ALIGN(dst_coded_vector.element_size);
+        if (!src_coded_vector.element) {
+          cost.Op(dst_element_size);
+          cost.src_size += src_element_size;
+          cost.dst_size += dst_element_size;
+          break;
+        }
+        cost += Walk(src_coded_vector.element, src_element_size, dst_element_size, depth + 1);
+        cost.Op(0);  // Vector padding.
+        break;
+      }
+      case fidl::kFidlTypeTable: {
+        const auto& coded_table = type->coded_table;
+        uint32_t max_ordinal = 0;
+        for (uint32_t i = 0; i < coded_table.field_count; i++) {
+          const auto& field = coded_table.fields[i];
+          cost += WalkEnvelope(field.type, depth);
+          if (field.ordinal > max_ordinal) {
+            max_ordinal = field.ordinal;
+          }
+        }
+        const uint32_t envelopes_size =
+            max_ordinal * static_cast<uint32_t>(sizeof(fidl_envelope_t));
+        cost.Op(sizeof(fidl_table_t));
+        cost.Op(envelopes_size);
+        cost.src_size += envelopes_size;
+        cost.dst_size += envelopes_size;
+        break;
+      }
+      case fidl::kFidlTypeXUnion: {
+        const auto& coded_xunion = type->coded_xunion;
+        cost.Op(sizeof(fidl_xunion_t));
+        NodeCost worst;
+        for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
+          NodeCost variant = WalkEnvelope(coded_xunion.fields[i].type, depth);
+          if (i == 0 || IsWorse(variant, worst)) {
+            worst = variant;
+          }
+        }
+        cost += worst;
+        break;
+      }
+    }
+
+    if (IsIdentity(type, depth) && !(compact_ && HasInlinedEnvelopes(type, from_, depth))) {
+      cost.bulk_bytes = cost.src_size;
+    }
+    return cost;
+  }
+
+ private:
+
+  void WalkStruct(const fidl::FidlCodedStruct& src_coded_struct, uint32_t depth,
+                  NodeCost* cost) const {
+    if (src_coded_struct.field_count == 0) {
+      cost->Op(cost->dst_size);
+      return;
+    }
+
+    const uint64_t src_inline_size = cost->src_size;
+    const uint64_t dst_inline_size = cost->dst_size;
+    uint32_t src_coded_inline_size = 0;
+    uint32_t dst_coded_inline_size = 0;
+    for (uint32_t i = 0; i < src_coded_struct.field_count; i++) {
+      const auto& src_field = src_coded_struct.fields[i];
+      if (!src_field.type) {
+        cost->Op(0);  // Copy of the primitive fields before the padding.
+        continue;
+      }
+      const auto& dst_field = *src_field.alt_field;
+      const uint32_t src_field_size = AlignedInlineSize(src_field.type, from_);
+      const uint32_t dst_field_size = AlignedInlineSize(dst_field.type, to_);
+      NodeCost field_cost = Walk(src_field.type, src_field_size, dst_field_size, depth + 1);
+      field_cost.src_size -= src_field_size;
+      field_cost.dst_size -= dst_field_size;
+      *cost += field_cost;
+      cost->Op(0);  // Padding between fields.
+      src_coded_inline_size += src_field_size;
+      dst_coded_inline_size += dst_field_size;
+    }
+    cost->Op(0);  // Copy after the last field.
+    cost->Op(0);  // Padding at the end.
+
+    // Primitive fields and padding are copied or padded by the operations above.
+    if (dst_inline_size > dst_coded_inline_size) {
+      cost->op_bytes += dst_inline_size - dst_coded_inline_size;
+    }
+
+    // Inline bytes outside of coded fields are primitives, and move as is.
+    if (src_inline_size > src_coded_inline_size) {
+      cost->bulk_bytes += src_inline_size - src_coded_inline_size;
+    }
+  }
+
+  void WalkUnion(const fidl::FidlCodedUnion& src_coded_union, uint32_t depth,
+                 NodeCost* cost) const {
+    const auto& dst_coded_union = *src_coded_union.alt_type;
+    const auto& old_coded_union = from_ == WireFormat::kOld ? src_coded_union : dst_coded_union;
+
+    cost->num_unions++;
+    cost->num_envelopes++;
+    cost->Op(from_ == WireFormat::kOld ? sizeof(fidl_xunion_t) : sizeof(uint32_t));
+    cost->Op(0);  // Padding of the variant.
+
+    NodeCost worst;
+    for (uint32_t i = 0; i < old_coded_union.field_count; i++) {
+      const auto& src_field = src_coded_union.fields[i];
+      const auto& old_field = old_coded_union.fields[i];
+
+      // Size of the variant inline in the old static-union, and in the v1 envelope.
+      const uint32_t data_size =
+          old_coded_union.size - old_coded_union.data_offset - old_field.padding;
+      const uint32_t envelope_size =
+          src_field.type && src_field.type->type_tag == fidl::kFidlTypeUnion ? 24u : data_size;
+
+      NodeCost variant;
+      if (from_ == WireFormat::kOld) {
+        variant = Walk(src_field.type, data_size, envelope_size, depth + 1);
+        variant.src_size -= data_size;
+        variant.dst_size = FIDL_ALIGN(variant.dst_size);
+      } else {
+        variant = Walk(src_field.type, FIDL_ALIGN(envelope_size), data_size, depth + 1);
+        variant.dst_size -= data_size;
+      }
+      // Inlined in the envelope on the v1 side.
+      if (compact_ && CompactInlineSize(src_field.type, data_size) != 0) {
+        if (from_ == WireFormat::kOld) {
+          variant.dst_size = 0;
+        } else {
+          variant.src_size -= FIDL_ALIGN(envelope_size);
+        }
+      }
+      if (i == 0 || IsWorse(variant, worst)) {
+        worst = variant;
+      }
+    }
+    *cost += worst;
+  }
+
+  NodeCost WalkEnvelope(const fidl_type_t* type, uint32_t depth) const {
+    const uint32_t src_size = FIDL_ALIGN(AlignedInlineSize(type, from_));
+    const uint32_t dst_size = fidl::internal::AlignedAltInlineSize(type);
+    NodeCost cost = Walk(type, src_size, dst_size, depth + 1);
+    cost.num_envelopes++;
+    cost.Op(sizeof(fidl_envelope_t));
+    // Inlined in the envelope on the v1 side.
+    if (compact_ && CompactInlineSize(type, 0) != 0) {
+      if (from_ == WireFormat::kOld) {
+        cost.dst_size -= dst_size;
+      } else {
+        cost.src_size -= src_size;
+      }
+    }
+    return cost;
+  }
+
+  const WireFormat from_;
+  const WireFormat to_;
+  const bool compact_;
+};
+
+// Walks a v1 coding table graph mirroring the operations `fidl_transform`
+// performs between the v1 and compact v1 wire formats on the worst-case shape of
+// a message. Objects are copied in bulk when their storage is first reached,
+// and only envelopes are rewritten, so the cost of a node only covers the
+// out-of-line objects it owns (its inline part being copied with its parent).
+class V1CompactCostWalker final {
+ public:
+  explicit V1CompactCostWalker(bool to_compact) : to_compact_(to_compact) {}
+
+  NodeCost Walk(const fidl_type_t* type, uint32_t depth) const {
+    NodeCost cost;
+    cost.num_nodes = 1;
+    if (!type || depth > kMaxDepth) {
+      return cost;
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+      case fidl::kFidlTypeHandle:
+        break;
+      case fidl::kFidlTypeStruct:
+        WalkStruct(type->coded_struct, depth, &cost);
+        break;
+      case fidl::kFidlTypeStructPointer: {
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        CopyOutOfLine(FIDL_ALIGN(coded_struct.size), &cost);
+        WalkStruct(coded_struct, depth, &cost);
+        break;
+      }
+      case fidl::kFidlTypeUnion:
+        WalkUnion(type->coded_union, depth, &cost);
+        break;
+      case fidl::kFidlTypeUnionPointer:
+        WalkUnion(*type->coded_union_pointer.union_type, depth, &cost);
+        break;
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        if (coded_array.element) {
+          const uint32_t count = coded_array.array_size / coded_array.element_size;
+          cost += Walk(coded_array.element, depth + 1).Times(count);
+        }
+        break;
+      }
+      case fidl::kFidlTypeString:
+        CopyOutOfLine(FIDL_ALIGNMENT, &cost);
+        break;
+      case fidl::kFidlTypeVector: {
+        const auto& coded_vector = type->coded_vector;
+        CopyOutOfLine(FIDL_ALIGN(coded_vector.element_size), &cost);
+        if (coded_vector.element) {
+          cost += Walk(coded_vector.element, depth + 1);
+        }
+        break;
+      }
+      case fidl::kFidlTypeTable: {
+        const auto& coded_table = type->coded_table;
+        uint32_t max_ordinal = 0;
+        for (uint32_t i = 0; i < coded_table.field_count; i++) {
+          const auto& field = coded_table.fields[i];
+          cost += WalkEnvelope(field.type, 0, depth);
+          if (field.ordinal > max_ordinal) {
+            max_ordinal = field.ordinal;
+          }
+        }
+        CopyOutOfLine(max_ordinal * static_cast<uint32_t>(sizeof(fidl_envelope_t)), &cost);
+        break;
+      }
+      case fidl::kFidlTypeXUnion: {
+        const auto& coded_xunion = type->coded_xunion;
+        NodeCost worst;
+        for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
+          NodeCost variant = WalkEnvelope(coded_xunion.fields[i].type, 0, depth);
+          if (i == 0 || IsWorse(variant, worst)) {
+            worst = variant;
+          }
+        }
+        cost += worst;
+        break;
+      }
+    }
+    return cost;
+  }
+
+ private:
+  static void CopyOutOfLine(uint32_t size, NodeCost* cost) {
+    cost->Op(size);
+    cost->src_size += size;
+    cost->dst_size += size;
+    cost->bulk_bytes += size;
+  }
+
+  void WalkStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t depth,
+                  NodeCost* cost) const {
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      if (coded_struct.fields[i].type) {
+        *cost += Walk(coded_struct.fields[i].type, depth + 1);
+      }
+    }
+  }
+
+  // Variants without a coding table take their size from the old coding table.
+  void WalkUnion(const fidl::FidlCodedUnion& coded_union, uint32_t depth, NodeCost* cost) const {
+    const auto& old_coded_union = *coded_union.alt_type;
+    NodeCost worst;
+    for (uint32_t i = 0; i < coded_union.field_count; i++) {
+      const uint32_t variant_size =
+          old_coded_union.size - old_coded_union.data_offset - old_coded_union.fields[i].padding;
+      NodeCost variant = WalkEnvelope(coded_union.fields[i].type, variant_size, depth);
+      if (i == 0 || IsWorse(variant, worst)) {
+        worst = variant;
+      }
+    }
+    *cost += worst;
+  }
+
+  // |size| is the size of contents without a coding table.
+  NodeCost WalkEnvelope(const fidl_type_t* type, uint32_t size, uint32_t depth) const {
+    NodeCost cost;
+    cost.num_envelopes = 1;
+    const uint32_t inline_size = CompactInlineSize(type, size);
+    if (inline_size != 0) {
+      // Contents move between the envelope and the out-of-line objects.
+      const uint32_t contents_size = FIDL_ALIGN(inline_size);
+      cost.Op(inline_size);
+      if (to_compact_) {
+        cost.src_size = contents_size;
+      } else {
+        cost.Op(contents_size - inline_size);
+        cost.dst_size = contents_size;
+      }
+    } else {
+      CopyOutOfLine(FIDL_ALIGN(type ? AlignedInlineSize(type, WireFormat::kV1) : size), &cost);
+      cost += Walk(type, depth + 1);
+    }
+    cost.Op(sizeof(fidl_envelope_t));
+    return cost;
+  }
+
+  const bool to_compact_;
+};
+
+// Number of costs of `fidl_transform_cost_model_t`.
+constexpr uint32_t kNumCosts = 3;
+
+void SampleCounts(const fidl_transform_cost_sample_t& sample, double out_counts[kNumCosts]) {
+  out_counts[0] = sample.num_nodes;
+  out_counts[1] = sample.num_ops;
+  out_counts[2] = sample.op_bytes;
+}
+
+// Fits the costs whose bit is set in |mask| by least squares, with the others
+// set to zero, and stores them into |out_costs|. Returns false if the samples
+// do not determine them.
+bool FitCosts(const fidl_transform_cost_sample_t* samples, uint32_t num_samples, uint32_t mask,
+              double out_costs[kNumCosts]) {
+  uint32_t indices[kNumCosts];
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < kNumCosts; i++) {
+    if (mask & (1u << i)) {
+      indices[n++] = i;
+    }
+  }
+
+  // Normal equations, as an augmented matrix.
+  double equations[kNumCosts][kNumCosts + 1] = {};
+  for (uint32_t s = 0; s < num_samples; s++) {
+    double counts[kNumCosts];
+    SampleCounts(samples[s], counts);
+    for (uint32_t row = 0; row < n; row++) {
+      for (uint32_t column = 0; column < n; column++) {
+        equations[row][column] += counts[indices[row]] * counts[indices[column]];
+      }
+      equations[row][n] += counts[indices[row]] * samples[s].cycles;
+    }
+  }
+  double scale = 0;
+  for (uint32_t row = 0; row < n; row++) {
+    scale = equations[row][row] > scale ? equations[row][row] : scale;
+  }
+
+  // Gaussian elimination with partial pivoting.
+  for (uint32_t pivot = 0; pivot < n; pivot++) {
+    uint32_t best = pivot;
+    for (uint32_t row = pivot + 1; row < n; row++) {
+      if (fabs(equations[row][pivot]) > fabs(equations[best][pivot])) {
+        best = row;
+      }
+    }
+    if (scale == 0 || fabs(equations[best][pivot]) <= 1e-12 * scale) {
+      return false;
+    }
+    for (uint32_t column = 0; column <= n; column++) {
+      std::swap(equations[pivot][column], equations[best][column]);
+    }
+    for (uint32_t row = 0; row < n; row++) {
+      if (row == pivot) {
+        continue;
+      }
+      const double factor = equations[row][pivot] / equations[pivot][pivot];
+      for (uint32_t column = pivot; column <= n; column++) {
+        equations[row][column] -= factor * equations[pivot][column];
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < kNumCosts; i++) {
+    out_costs[i] = 0;
+  }
+  for (uint32_t row = 0; row < n; row++) {
+    out_costs[indices[row]] = equations[row][n] / equations[row][row];
+  }
+  return true;
+}
+
+}  // namespace
+
+fidl_transform_cost_model_t fidl_transform_cost_model_default(void) {
+  fidl_transform_cost_model_t model;
+  model.cycles_per_node = 12.0;
+  model.cycles_per_op = 8.0;
+  model.cycles_per_byte = 0.125;
+  return model;
+}
+
+zx_status_t fidl_transform_cost_model_fit(const fidl_transform_cost_sample_t* samples,
+                                          uint32_t num_samples,
+                                          fidl_transform_cost_model_t* out_model,
+                                          const char** out_error_msg) {
+  assert(samples || num_samples == 0);
+  assert(out_model);
+
+  if (num_samples < kNumCosts) {
+    if (out_error_msg)
+      *out_error_msg = "too few samples to fit a cost model";
+    return ZX_ERR_INVALID_ARGS;
+  }
+
+  // Least squares with non-negative costs: the unconstrained fit of one of the
+  // subsets of the costs (the others being zero) is the best, and there are
+  // only eight of them to try, starting with the empty one.
+  double best_costs[kNumCosts] = {};
+  double best_residual = 0;
+  for (uint32_t s = 0; s < num_samples; s++) {
+    best_residual += samples[s].cycles * samples[s].cycles;
+  }
+  for (uint32_t mask = 1; mask < (1u << kNumCosts); mask++) {
+    double costs[kNumCosts];
+    if (!FitCosts(samples, num_samples, mask, costs)) {
+      continue;
+    }
+    bool non_negative = true;
+    for (uint32_t i = 0; i < kNumCosts; i++) {
+      non_negative = non_negative && costs[i] >= 0;
+    }
+    if (!non_negative) {
+      continue;
+    }
+    double residual = 0;
+    for (uint32_t s = 0; s < num_samples; s++) {
+      double counts[kNumCosts];
+      SampleCounts(samples[s], counts);
+      double error = samples[s].cycles;
+      for (uint32_t i = 0; i < kNumCosts; i++) {
+        error -= costs[i] * counts[i];
+      }
+      residual += error * error;
+    }
+    if (residual < best_residual) {
+      best_residual = residual;
+      for (uint32_t i = 0; i < kNumCosts; i++) {
+        best_costs[i] = costs[i];
+      }
+    }
+  }
+  out_model->cycles_per_node = best_costs[0];
+  out_model->cycles_per_op = best_costs[1];
+  out_model->cycles_per_byte = best_costs[2];
+  return ZX_OK;
+}
+
+zx_status_t fidl_transform_explain(fidl_transformation_t transformation, const fidl_type_t* type,
+                                   const fidl_transform_cost_model_t* model,
+                                   fidl_transform_cost_t* out_cost, const char** out_error_msg) {
+  assert(type);
+  assert(out_cost);
+
+  const fidl_transform_cost_model_t default_model = fidl_transform_cost_model_default();
+  if (!model) {
+    model = &default_model;
+  }
+
+  NodeCost cost;
+  uint32_t src_inline_size;
+  uint32_t dst_inline_size;
+  bool identity_eligible;
+  switch (transformation) {
+    case FIDL_TRANSFORMATION_NONE:
+      src_inline_size = dst_inline_size = AlignedInlineSize(type, WireFormat::kOld);
+      cost.num_nodes = 1;
+      cost.Op(src_inline_size);
+      cost.src_size = cost.dst_size = cost.bulk_bytes = src_inline_size;
+      identity_eligible = true;
+      break;
+    case FIDL_TRANSFORMATION_V1_TO_OLD:
+    case FIDL_TRANSFORMATION_OLD_TO_V1:
+    case FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT:
+    case FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD: {
+      const WireFormat from = transformation == FIDL_TRANSFORMATION_OLD_TO_V1 ||
+                                      transformation == FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT
+                                  ? WireFormat::kOld
+                                  : WireFormat::kV1;
+      const WireFormat to = from == WireFormat::kOld ? WireFormat::kV1 : WireFormat::kOld;
+      const bool compact = transformation == FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT ||
+                           transformation == FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD;
+      src_inline_size = AlignedInlineSize(type, from);
+      dst_inline_size = type->type_tag == fidl::kFidlTypeStruct
+                            ? type->coded_struct.alt_type->size
+                            : AlignedInlineSize(type, to);
+      cost = CostWalker(from, to, compact).Walk(type, src_inline_size, dst_inline_size, 0);
+      identity_eligible =
+          IsIdentity(type, 0) && !(compact && HasInlinedEnvelopes(type, from, 0));
+      break;
+    }
+    case FIDL_TRANSFORMATION_V1_TO_V1_COMPACT:
+    case FIDL_TRANSFORMATION_V1_COMPACT_TO_V1: {
+      src_inline_size = dst_inline_size = AlignedInlineSize(type, WireFormat::kV1);
+      const uint32_t aligned_inline_size = FIDL_ALIGN(src_inline_size);
+      cost = V1CompactCostWalker(transformation == FIDL_TRANSFORMATION_V1_TO_V1_COMPACT)
+                 .Walk(type, 0);
+      cost.Op(src_inline_size);
+      cost.Op(aligned_inline_size - src_inline_size);
+      cost.src_size += aligned_inline_size;
+      cost.dst_size += aligned_inline_size;
+      cost.bulk_bytes += aligned_inline_size;
+      identity_eligible = !HasInlinedEnvelopes(type, WireFormat::kV1, 0);
+      break;
+    }
+    default:
+      if (out_error_msg)
+        *out_error_msg = "unsupported transformation";
+      return ZX_ERR_INVALID_ARGS;
+  }
+
+  out_cost->src_inline_size = src_inline_size;
+  out_cost->dst_inline_size = dst_inline_size;
+  out_cost->src_size = cost.src_size;
+  out_cost->dst_size = cost.dst_size;
+  out_cost->num_unions = cost.num_unions;
+  out_cost->num_envelopes = cost.num_envelopes;
+  out_cost->bulk_bytes = cost.bulk_bytes < cost.src_size ? cost.bulk_bytes : cost.src_size;
+  out_cost->moved_bytes = cost.src_size - out_cost->bulk_bytes;
+  out_cost->num_nodes = cost.num_nodes;
+  out_cost->num_ops = cost.num_ops;
+  out_cost->op_bytes = cost.op_bytes;
+  out_cost->expansion =
+      cost.src_size ? static_cast<double>(cost.dst_size) / static_cast<double>(cost.src_size) : 1.0;
+  out_cost->identity_eligible = identity_eligible;
+  out_cost->dominated_by_small_copies =
+      cost.num_ops > 0 && cost.op_bytes < static_cast<uint64_t>(cost.num_ops) *
+                                              FIDL_TRANSFORM_COST_SMALL_OP_BYTES;
+  out_cost->estimated_cycles = model->cycles_per_node * cost.num_nodes +
+                               model->cycles_per_op * cost.num_ops +
+                               model->cycles_per_byte * static_cast<double>(cost.op_bytes);
+  return ZX_OK;
+}
+
+#pragma GCC diagnostic pop  // "-Wimplicit-fallthrough"
@@ -0,0 +1,120 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_EXPLAIN_H_
+#define LIB_FIDL_EXPLAIN_H_
+
+#include "fidl.h"
+#include "transformer.h"
+
+// __BEGIN_CDECLS
+
+// Per-operation costs used to turn the operations of a transformation into an
+// estimate of cycles per message.
+//
+// The defaults (see `fidl_transform_cost_model_default`) are rough numbers for
+// an optimized build on a contemporary x86-64 core, not measurements. Callers
+// wanting precise estimates should fit a model to measurements of
+// `fidl_transform` on their own hardware (see `fidl_transform_cost_model_fit`,
+// and `bench --calibrate` which does so) and provide it.
+typedef struct {
+  // Cost of entering a node of the coding table graph (dispatch, position
+  // bookkeeping).
+  double cycles_per_node;
+  // Fixed cost of each copy, pad or write performed on the destination.
+  double cycles_per_op;
+  // Cost per byte copied or padded.
+  double cycles_per_byte;
+} fidl_transform_cost_model_t;
+
+// A static estimate of what transforming one message of a given type costs.
+//
+// Out-of-line sizes depend on the message, so the estimate is computed for a
+// representative worst-case shape: nullable objects are present, vectors and
+// strings hold a single element (respectively a single 8-byte chunk), tables
+// have all their fields set, and unions and xunions hold the variant that grows
+// the most when transformed. Recursive types are cut off at a depth of 32.
+typedef struct {
+  // Inline size of the top-level object, in the source and destination.
+  uint32_t src_inline_size;
+  uint32_t dst_inline_size;
+
+  // Total (inline and out-of-line) size of the worst-case shape.
+  uint64_t src_size;
+  uint64_t dst_size;
+
+  // Number of static unions which are converted, and of envelopes which are
+  // read or written (including those of tables and xunions).
+  uint32_t num_unions;
+  uint32_t num_envelopes;
+
+  // Source bytes belonging to sub-objects with an identical layout in both wire
+  // formats (and which could therefore be copied in bulk), and source bytes
+  // which must be moved individually.
+  uint64_t bulk_bytes;
+  uint64_t moved_bytes;
+
+  // Number of nodes entered, and of copy, pad and write operations performed on
+  // the destination by `fidl_transform`, as well as the bytes they cover.
+  uint32_t num_nodes;
+  uint32_t num_ops;
+  uint64_t op_bytes;
+
+  // |dst_size| / |src_size|.
+  double expansion;
+
+  // True if the type has the same layout in both wire formats, i.e. the
+  // transformation is a plain copy.
+  bool identity_eligible;
+
+  // True if the cost is dominated by small scattered copies, i.e. the average
+  // operation covers fewer than `FIDL_TRANSFORM_COST_SMALL_OP_BYTES` bytes.
+  bool dominated_by_small_copies;
+
+  double estimated_cycles;
+} fidl_transform_cost_t;
+
+#define FIDL_TRANSFORM_COST_SMALL_OP_BYTES 16u
+
+// Returns the default cost model.
+fidl_transform_cost_model_t fidl_transform_cost_model_default(void);
+
+// A measurement of transforming messages, for `fidl_transform_cost_model_fit`:
+// the average number of nodes entered, of operations and of the bytes they
+// cover per message (e.g. counted from the trace events recorded by
+// `fidl_transform`, see `transformer.h`), and the average cycles per message.
+typedef struct {
+  double num_nodes;
+  double num_ops;
+  double op_bytes;
+  double cycles;
+} fidl_transform_cost_sample_t;
+
+// Fits a cost model to |num_samples| samples by least squares, with costs
+// constrained to be non-negative. Samples should come from types with different
+// shapes (e.g. one per type and transformation), so that they tell the costs
+// apart.
+//
+// Upon success, returns `ZX_OK` and fills |out_model|. Fails with
+// `ZX_ERR_INVALID_ARGS` if there are fewer than 3 samples, in which case (and
+// if provided) writes an error message to |out_error_msg|.
+zx_status_t fidl_transform_cost_model_fit(const fidl_transform_cost_sample_t* samples,
+                                          uint32_t num_samples,
+                                          fidl_transform_cost_model_t* out_model,
+                                          const char** out_error_msg);
+
+// Statically estimates the cost of applying |transformation| to messages of
+// type |type| (a coding table of the transformation's source wire format),
+// using |model| (or the default model if null) for the cycle estimate. All the
+// transformations of `fidl_transform` are supported, compact ones included.
+//
+// Upon success, returns `ZX_OK` and fills |out_cost|. Upon failure (and if
+// provided) writes an error message to |out_error_msg|.
+zx_status_t fidl_transform_explain(fidl_transformation_t transformation, const fidl_type_t* type,
+                                   const fidl_transform_cost_model_t* model,
+                                   fidl_transform_cost_t* out_cost, const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_EXPLAIN_H_
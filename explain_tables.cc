@@ -0,0 +1,64 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Prints the static cost estimate of `fidl_transform_explain` for every coding
+// table of `tables.h`, in both directions. Usage:
+//
+//     ./explain_tables [name-substring]
+//
+// Types whose cost is dominated by small scattered copies are flagged with
+// "SCATTERED"; types which could be transformed with a plain copy are flagged
+// with "IDENTITY".
+
+#include <lib/fidl/explain.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "tables_catalog.h"
+
+namespace {
+
+void PrintCost(const char* name, const char* direction, const fidl_transform_cost_t& cost) {
+  printf("%-44s %-9s %5u -> %-5u %6llu -> %-6llu x%-5.2f %3u %3u %6llu %6llu %4u %5u %8.0f %s%s\n",
+         name, direction, cost.src_inline_size, cost.dst_inline_size,
+         static_cast<unsigned long long>(cost.src_size),
+         static_cast<unsigned long long>(cost.dst_size), cost.expansion, cost.num_unions,
+         cost.num_envelopes, static_cast<unsigned long long>(cost.bulk_bytes),
+         static_cast<unsigned long long>(cost.moved_bytes), cost.num_nodes, cost.num_ops,
+         cost.estimated_cycles, cost.identity_eligible ? "IDENTITY " : "",
+         cost.dominated_by_small_copies ? "SCATTERED" : "");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* filter = argc > 1 ? argv[1] : nullptr;
+
+  printf("%-44s %-9s %-14s %-16s %-6s %3s %3s %6s %6s %4s %5s %8s\n", "type", "direction",
+         "inline", "worst-case size", "expand", "uni", "env", "bulk", "moved", "node", "ops",
+         "cycles");
+
+  for (const auto& entry : kCatalog) {
+    if (filter && !strstr(entry.name, filter)) {
+      continue;
+    }
+
+    fidl_transform_cost_t cost;
+    const char* error = nullptr;
+    if (fidl_transform_explain(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, nullptr, &cost,
+                               &error) == ZX_OK) {
+      PrintCost(entry.name, "old->v1", cost);
+    } else {
+      printf("%-44s %-9s error: %s\n", entry.name, "old->v1", error);
+    }
+    if (fidl_transform_explain(FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, nullptr, &cost,
+                               &error) == ZX_OK) {
+      PrintCost(entry.name, "v1->old", cost);
+    } else {
+      printf("%-44s %-9s error: %s\n", entry.name, "v1->old", error);
+    }
+  }
+  return 0;
+}
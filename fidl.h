@@ -45,6 +45,8 @@ typedef int32_t zx_status_t;
 #define ZX_OK (0)
 #define ZX_ERR_BAD_STATE (-20)
 #define ZX_ERR_INVALID_ARGS (-10)
+#define ZX_ERR_OUT_OF_RANGE (-14)
+#define ZX_ERR_NOT_FOUND (-25)
 #define ZX_ERR_BUFFER_TOO_SMALL (-789)
 
 #define FIDL_MAX_SIZE UINT32_MAX
@@ -0,0 +1,414 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/filter.h>
+#include <lib/fidl/transformer_internal.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+using fidl::internal::MemberOffset;
+using fidl::internal::TableFieldType;
+using fidl::internal::WireFormat;
+
+// Messages are evaluated this many at a time by `fidl_filter_match_batch`.
+constexpr uint32_t kBatchBlock = 64;
+
+zx_status_t Fail(zx_status_t status, const char* error_msg, const char** out_error_msg) {
+  if (out_error_msg) {
+    *out_error_msg = error_msg;
+  }
+  return status;
+}
+
+const fidl::FidlCodedStruct* SelectedStruct(const fidl_type_t* type) {
+  if (!type) {
+    return nullptr;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypeStruct:
+      return &type->coded_struct;
+    case fidl::kFidlTypeStructPointer:
+      return type->coded_struct_pointer.struct_type;
+    default:
+      return nullptr;
+  }
+}
+
+// Sets up the comparison of |compiled| (see `fidl_compiled_predicate_t`), for
+// the inclusive range |min| to |max|, clamped to the integers of |size| bytes.
+zx_status_t CompileRange(uint32_t size, bool is_signed, uint64_t min, uint64_t max,
+                         fidl_compiled_predicate_t* compiled, const char** out_error_msg) {
+  compiled->shift = 64 - 8 * size;
+  if (size < sizeof(uint64_t) && is_signed) {
+    const int64_t limit = int64_t{1} << (8 * size - 1);
+    const int64_t signed_min = std::max(static_cast<int64_t>(min), -limit);
+    const int64_t signed_max = std::min(static_cast<int64_t>(max), limit - 1);
+    if (signed_min > signed_max) {
+      return Fail(ZX_ERR_INVALID_ARGS, "predicate range is empty", out_error_msg);
+    }
+    min = static_cast<uint64_t>(signed_min);
+    max = static_cast<uint64_t>(signed_max);
+  } else if (size < sizeof(uint64_t)) {
+    const uint64_t limit = (uint64_t{1} << (8 * size)) - 1;
+    if (min > limit) {
+      return Fail(ZX_ERR_INVALID_ARGS, "predicate range is empty", out_error_msg);
+    }
+    max = std::min(max, limit);
+  }
+  compiled->bias = is_signed ? uint64_t{1} << 63 : 0;
+  const uint64_t low = (min << compiled->shift) ^ compiled->bias;
+  const uint64_t high = (max << compiled->shift) ^ compiled->bias;
+  if (low > high) {
+    return Fail(ZX_ERR_INVALID_ARGS, "predicate range is empty", out_error_msg);
+  }
+  compiled->low = low;
+  compiled->span = high - low;
+  return ZX_OK;
+}
+
+zx_status_t Compile(WireFormat wire_format, const fidl_type_t* type,
+                    const fidl_predicate_t& predicate, fidl_compiled_predicate_t* compiled,
+                    const char** out_error_msg) {
+  // Follow the path through the coding tables, keeping track of the offset of
+  // the selected field while it is inline in the top-level struct.
+  bool fixed = true;
+  uint32_t offset = 0;
+  compiled->table_field = false;
+  for (uint32_t i = 0; i < predicate.path.num_elements; i++) {
+    const uint32_t element = predicate.path.elements[i];
+    if (compiled->table_field) {
+      return Fail(ZX_ERR_INVALID_ARGS, "field path continues past a table field", out_error_msg);
+    }
+    if (const fidl::FidlCodedStruct* coded_struct = SelectedStruct(type)) {
+      fixed = fixed && type->type_tag == fidl::kFidlTypeStruct;
+      const fidl::FidlStructField* field = nullptr;
+      for (uint32_t j = 0, index = 0; j < coded_struct->field_count; j++) {
+        if (coded_struct->fields[j].type && index++ == element) {
+          field = &coded_struct->fields[j];
+          break;
+        }
+      }
+      if (!field) {
+        return Fail(ZX_ERR_OUT_OF_RANGE, "field index out of range", out_error_msg);
+      }
+      offset += field->offset;
+      type = field->type;
+    } else if (type && type->type_tag == fidl::kFidlTypeTable) {
+      uint32_t cursor = 0;
+      fixed = false;
+      compiled->table_field = true;
+      type = TableFieldType(type->coded_table, element, &cursor);
+    } else {
+      return Fail(ZX_ERR_INVALID_ARGS, "field path descends into neither a struct nor a table",
+                  out_error_msg);
+    }
+  }
+
+  compiled->fixed_offset = FIDL_FILTER_NO_FIXED_OFFSET;
+  switch (predicate.op) {
+    case FIDL_PREDICATE_EQUAL:
+    case FIDL_PREDICATE_RANGE:
+    case FIDL_PREDICATE_SIGNED_RANGE: {
+      const fidl::FidlCodedStruct* coded_struct = SelectedStruct(type);
+      if (!coded_struct) {
+        return Fail(ZX_ERR_INVALID_ARGS, "predicate on the members of a non-struct",
+                    out_error_msg);
+      }
+      if (predicate.size != 1 && predicate.size != 2 && predicate.size != 4 &&
+          predicate.size != 8) {
+        return Fail(ZX_ERR_INVALID_ARGS, "predicate size is not 1, 2, 4 or 8", out_error_msg);
+      }
+      uint32_t member_offset;
+      if (const char* error = MemberOffset(*coded_struct, wire_format, predicate.offset,
+                                           predicate.size, &member_offset)) {
+        return Fail(ZX_ERR_INVALID_ARGS, error, out_error_msg);
+      }
+      if (fixed && type->type_tag == fidl::kFidlTypeStruct) {
+        compiled->fixed_offset = offset + member_offset;
+      }
+      if (predicate.op == FIDL_PREDICATE_EQUAL) {
+        return CompileRange(predicate.size, false, predicate.min, predicate.min, compiled,
+                            out_error_msg);
+      }
+      return CompileRange(predicate.size, predicate.op == FIDL_PREDICATE_SIGNED_RANGE,
+                          predicate.min, predicate.max, compiled, out_error_msg);
+    }
+    case FIDL_PREDICATE_VARIANT: {
+      // Static unions hold their tag in the old wire format, and the ordinal of
+      // the variant in the v1 wire format. Xunions hold their ordinal.
+      uint64_t tag = predicate.min;
+      if (type && (type->type_tag == fidl::kFidlTypeUnion ||
+                   type->type_tag == fidl::kFidlTypeUnionPointer)) {
+        const fidl::FidlCodedUnion& coded_union = type->type_tag == fidl::kFidlTypeUnion
+                                                      ? type->coded_union
+                                                      : *type->coded_union_pointer.union_type;
+        if (predicate.min >= coded_union.field_count) {
+          return Fail(ZX_ERR_INVALID_ARGS, "union has no such variant", out_error_msg);
+        }
+        if (wire_format == WireFormat::kV1) {
+          tag = coded_union.fields[predicate.min].xunion_ordinal;
+        }
+        fixed = fixed && type->type_tag == fidl::kFidlTypeUnion;
+      } else if (!type || type->type_tag != fidl::kFidlTypeXUnion) {
+        return Fail(ZX_ERR_INVALID_ARGS, "variant predicate on a non-union", out_error_msg);
+      }
+      if (fixed) {
+        compiled->fixed_offset = offset;
+      }
+      return CompileRange(sizeof(uint32_t), false, tag, tag, compiled, out_error_msg);
+    }
+    case FIDL_PREDICATE_PRESENT:
+      return ZX_OK;
+  }
+  return Fail(ZX_ERR_INVALID_ARGS, "unknown predicate", out_error_msg);
+}
+
+bool InRange(const fidl_compiled_predicate_t& compiled, uint64_t value) {
+  return ((value << compiled.shift) ^ compiled.bias) - compiled.low <= compiled.span;
+}
+
+// Views the field (or struct) selected by the path of |compiled|.
+zx_status_t ViewPath(const fidl_compiled_predicate_t& compiled, const fidl_view_t& message,
+                     fidl_view_t* out_view, const char** out_error_msg) {
+  const fidl_field_path_t& path = compiled.predicate.path;
+  *out_view = message;
+  for (uint32_t i = 0; i < path.num_elements; i++) {
+    const fidl_view_t view = *out_view;
+    const zx_status_t status =
+        compiled.table_field && i + 1 == path.num_elements
+            ? fidl_view_table_field(&view, path.elements[i], out_view, out_error_msg)
+            : fidl_view_field(&view, path.elements[i], out_view, out_error_msg);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  return ZX_OK;
+}
+
+// Evaluates |compiled| through views of |message|.
+zx_status_t MatchViewed(const fidl_compiled_predicate_t& compiled, const fidl_view_t& message,
+                        bool* out_match, const char** out_error_msg) {
+  *out_match = false;
+  fidl_view_t view;
+  zx_status_t status = ViewPath(compiled, message, &view, out_error_msg);
+  if (status == ZX_ERR_NOT_FOUND) {
+    return ZX_OK;
+  }
+  if (status != ZX_OK) {
+    return status;
+  }
+  const fidl_predicate_t& predicate = compiled.predicate;
+  switch (predicate.op) {
+    case FIDL_PREDICATE_EQUAL:
+    case FIDL_PREDICATE_RANGE:
+    case FIDL_PREDICATE_SIGNED_RANGE: {
+      uint64_t value = 0;
+      status = fidl_view_read(&view, predicate.offset, &value, predicate.size, out_error_msg);
+      *out_match = status == ZX_OK && InRange(compiled, value);
+      return status;
+    }
+    case FIDL_PREDICATE_VARIANT: {
+      uint32_t variant;
+      fidl_view_t data;
+      status = fidl_view_variant(&view, &variant, &data, out_error_msg);
+      if (status == ZX_ERR_NOT_FOUND) {
+        return ZX_OK;
+      }
+      *out_match = status == ZX_OK && variant == predicate.min;
+      return status;
+    }
+    case FIDL_PREDICATE_PRESENT:
+      *out_match = fidl_view_is_present(&view);
+      return ZX_OK;
+  }
+  return Fail(ZX_ERR_INVALID_ARGS, "unknown predicate", out_error_msg);
+}
+
+zx_status_t InitView(const fidl_compiled_predicate_t& compiled, const uint8_t* bytes,
+                     uint32_t num_bytes, fidl_view_t* out_view, const char** out_error_msg) {
+  return fidl_view_init(compiled.wire_format, compiled.type, bytes, num_bytes, out_view,
+                        out_error_msg);
+}
+
+// Loads the compared bytes of a block of messages, as |Size| byte integers, and
+// whether the messages hold them.
+template <uint32_t Size>
+void LoadBlock(uint32_t offset, const uint8_t* const* messages, const uint32_t* num_bytes,
+               uint32_t count, uint64_t* out_values, uint8_t* out_loaded) {
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t value = 0;
+    out_loaded[i] = static_cast<uint64_t>(offset) + Size <= num_bytes[i];
+    if (out_loaded[i]) {
+      memcpy(&value, &messages[i][offset], Size);
+    }
+    out_values[i] = value;
+  }
+}
+
+// Clears |matches| of the messages of a block whose loaded values do not match
+// |predicate|. Always compares whole blocks, so that the loop has a constant
+// trip count and no epilogue, and vectorizes even at -O2.
+inline void CompareBlockGeneric(const fidl_compiled_predicate_t& predicate,
+                                const uint64_t* __restrict values,
+                                const uint8_t* __restrict loaded, uint8_t* __restrict matches) {
+  const uint32_t shift = predicate.shift;
+  const uint64_t bias = predicate.bias, low = predicate.low, span = predicate.span;
+  for (uint32_t i = 0; i < kBatchBlock; i++) {
+    matches[i] &= loaded[i] & static_cast<uint8_t>(((values[i] << shift) ^ bias) - low <= span);
+  }
+}
+
+#if defined(__x86_64__)
+// SSE2 has no 64-bit comparisons, so the same loop is compiled for AVX2 as
+// well, and selected at runtime where supported.
+__attribute__((target("avx2"))) void CompareBlockAvx2(const fidl_compiled_predicate_t& predicate,
+                                                      const uint64_t* values,
+                                                      const uint8_t* loaded, uint8_t* matches) {
+  CompareBlockGeneric(predicate, values, loaded, matches);
+}
+#endif
+
+void CompareBlock(const fidl_compiled_predicate_t& predicate, const uint64_t* values,
+                  const uint8_t* loaded, uint8_t* matches) {
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    CompareBlockAvx2(predicate, values, loaded, matches);
+    return;
+  }
+#endif
+  CompareBlockGeneric(predicate, values, loaded, matches);
+}
+
+}  // namespace
+
+zx_status_t fidl_filter_compile(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                const fidl_predicate_t* predicates, uint32_t num_predicates,
+                                fidl_compiled_predicate_t* out_compiled,
+                                const char** out_error_msg) {
+  if (wire_format != FIDL_WIRE_FORMAT_OLD && wire_format != FIDL_WIRE_FORMAT_V1) {
+    return Fail(ZX_ERR_INVALID_ARGS, "unknown wire format", out_error_msg);
+  }
+  if (type->type_tag != fidl::kFidlTypeStruct) {
+    return Fail(ZX_ERR_INVALID_ARGS, "only top-level structs supported", out_error_msg);
+  }
+  for (uint32_t i = 0; i < num_predicates; i++) {
+    fidl_compiled_predicate_t& compiled = out_compiled[i];
+    compiled = {};
+    compiled.wire_format = wire_format;
+    compiled.type = type;
+    compiled.predicate = predicates[i];
+    const zx_status_t status =
+        Compile(wire_format == FIDL_WIRE_FORMAT_OLD ? WireFormat::kOld : WireFormat::kV1, type,
+                predicates[i], &compiled, out_error_msg);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  return ZX_OK;
+}
+
+zx_status_t fidl_filter_match(const fidl_compiled_predicate_t* compiled, uint32_t num_predicates,
+                              const uint8_t* bytes, uint32_t num_bytes, bool* out_match,
+                              const char** out_error_msg) {
+  *out_match = true;
+  fidl_view_t message;
+  bool viewed = false;
+  for (uint32_t i = 0; i < num_predicates && *out_match; i++) {
+    const fidl_compiled_predicate_t& predicate = compiled[i];
+    if (predicate.fixed_offset != FIDL_FILTER_NO_FIXED_OFFSET) {
+      const uint32_t size = predicate.predicate.op == FIDL_PREDICATE_VARIANT
+                                ? static_cast<uint32_t>(sizeof(uint32_t))
+                                : predicate.predicate.size;
+      if (static_cast<uint64_t>(predicate.fixed_offset) + size > num_bytes) {
+        return Fail(ZX_ERR_INVALID_ARGS, "message is too small", out_error_msg);
+      }
+      uint64_t value = 0;
+      memcpy(&value, &bytes[predicate.fixed_offset], size);
+      *out_match = InRange(predicate, value);
+      continue;
+    }
+    if (!viewed) {
+      const zx_status_t status = InitView(predicate, bytes, num_bytes, &message, out_error_msg);
+      if (status != ZX_OK) {
+        return status;
+      }
+      viewed = true;
+    }
+    const zx_status_t status = MatchViewed(predicate, message, out_match, out_error_msg);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  return ZX_OK;
+}
+
+void fidl_filter_match_batch(const fidl_compiled_predicate_t* compiled, uint32_t num_predicates,
+                             const uint8_t* const* messages, const uint32_t* num_bytes,
+                             uint32_t count, bool* out_matches) {
+  // Blocks are compared whole. Entries past the last message of a partial
+  // block are neither loaded nor matching, whatever the previous block held.
+  uint64_t values[kBatchBlock] = {};
+  uint8_t loaded[kBatchBlock] = {};
+  uint8_t matches[kBatchBlock] = {};
+  for (uint32_t start = 0; start < count; start += kBatchBlock) {
+    const uint32_t block = std::min(kBatchBlock, count - start);
+    std::fill(matches, matches + block, uint8_t{1});
+    if (block < kBatchBlock) {
+      std::fill(loaded + block, loaded + kBatchBlock, uint8_t{0});
+      std::fill(matches + block, matches + kBatchBlock, uint8_t{0});
+    }
+
+    // Predicates at a fixed offset: load the compared bytes of every message,
+    // then compare them all at once, without branches.
+    for (uint32_t p = 0; p < num_predicates; p++) {
+      const fidl_compiled_predicate_t& predicate = compiled[p];
+      if (predicate.fixed_offset == FIDL_FILTER_NO_FIXED_OFFSET) {
+        continue;
+      }
+      const uint32_t offset = predicate.fixed_offset;
+      switch (predicate.predicate.op == FIDL_PREDICATE_VARIANT ? 4 : predicate.predicate.size) {
+        case 1:
+          LoadBlock<1>(offset, &messages[start], &num_bytes[start], block, values, loaded);
+          break;
+        case 2:
+          LoadBlock<2>(offset, &messages[start], &num_bytes[start], block, values, loaded);
+          break;
+        case 4:
+          LoadBlock<4>(offset, &messages[start], &num_bytes[start], block, values, loaded);
+          break;
+        default:
+          LoadBlock<8>(offset, &messages[start], &num_bytes[start], block, values, loaded);
+          break;
+      }
+      CompareBlock(predicate, values, loaded, matches);
+    }
+
+    // Other predicates, on messages which still match.
+    for (uint32_t i = 0; i < block; i++) {
+      fidl_view_t message;
+      bool viewed = false;
+      for (uint32_t p = 0; p < num_predicates && matches[i]; p++) {
+        const fidl_compiled_predicate_t& predicate = compiled[p];
+        if (predicate.fixed_offset != FIDL_FILTER_NO_FIXED_OFFSET) {
+          continue;
+        }
+        if (!viewed && InitView(predicate, messages[start + i], num_bytes[start + i], &message,
+                                nullptr) != ZX_OK) {
+          matches[i] = 0;
+          break;
+        }
+        viewed = true;
+        bool match;
+        if (MatchViewed(predicate, message, &match, nullptr) != ZX_OK || !match) {
+          matches[i] = 0;
+        }
+      }
+      out_matches[start + i] = matches[i] != 0;
+    }
+  }
+}
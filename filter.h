@@ -0,0 +1,121 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_FILTER_H_
+#define LIB_FIDL_FILTER_H_
+
+#include "fidl.h"
+#include "transformer.h"
+#include "view.h"
+
+// __BEGIN_CDECLS
+
+// Filters evaluate simple predicates on encoded messages, in either wire
+// format, without transforming them, so that consumers which drop most
+// messages based on a few fields only transform the messages they keep.
+//
+// Predicates are compiled once against the coding table of a top-level struct,
+// then evaluated on any number of messages of that struct. Predicates on
+// objects at a fixed offset in the message (primitive members of the top-level
+// struct or of structs inline in it, and the tag of unions and xunions inline
+// in them) only read those bytes. Others read the message through views (see
+// `view.h`), which only walk the objects needed to find the selected field.
+
+typedef uint32_t fidl_predicate_op_t;
+
+// The |size| bytes at |offset| of the selected struct (the offset of a
+// primitive member in the old wire format, as in `fidl_view_read`) are equal
+// to the |size| low bytes of |min|.
+#define FIDL_PREDICATE_EQUAL ((fidl_predicate_op_t)1u)
+
+// The |size| bytes at |offset| of the selected struct, as an unsigned integer,
+// are between |min| and |max| (inclusive).
+#define FIDL_PREDICATE_RANGE ((fidl_predicate_op_t)2u)
+
+// Same as `FIDL_PREDICATE_RANGE`, for signed integers (|min| and |max| being
+// `int64_t` values).
+#define FIDL_PREDICATE_SIGNED_RANGE ((fidl_predicate_op_t)3u)
+
+// The selected static union or xunion holds variant |min| (an index for static
+// unions, the same in both wire formats, and an ordinal for xunions).
+#define FIDL_PREDICATE_VARIANT ((fidl_predicate_op_t)4u)
+
+// The selected field is present (see `fidl_view_is_present`), including table
+// fields of unknown ordinals.
+#define FIDL_PREDICATE_PRESENT ((fidl_predicate_op_t)5u)
+
+// A predicate on the field (or for `FIDL_PREDICATE_EQUAL` and
+// `FIDL_PREDICATE_..._RANGE`, on the struct) selected by |path| (see
+// `fidl_field_path_t`). Predicates on fields which are absent (e.g. behind an
+// absent struct pointer, or absent table fields) do not match.
+typedef struct {
+  fidl_predicate_op_t op;
+  fidl_field_path_t path;
+  uint32_t offset;
+  // 1, 2, 4 or 8.
+  uint32_t size;
+  uint64_t min;
+  uint64_t max;
+} fidl_predicate_t;
+
+// A predicate compiled against a coding table. The path of the predicate it
+// was compiled from must outlive it.
+typedef struct {
+  // Private.
+  fidl_wire_format_t wire_format;
+  const fidl_type_t* type;
+  fidl_predicate_t predicate;
+  // Whether the path ends at a field of a table.
+  bool table_field;
+  // Offset of the compared bytes in the message, or
+  // `FIDL_FILTER_NO_FIXED_OFFSET`.
+  uint32_t fixed_offset;
+  // Compared bytes are loaded as a little-endian integer, shifted into the high
+  // bytes of a `uint64_t` and xored with |bias|, which orders signed integers
+  // as unsigned ones, and then match if within |low| and |low + span|.
+  uint32_t shift;
+  uint64_t bias;
+  uint64_t low;
+  uint64_t span;
+} fidl_compiled_predicate_t;
+
+#define FIDL_FILTER_NO_FIXED_OFFSET UINT32_MAX
+
+// Compiles the |num_predicates| |predicates| for messages of top-level struct
+// |type|, in |wire_format|, into |out_compiled| (which has room for as many).
+//
+// Returns `ZX_OK` upon success. Upon failure (and if provided) writes an error
+// message to |out_error_msg|, and returns `ZX_ERR_OUT_OF_RANGE` if a path
+// selects a field past the last field of a struct, and `ZX_ERR_INVALID_ARGS`
+// if a predicate does not apply to the field it selects.
+zx_status_t fidl_filter_compile(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                const fidl_predicate_t* predicates, uint32_t num_predicates,
+                                fidl_compiled_predicate_t* out_compiled,
+                                const char** out_error_msg);
+
+// Stores into |out_match| whether the message |bytes| matches all of the
+// |num_predicates| |compiled| predicates. Predicates are evaluated in order,
+// and evaluation stops at the first one which does not match.
+//
+// Returns `ZX_OK` upon success. Upon failure (and if provided) writes an error
+// message to |out_error_msg|, and returns `ZX_ERR_INVALID_ARGS` if the bytes
+// read are not a valid message.
+zx_status_t fidl_filter_match(const fidl_compiled_predicate_t* compiled, uint32_t num_predicates,
+                              const uint8_t* bytes, uint32_t num_bytes, bool* out_match,
+                              const char** out_error_msg);
+
+// Same as `fidl_filter_match`, for the |count| messages |messages| (of
+// |num_bytes| bytes each), storing whether each matches into |out_matches|.
+// Messages which are not valid do not match.
+//
+// Predicates at a fixed offset are evaluated first, over blocks of messages at
+// a time (comparing a whole block with vector instructions where available),
+// and the others only on messages which still match.
+void fidl_filter_match_batch(const fidl_compiled_predicate_t* compiled, uint32_t num_predicates,
+                             const uint8_t* const* messages, const uint32_t* num_bytes,
+                             uint32_t count, bool* out_matches);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_FILTER_H_
@@ -0,0 +1,227 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Replays messages through both wire formats and reports how much they grow
+// when moving from the old wire format to v1. Usage:
+//
+//     ./inflation_report [options] [capture...]
+//
+// Options:
+//
+//     --generate N     Without captures, generate N messages per struct type of
+//                      `tables.h` (default: 1000).
+//     --max-count N    Maximum number of elements of generated vectors and
+//                      strings (default: 16).
+//     --seed N         Seed of the generator (default: 1).
+//     --save FILE      Also write the generated corpus to the capture FILE.
+//     --rate N         Messages per second, to convert the extra bytes into
+//                      bandwidth (default: 1000000).
+//
+// Messages recorded in v1 are transformed to the old wire format, so that both
+// sizes are always known. For each type, and in aggregate, the report lists the
+// average sizes in both formats, the mean and maximum inflation, how many
+// messages exceed `ZX_CHANNEL_MAX_MSG_BYTES` in v1, and the bandwidth implied at
+// the given message rate: the extra bytes on the wire, and the memory traffic of
+// the transformation itself (reading the source and writing the destination).
+
+#include <lib/fidl/transformer.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "message_generator.h"
+#include "tables_catalog.h"
+
+namespace {
+
+// Transformations never grow messages by more than this.
+constexpr uint32_t kDstCapacity = 16 * ZX_CHANNEL_MAX_MSG_BYTES;
+
+struct Stats {
+  uint64_t messages = 0;
+  uint64_t failures = 0;
+  uint64_t old_bytes = 0;
+  uint64_t v1_bytes = 0;
+  double max_inflation = 0;
+  uint64_t overflows = 0;
+
+  void Add(uint32_t old_num_bytes, uint32_t v1_num_bytes) {
+    messages++;
+    old_bytes += old_num_bytes;
+    v1_bytes += v1_num_bytes;
+    double inflation = old_num_bytes ? static_cast<double>(v1_num_bytes) / old_num_bytes : 1;
+    if (inflation > max_inflation) {
+      max_inflation = inflation;
+    }
+    if (v1_num_bytes > ZX_CHANNEL_MAX_MSG_BYTES) {
+      overflows++;
+    }
+  }
+
+  void Merge(const Stats& other) {
+    messages += other.messages;
+    failures += other.failures;
+    old_bytes += other.old_bytes;
+    v1_bytes += other.v1_bytes;
+    overflows += other.overflows;
+    if (other.max_inflation > max_inflation) {
+      max_inflation = other.max_inflation;
+    }
+  }
+};
+
+const CatalogEntry* FindEntry(const std::string& name) {
+  for (const auto& entry : kCatalog) {
+    if (name == entry.name) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+void Replay(const CatalogEntry& entry, uint32_t wire_format, const uint8_t* bytes,
+            uint32_t num_bytes, uint8_t* dst_bytes, Stats* stats) {
+  const bool from_old = wire_format == kCaptureWireFormatOld;
+  uint32_t dst_num_bytes = 0;
+  const char* error = nullptr;
+  zx_status_t status = fidl_transform(
+      from_old ? FIDL_TRANSFORMATION_OLD_TO_V1 : FIDL_TRANSFORMATION_V1_TO_OLD,
+      from_old ? entry.old_type : entry.v1_type, bytes, num_bytes, dst_bytes, &dst_num_bytes,
+      &error);
+  if (status != ZX_OK) {
+    fprintf(stderr, "%s: transformation failed: %s\n", entry.name, error);
+    stats->failures++;
+    return;
+  }
+  if (from_old) {
+    stats->Add(num_bytes, dst_num_bytes);
+  } else {
+    stats->Add(dst_num_bytes, num_bytes);
+  }
+}
+
+void PrintStats(const char* name, const Stats& stats, double rate) {
+  if (stats.messages == 0) {
+    printf("%-44s %8llu messages, %llu failures\n", name,
+           static_cast<unsigned long long>(stats.messages),
+           static_cast<unsigned long long>(stats.failures));
+    return;
+  }
+  double messages = static_cast<double>(stats.messages);
+  double old_average = static_cast<double>(stats.old_bytes) / messages;
+  double v1_average = static_cast<double>(stats.v1_bytes) / messages;
+  double extra_wire = (v1_average - old_average) * rate / 1e6;
+  double transform_traffic = (v1_average + old_average) * rate / 1e6;
+  printf("%-44s %8llu %9.1f %9.1f x%-6.2f x%-6.2f %7llu %6.2f%% %10.2f %10.2f\n", name,
+         static_cast<unsigned long long>(stats.messages), old_average, v1_average,
+         static_cast<double>(stats.v1_bytes) / static_cast<double>(stats.old_bytes),
+         stats.max_inflation, static_cast<unsigned long long>(stats.overflows),
+         100.0 * static_cast<double>(stats.overflows) / messages, extra_wire, transform_traffic);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t generate = 1000;
+  uint32_t max_count = 16;
+  uint64_t seed = 1;
+  const char* save = nullptr;
+  double rate = 1e6;
+  std::vector<const char*> captures;
+
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--generate") && has_value) {
+      generate = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--max-count") && has_value) {
+      max_count = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--seed") && has_value) {
+      seed = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--save") && has_value) {
+      save = argv[++i];
+    } else if (!strcmp(argv[i], "--rate") && has_value) {
+      rate = strtod(argv[++i], nullptr);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr,
+              "usage: %s [--generate N] [--max-count N] [--seed N] [--save FILE] [--rate N] "
+              "[capture...]\n",
+              argv[0]);
+      return 1;
+    } else {
+      captures.push_back(argv[i]);
+    }
+  }
+
+  std::vector<uint8_t> src_bytes(ZX_CHANNEL_MAX_MSG_BYTES);
+  std::vector<uint8_t> dst_bytes(kDstCapacity);
+  std::map<std::string, Stats> stats_by_type;
+
+  if (captures.empty()) {
+    CaptureWriter writer;
+    if (save && !writer.Open(save)) {
+      perror(save);
+      return 1;
+    }
+    MessageGenerator generator(seed, max_count);
+    for (const auto& entry : kCatalog) {
+      if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+        continue;
+      }
+      Stats& stats = stats_by_type[entry.name];
+      for (uint32_t i = 0; i < generate; i++) {
+        uint32_t num_bytes, num_handles;
+        if (!generator.Generate(entry.old_type, src_bytes.data(), ZX_CHANNEL_MAX_MSG_BYTES,
+                                &num_bytes, &num_handles)) {
+          // The old message alone does not fit in a channel; not representative.
+          continue;
+        }
+        if (save && !writer.Write(kCaptureWireFormatOld, entry.name, src_bytes.data(), num_bytes,
+                                  num_handles)) {
+          perror(save);
+          return 1;
+        }
+        Replay(entry, kCaptureWireFormatOld, src_bytes.data(), num_bytes, dst_bytes.data(),
+               &stats);
+      }
+    }
+  }
+
+  for (const char* path : captures) {
+    CaptureReader reader;
+    if (!reader.Open(path)) {
+      fprintf(stderr, "%s: %s\n", path, reader.error());
+      return 1;
+    }
+    CaptureRecord record;
+    while (reader.Next(&record)) {
+      const CatalogEntry* entry = FindEntry(record.name);
+      if (!entry) {
+        fprintf(stderr, "%s: skipping message of unknown type %s\n", path, record.name.c_str());
+        continue;
+      }
+      Replay(*entry, record.wire_format, record.bytes.data(),
+             static_cast<uint32_t>(record.bytes.size()), dst_bytes.data(),
+             &stats_by_type[record.name]);
+    }
+    if (reader.error()) {
+      fprintf(stderr, "%s: %s\n", path, reader.error());
+      return 1;
+    }
+  }
+
+  printf("%-44s %8s %9s %9s %-7s %-7s %7s %7s %10s %10s\n", "type", "messages", "old avg",
+         "v1 avg", "mean", "max", ">max", "", "+wire MB/s", "xform MB/s");
+  Stats total;
+  for (const auto& type_and_stats : stats_by_type) {
+    PrintStats(type_and_stats.first.c_str(), type_and_stats.second, rate);
+    total.Merge(type_and_stats.second);
+  }
+  PrintStats("(all)", total, rate);
+  return total.failures == 0 ? 0 : 1;
+}
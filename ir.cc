@@ -0,0 +1,1273 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/ir.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct fidl_ir_library {
+  // A field of a declaration, as described by `fidl_ir_describe`.
+  struct Member {
+    uint32_t key;
+    std::string name;
+    uint32_t size;
+    fidl_json_format_t format;
+  };
+
+  struct Declaration {
+    // Coding tables in the old and v1 wire formats.
+    const fidl_type_t* types[2];
+    std::vector<Member> members;
+  };
+
+  std::unique_ptr<uint64_t[]> arena;
+  std::unordered_map<std::string, Declaration> declarations;
+  fidl_ir_stats_t stats;
+};
+
+namespace {
+
+// JSON nested deeper than this is rejected, so that malformed IR cannot exhaust
+// the stack. The IR itself nests types a few levels per FIDL nesting level.
+constexpr uint32_t kMaxDepth = 128;
+
+constexpr uint32_t kFormats = 2;
+constexpr uint32_t kOld = 0;
+constexpr uint32_t kV1 = 1;
+
+struct JsonValue {
+  enum class Kind { kNull, kBool, kNumber, kString, kArray, kObject };
+
+  const JsonValue* Get(const char* key) const {
+    for (const auto& member : members) {
+      if (member.first == key) {
+        return &member.second;
+      }
+    }
+    return nullptr;
+  }
+
+  Kind kind = Kind::kNull;
+  bool boolean = false;
+  // Numbers are only used as unsigned integers. Others (negative, fractional or
+  // larger numbers) are kept as numbers, but not |integer|.
+  uint64_t number = 0;
+  bool integer = false;
+  std::string string;
+  std::vector<JsonValue> elements;
+  std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+class JsonParser final {
+ public:
+  JsonParser(const char* json, uint32_t num_bytes) : cursor_(json), end_(json + num_bytes) {}
+
+  bool Parse(JsonValue* out_value) {
+    if (!ParseValue(out_value, 0)) {
+      return false;
+    }
+    SkipSpace();
+    return cursor_ == end_;
+  }
+
+ private:
+  void SkipSpace() {
+    while (cursor_ != end_ &&
+           (*cursor_ == ' ' || *cursor_ == '\t' || *cursor_ == '\n' || *cursor_ == '\r')) {
+      cursor_++;
+    }
+  }
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (cursor_ == end_ || *cursor_ != c) {
+      return false;
+    }
+    cursor_++;
+    return true;
+  }
+
+  bool ConsumeLiteral(const char* literal) {
+    const size_t size = strlen(literal);
+    if (static_cast<size_t>(end_ - cursor_) < size || memcmp(cursor_, literal, size) != 0) {
+      return false;
+    }
+    cursor_ += size;
+    return true;
+  }
+
+  bool ParseValue(JsonValue* out_value, uint32_t depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    SkipSpace();
+    if (cursor_ == end_) {
+      return false;
+    }
+    switch (*cursor_) {
+      case '{':
+        cursor_++;
+        out_value->kind = JsonValue::Kind::kObject;
+        if (Consume('}')) {
+          return true;
+        }
+        do {
+          std::pair<std::string, JsonValue> member;
+          if (!Consume('"') || !ParseString(&member.first) || !Consume(':') ||
+              !ParseValue(&member.second, depth + 1)) {
+            return false;
+          }
+          out_value->members.push_back(std::move(member));
+        } while (Consume(','));
+        return Consume('}');
+      case '[':
+        cursor_++;
+        out_value->kind = JsonValue::Kind::kArray;
+        if (Consume(']')) {
+          return true;
+        }
+        do {
+          out_value->elements.emplace_back();
+          if (!ParseValue(&out_value->elements.back(), depth + 1)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume(']');
+      case '"':
+        cursor_++;
+        out_value->kind = JsonValue::Kind::kString;
+        return ParseString(&out_value->string);
+      case 't':
+        out_value->kind = JsonValue::Kind::kBool;
+        out_value->boolean = true;
+        return ConsumeLiteral("true");
+      case 'f':
+        out_value->kind = JsonValue::Kind::kBool;
+        return ConsumeLiteral("false");
+      case 'n':
+        return ConsumeLiteral("null");
+      default:
+        return ParseNumber(out_value);
+    }
+  }
+
+  // Parses the rest of a string, after its opening quote.
+  bool ParseString(std::string* out_string) {
+    while (cursor_ != end_) {
+      const char c = *cursor_++;
+      if (c == '"') {
+        return true;
+      }
+      if (static_cast<unsigned char>(c) < 0x20) {
+        return false;
+      }
+      if (c != '\\') {
+        out_string->push_back(c);
+        continue;
+      }
+      if (cursor_ == end_) {
+        return false;
+      }
+      switch (*cursor_++) {
+        case '"':
+          out_string->push_back('"');
+          break;
+        case '\\':
+          out_string->push_back('\\');
+          break;
+        case '/':
+          out_string->push_back('/');
+          break;
+        case 'b':
+          out_string->push_back('\b');
+          break;
+        case 'f':
+          out_string->push_back('\f');
+          break;
+        case 'n':
+          out_string->push_back('\n');
+          break;
+        case 'r':
+          out_string->push_back('\r');
+          break;
+        case 't':
+          out_string->push_back('\t');
+          break;
+        case 'u': {
+          uint32_t code_point;
+          if (!ParseCodeUnit(&code_point)) {
+            return false;
+          }
+          uint32_t low;
+          if (code_point >= 0xd800 && code_point < 0xdc00 && ConsumeLiteral("\\u") &&
+              ParseCodeUnit(&low)) {
+            if (low < 0xdc00 || low >= 0xe000) {
+              return false;
+            }
+            code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+          }
+          AppendUtf8(code_point, out_string);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  bool ParseCodeUnit(uint32_t* out_code_unit) {
+    if (end_ - cursor_ < 4) {
+      return false;
+    }
+    uint32_t code_unit = 0;
+    for (int i = 0; i < 4; i++) {
+      const char c = *cursor_++;
+      uint32_t digit;
+      if (c >= '0' && c <= '9') {
+        digit = static_cast<uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        digit = static_cast<uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        digit = static_cast<uint32_t>(c - 'A' + 10);
+      } else {
+        return false;
+      }
+      code_unit = code_unit << 4 | digit;
+    }
+    *out_code_unit = code_unit;
+    return true;
+  }
+
+  static void AppendUtf8(uint32_t code_point, std::string* out_string) {
+    if (code_point < 0x80) {
+      out_string->push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      out_string->push_back(static_cast<char>(0xc0 | code_point >> 6));
+      out_string->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    } else if (code_point < 0x10000) {
+      out_string->push_back(static_cast<char>(0xe0 | code_point >> 12));
+      out_string->push_back(static_cast<char>(0x80 | (code_point >> 6 & 0x3f)));
+      out_string->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    } else {
+      out_string->push_back(static_cast<char>(0xf0 | code_point >> 18));
+      out_string->push_back(static_cast<char>(0x80 | (code_point >> 12 & 0x3f)));
+      out_string->push_back(static_cast<char>(0x80 | (code_point >> 6 & 0x3f)));
+      out_string->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    }
+  }
+
+  bool ParseNumber(JsonValue* out_value) {
+    out_value->kind = JsonValue::Kind::kNumber;
+    out_value->integer = true;
+    if (cursor_ != end_ && *cursor_ == '-') {
+      out_value->integer = false;
+      cursor_++;
+    }
+    if (!ParseDigits(out_value)) {
+      return false;
+    }
+    if (cursor_ != end_ && *cursor_ == '.') {
+      out_value->integer = false;
+      cursor_++;
+      if (!ParseDigits(nullptr)) {
+        return false;
+      }
+    }
+    if (cursor_ != end_ && (*cursor_ == 'e' || *cursor_ == 'E')) {
+      out_value->integer = false;
+      cursor_++;
+      if (cursor_ != end_ && (*cursor_ == '+' || *cursor_ == '-')) {
+        cursor_++;
+      }
+      if (!ParseDigits(nullptr)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Parses one or more digits, accumulating them into the number of
+  // |out_value| if provided.
+  bool ParseDigits(JsonValue* out_value) {
+    const char* start = cursor_;
+    for (; cursor_ != end_ && *cursor_ >= '0' && *cursor_ <= '9'; cursor_++) {
+      if (out_value == nullptr) {
+        continue;
+      }
+      const uint64_t digit = static_cast<uint64_t>(*cursor_ - '0');
+      if (out_value->number > (UINT64_MAX - digit) / 10) {
+        out_value->integer = false;
+      }
+      out_value->number = out_value->number * 10 + digit;
+    }
+    return cursor_ != start;
+  }
+
+  const char* cursor_;
+  const char* const end_;
+};
+
+struct Primitive {
+  const char* name;
+  uint32_t size;
+  const fidl_type_t* type;
+  fidl_json_format_t format;
+};
+
+const Primitive kPrimitives[] = {
+    {"bool", 1, &fidl::internal::kBoolTable, FIDL_JSON_FORMAT_BOOL},
+    {"int8", 1, &fidl::internal::kInt8Table, FIDL_JSON_FORMAT_SIGNED},
+    {"int16", 2, &fidl::internal::kInt16Table, FIDL_JSON_FORMAT_SIGNED},
+    {"int32", 4, &fidl::internal::kInt32Table, FIDL_JSON_FORMAT_SIGNED},
+    {"int64", 8, &fidl::internal::kInt64Table, FIDL_JSON_FORMAT_SIGNED},
+    {"uint8", 1, &fidl::internal::kUint8Table, FIDL_JSON_FORMAT_UNSIGNED},
+    {"uint16", 2, &fidl::internal::kUint16Table, FIDL_JSON_FORMAT_UNSIGNED},
+    {"uint32", 4, &fidl::internal::kUint32Table, FIDL_JSON_FORMAT_UNSIGNED},
+    {"uint64", 8, &fidl::internal::kUint64Table, FIDL_JSON_FORMAT_UNSIGNED},
+    {"float32", 4, &fidl::internal::kFloat32Table, FIDL_JSON_FORMAT_FLOAT},
+    {"float64", 8, &fidl::internal::kFloat64Table, FIDL_JSON_FORMAT_FLOAT},
+};
+
+// Object types of handle subtypes (see `FidlHandleSubtype`).
+const std::pair<const char*, uint32_t> kHandleSubtypes[] = {
+    {"handle", 0},     {"process", 1},   {"thread", 2},        {"vmo", 3},
+    {"channel", 4},    {"event", 5},     {"port", 6},          {"interrupt", 9},
+    {"pci_device", 11}, {"log", 12},     {"socket", 14},       {"resource", 15},
+    {"eventpair", 16}, {"job", 17},      {"vmar", 18},         {"fifo", 19},
+    {"guest", 20},     {"vcpu", 21},     {"timer", 22},        {"iommu", 23},
+    {"bti", 24},       {"profile", 25},  {"pmt", 26},          {"suspend_token", 27},
+    {"pager", 28},     {"exception", 29},
+};
+
+constexpr uint32_t kChannelSubtype = 4;
+
+enum class NodeKind {
+  kPrimitive,
+  kStruct,
+  kStructPointer,
+  kUnion,
+  kUnionPointer,
+  kXUnion,
+  kTable,
+  kString,
+  kHandle,
+  kVector,
+  kArray,
+};
+
+// A field of a struct, or (with |member| holding its padding, index or ordinal)
+// a variant of a union or xunion, or a field of a table.
+struct FieldPlan {
+  int32_t type;
+  uint32_t offset;
+  uint32_t padding;
+  // Index of the struct member, for `alt_field`, or ordinal.
+  uint32_t member;
+};
+
+// A coding table to be built, referring to others by their index. Primitives
+// refer to their predefined table, and take no room in the arena.
+struct Node {
+  NodeKind kind = NodeKind::kPrimitive;
+  uint32_t format = 0;
+  const fidl_type_t* primitive = nullptr;
+  // Index of the name, for declarations.
+  uint32_t name = 0;
+  bool nullable = false;
+  bool strict = false;
+  // Size of structs, unions and arrays, maximum size of strings and vectors,
+  // and subtype of handles.
+  uint32_t size = 0;
+  // Data offset of unions, and element size of arrays and vectors.
+  uint32_t data_offset = 0;
+  // Element, or pointed-to declaration. Nullable xunions share the fields of
+  // the xunion they refer to.
+  int32_t target = -1;
+  int32_t alt = -1;
+  std::vector<FieldPlan> fields;
+
+  // Placement of the table and of its fields in the arena.
+  size_t type_offset = 0;
+  size_t fields_offset = 0;
+};
+
+class Loader final {
+ public:
+  explicit Loader(fidl_ir_library* library) : library_(library) {}
+
+  bool Load(const JsonValue& ir) {
+    if (ir.kind != JsonValue::Kind::kObject) {
+      return Fail("IR is not an object");
+    }
+    const JsonValue* order = ir.Get("declaration_order");
+    if (!Declare(ir, "struct_declarations", NodeKind::kStruct) ||
+        !Declare(ir, "union_declarations", NodeKind::kUnion) ||
+        !Declare(ir, "xunion_declarations", NodeKind::kXUnion) ||
+        !Declare(ir, "table_declarations", NodeKind::kTable) ||
+        !DeclarePrimitives(ir, "enum_declarations") ||
+        !DeclarePrimitives(ir, "bits_declarations") || !DeclareProtocols(ir)) {
+      return false;
+    }
+    if (order == nullptr || order->kind != JsonValue::Kind::kArray) {
+      return Fail("IR has no declaration order");
+    }
+    // Coding tables of declarations are created first, in declaration order, so
+    // that they are laid out in that order, and can be referred to before their
+    // fields are compiled.
+    for (const auto& name : order->elements) {
+      auto it = decls_.find(name.string);
+      if (it == decls_.end()) {
+        continue;
+      }
+      Decl& decl = it->second;
+      const uint32_t name_index = static_cast<uint32_t>(names_.size());
+      names_.push_back(&name.string);
+      for (uint32_t format = 0; format < kFormats; format++) {
+        Node node;
+        node.kind = decl.kind;
+        node.format = format;
+        node.name = name_index;
+        decl.nodes[format] = AddNode(std::move(node));
+      }
+      if (decl.kind == NodeKind::kStruct || decl.kind == NodeKind::kUnion) {
+        nodes_[static_cast<size_t>(decl.nodes[kOld])].alt = decl.nodes[kV1];
+        nodes_[static_cast<size_t>(decl.nodes[kV1])].alt = decl.nodes[kOld];
+      }
+      declared_.push_back(&decl);
+    }
+    for (Decl* decl : declared_) {
+      if (!Compile(decl)) {
+        return false;
+      }
+    }
+    return Build();
+  }
+
+  const char* error() const { return error_; }
+
+ private:
+  struct Decl {
+    NodeKind kind;
+    const JsonValue* json;
+    int32_t nodes[kFormats];
+    const std::string* name;
+  };
+
+  bool Fail(const char* error) {
+    error_ = error;
+    return false;
+  }
+
+  bool Declare(const JsonValue& ir, const char* key, NodeKind kind) {
+    const JsonValue* declarations = ir.Get(key);
+    if (declarations == nullptr) {
+      return true;
+    }
+    if (declarations->kind != JsonValue::Kind::kArray) {
+      return Fail("declarations are not an array");
+    }
+    for (const auto& declaration : declarations->elements) {
+      const JsonValue* name = declaration.Get("name");
+      if (name == nullptr || name->kind != JsonValue::Kind::kString) {
+        return Fail("declaration has no name");
+      }
+      Decl decl = {};
+      decl.kind = kind;
+      decl.json = &declaration;
+      decl.nodes[kOld] = decl.nodes[kV1] = -1;
+      decl.name = &name->string;
+      if (!decls_.emplace(name->string, decl).second) {
+        return Fail("declaration is duplicated");
+      }
+    }
+    return true;
+  }
+
+  // Enums and bits are coded as their underlying primitive.
+  bool DeclarePrimitives(const JsonValue& ir, const char* key) {
+    const JsonValue* declarations = ir.Get(key);
+    if (declarations == nullptr) {
+      return true;
+    }
+    for (const auto& declaration : declarations->elements) {
+      const JsonValue* name = declaration.Get("name");
+      const JsonValue* type = declaration.Get("type");
+      const Primitive* primitive;
+      if (name == nullptr || type == nullptr ||
+          !FindPrimitive(type->kind == JsonValue::Kind::kObject ? type->Get("subtype") : type,
+                         &primitive)) {
+        return Fail("enum or bits declaration has no underlying primitive");
+      }
+      primitives_[name->string] = primitive;
+    }
+    return true;
+  }
+
+  bool DeclareProtocols(const JsonValue& ir) {
+    const JsonValue* declarations = ir.Get("interface_declarations");
+    if (declarations == nullptr) {
+      return true;
+    }
+    for (const auto& declaration : declarations->elements) {
+      const JsonValue* name = declaration.Get("name");
+      if (name == nullptr) {
+        return Fail("protocol declaration has no name");
+      }
+      primitives_[name->string] = nullptr;
+    }
+    return true;
+  }
+
+  bool FindPrimitive(const JsonValue* subtype, const Primitive** out_primitive) {
+    if (subtype == nullptr) {
+      return false;
+    }
+    for (const auto& primitive : kPrimitives) {
+      if (subtype->string == primitive.name) {
+        *out_primitive = &primitive;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool GetUint32(const JsonValue& object, const char* key, uint32_t* out_value) {
+    const JsonValue* value = object.Get(key);
+    if (value == nullptr || !value->integer || value->number > UINT32_MAX) {
+      error_ = "IR is missing a size, offset or ordinal";
+      return false;
+    }
+    *out_value = static_cast<uint32_t>(value->number);
+    return true;
+  }
+
+  bool GetShape(const JsonValue& object, const char* key, uint32_t format, const char* field,
+                uint32_t* out_value) {
+    const std::string shape = std::string(key) + (format == kOld ? "_old" : "_v1");
+    const JsonValue* value = object.Get(shape.c_str());
+    if (value == nullptr) {
+      return Fail("IR has no old and v1 type shapes");
+    }
+    return GetUint32(*value, field, out_value);
+  }
+
+  bool IsReserved(const JsonValue& member) {
+    const JsonValue* reserved = member.Get("reserved");
+    return reserved != nullptr && reserved->boolean;
+  }
+
+  int32_t AddNode(Node node) {
+    nodes_.push_back(std::move(node));
+    return static_cast<int32_t>(nodes_.size() - 1);
+  }
+
+  // Returns the index of the node interned as |key|, adding |node| if there is
+  // none.
+  int32_t Intern(const std::string& key, Node node) {
+    auto it = interned_.find(key);
+    if (it != interned_.end()) {
+      return it->second;
+    }
+    const int32_t index = AddNode(std::move(node));
+    interned_.emplace(key, index);
+    return index;
+  }
+
+  int32_t InternPrimitive(const Primitive* primitive) {
+    Node node;
+    node.kind = NodeKind::kPrimitive;
+    node.primitive = primitive->type;
+    return Intern(primitive->name, std::move(node));
+  }
+
+  int32_t InternHandle(uint32_t format, uint32_t subtype, bool nullable) {
+    Node node;
+    node.kind = NodeKind::kHandle;
+    node.format = format;
+    node.size = subtype;
+    node.nullable = nullable;
+    return Intern(
+        std::to_string(format) + "h" + std::to_string(subtype) + (nullable ? "?" : ""),
+        std::move(node));
+  }
+
+  static std::string Key(uint32_t format, const char* kind, int32_t target) {
+    return std::to_string(format) + kind + std::to_string(target);
+  }
+
+  bool Nullable(const JsonValue& type) {
+    const JsonValue* nullable = type.Get("nullable");
+    return nullable != nullptr && nullable->boolean;
+  }
+
+  // Stores into |out_size| the inline size of objects of |type|.
+  bool InlineSize(const JsonValue& type, uint32_t format, uint32_t* out_size) {
+    const JsonValue* kind = type.Get("kind");
+    if (kind == nullptr) {
+      return Fail("type has no kind");
+    }
+    if (kind->string == "primitive") {
+      const Primitive* primitive;
+      if (!FindPrimitive(type.Get("subtype"), &primitive)) {
+        return Fail("unknown primitive");
+      }
+      *out_size = primitive->size;
+      return true;
+    }
+    if (kind->string == "string" || kind->string == "vector") {
+      *out_size = 16;
+      return true;
+    }
+    if (kind->string == "handle" || kind->string == "request") {
+      *out_size = 4;
+      return true;
+    }
+    if (kind->string == "array") {
+      const JsonValue* element_type = type.Get("element_type");
+      uint32_t count, element_size;
+      if (element_type == nullptr || !GetUint32(type, "element_count", &count) ||
+          !InlineSize(*element_type, format, &element_size)) {
+        return false;
+      }
+      *out_size = count * element_size;
+      return true;
+    }
+    if (kind->string != "identifier") {
+      return Fail("unknown type kind");
+    }
+    const JsonValue* identifier = type.Get("identifier");
+    if (identifier == nullptr) {
+      return Fail("type has no identifier");
+    }
+    auto primitive = primitives_.find(identifier->string);
+    if (primitive != primitives_.end()) {
+      *out_size = primitive->second != nullptr ? primitive->second->size : 4;
+      return true;
+    }
+    auto it = decls_.find(identifier->string);
+    if (it == decls_.end()) {
+      return Fail("unknown identifier (dependencies are not supported)");
+    }
+    if (Nullable(type)) {
+      switch (it->second.kind) {
+        case NodeKind::kStruct:
+          *out_size = 8;
+          return true;
+        case NodeKind::kUnion:
+          *out_size = format == kOld ? 8 : 24;
+          return true;
+        default:
+          break;
+      }
+    }
+    return GetShape(*it->second.json, "type_shape", format, "inline_size", out_size);
+  }
+
+  // Stores into |out_node| the node of the coding table of |type| in |format|,
+  // or -1 if it has none. Primitives only have coding tables in envelopes.
+  bool Compile(const JsonValue& type, uint32_t format, bool envelope, int32_t* out_node) {
+    *out_node = -1;
+    const JsonValue* kind = type.Get("kind");
+    if (kind == nullptr) {
+      return Fail("type has no kind");
+    }
+    if (kind->string == "primitive") {
+      const Primitive* primitive;
+      if (!FindPrimitive(type.Get("subtype"), &primitive)) {
+        return Fail("unknown primitive");
+      }
+      if (envelope) {
+        *out_node = InternPrimitive(primitive);
+      }
+      return true;
+    }
+    if (kind->string == "string") {
+      uint32_t max_size = UINT32_MAX;
+      if (type.Get("maybe_element_count") != nullptr &&
+          !GetUint32(type, "maybe_element_count", &max_size)) {
+        return false;
+      }
+      Node node;
+      node.kind = NodeKind::kString;
+      node.format = format;
+      node.size = max_size;
+      node.nullable = Nullable(type);
+      *out_node = Intern(std::to_string(format) + "s" + std::to_string(max_size) +
+                             (node.nullable ? "?" : ""),
+                         std::move(node));
+      return true;
+    }
+    if (kind->string == "handle") {
+      const JsonValue* subtype = type.Get("subtype");
+      for (const auto& handle_subtype : kHandleSubtypes) {
+        if (subtype != nullptr && subtype->string == handle_subtype.first) {
+          *out_node = InternHandle(format, handle_subtype.second, Nullable(type));
+          return true;
+        }
+      }
+      return Fail("unknown handle subtype");
+    }
+    if (kind->string == "request") {
+      *out_node = InternHandle(format, kChannelSubtype, Nullable(type));
+      return true;
+    }
+    if (kind->string == "vector" || kind->string == "array") {
+      return CompileSequence(type, kind->string == "vector", format, envelope, out_node);
+    }
+    if (kind->string != "identifier") {
+      return Fail("unknown type kind");
+    }
+    const JsonValue* identifier = type.Get("identifier");
+    if (identifier == nullptr) {
+      return Fail("type has no identifier");
+    }
+    auto primitive = primitives_.find(identifier->string);
+    if (primitive != primitives_.end()) {
+      if (primitive->second == nullptr) {
+        *out_node = InternHandle(format, kChannelSubtype, Nullable(type));
+      } else if (envelope) {
+        *out_node = InternPrimitive(primitive->second);
+      }
+      return true;
+    }
+    auto it = decls_.find(identifier->string);
+    if (it == decls_.end()) {
+      return Fail("unknown identifier (dependencies are not supported)");
+    }
+    const Decl& decl = it->second;
+    const int32_t target = decl.nodes[format];
+    if (target == -1) {
+      return Fail("declaration is missing from the declaration order");
+    }
+    if (!Nullable(type) || decl.kind == NodeKind::kTable) {
+      *out_node = target;
+      return true;
+    }
+    Node node;
+    node.format = format;
+    node.target = target;
+    switch (decl.kind) {
+      case NodeKind::kStruct:
+        node.kind = NodeKind::kStructPointer;
+        *out_node = Intern(Key(format, "sp", target), std::move(node));
+        return true;
+      case NodeKind::kUnion:
+        node.kind = NodeKind::kUnionPointer;
+        *out_node = Intern(Key(format, "up", target), std::move(node));
+        return true;
+      default:
+        node.kind = NodeKind::kXUnion;
+        node.name = nodes_[static_cast<size_t>(target)].name;
+        node.nullable = true;
+        *out_node = Intern(Key(format, "x?", target), std::move(node));
+        return true;
+    }
+  }
+
+  bool CompileSequence(const JsonValue& type, bool vector, uint32_t format, bool envelope,
+                       int32_t* out_node) {
+    const JsonValue* element_type = type.Get("element_type");
+    if (element_type == nullptr) {
+      return Fail("vector or array has no element type");
+    }
+    int32_t element;
+    uint32_t element_size;
+    if (!Compile(*element_type, format, envelope && !vector, &element) ||
+        !InlineSize(*element_type, format, &element_size)) {
+      return false;
+    }
+    Node node;
+    node.format = format;
+    node.target = element;
+    node.data_offset = element_size;
+    const std::string element_key =
+        std::to_string(element) + ":" + std::to_string(element_size);
+    if (vector) {
+      uint32_t max_count = UINT32_MAX;
+      if (type.Get("maybe_element_count") != nullptr &&
+          !GetUint32(type, "maybe_element_count", &max_count)) {
+        return false;
+      }
+      node.kind = NodeKind::kVector;
+      node.size = max_count;
+      node.nullable = Nullable(type);
+      *out_node = Intern(std::to_string(format) + "v" + std::to_string(max_count) +
+                             (node.nullable ? "?" : "") + element_key,
+                         std::move(node));
+      return true;
+    }
+    uint32_t count;
+    if (!GetUint32(type, "element_count", &count)) {
+      return false;
+    }
+    // Arrays of objects without coding tables have none either.
+    if (element == -1) {
+      return true;
+    }
+    node.kind = NodeKind::kArray;
+    node.size = count * element_size;
+    *out_node = Intern(std::to_string(format) + "a" + std::to_string(count) + element_key,
+                       std::move(node));
+    return true;
+  }
+
+  // Compiles |type| in both wire formats, linking vectors and arrays (and
+  // their elements) to their counterpart in the other wire format.
+  bool CompileBoth(const JsonValue& type, bool envelope, int32_t* out_nodes) {
+    if (!Compile(type, kOld, envelope, &out_nodes[kOld]) ||
+        !Compile(type, kV1, envelope, &out_nodes[kV1])) {
+      return false;
+    }
+    Link(out_nodes[kOld], out_nodes[kV1]);
+    return true;
+  }
+
+  void Link(int32_t old_node, int32_t v1_node) {
+    if (old_node == -1 || v1_node == -1) {
+      return;
+    }
+    Node& old_type = nodes_[static_cast<size_t>(old_node)];
+    Node& v1_type = nodes_[static_cast<size_t>(v1_node)];
+    if ((old_type.kind != NodeKind::kVector && old_type.kind != NodeKind::kArray) ||
+        old_type.alt != -1) {
+      return;
+    }
+    old_type.alt = v1_node;
+    v1_type.alt = old_node;
+    Link(old_type.target, v1_type.target);
+  }
+
+  bool Compile(Decl* decl) {
+    const JsonValue* members = decl->json->Get("members");
+    if (members == nullptr || members->kind != JsonValue::Kind::kArray) {
+      return Fail("declaration has no members");
+    }
+    fidl_ir_library::Declaration& declaration = library_->declarations[*decl->name];
+    declaration.types[kOld] = declaration.types[kV1] = nullptr;
+    Node* nodes[kFormats];
+    std::vector<const JsonValue*> compiled;
+    for (const auto& member : members->elements) {
+      if (!IsReserved(member)) {
+        compiled.push_back(&member);
+      }
+    }
+    if (decl->kind == NodeKind::kTable) {
+      std::vector<std::pair<uint32_t, const JsonValue*>> ordered;
+      for (const JsonValue* member : compiled) {
+        uint32_t ordinal;
+        if (!GetUint32(*member, "ordinal", &ordinal)) {
+          return false;
+        }
+        ordered.emplace_back(ordinal, member);
+      }
+      std::stable_sort(ordered.begin(), ordered.end(),
+                       [](const std::pair<uint32_t, const JsonValue*>& a,
+                          const std::pair<uint32_t, const JsonValue*>& b) {
+                         return a.first < b.first;
+                       });
+      for (size_t i = 0; i < ordered.size(); i++) {
+        compiled[i] = ordered[i].second;
+      }
+    }
+    uint32_t union_sizes[kFormats] = {0, 24};
+    uint32_t data_offsets[kFormats] = {0, 8};
+    if (decl->kind == NodeKind::kUnion) {
+      if (!GetShape(*decl->json, "type_shape", kOld, "inline_size", &union_sizes[kOld]) ||
+          !GetShape(*decl->json, "type_shape", kOld, "alignment", &data_offsets[kOld])) {
+        return false;
+      }
+      // The tag is followed by the data, at the alignment of the union.
+      data_offsets[kOld] = std::max(data_offsets[kOld], 4u);
+    }
+    for (uint32_t format = 0; format < kFormats; format++) {
+      Node& node = nodes_[static_cast<size_t>(decl->nodes[format])];
+      if (decl->kind == NodeKind::kStruct) {
+        if (!GetShape(*decl->json, "type_shape", format, "inline_size", &node.size)) {
+          return false;
+        }
+      } else if (decl->kind == NodeKind::kUnion) {
+        node.size = union_sizes[format];
+        node.data_offset = data_offsets[format];
+      } else if (decl->kind == NodeKind::kXUnion) {
+        const JsonValue* strict = decl->json->Get("strict");
+        node.strict = strict != nullptr && strict->boolean;
+      }
+    }
+    for (uint32_t index = 0; index < compiled.size(); index++) {
+      const JsonValue& member = *compiled[index];
+      const JsonValue* type = member.Get("type");
+      if (type == nullptr) {
+        return Fail("member has no type");
+      }
+      int32_t types[kFormats];
+      if (!CompileBoth(*type, decl->kind == NodeKind::kXUnion || decl->kind == NodeKind::kTable,
+                       types)) {
+        return false;
+      }
+      fidl_ir_library::Member described;
+      if (!Describe(member, *type, decl->kind, index, &described)) {
+        return false;
+      }
+      for (uint32_t format = 0; format < kFormats; format++) {
+        nodes[format] = &nodes_[static_cast<size_t>(decl->nodes[format])];
+        uint32_t size;
+        if (!InlineSize(*type, format, &size)) {
+          return false;
+        }
+        FieldPlan field = {};
+        field.type = types[format];
+        switch (decl->kind) {
+          case NodeKind::kStruct: {
+            uint32_t padding;
+            if (!GetShape(member, "field_shape", format, "offset", &field.offset) ||
+                !GetShape(member, "field_shape", format, "padding", &padding)) {
+              return false;
+            }
+            field.padding = padding;
+            field.member = index;
+            if (field.type == -1) {
+              // Members without coding tables are only listed for their padding.
+              if (padding == 0) {
+                continue;
+              }
+              field.offset += size;
+            }
+            break;
+          }
+          case NodeKind::kUnion: {
+            // Variants are inline in the old wire format, and in envelopes
+            // in the v1 wire format.
+            if (format == kOld) {
+              const uint32_t end = nodes[format]->data_offset + size;
+              if (end > nodes[format]->size) {
+                return Fail("union variant does not fit in the union");
+              }
+              field.padding = nodes[format]->size - end;
+            } else {
+              field.padding = (8 - size % 8) % 8;
+            }
+            if (!GetUint32(member, "xunion_ordinal", &field.member)) {
+              return false;
+            }
+            break;
+          }
+          default:
+            if (!GetUint32(member, "ordinal", &field.member)) {
+              return false;
+            }
+            break;
+        }
+        nodes[format]->fields.push_back(field);
+      }
+      declaration.members.push_back(std::move(described));
+    }
+    return true;
+  }
+
+  // Describes |member| of a declaration of |kind|, the |index|-th one which is
+  // not reserved.
+  bool Describe(const JsonValue& member, const JsonValue& type, NodeKind kind, uint32_t index,
+                fidl_ir_library::Member* out_member) {
+    const JsonValue* name = member.Get("name");
+    if (name == nullptr) {
+      return Fail("member has no name");
+    }
+    out_member->name = name->string;
+    out_member->size = 0;
+    out_member->format = FIDL_JSON_FORMAT_HEX;
+    switch (kind) {
+      case NodeKind::kStruct:
+        if (!GetShape(member, "field_shape", kOld, "offset", &out_member->key)) {
+          return false;
+        }
+        break;
+      case NodeKind::kUnion:
+        out_member->key = index;
+        break;
+      default:
+        if (!GetUint32(member, "ordinal", &out_member->key)) {
+          return false;
+        }
+        break;
+    }
+    const JsonValue* kind_name = type.Get("kind");
+    const Primitive* primitive = nullptr;
+    if (kind_name->string == "primitive") {
+      FindPrimitive(type.Get("subtype"), &primitive);
+    } else if (kind_name->string == "identifier") {
+      auto it = primitives_.find(type.Get("identifier")->string);
+      if (it != primitives_.end()) {
+        primitive = it->second;
+      }
+    } else if (kind_name->string == "array") {
+      return InlineSize(type, kOld, &out_member->size);
+    }
+    if (primitive != nullptr) {
+      out_member->size = primitive->size;
+      out_member->format = primitive->format;
+    }
+    return true;
+  }
+
+  // Lays out the coding tables in the arena, and builds them there.
+  bool Build() {
+    size_t size = 0;
+    uint32_t num_types = 0;
+    for (auto& node : nodes_) {
+      if (node.kind != NodeKind::kPrimitive) {
+        node.type_offset = size;
+        size += sizeof(fidl_type_t);
+        num_types++;
+      }
+    }
+    static_assert(alignof(fidl_type_t) <= alignof(uint64_t), "arena is under-aligned");
+    static_assert(alignof(fidl::FidlStructField) <= alignof(uint64_t), "arena is under-aligned");
+    for (auto& node : nodes_) {
+      node.fields_offset = size;
+      size_t field_size;
+      switch (node.kind) {
+        case NodeKind::kStruct:
+          field_size = sizeof(fidl::FidlStructField);
+          break;
+        case NodeKind::kUnion:
+          field_size = sizeof(fidl::FidlUnionField);
+          break;
+        case NodeKind::kXUnion:
+          field_size = sizeof(fidl::FidlXUnionField);
+          break;
+        case NodeKind::kTable:
+          field_size = sizeof(fidl::FidlTableField);
+          break;
+        default:
+          continue;
+      }
+      size = Align(size + node.fields.size() * field_size);
+    }
+    std::vector<size_t> name_offsets;
+    for (const std::string* name : names_) {
+      name_offsets.push_back(size);
+      size += name->size() + 1;
+    }
+    size = Align(size);
+    if (size > UINT32_MAX) {
+      return Fail("IR is too large");
+    }
+
+    library_->arena.reset(new uint64_t[size / sizeof(uint64_t)]);
+    arena_ = reinterpret_cast<char*>(library_->arena.get());
+    for (size_t i = 0; i < names_.size(); i++) {
+      memcpy(&arena_[name_offsets[i]], names_[i]->c_str(), names_[i]->size() + 1);
+    }
+    for (auto& node : nodes_) {
+      const char* name = names_.empty() ? nullptr : &arena_[name_offsets[node.name]];
+      switch (node.kind) {
+        case NodeKind::kPrimitive:
+          break;
+        case NodeKind::kStruct: {
+          const Node* alt = &nodes_[static_cast<size_t>(node.alt)];
+          auto fields = reinterpret_cast<fidl::FidlStructField*>(&arena_[node.fields_offset]);
+          auto alt_fields = reinterpret_cast<const fidl::FidlStructField*>(
+              &arena_[alt->fields_offset]);
+          for (size_t i = 0; i < node.fields.size(); i++) {
+            const FieldPlan& field = node.fields[i];
+            const fidl::FidlStructField* alt_field = nullptr;
+            for (size_t j = 0; field.type != -1 && j < alt->fields.size(); j++) {
+              if (alt->fields[j].type != -1 && alt->fields[j].member == field.member) {
+                alt_field = &alt_fields[j];
+              }
+            }
+            new (&fields[i]) fidl::FidlStructField(Type(field.type), field.offset,
+                                                   static_cast<uint8_t>(field.padding),
+                                                   alt_field);
+          }
+          new (Place(node)) fidl_type_t(fidl::FidlCodedStruct(
+              fields, Count(node), node.size, name, &Type(node.alt)->coded_struct));
+          break;
+        }
+        case NodeKind::kStructPointer:
+          new (Place(node))
+              fidl_type_t(fidl::FidlCodedStructPointer(&Type(node.target)->coded_struct));
+          break;
+        case NodeKind::kUnion: {
+          auto fields = reinterpret_cast<fidl::FidlUnionField*>(&arena_[node.fields_offset]);
+          for (size_t i = 0; i < node.fields.size(); i++) {
+            const FieldPlan& field = node.fields[i];
+            new (&fields[i]) fidl::FidlUnionField(Type(field.type), field.padding, field.member);
+          }
+          new (Place(node)) fidl_type_t(fidl::FidlCodedUnion(fields, Count(node), node.data_offset,
+                                                             node.size, name,
+                                                             &Type(node.alt)->coded_union));
+          break;
+        }
+        case NodeKind::kUnionPointer:
+          new (Place(node))
+              fidl_type_t(fidl::FidlCodedUnionPointer(&Type(node.target)->coded_union));
+          break;
+        case NodeKind::kXUnion: {
+          // Nullable xunions share the fields of the xunion they refer to.
+          const Node& fields_node =
+              node.target == -1 ? node : nodes_[static_cast<size_t>(node.target)];
+          auto fields =
+              reinterpret_cast<fidl::FidlXUnionField*>(&arena_[fields_node.fields_offset]);
+          for (size_t i = 0; node.target == -1 && i < node.fields.size(); i++) {
+            new (&fields[i])
+                fidl::FidlXUnionField(Type(node.fields[i].type), node.fields[i].member);
+          }
+          new (Place(node)) fidl_type_t(fidl::FidlCodedXUnion(
+              Count(fields_node), fields, node.nullable ? fidl::kNullable : fidl::kNonnullable,
+              name, fields_node.strict ? fidl::kStrict : fidl::kFlexible));
+          break;
+        }
+        case NodeKind::kTable: {
+          auto fields = reinterpret_cast<fidl::FidlTableField*>(&arena_[node.fields_offset]);
+          for (size_t i = 0; i < node.fields.size(); i++) {
+            new (&fields[i]) fidl::FidlTableField(Type(node.fields[i].type), node.fields[i].member);
+          }
+          new (Place(node)) fidl_type_t(fidl::FidlCodedTable(fields, Count(node), name));
+          break;
+        }
+        case NodeKind::kString:
+          new (Place(node)) fidl_type_t(fidl::FidlCodedString(
+              node.size, node.nullable ? fidl::kNullable : fidl::kNonnullable));
+          break;
+        case NodeKind::kHandle:
+          new (Place(node)) fidl_type_t(fidl::FidlCodedHandle(
+              node.size, node.nullable ? fidl::kNullable : fidl::kNonnullable));
+          break;
+        case NodeKind::kVector:
+          new (Place(node)) fidl_type_t(fidl::FidlCodedVector(
+              Type(node.target), node.size, node.data_offset,
+              node.nullable ? fidl::kNullable : fidl::kNonnullable,
+              node.alt == -1 ? nullptr : &Type(node.alt)->coded_vector));
+          break;
+        case NodeKind::kArray:
+          new (Place(node)) fidl_type_t(
+              fidl::FidlCodedArray(Type(node.target), node.size, node.data_offset,
+                                   node.alt == -1 ? nullptr : &Type(node.alt)->coded_array));
+          break;
+      }
+    }
+    for (const Decl* decl : declared_) {
+      fidl_ir_library::Declaration& declaration = library_->declarations[*decl->name];
+      for (uint32_t format = 0; format < kFormats; format++) {
+        declaration.types[format] = Type(decl->nodes[format]);
+      }
+    }
+    library_->stats.num_declarations = static_cast<uint32_t>(declared_.size());
+    library_->stats.num_types = num_types;
+    library_->stats.arena_size = static_cast<uint32_t>(size);
+    return true;
+  }
+
+  static size_t Align(size_t size) {
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  }
+
+  void* Place(const Node& node) { return &arena_[node.type_offset]; }
+
+  static uint32_t Count(const Node& node) { return static_cast<uint32_t>(node.fields.size()); }
+
+  // The coding table of |node| (which may not be built yet), or null for -1.
+  const fidl_type_t* Type(int32_t node) const {
+    if (node == -1) {
+      return nullptr;
+    }
+    const Node& type = nodes_[static_cast<size_t>(node)];
+    if (type.kind == NodeKind::kPrimitive) {
+      return type.primitive;
+    }
+    return reinterpret_cast<const fidl_type_t*>(&arena_[type.type_offset]);
+  }
+
+  fidl_ir_library* const library_;
+  const char* error_ = nullptr;
+
+  std::unordered_map<std::string, Decl> decls_;
+  // Enums and bits (by their underlying primitive), and protocols (null).
+  std::unordered_map<std::string, const Primitive*> primitives_;
+  std::vector<Decl*> declared_;
+  std::vector<const std::string*> names_;
+  std::vector<Node> nodes_;
+  std::unordered_map<std::string, int32_t> interned_;
+  char* arena_ = nullptr;
+};
+
+}  // namespace
+
+zx_status_t fidl_ir_load(const char* json, uint32_t num_bytes, fidl_ir_library_t** out_library,
+                         const char** out_error_msg) {
+  auto set_error = [out_error_msg](const char* msg) {
+    if (out_error_msg)
+      *out_error_msg = msg;
+  };
+  if (json == nullptr || out_library == nullptr) {
+    set_error("json and out_library must be non-null");
+    return ZX_ERR_INVALID_ARGS;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  JsonValue ir;
+  if (!JsonParser(json, num_bytes).Parse(&ir)) {
+    set_error("malformed JSON");
+    return ZX_ERR_INVALID_ARGS;
+  }
+  std::unique_ptr<fidl_ir_library> library(new fidl_ir_library());
+  Loader loader(library.get());
+  if (!loader.Load(ir)) {
+    set_error(loader.error());
+    return ZX_ERR_INVALID_ARGS;
+  }
+  library->stats.load_ns = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                           start)
+          .count());
+  *out_library = library.release();
+  return ZX_OK;
+}
+
+zx_status_t fidl_ir_lookup(const fidl_ir_library_t* library, fidl_wire_format_t wire_format,
+                           const char* name, const fidl_type_t** out_type) {
+  if (wire_format != FIDL_WIRE_FORMAT_OLD && wire_format != FIDL_WIRE_FORMAT_V1) {
+    return ZX_ERR_INVALID_ARGS;
+  }
+  auto it = library->declarations.find(name);
+  if (it == library->declarations.end()) {
+    return ZX_ERR_NOT_FOUND;
+  }
+  *out_type = it->second.types[wire_format == FIDL_WIRE_FORMAT_OLD ? kOld : kV1];
+  return ZX_OK;
+}
+
+void fidl_ir_stats(const fidl_ir_library_t* library, fidl_ir_stats_t* out_stats) {
+  *out_stats = library->stats;
+}
+
+bool fidl_ir_describe(void* context, const char* type_name, uint32_t key,
+                      fidl_json_field_t* out_field) {
+  const auto library = static_cast<const fidl_ir_library_t*>(context);
+  auto it = library->declarations.find(type_name);
+  if (it == library->declarations.end()) {
+    return false;
+  }
+  for (const auto& member : it->second.members) {
+    if (member.key == key) {
+      out_field->name = member.name.c_str();
+      out_field->size = member.size;
+      out_field->format = member.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+void fidl_ir_free(fidl_ir_library_t* library) { delete library; }
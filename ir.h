@@ -0,0 +1,77 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_IR_H_
+#define LIB_FIDL_IR_H_
+
+#include "fidl.h"
+#include "json.h"
+
+// __BEGIN_CDECLS
+
+// Coding tables can be loaded at runtime from the JSON IR of a library (as
+// written by `fidlc --json`), instead of being generated and compiled in, so
+// that new types can be transformed without relinking.
+//
+// A library is loaded in a single pass over its IR, which builds the coding
+// tables of all of its structs, unions, xunions and tables in both the old and
+// v1 wire formats, as `fidlc` would generate them: with the same fields, sizes
+// and paddings, `alt_type` and `alt_field` links between the two wire formats,
+// and the predefined primitive tables of `fidl::internal` (e.g.
+// `fidl::internal::kUint32Table`) for primitives in envelopes. Strings,
+// vectors, arrays, handles and pointers are interned, so that each is built
+// once per wire format however many fields use it.
+//
+// All the tables of a library (with their fields and names) are allocated in a
+// single contiguous arena, in declaration order, and are only read once
+// loaded. They transform messages as fast as compiled-in tables.
+//
+// Only libraries without dependencies are supported. Enums and bits are
+// coded as their underlying primitive (their values are not validated), and
+// protocols and protocol requests as channel handles.
+
+typedef struct fidl_ir_library fidl_ir_library_t;
+
+typedef struct {
+  // Number of declarations loaded, and of coding tables built for them (in
+  // both wire formats, including interned ones).
+  uint32_t num_declarations;
+  uint32_t num_types;
+  // Size of the arena holding the coding tables, their fields and names.
+  uint32_t arena_size;
+  // Time taken to parse the IR and build the coding tables.
+  uint64_t load_ns;
+} fidl_ir_stats_t;
+
+// Loads the |num_bytes| bytes of JSON IR |json| into |out_library|, which must
+// be freed with `fidl_ir_free`.
+//
+// Returns `ZX_OK` upon success. Upon failure (and if provided) writes an error
+// message to |out_error_msg|, and returns `ZX_ERR_INVALID_ARGS` if |json| is
+// not valid JSON IR (including IR without old and v1 type shapes, written by
+// older versions of `fidlc`), or refers to declarations of other libraries.
+zx_status_t fidl_ir_load(const char* json, uint32_t num_bytes, fidl_ir_library_t** out_library,
+                         const char** out_error_msg);
+
+// Stores into |out_type| the coding table, in |wire_format|, of the struct,
+// union, xunion or table of |library| named |name| (its fully qualified name,
+// e.g. "example/Sandwich1"). Returns `ZX_ERR_NOT_FOUND` if there is none, and
+// `ZX_ERR_INVALID_ARGS` if |wire_format| is neither old nor v1.
+zx_status_t fidl_ir_lookup(const fidl_ir_library_t* library, fidl_wire_format_t wire_format,
+                           const char* name, const fidl_type_t** out_type);
+
+// Stores the statistics of |library| into |out_stats|.
+void fidl_ir_stats(const fidl_ir_library_t* library, fidl_ir_stats_t* out_stats);
+
+// Describes the fields of the types of |library| from their names and types in
+// the IR, as a `fidl_json_describe_t` taking the library as |context|.
+bool fidl_ir_describe(void* context, const char* type_name, uint32_t key,
+                      fidl_json_field_t* out_field);
+
+// Frees |library| and its coding tables.
+void fidl_ir_free(fidl_ir_library_t* library);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_IR_H_
@@ -0,0 +1,567 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/json.h>
+#include <lib/fidl/json_internal.h>
+#include <lib/fidl/view_internal.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+using fidl::internal::InlineSize;
+using fidl::internal::JsonWriter;
+using fidl::internal::kViewMaxDepth;
+using fidl::internal::MemberRuns;
+using fidl::internal::PrimitiveSize;
+using fidl::internal::TableFieldType;
+using fidl::internal::VariantIndex;
+using fidl::internal::VariantSize;
+using fidl::internal::VectorShape;
+using fidl::internal::ViewReader;
+using fidl::internal::WireFormat;
+using fidl::internal::XUnionField;
+
+// Writes an object of a message, and the objects it refers to, as JSON, walking
+// the message once, in the order of its out-of-line objects.
+class JsonDumper final {
+ public:
+  JsonDumper(const fidl_view_t& view, fidl_json_describe_t describe, void* context, char* out_json,
+             uint32_t capacity)
+      : reader_(view),
+        view_(view),
+        wire_format_(view.wire_format == FIDL_WIRE_FORMAT_V1 ? WireFormat::kV1
+                                                              : WireFormat::kOld),
+        describe_(describe),
+        context_(context),
+        writer_(out_json, capacity) {}
+
+  bool Dump(uint32_t* out_size) {
+    const fidl_type_t* type = view_.type;
+    uint32_t out_of_line_offset = view_.out_of_line_offset;
+    bool ok;
+    // Views of pointers refer to the object they point to.
+    if (type && type->type_tag == fidl::kFidlTypeStructPointer) {
+      ok = DumpStruct(*type->coded_struct_pointer.struct_type, view_.offset, &out_of_line_offset,
+                      0);
+    } else if (type && type->type_tag == fidl::kFidlTypeUnionPointer) {
+      ok = DumpUnion(*type->coded_union_pointer.union_type, view_.offset, &out_of_line_offset, 0);
+    } else {
+      ok = DumpObject(type, view_.size, view_.offset, &out_of_line_offset, 0, nullptr);
+    }
+    if (!ok || writer_.full()) {
+      return Full();
+    }
+    *out_size = writer_.size();
+    return true;
+  }
+
+  zx_status_t Result(const char** out_error_msg) const { return reader_.Result(out_error_msg); }
+
+ private:
+  // Reads and writes the members of a struct in order, following the runs of
+  // primitive members of the struct in the wire format of the message.
+  struct Members {
+    Members(const fidl::FidlCodedStruct& coded_struct, WireFormat wire_format,
+            uint32_t struct_offset)
+        : runs(coded_struct, wire_format), offset(struct_offset) {}
+
+    MemberRuns runs;
+    const uint32_t offset;
+    uint32_t start = 0;
+    uint32_t end = 0;
+  };
+
+  // Writes the object of |type| at |offset|, whose out-of-line objects are at
+  // |*out_of_line_offset|. Objects without a coding table are |size| bytes,
+  // formatted as |described| describes if provided.
+  bool DumpObject(const fidl_type_t* type, uint32_t size, uint32_t offset,
+                  uint32_t* out_of_line_offset, uint32_t depth,
+                  const fidl_json_field_t* described) {
+    if (depth > kViewMaxDepth) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "message is too deeply nested");
+    }
+    if (writer_.full()) {
+      return Full();
+    }
+    if (!type) {
+      return DumpBytes(offset, size, described ? described->format : FIDL_JSON_FORMAT_HEX);
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+        return DumpPrimitive(type->coded_primitive, offset);
+      case fidl::kFidlTypeEnum:
+        return DumpPrimitive(type->coded_enum.underlying_type, offset);
+      case fidl::kFidlTypeBits:
+        return DumpPrimitive(type->coded_bits.underlying_type, offset);
+      case fidl::kFidlTypeHandle: {
+        uint32_t handle;
+        if (!reader_.Read(offset, &handle, sizeof(handle))) {
+          return false;
+        }
+        if (handle == FIDL_HANDLE_ABSENT) {
+          writer_.Append("null", 4);
+        } else {
+          writer_.Unsigned(num_handles_++);
+        }
+        return true;
+      }
+      case fidl::kFidlTypeStruct:
+        return DumpStruct(type->coded_struct, offset, out_of_line_offset, depth);
+      case fidl::kFidlTypeStructPointer: {
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        bool present;
+        uint32_t struct_offset;
+        if (!reader_.ReadPresence(offset, &present)) {
+          return false;
+        }
+        if (!present) {
+          writer_.Append("null", 4);
+          return true;
+        }
+        return reader_.Claim(coded_struct.size, out_of_line_offset, &struct_offset) &&
+               DumpStruct(coded_struct, struct_offset, out_of_line_offset, depth + 1);
+      }
+      case fidl::kFidlTypeUnion:
+        return DumpUnion(type->coded_union, offset, out_of_line_offset, depth);
+      case fidl::kFidlTypeUnionPointer: {
+        const auto& coded_union = *type->coded_union_pointer.union_type;
+        bool present;
+        uint32_t union_offset = offset;
+        if (wire_format_ == WireFormat::kV1) {
+          uint32_t tag;
+          if (!reader_.Read(offset, &tag, sizeof(tag))) {
+            return false;
+          }
+          present = tag != 0;
+        } else if (!reader_.ReadPresence(offset, &present) ||
+                   (present &&
+                    !reader_.Claim(coded_union.size, out_of_line_offset, &union_offset))) {
+          return false;
+        }
+        if (!present) {
+          writer_.Append("null", 4);
+          return true;
+        }
+        return DumpUnion(coded_union, union_offset, out_of_line_offset, depth + 1);
+      }
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        if (!coded_array.element) {
+          return DumpBytes(offset, coded_array.array_size, FIDL_JSON_FORMAT_HEX);
+        }
+        writer_.Put('[');
+        for (uint32_t element_offset = 0; element_offset < coded_array.array_size;
+             element_offset += coded_array.element_size) {
+          if (element_offset > 0) {
+            writer_.Put(',');
+          }
+          if (!DumpObject(coded_array.element, coded_array.element_size, offset + element_offset,
+                          out_of_line_offset, depth, nullptr)) {
+            return false;
+          }
+        }
+        writer_.Put(']');
+        return true;
+      }
+      case fidl::kFidlTypeString:
+      case fidl::kFidlTypeVector: {
+        const fidl_type_t* element;
+        uint32_t element_size, max_count;
+        bool nullable, present;
+        VectorShape(type, &element, &element_size, &nullable, &max_count);
+        fidl_vector_t vector;
+        if (!reader_.Read(offset, &vector, sizeof(vector)) ||
+            !reader_.ReadPresence(offset + static_cast<uint32_t>(offsetof(fidl_vector_t, data)),
+                                  &present)) {
+          return false;
+        }
+        if (!present) {
+          writer_.Append("null", 4);
+          return true;
+        }
+        uint32_t data_offset;
+        if (vector.count > view_.num_bytes ||
+            !reader_.Claim(vector.count * element_size, out_of_line_offset, &data_offset)) {
+          return reader_.Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+        }
+        const auto count = static_cast<uint32_t>(vector.count);
+        if (type->type_tag == fidl::kFidlTypeString) {
+          writer_.String(reinterpret_cast<const char*>(&view_.bytes[data_offset]), count);
+          return true;
+        }
+        if (!element) {
+          return DumpBytes(data_offset, count * element_size, FIDL_JSON_FORMAT_HEX);
+        }
+        writer_.Put('[');
+        for (uint32_t i = 0; i < count; i++) {
+          if (i > 0) {
+            writer_.Put(',');
+          }
+          if (!DumpObject(element, element_size, data_offset + i * element_size,
+                          out_of_line_offset, depth + 1, nullptr)) {
+            return false;
+          }
+        }
+        writer_.Put(']');
+        return true;
+      }
+      case fidl::kFidlTypeTable: {
+        const auto& coded_table = type->coded_table;
+        fidl_vector_t envelopes;
+        uint32_t envelopes_offset, cursor = 0;
+        if (!reader_.Read(offset, &envelopes, sizeof(envelopes))) {
+          return false;
+        }
+        if (envelopes.count > view_.num_bytes ||
+            !reader_.Claim(envelopes.count * sizeof(fidl_envelope_t), out_of_line_offset,
+                           &envelopes_offset)) {
+          return reader_.Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+        }
+        writer_.Put('{');
+        bool first = true;
+        for (uint32_t i = 0; i < envelopes.count; i++) {
+          const uint32_t envelope_offset =
+              envelopes_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t));
+          fidl_envelope_t envelope;
+          bool present;
+          if (!reader_.ReadEnvelope(envelope_offset, &envelope, &present)) {
+            return false;
+          }
+          if (!present) {
+            continue;
+          }
+          const uint32_t ordinal = i + 1;
+          const fidl_type_t* field_type = TableFieldType(coded_table, ordinal, &cursor);
+          fidl_json_field_t field;
+          const bool has_field = Key(coded_table.name, ordinal, &first, &field);
+          if (!DumpEnvelope(field_type, field_type ? InlineSize(field_type, wire_format_) : 0,
+                            envelope_offset, out_of_line_offset, depth,
+                            has_field ? &field : nullptr)) {
+            return false;
+          }
+        }
+        writer_.Put('}');
+        return true;
+      }
+      case fidl::kFidlTypeXUnion: {
+        const auto& coded_xunion = type->coded_xunion;
+        uint32_t tag;
+        if (!reader_.Read(offset, &tag, sizeof(tag))) {
+          return false;
+        }
+        if (tag == 0) {
+          writer_.Append("null", 4);
+          return true;
+        }
+        const auto* xunion_field = XUnionField(coded_xunion, tag);
+        const fidl_type_t* field_type = xunion_field ? xunion_field->type : nullptr;
+        fidl_json_field_t field;
+        bool first = true;
+        writer_.Put('{');
+        const bool has_field = Key(coded_xunion.name, tag, &first, &field);
+        if (!DumpEnvelope(field_type, field_type ? InlineSize(field_type, wire_format_) : 0,
+                          offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                          out_of_line_offset, depth, has_field ? &field : nullptr)) {
+          return false;
+        }
+        writer_.Put('}');
+        return true;
+      }
+    }
+
+    assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+    return false;
+  }
+
+  // Writes the members of a struct in the order of the old wire format, so that
+  // both wire formats give the same JSON.
+  bool DumpStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t offset,
+                  uint32_t* out_of_line_offset, uint32_t depth) {
+    const auto* old_struct =
+        wire_format_ == WireFormat::kOld ? &coded_struct : coded_struct.alt_type;
+    if (!old_struct) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "struct has no old wire format coding table");
+    }
+    Members members(coded_struct, wire_format_, offset);
+    bool first = true;
+    uint32_t cursor = 0, field_index = 0;
+    writer_.Put('{');
+    for (uint32_t i = 0; i < old_struct->field_count; i++) {
+      const auto& old_field = old_struct->fields[i];
+      const uint32_t end = old_field.type ? old_field.offset : old_field.padding_offset;
+      if (cursor < end && !DumpMembers(old_struct->name, cursor, end, &members, &first)) {
+        return false;
+      }
+      if (!old_field.type) {
+        cursor = old_field.padding_offset + old_field.padding;
+        continue;
+      }
+      cursor = old_field.offset + InlineSize(old_field.type, WireFormat::kOld) + old_field.padding;
+      // Coded fields are in the same order in both wire formats.
+      while (!coded_struct.fields[field_index].type) {
+        field_index++;
+      }
+      const auto& field = coded_struct.fields[field_index++];
+      fidl_json_field_t unused;
+      Key(old_struct->name, old_field.offset, &first, &unused);
+      if (!DumpObject(field.type, InlineSize(field.type, wire_format_), offset + field.offset,
+                      out_of_line_offset, depth, nullptr)) {
+        return false;
+      }
+    }
+    if (cursor < old_struct->size &&
+        !DumpMembers(old_struct->name, cursor, old_struct->size, &members, &first)) {
+      return false;
+    }
+    writer_.Put('}');
+    return true;
+  }
+
+  // Writes the primitive members between old wire format offsets |start| and
+  // |end|, as described, and otherwise as a single run of bytes.
+  bool DumpMembers(const char* type_name, uint32_t start, uint32_t end, Members* members,
+                   bool* first) {
+    while (start < end) {
+      fidl_json_field_t field;
+      uint32_t size = end - start;
+      const bool described = Key(type_name, start, first, &field) && field.size > 0 &&
+                             field.size <= size &&
+                             (field.format == FIDL_JSON_FORMAT_HEX || field.size <= 8);
+      if (described) {
+        size = field.size;
+      }
+      const fidl_json_format_t format = described ? field.format : FIDL_JSON_FORMAT_HEX;
+      uint8_t value[8];
+      if (format != FIDL_JSON_FORMAT_HEX) {
+        uint32_t copied = 0;
+        if (!ReadMembers(members, size, [&](const uint8_t* data, uint32_t chunk) {
+              memcpy(&value[copied], data, chunk);
+              copied += chunk;
+            })) {
+          return false;
+        }
+        DumpValue(value, size, format);
+      } else {
+        writer_.Put('"');
+        if (!ReadMembers(members, size,
+                         [&](const uint8_t* data, uint32_t chunk) { writer_.Hex(data, chunk); })) {
+          return false;
+        }
+        writer_.Put('"');
+      }
+      start += size;
+    }
+    return true;
+  }
+
+  // Passes the next |size| bytes of primitive members to |read|, in chunks
+  // which are contiguous in the message.
+  template <typename Read>
+  bool ReadMembers(Members* members, uint32_t size, Read read) {
+    while (size > 0) {
+      if (members->start == members->end && !members->runs.Next(&members->start, &members->end)) {
+        return reader_.Fail(ZX_ERR_INVALID_ARGS, "struct members differ between wire formats");
+      }
+      const uint32_t chunk = std::min(size, members->end - members->start);
+      const uint8_t* data;
+      if (!Bytes(members->offset + members->start, chunk, &data)) {
+        return false;
+      }
+      read(data, chunk);
+      members->start += chunk;
+      size -= chunk;
+    }
+    return true;
+  }
+
+  bool DumpUnion(const fidl::FidlCodedUnion& coded_union, uint32_t offset,
+                 uint32_t* out_of_line_offset, uint32_t depth) {
+    uint32_t tag;
+    if (!reader_.Read(offset, &tag, sizeof(tag))) {
+      return false;
+    }
+    uint32_t index = tag;
+    if (wire_format_ == WireFormat::kV1) {
+      if (!VariantIndex(coded_union, tag, &index)) {
+        return reader_.Fail(ZX_ERR_INVALID_ARGS, "unknown static-union ordinal");
+      }
+    } else if (tag >= coded_union.field_count) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "invalid static-union tag");
+    }
+    const fidl_type_t* type = coded_union.fields[index].type;
+    const uint32_t size = VariantSize(coded_union, index, wire_format_);
+    fidl_json_field_t field;
+    bool first = true;
+    writer_.Put('{');
+    const bool described = Key(coded_union.name, index, &first, &field);
+    if (wire_format_ == WireFormat::kV1
+            ? !DumpEnvelope(type, size,
+                            offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                            out_of_line_offset, depth, described ? &field : nullptr)
+            : !DumpObject(type, size, offset + coded_union.data_offset, out_of_line_offset, depth,
+                          described ? &field : nullptr)) {
+      return false;
+    }
+    writer_.Put('}');
+    return true;
+  }
+
+  // Writes the contents of the envelope at |envelope_offset|: |size| bytes of
+  // |type| if it has a coding table, and otherwise raw bytes.
+  bool DumpEnvelope(const fidl_type_t* type, uint32_t size, uint32_t envelope_offset,
+                    uint32_t* out_of_line_offset, uint32_t depth, const fidl_json_field_t* field) {
+    fidl_envelope_t envelope;
+    bool present;
+    uint32_t contents_offset;
+    if (!reader_.ReadEnvelope(envelope_offset, &envelope, &present)) {
+      return false;
+    }
+    if (!present) {
+      writer_.Append("null", 4);
+      return true;
+    }
+    if (!reader_.Claim(envelope.num_bytes, out_of_line_offset, &contents_offset)) {
+      return false;
+    }
+    if (!type && size == 0) {
+      size = envelope.num_bytes;
+    }
+    if (size > envelope.num_bytes) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "envelope is smaller than its contents");
+    }
+    uint32_t contents_out_of_line_offset =
+        contents_offset + static_cast<uint32_t>(fidl::FidlAlign(size));
+    return DumpObject(type, size, contents_offset, &contents_out_of_line_offset, depth + 1,
+                      field);
+  }
+
+  bool DumpPrimitive(fidl::FidlCodedPrimitive primitive, uint32_t offset) {
+    fidl_json_format_t format;
+    switch (primitive) {
+      case fidl::FidlCodedPrimitive::kBool:
+        format = FIDL_JSON_FORMAT_BOOL;
+        break;
+      case fidl::FidlCodedPrimitive::kInt8:
+      case fidl::FidlCodedPrimitive::kInt16:
+      case fidl::FidlCodedPrimitive::kInt32:
+      case fidl::FidlCodedPrimitive::kInt64:
+        format = FIDL_JSON_FORMAT_SIGNED;
+        break;
+      case fidl::FidlCodedPrimitive::kFloat32:
+      case fidl::FidlCodedPrimitive::kFloat64:
+        format = FIDL_JSON_FORMAT_FLOAT;
+        break;
+      default:
+        format = FIDL_JSON_FORMAT_UNSIGNED;
+        break;
+    }
+    return DumpBytes(offset, PrimitiveSize(primitive), format);
+  }
+
+  bool DumpBytes(uint32_t offset, uint32_t size, fidl_json_format_t format) {
+    const uint8_t* data;
+    if (!Bytes(offset, size, &data)) {
+      return false;
+    }
+    if (format == FIDL_JSON_FORMAT_HEX || size > 8) {
+      writer_.Put('"');
+      writer_.Hex(data, size);
+      writer_.Put('"');
+      return true;
+    }
+    DumpValue(data, size, format);
+    return true;
+  }
+
+  // Writes |size| (at most 8) little-endian bytes in |format|, falling back to
+  // hexadecimal for sizes which the format does not apply to.
+  void DumpValue(const uint8_t* data, uint32_t size, fidl_json_format_t format) {
+    uint64_t value = 0;
+    memcpy(&value, data, size);
+    switch (format) {
+      case FIDL_JSON_FORMAT_UNSIGNED:
+        return writer_.Unsigned(value);
+      case FIDL_JSON_FORMAT_SIGNED: {
+        const uint32_t shift = 64 - 8 * size;
+        return writer_.Signed(static_cast<int64_t>(value << shift) >> shift);
+      }
+      case FIDL_JSON_FORMAT_BOOL:
+        return value ? writer_.Append("true", 4) : writer_.Append("false", 5);
+      case FIDL_JSON_FORMAT_FLOAT:
+        if (size == sizeof(float)) {
+          float single;
+          memcpy(&single, data, sizeof(single));
+          return writer_.Float(single, 9);
+        }
+        if (size == sizeof(double)) {
+          double number;
+          memcpy(&number, data, sizeof(number));
+          return writer_.Float(number, 17);
+        }
+        break;
+    }
+    writer_.Put('"');
+    writer_.Hex(data, size);
+    writer_.Put('"');
+  }
+
+  // Writes the key of field |key| of the type named |type_name|, and returns
+  // whether it was described into |out_field|.
+  bool Key(const char* type_name, uint32_t key, bool* first, fidl_json_field_t* out_field) {
+    if (!*first) {
+      writer_.Put(',');
+    }
+    *first = false;
+    *out_field = {};
+    const bool described = describe_ && describe_(context_, type_name, key, out_field) &&
+                           out_field->name;
+    if (described) {
+      writer_.String(out_field->name, static_cast<uint32_t>(strlen(out_field->name)));
+    } else {
+      writer_.Put('"');
+      writer_.Unsigned(key);
+      writer_.Put('"');
+    }
+    writer_.Put(':');
+    return described;
+  }
+
+  bool Bytes(uint32_t offset, uint32_t size, const uint8_t** out_data) {
+    if (offset > view_.num_bytes || size > view_.num_bytes - offset) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+    }
+    *out_data = &view_.bytes[offset];
+    return true;
+  }
+
+  bool Full() {
+    const char* error = nullptr;
+    if (reader_.Result(&error) != ZX_OK) {
+      return false;
+    }
+    return reader_.Fail(ZX_ERR_BUFFER_TOO_SMALL, "JSON does not fit in the buffer");
+  }
+
+  ViewReader reader_;
+  const fidl_view_t view_;
+  const WireFormat wire_format_;
+  const fidl_json_describe_t describe_;
+  void* const context_;
+  JsonWriter writer_;
+  uint64_t num_handles_ = 0;
+};
+
+}  // namespace
+
+zx_status_t fidl_view_dump_json(const fidl_view_t* view, fidl_json_describe_t describe,
+                                void* context, char* out_json, uint32_t capacity,
+                                uint32_t* out_size, const char** out_error_msg) {
+  JsonDumper dumper(*view, describe, context, out_json, capacity);
+  dumper.Dump(out_size);
+  return dumper.Result(out_error_msg);
+}
@@ -0,0 +1,60 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_JSON_H_
+#define LIB_FIDL_JSON_H_
+
+#include "fidl.h"
+#include "view.h"
+
+// __BEGIN_CDECLS
+
+// How to format the bytes of a primitive struct member, or of a union, xunion
+// or table field without a coding table.
+typedef uint32_t fidl_json_format_t;
+
+#define FIDL_JSON_FORMAT_HEX ((fidl_json_format_t)0u)
+#define FIDL_JSON_FORMAT_UNSIGNED ((fidl_json_format_t)1u)
+#define FIDL_JSON_FORMAT_SIGNED ((fidl_json_format_t)2u)
+#define FIDL_JSON_FORMAT_FLOAT ((fidl_json_format_t)3u)
+#define FIDL_JSON_FORMAT_BOOL ((fidl_json_format_t)4u)
+
+// A field of a struct, union, xunion or table, as described by the caller of
+// `fidl_view_dump_json` (e.g. from the JSON IR). Coding tables only name
+// types, and leave primitive struct members out.
+typedef struct {
+  // Key of the field in JSON objects.
+  const char* name;
+  // Size of primitive struct members (1, 2, 4 or 8 bytes for formats other
+  // than `FIDL_JSON_FORMAT_HEX`), and ignored for other fields.
+  uint32_t size;
+  fidl_json_format_t format;
+} fidl_json_field_t;
+
+// Describes into |out_field| the field |key| of the type named |type_name| (as
+// in its coding table): the old wire format offset of a struct member, the
+// index of a static-union variant, or the ordinal of an xunion or table field.
+// Returns false if the field is unknown.
+typedef bool (*fidl_json_describe_t)(void* context, const char* type_name, uint32_t key,
+                                     fidl_json_field_t* out_field);
+
+// Writes the viewed object, and the objects it refers to, into |out_json| as
+// JSON, in a single pass over the message, and stores the size of the JSON
+// (which is not null-terminated) into |out_size|. Fails with
+// `ZX_ERR_BUFFER_TOO_SMALL` if it does not fit in |capacity| bytes.
+//
+// Structs, unions, xunions and tables are objects, keyed by the names
+// |describe| gives their fields (if provided), and otherwise by their key as a
+// decimal number. Runs of primitive struct members that |describe| does not
+// describe are hexadecimal strings keyed by their offset. Absent objects are
+// null, present handles are numbered in the order they are written, and the
+// bytes of strings are escaped but not validated. The output is the same for
+// both wire formats.
+zx_status_t fidl_view_dump_json(const fidl_view_t* view, fidl_json_describe_t describe,
+                                void* context, char* out_json, uint32_t capacity,
+                                uint32_t* out_size, const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_JSON_H_
@@ -0,0 +1,136 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_JSON_INTERNAL_H_
+#define LIB_FIDL_JSON_INTERNAL_H_
+
+// The JSON writer behind `fidl_view_dump_json` (see `json.h`), shared with
+// `fidl_view_path` (see `path.h`). Not part of the public API.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace fidl {
+namespace internal {
+
+// Writes JSON into a buffer. Writes past its capacity are dropped, and the
+// writer then reports that it is full.
+class JsonWriter final {
+ public:
+  JsonWriter(char* out, uint32_t capacity) : out_(out), capacity_(capacity) {}
+
+  bool full() const { return full_; }
+  uint32_t size() const { return size_; }
+
+  void Put(char c) {
+    if (size_ == capacity_) {
+      full_ = true;
+      return;
+    }
+    out_[size_++] = c;
+  }
+
+  void Append(const char* data, uint32_t size) {
+    if (size > capacity_ - size_) {
+      full_ = true;
+      return;
+    }
+    memcpy(&out_[size_], data, size);
+    size_ += size;
+  }
+
+  void Unsigned(uint64_t value) {
+    // Two-digit decimal numbers, for formatting integers two digits at a time.
+    static constexpr char kDigitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[20];
+    char* const end = digits + sizeof(digits);
+    char* begin = end;
+    while (value >= 100) {
+      begin -= 2;
+      memcpy(begin, &kDigitPairs[(value % 100) * 2], 2);
+      value /= 100;
+    }
+    if (value >= 10) {
+      begin -= 2;
+      memcpy(begin, &kDigitPairs[value * 2], 2);
+    } else {
+      *--begin = static_cast<char>('0' + value);
+    }
+    Append(begin, static_cast<uint32_t>(end - begin));
+  }
+
+  void Signed(int64_t value) {
+    if (value < 0) {
+      Put('-');
+      return Unsigned(0 - static_cast<uint64_t>(value));
+    }
+    Unsigned(static_cast<uint64_t>(value));
+  }
+
+  // Floats are written with as many digits as needed to read them back
+  // exactly. JSON has no infinities or NaNs, which are written as null.
+  void Float(double value, int precision) {
+    if (!std::isfinite(value)) {
+      return Append("null", 4);
+    }
+    char digits[32];
+    const int size = snprintf(digits, sizeof(digits), "%.*g", precision, value);
+    Append(digits, static_cast<uint32_t>(size));
+  }
+
+  void Hex(const uint8_t* data, uint32_t size) {
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    if (static_cast<uint64_t>(size) * 2 > capacity_ - size_) {
+      full_ = true;
+      return;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+      out_[size_++] = kHexDigits[data[i] >> 4];
+      out_[size_++] = kHexDigits[data[i] & 0xf];
+    }
+  }
+
+  // Writes |size| bytes as a JSON string, escaping quotes, backslashes and
+  // control characters. Other bytes are copied as is.
+  void String(const char* data, uint32_t size) {
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    Put('"');
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      const auto c = static_cast<uint8_t>(data[i]);
+      if (c >= 0x20 && c != '"' && c != '\\') {
+        continue;
+      }
+      Append(&data[start], i - start);
+      start = i + 1;
+      char escape[6] = {'\\', static_cast<char>(c), 'u', '0', '0', 0};
+      if (c == '"' || c == '\\') {
+        Append(escape, 2);
+        continue;
+      }
+      escape[1] = 'u';
+      escape[4] = kHexDigits[c >> 4];
+      escape[5] = kHexDigits[c & 0xf];
+      Append(escape, sizeof(escape));
+    }
+    Append(&data[start], size - start);
+    Put('"');
+  }
+
+ private:
+  char* const out_;
+  const uint32_t capacity_;
+  uint32_t size_ = 0;
+  bool full_ = false;
+};
+
+}  // namespace internal
+}  // namespace fidl
+
+#endif  // LIB_FIDL_JSON_INTERNAL_H_
@@ -0,0 +1 @@
+../../columns.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../detect.h
\ No newline at end of file
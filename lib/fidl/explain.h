@@ -0,0 +1 @@
+../../explain.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../filter.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../ir.h
\ No newline at end of file
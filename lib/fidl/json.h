@@ -0,0 +1 @@
+../../json.h
\ No newline at end of file
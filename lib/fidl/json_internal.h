@@ -0,0 +1 @@
+../../json_internal.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../path.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../projection.h
\ No newline at end of file
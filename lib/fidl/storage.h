@@ -0,0 +1 @@
+../../storage.h
\ No newline at end of file
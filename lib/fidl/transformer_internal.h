@@ -0,0 +1 @@
+../../transformer_internal.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../view.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../view_internal.h
\ No newline at end of file
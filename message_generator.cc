@@ -0,0 +1,304 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "message_generator.h"
+
+#include <lib/fidl/transformer_internal.h>
+
+#include <cstring>
+
+namespace {
+
+using fidl::internal::InlineSize;
+using fidl::internal::PrimitiveSize;
+using fidl::internal::WireFormat;
+
+constexpr uint32_t kMaxDepth = 32;
+
+// xorshift64*: fast, and good enough for shaping messages.
+uint64_t XorShift(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1Dull;
+}
+
+}  // namespace
+
+bool MessageGenerator::Generate(const fidl_type_t* type, uint8_t* bytes, uint32_t capacity,
+                                uint32_t* out_num_bytes, uint32_t* out_num_handles) {
+  if (type->type_tag != fidl::kFidlTypeStruct) {
+    return false;
+  }
+
+  bytes_ = bytes;
+  capacity_ = capacity;
+  next_out_of_line_ = 0;
+  num_handles_ = 0;
+
+  uint32_t offset;
+  if (!Allocate(type->coded_struct.size, &offset) || !FillStruct(type->coded_struct, offset, 0)) {
+    return false;
+  }
+
+  *out_num_bytes = next_out_of_line_;
+  *out_num_handles = num_handles_;
+  return true;
+}
+
+uint64_t MessageGenerator::Next() { return XorShift(&state_); }
+
+uint64_t MessageGenerator::Garbage() { return garbage_state_ ? XorShift(&garbage_state_) : 0; }
+
+bool MessageGenerator::Allocate(uint32_t size, uint32_t* out_offset) {
+  uint32_t new_offset;
+  if (!fidl::AddOutOfLine(next_out_of_line_, size, &new_offset) || new_offset > capacity_) {
+    return false;
+  }
+  memset(&bytes_[next_out_of_line_], 0, size);
+  FillPadding(next_out_of_line_ + size, new_offset - next_out_of_line_ - size);
+  *out_offset = next_out_of_line_;
+  next_out_of_line_ = new_offset;
+  return true;
+}
+
+void MessageGenerator::FillRandom(uint32_t offset, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    bytes_[offset + i] = static_cast<uint8_t>(Next() >> 56);
+  }
+}
+
+void MessageGenerator::FillPadding(uint32_t offset, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    bytes_[offset + i] = static_cast<uint8_t>(Garbage() >> 56);
+  }
+}
+
+void MessageGenerator::FillAbsentEnvelope(fidl_envelope_t* envelope) {
+  envelope->num_bytes = static_cast<uint32_t>(Garbage());
+  envelope->num_handles = static_cast<uint32_t>(Garbage());
+  envelope->presence = FIDL_ALLOC_ABSENT;
+}
+
+bool MessageGenerator::Fill(const fidl_type_t* type, uint32_t offset, uint32_t size,
+                            uint32_t depth) {
+  if (!type) {
+    FillRandom(offset, size);
+    return true;
+  }
+
+  switch (type->type_tag) {
+    case fidl::kFidlTypePrimitive:
+      if (type->coded_primitive == fidl::FidlCodedPrimitive::kBool) {
+        bytes_[offset] = Coin() ? 1 : 0;
+      } else {
+        FillRandom(offset, PrimitiveSize(type->coded_primitive));
+      }
+      return true;
+    case fidl::kFidlTypeEnum: {
+      // Enum members are usually small; fall back to zero if none is found.
+      const auto& coded_enum = type->coded_enum;
+      uint64_t value = 0;
+      for (int attempt = 0; attempt < 16; attempt++) {
+        uint64_t candidate = Uniform(256);
+        if (!coded_enum.validate || coded_enum.validate(candidate)) {
+          value = candidate;
+          break;
+        }
+      }
+      memcpy(&bytes_[offset], &value, PrimitiveSize(coded_enum.underlying_type));
+      return true;
+    }
+    case fidl::kFidlTypeBits: {
+      uint64_t value = Next() & type->coded_bits.mask;
+      memcpy(&bytes_[offset], &value, PrimitiveSize(type->coded_bits.underlying_type));
+      return true;
+    }
+    case fidl::kFidlTypeHandle: {
+      bool present = !type->coded_handle.nullable || Coin();
+      *reinterpret_cast<uint32_t*>(&bytes_[offset]) =
+          present ? FIDL_HANDLE_PRESENT : AbsentHandle();
+      if (present) {
+        num_handles_++;
+      }
+      return true;
+    }
+    case fidl::kFidlTypeStruct:
+      return FillStruct(type->coded_struct, offset, depth);
+    case fidl::kFidlTypeUnion:
+      return FillUnion(type->coded_union, offset, depth);
+    case fidl::kFidlTypeStructPointer:
+    case fidl::kFidlTypeUnionPointer: {
+      auto presence = reinterpret_cast<uint64_t*>(&bytes_[offset]);
+      if (depth >= kMaxDepth || Coin()) {
+        *presence = AbsentPointer();
+        return true;
+      }
+      *presence = FIDL_ALLOC_PRESENT;
+      uint32_t object_offset;
+      if (type->type_tag == fidl::kFidlTypeStructPointer) {
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        return Allocate(coded_struct.size, &object_offset) &&
+               FillStruct(coded_struct, object_offset, depth + 1);
+      }
+      const auto& coded_union = *type->coded_union_pointer.union_type;
+      return Allocate(coded_union.size, &object_offset) &&
+             FillUnion(coded_union, object_offset, depth + 1);
+    }
+    case fidl::kFidlTypeArray: {
+      const auto& coded_array = type->coded_array;
+      for (uint32_t element_offset = 0; element_offset < coded_array.array_size;
+           element_offset += coded_array.element_size) {
+        if (!Fill(coded_array.element, offset + element_offset, coded_array.element_size,
+                  depth)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeString:
+    case fidl::kFidlTypeVector: {
+      const bool is_string = type->type_tag == fidl::kFidlTypeString;
+      const bool nullable =
+          is_string ? type->coded_string.nullable : type->coded_vector.nullable;
+      const uint32_t max_count =
+          is_string ? type->coded_string.max_size : type->coded_vector.max_count;
+      const uint32_t element_size = is_string ? 1 : type->coded_vector.element_size;
+      const fidl_type_t* element = is_string ? nullptr : type->coded_vector.element;
+
+      auto vector = reinterpret_cast<fidl_vector_t*>(&bytes_[offset]);
+      if (nullable && Coin()) {
+        vector->count = Garbage();
+        vector->data = reinterpret_cast<void*>(AbsentPointer());
+        return true;
+      }
+      uint32_t count = 0;
+      if (depth < kMaxDepth) {
+        uint32_t bound = max_count < max_count_ ? max_count : max_count_;
+        count = Uniform(bound + 1);
+      }
+      vector->count = count;
+      vector->data = reinterpret_cast<void*>(FIDL_ALLOC_PRESENT);
+
+      uint32_t data_offset;
+      if (!Allocate(count * element_size, &data_offset)) {
+        return false;
+      }
+      if (is_string) {
+        for (uint32_t i = 0; i < count; i++) {
+          bytes_[data_offset + i] = static_cast<uint8_t>(' ' + Uniform('~' - ' ' + 1));
+        }
+        return true;
+      }
+      for (uint32_t i = 0; i < count; i++) {
+        if (!Fill(element, data_offset + i * element_size, element_size, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeTable: {
+      const auto& coded_table = type->coded_table;
+      auto table = reinterpret_cast<fidl_table_t*>(&bytes_[offset]);
+      table->envelopes.data = reinterpret_cast<void*>(FIDL_ALLOC_PRESENT);
+
+      // Envelopes run up to the highest set field; reserved ordinals and unset
+      // fields are absent.
+      uint32_t count = 0;
+      if (depth < kMaxDepth && coded_table.field_count > 0) {
+        count = coded_table.fields[Uniform(coded_table.field_count)].ordinal;
+        if (Coin()) {
+          count = 0;
+        }
+      }
+      table->envelopes.count = count;
+
+      uint32_t envelopes_offset;
+      if (!Allocate(count * static_cast<uint32_t>(sizeof(fidl_envelope_t)), &envelopes_offset)) {
+        return false;
+      }
+      auto envelopes = reinterpret_cast<fidl_envelope_t*>(&bytes_[envelopes_offset]);
+      for (uint32_t i = 0; i < count; i++) {
+        FillAbsentEnvelope(&envelopes[i]);
+      }
+      for (uint32_t i = 0; i < coded_table.field_count; i++) {
+        const auto& field = coded_table.fields[i];
+        if (field.ordinal > count || (field.ordinal < count && Coin())) {
+          continue;
+        }
+        auto envelope = reinterpret_cast<fidl_envelope_t*>(
+            &bytes_[envelopes_offset + (field.ordinal - 1) * sizeof(fidl_envelope_t)]);
+        if (!FillEnvelope(field.type, envelope, depth)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeXUnion: {
+      const auto& coded_xunion = type->coded_xunion;
+      auto xunion = reinterpret_cast<fidl_xunion_t*>(&bytes_[offset]);
+      xunion->padding = static_cast<uint32_t>(Garbage());
+      if (coded_xunion.field_count == 0 || (coded_xunion.nullable && Coin())) {
+        FillAbsentEnvelope(&xunion->envelope);
+        return true;
+      }
+      const auto& field = coded_xunion.fields[Uniform(coded_xunion.field_count)];
+      xunion->tag = field.ordinal;
+      return FillEnvelope(field.type, &xunion->envelope, depth);
+    }
+  }
+  return false;
+}
+
+bool MessageGenerator::FillStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t offset,
+                                  uint32_t depth) {
+  FillRandom(offset, coded_struct.size);
+  for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+    const auto& field = coded_struct.fields[i];
+    if (!field.type) {
+      FillPadding(offset + field.padding_offset, field.padding);
+      continue;
+    }
+    uint32_t field_size = InlineSize(field.type, WireFormat::kOld);
+    memset(&bytes_[offset + field.offset], 0, field_size);
+    FillPadding(offset + field.offset + field_size, field.padding);
+    if (!Fill(field.type, offset + field.offset, field_size, depth)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MessageGenerator::FillUnion(const fidl::FidlCodedUnion& coded_union, uint32_t offset,
+                                 uint32_t depth) {
+  memset(&bytes_[offset], 0, coded_union.size);
+  if (coded_union.field_count == 0) {
+    return true;
+  }
+  uint32_t tag = Uniform(coded_union.field_count);
+  *reinterpret_cast<uint32_t*>(&bytes_[offset]) = tag;
+  const auto tag_size = static_cast<uint32_t>(sizeof(tag));
+  FillPadding(offset + tag_size, coded_union.data_offset - tag_size);
+
+  const auto& field = coded_union.fields[tag];
+  uint32_t variant_size = coded_union.size - coded_union.data_offset - field.padding;
+  FillPadding(offset + coded_union.data_offset + variant_size, field.padding);
+  return Fill(field.type, offset + coded_union.data_offset, variant_size, depth);
+}
+
+bool MessageGenerator::FillEnvelope(const fidl_type_t* type, fidl_envelope_t* envelope,
+                                    uint32_t depth) {
+  const uint32_t start = next_out_of_line_;
+  const uint32_t handles_before = num_handles_;
+  // |envelope| points into the buffer, which does not move.
+  uint32_t size = type ? InlineSize(type, WireFormat::kOld) : 8;
+  uint32_t content_offset;
+  if (!Allocate(size, &content_offset) || !Fill(type, content_offset, size, depth + 1)) {
+    return false;
+  }
+  envelope->num_bytes = next_out_of_line_ - start;
+  envelope->num_handles = num_handles_ - handles_before;
+  envelope->presence = FIDL_ALLOC_PRESENT;
+  return true;
+}
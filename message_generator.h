@@ -0,0 +1,64 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef MESSAGE_GENERATOR_H_
+#define MESSAGE_GENERATOR_H_
+
+#include "fidl.h"
+
+// Generates random, well-formed encoded messages in the old wire format from
+// coding tables, for corpora, benchmarks and round-trip tests.
+//
+// Primitive values are random and padding is zeroed. Nullable objects are
+// present with probability 1/2, tables have each field set with probability
+// 1/2, and vectors and strings have up to |max_count| elements (respecting
+// their bounds). Recursion stops at a depth of 32 by leaving nullable objects
+// absent and vectors empty.
+//
+// With |garbage| set, messages hold the same values as without it, but with
+// random padding, absent objects marked with random values other than the
+// present marker, and random sizes in absent vectors, strings and envelopes
+// (including the unknown envelopes of reserved table fields), as a sender
+// which does not canonicalize may write them.
+class MessageGenerator final {
+ public:
+  MessageGenerator(uint64_t seed, uint32_t max_count, bool garbage = false)
+      : state_(seed | 1), garbage_state_(garbage ? ~seed | 1 : 0), max_count_(max_count) {}
+
+  // Generates a message for the top-level struct |type| into |bytes|, which
+  // has room for |capacity| bytes. Returns false if the message does not fit.
+  bool Generate(const fidl_type_t* type, uint8_t* bytes, uint32_t capacity,
+                uint32_t* out_num_bytes, uint32_t* out_num_handles);
+
+ private:
+  uint64_t Next();
+  // Random bytes which do not change values, or zero without |garbage|.
+  uint64_t Garbage();
+  // A pointer or handle presence marker of an absent object.
+  uint64_t AbsentPointer() { return Garbage() & ~uint64_t{1}; }
+  uint32_t AbsentHandle() { return static_cast<uint32_t>(Garbage()) & ~1u; }
+  uint32_t Uniform(uint32_t bound) { return static_cast<uint32_t>(Next() % bound); }
+  bool Coin() { return (Next() & 1) != 0; }
+
+  bool Allocate(uint32_t size, uint32_t* out_offset);
+  void FillRandom(uint32_t offset, uint32_t size);
+  void FillPadding(uint32_t offset, uint32_t size);
+  void FillAbsentEnvelope(fidl_envelope_t* envelope);
+  bool Fill(const fidl_type_t* type, uint32_t offset, uint32_t size, uint32_t depth);
+  bool FillStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t offset, uint32_t depth);
+  bool FillUnion(const fidl::FidlCodedUnion& coded_union, uint32_t offset, uint32_t depth);
+  bool FillEnvelope(const fidl_type_t* type, fidl_envelope_t* envelope, uint32_t depth);
+
+  uint64_t state_;
+  // Kept apart from |state_|, so that values do not depend on garbage.
+  uint64_t garbage_state_;
+  const uint32_t max_count_;
+
+  uint8_t* bytes_ = nullptr;
+  uint32_t capacity_ = 0;
+  uint32_t next_out_of_line_ = 0;
+  uint32_t num_handles_ = 0;
+};
+
+#endif  // MESSAGE_GENERATOR_H_
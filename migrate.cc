@@ -0,0 +1,162 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Migrates a directory of captures (see `capture.h`) holding messages at rest
+// from the old wire format to v1. Usage:
+//
+//     ./migrate [options] src-dir dst-dir
+//
+// Options:
+//
+//     --threads N      Number of workers (default: number of CPUs).
+//     --checkpoint F   Checkpoint file (default: dst-dir/.migrate-checkpoint).
+//     --io-mb-per-s N  Budget of bytes read and written per second, shared by
+//                      all workers (default: unlimited).
+//     --cpu-percent N  Share of its time each worker spends migrating, the rest
+//                      being spent sleeping (default: 100).
+//     --verify N       Transform every N-th old message of each capture back
+//                      to the old wire format, and check it is unchanged
+//                      (default: 100; 0 disables verification).
+//     --ir FILE        Load the coding tables from the JSON IR FILE (see
+//                      `ir.h`) instead of using those of `tables.h`.
+//     --max-captures N Migrate at most N captures, leaving the others to a
+//                      later run (default: no limit).
+//
+// Each capture of src-dir is migrated to a capture of the same name in dst-dir,
+// in which every message is in v1, and recorded in the checkpoint so that a
+// stopped job resumes where it left off (see `migration.h`). Captures which
+// fail are reported and not written, and the job exits with an error once the
+// others are migrated.
+//
+// Once done, the report lists, for each worker and in aggregate, the captures
+// and messages migrated and verified, the bytes read and written, the time
+// spent working and throttled, and the throughput in messages per second.
+
+#include <lib/fidl/ir.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "migration.h"
+#include "tables_catalog.h"
+
+namespace {
+
+using Clock = Migration::Clock;
+
+bool FindCatalogTypes(const std::string& name, const fidl_type_t** out_old_type,
+                      const fidl_type_t** out_v1_type) {
+  for (const auto& entry : kCatalog) {
+    if (name == entry.name) {
+      *out_old_type = entry.old_type;
+      *out_v1_type = entry.v1_type;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PrintStats(const char* name, const Migration::WorkerStats& stats, double elapsed_s) {
+  const double busy_s = std::chrono::duration<double>(stats.busy).count();
+  const double throttled_s = std::chrono::duration<double>(stats.throttled).count();
+  printf("%-8s %8llu %8llu %10llu %10llu %10.1f %10.1f %9.2f %9.2f %12.0f\n", name,
+         static_cast<unsigned long long>(stats.captures),
+         static_cast<unsigned long long>(stats.failures),
+         static_cast<unsigned long long>(stats.messages),
+         static_cast<unsigned long long>(stats.verified),
+         static_cast<double>(stats.bytes_read) / 1e6,
+         static_cast<double>(stats.bytes_written) / 1e6, busy_s, throttled_s,
+         elapsed_s > 0 ? static_cast<double>(stats.messages) / elapsed_s : 0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Migration::Options options;
+  options.threads = std::max(1u, std::thread::hardware_concurrency());
+  options.find_types = FindCatalogTypes;
+  const char* ir_path = nullptr;
+  std::vector<const char*> dirs;
+
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--threads") && has_value) {
+      options.threads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--checkpoint") && has_value) {
+      options.checkpoint_path = argv[++i];
+    } else if (!strcmp(argv[i], "--io-mb-per-s") && has_value) {
+      options.io_bytes_per_s = strtod(argv[++i], nullptr) * 1e6;
+    } else if (!strcmp(argv[i], "--cpu-percent") && has_value) {
+      options.cpu_percent = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--verify") && has_value) {
+      options.verify_every = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--ir") && has_value) {
+      ir_path = argv[++i];
+    } else if (!strcmp(argv[i], "--max-captures") && has_value) {
+      options.max_captures = strtoull(argv[++i], nullptr, 10);
+    } else if (argv[i][0] == '-') {
+      dirs.clear();
+      break;
+    } else {
+      dirs.push_back(argv[i]);
+    }
+  }
+  if (dirs.size() != 2 || options.threads == 0 || options.cpu_percent == 0 ||
+      options.cpu_percent > 100) {
+    fprintf(stderr,
+            "usage: %s [--threads N] [--checkpoint FILE] [--io-mb-per-s N] [--cpu-percent N] "
+            "[--verify N] [--ir FILE] [--max-captures N] src-dir dst-dir\n",
+            argv[0]);
+    return 1;
+  }
+  options.src_dir = dirs[0];
+  options.dst_dir = dirs[1];
+
+  fidl_ir_library_t* library = nullptr;
+  if (ir_path) {
+    std::ifstream file(ir_path);
+    const std::string ir((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const char* error = nullptr;
+    if (fidl_ir_load(ir.data(), static_cast<uint32_t>(ir.size()), &library, &error) != ZX_OK) {
+      fprintf(stderr, "loading %s failed: %s\n", ir_path, error);
+      return 1;
+    }
+    options.library = library;
+  }
+
+  Migration migration(options);
+  std::string failed_path;
+  if (!migration.Prepare(&failed_path)) {
+    perror(failed_path.c_str());
+    return 1;
+  }
+  printf("%zu captures, %zu already migrated, %u workers\n\n", migration.num_captures(),
+         migration.num_completed(), options.threads);
+
+  const Clock::time_point start = Clock::now();
+  std::vector<Migration::WorkerStats> stats;
+  migration.Run(&stats);
+  const double elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+  printf("%-8s %8s %8s %10s %10s %10s %10s %9s %9s %12s\n", "worker", "captures", "failed",
+         "messages", "verified", "MB read", "MB written", "busy s", "throttled", "messages/s");
+  Migration::WorkerStats total;
+  for (uint32_t i = 0; i < options.threads; i++) {
+    PrintStats(std::to_string(i).c_str(), stats[i], elapsed_s);
+    total.Merge(stats[i]);
+  }
+  PrintStats("(all)", total, elapsed_s);
+  if (library) {
+    fidl_ir_free(library);
+  }
+  return total.failures == 0 ? 0 : 1;
+}
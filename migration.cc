@@ -0,0 +1,291 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "migration.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lib/fidl/transformer.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <thread>
+
+namespace {
+
+using Clock = Migration::Clock;
+
+// Transformations never grow messages by more than this.
+constexpr uint32_t kDstCapacity = 16 * ZX_CHANNEL_MAX_MSG_BYTES;
+
+// Workers sleep off their CPU budget once they owe this much.
+constexpr std::chrono::milliseconds kMinCpuSleep(10);
+
+// Lists the regular files of |dir| (except hidden ones), sorted by name.
+bool ListCaptures(const std::string& dir, std::vector<std::string>* out_names) {
+  DIR* entries = opendir(dir.c_str());
+  if (!entries) {
+    return false;
+  }
+  while (const dirent* entry = readdir(entries)) {
+    struct stat st;
+    if (entry->d_name[0] != '.' && stat((dir + "/" + entry->d_name).c_str(), &st) == 0 &&
+        S_ISREG(st.st_mode)) {
+      out_names->push_back(entry->d_name);
+    }
+  }
+  closedir(entries);
+  std::sort(out_names->begin(), out_names->end());
+  return true;
+}
+
+// Flushes the entries of |dir| (e.g. a rename into it) to storage.
+bool SyncDirectory(const std::string& dir) {
+  const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    return false;
+  }
+  const bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+}  // namespace
+
+void Migration::WorkerStats::Merge(const WorkerStats& other) {
+  captures += other.captures;
+  failures += other.failures;
+  messages += other.messages;
+  verified += other.verified;
+  bytes_read += other.bytes_read;
+  bytes_written += other.bytes_written;
+  busy += other.busy;
+  throttled += other.throttled;
+}
+
+Clock::duration Migration::IoThrottle::Consume(uint64_t bytes) {
+  if (bytes_per_s_ <= 0) {
+    return Clock::duration::zero();
+  }
+  Clock::time_point due;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    total_bytes_ += bytes;
+    due = start_ + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                       static_cast<double>(total_bytes_) / bytes_per_s_));
+  }
+  const Clock::time_point now = Clock::now();
+  if (due <= now) {
+    return Clock::duration::zero();
+  }
+  std::this_thread::sleep_until(due);
+  return due - now;
+}
+
+Migration::Migration(const Options& options)
+    : options_(options), io_throttle_(options.io_bytes_per_s) {
+  if (options_.checkpoint_path.empty()) {
+    options_.checkpoint_path = options_.dst_dir + "/.migrate-checkpoint";
+  }
+}
+
+Migration::~Migration() {
+  if (checkpoint_) {
+    fclose(checkpoint_);
+  }
+}
+
+bool Migration::Prepare(std::string* out_path) {
+  std::vector<std::string> captures;
+  if (!ListCaptures(options_.src_dir, &captures)) {
+    *out_path = options_.src_dir;
+    return false;
+  }
+  num_captures_ = captures.size();
+  mkdir(options_.dst_dir.c_str(), 0777);
+
+  // Captures completed by previous runs.
+  std::set<std::string> completed;
+  {
+    std::ifstream checkpoint(options_.checkpoint_path);
+    for (std::string line; std::getline(checkpoint, line);) {
+      completed.insert(line);
+    }
+  }
+  for (const auto& name : captures) {
+    if (completed.count(name)) {
+      num_completed_++;
+    } else if (options_.max_captures == 0 || pending_.size() < options_.max_captures) {
+      pending_.push_back(name);
+    }
+  }
+  checkpoint_ = fopen(options_.checkpoint_path.c_str(), "a");
+  if (!checkpoint_) {
+    *out_path = options_.checkpoint_path;
+    return false;
+  }
+  return true;
+}
+
+void Migration::Run(std::vector<WorkerStats>* out_stats) {
+  out_stats->assign(options_.threads, WorkerStats());
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < options_.threads; i++) {
+    workers.emplace_back([this, out_stats, i] { Work(&(*out_stats)[i]); });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+// Migrates pending captures until there are none left.
+void Migration::Work(WorkerStats* stats) {
+  std::vector<uint8_t> dst_bytes(kDstCapacity);
+  std::vector<uint8_t> verify_bytes(kDstCapacity);
+  Clock::duration cpu_debt = Clock::duration::zero();
+  for (size_t i = next_++; i < pending_.size(); i = next_++) {
+    const std::string& name = pending_[i];
+    const char* error = nullptr;
+    uint64_t index = 0;
+    if (Migrate(name, dst_bytes.data(), verify_bytes.data(), &index, &cpu_debt, stats, &error)) {
+      stats->captures++;
+    } else {
+      stats->failures++;
+      std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+      fprintf(stderr, "%s: message %llu: %s\n", name.c_str(),
+              static_cast<unsigned long long>(index), error);
+    }
+  }
+}
+
+bool Migration::Migrate(const std::string& name, uint8_t* dst_bytes, uint8_t* verify_bytes,
+                        uint64_t* out_index, Clock::duration* cpu_debt, WorkerStats* stats,
+                        const char** out_error) {
+  const std::string src_path = options_.src_dir + "/" + name;
+  const std::string dst_path = options_.dst_dir + "/" + name;
+  const std::string tmp_path = options_.dst_dir + "/." + name + ".tmp";
+
+  CaptureReader reader;
+  CaptureWriter writer;
+  if (!reader.Open(src_path.c_str())) {
+    *out_error = reader.error();
+    return false;
+  }
+  if (!writer.Open(tmp_path.c_str())) {
+    *out_error = "cannot create the temporary capture";
+    return false;
+  }
+  bool ok = true;
+  CaptureRecord record;
+  uint64_t old_messages = 0;
+  for (*out_index = 0;; ++*out_index) {
+    const Clock::time_point start = Clock::now();
+    if (!reader.Next(&record)) {
+      *out_error = reader.error();
+      ok = reader.error() == nullptr;
+      break;
+    }
+    ok = MigrateRecord(record, dst_bytes, verify_bytes, &old_messages, &writer, stats, out_error);
+
+    // Workers sleep in proportion to the time they spent working, so that
+    // they only work |cpu_percent| of the time.
+    const Clock::duration busy = Clock::now() - start;
+    stats->busy += busy;
+    *cpu_debt += busy * (100 - options_.cpu_percent) / options_.cpu_percent;
+    if (*cpu_debt >= kMinCpuSleep) {
+      std::this_thread::sleep_for(*cpu_debt);
+      stats->throttled += *cpu_debt;
+      *cpu_debt = Clock::duration::zero();
+    }
+    if (!ok) {
+      break;
+    }
+  }
+  if (ok && !writer.Close()) {
+    *out_error = "cannot write the temporary capture";
+    ok = false;
+  }
+  if (ok && rename(tmp_path.c_str(), dst_path.c_str()) != 0) {
+    *out_error = "cannot rename the temporary capture";
+    ok = false;
+  }
+  if (!ok) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  // Until the rename reaches storage, the checkpoint must not list the
+  // capture: a job resumed after a crash would skip it for good.
+  if (!SyncDirectory(options_.dst_dir)) {
+    *out_error = "cannot flush the destination directory";
+    return false;
+  }
+  Commit(name);
+  return true;
+}
+
+bool Migration::MigrateRecord(const CaptureRecord& record, uint8_t* dst_bytes,
+                              uint8_t* verify_bytes, uint64_t* old_messages,
+                              CaptureWriter* writer, WorkerStats* stats, const char** out_error) {
+  const uint8_t* bytes = record.bytes.data();
+  const uint32_t num_bytes = static_cast<uint32_t>(record.bytes.size());
+  const fidl_type_t* old_type;
+  const fidl_type_t* v1_type;
+  const bool found =
+      options_.library
+          ? fidl_ir_lookup(options_.library, FIDL_WIRE_FORMAT_OLD, record.name.c_str(),
+                           &old_type) == ZX_OK &&
+                fidl_ir_lookup(options_.library, FIDL_WIRE_FORMAT_V1, record.name.c_str(),
+                               &v1_type) == ZX_OK
+          : options_.find_types && options_.find_types(record.name, &old_type, &v1_type);
+  if (!found) {
+    *out_error = "message of unknown type";
+    return false;
+  }
+
+  const uint8_t* v1_bytes = bytes;
+  uint32_t v1_num_bytes = num_bytes;
+  if (record.wire_format == kCaptureWireFormatOld) {
+    if (fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, old_type, bytes, num_bytes, dst_bytes,
+                       &v1_num_bytes, out_error) != ZX_OK) {
+      return false;
+    }
+    v1_bytes = dst_bytes;
+    if (options_.verify_every != 0 && (*old_messages)++ % options_.verify_every == 0) {
+      uint32_t verify_num_bytes;
+      if (fidl_transform(FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, v1_bytes, v1_num_bytes,
+                         verify_bytes, &verify_num_bytes, out_error) != ZX_OK) {
+        return false;
+      }
+      if (verify_num_bytes != num_bytes || memcmp(verify_bytes, bytes, num_bytes) != 0) {
+        *out_error = "message changed when transformed back to the old wire format";
+        return false;
+      }
+      stats->verified++;
+    }
+  }
+  if (!writer->Write(kCaptureWireFormatV1, record.name.c_str(), v1_bytes, v1_num_bytes,
+                     record.num_handles)) {
+    *out_error = "cannot write the temporary capture";
+    return false;
+  }
+  stats->messages++;
+  stats->bytes_read += num_bytes;
+  stats->bytes_written += v1_num_bytes;
+  stats->throttled += io_throttle_.Consume(num_bytes + v1_num_bytes);
+  return true;
+}
+
+void Migration::Commit(const std::string& name) {
+  std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+  if (fprintf(checkpoint_, "%s\n", name.c_str()) < 0 || fflush(checkpoint_) != 0 ||
+      fsync(fileno(checkpoint_)) != 0) {
+    // The capture is complete, and will only be migrated again.
+    fprintf(stderr, "%s: cannot record in the checkpoint\n", name.c_str());
+  }
+}
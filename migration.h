@@ -0,0 +1,138 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef MIGRATION_H_
+#define MIGRATION_H_
+
+// Migration of a directory of captures (see `capture.h`) holding messages at
+// rest from the old wire format to v1, as done by the `migrate` tool.
+//
+// Each capture of the source directory is migrated to a capture of the same
+// name in the destination directory, in which every message is in v1 (messages
+// already in v1 are copied as is). Captures are migrated by the workers in
+// parallel, one capture per worker at a time. A capture is written to a
+// temporary file, flushed to storage, and then renamed, so that the destination
+// only ever holds complete captures.
+//
+// Once renamed, the destination directory is flushed to storage, so that the
+// rename outlives a crash, and only then is the name of the capture appended to
+// the checkpoint, and flushed to storage. Captures listed in the checkpoint are
+// skipped, so that a job which was stopped resumes with the captures it had not
+// completed (at worst migrating again the captures it completed without
+// recording them). Captures which fail (e.g. with malformed messages, messages
+// of unknown types, or a failed verification) are reported and not written.
+
+#include <lib/fidl/ir.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "fidl.h"
+
+class Migration final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    std::string src_dir;
+    std::string dst_dir;
+    // Checkpoint file, |dst_dir|/.migrate-checkpoint if empty.
+    std::string checkpoint_path;
+    uint32_t threads = 1;
+    // Budget of bytes read and written per second, shared by all workers (0 for
+    // unlimited).
+    double io_bytes_per_s = 0;
+    // Share of its time each worker spends migrating, the rest being spent
+    // sleeping.
+    uint32_t cpu_percent = 100;
+    // Transforms every N-th old message of each capture back to the old wire
+    // format, and checks it is unchanged (0 disables verification).
+    uint32_t verify_every = 100;
+    // Coding tables are looked up in |library| if set, and otherwise with
+    // |find_types| (e.g. in `tables_catalog.h`), which stores those of the type
+    // |name| in both wire formats, and returns false if it is unknown.
+    const fidl_ir_library_t* library = nullptr;
+    bool (*find_types)(const std::string& name, const fidl_type_t** out_old_type,
+                       const fidl_type_t** out_v1_type) = nullptr;
+    // Migrates at most this many captures (0 for no limit), leaving the others
+    // to a later job, as if the job were stopped.
+    uint64_t max_captures = 0;
+  };
+
+  struct WorkerStats {
+    uint64_t captures = 0;
+    uint64_t failures = 0;
+    uint64_t messages = 0;
+    uint64_t verified = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    Clock::duration busy = Clock::duration::zero();
+    Clock::duration throttled = Clock::duration::zero();
+
+    void Merge(const WorkerStats& other);
+  };
+
+  explicit Migration(const Options& options);
+  ~Migration();
+  Migration(const Migration&) = delete;
+  Migration& operator=(const Migration&) = delete;
+
+  // Lists the captures of the source directory, creates the destination
+  // directory, and opens the checkpoint, skipping the captures it lists.
+  // Returns false on failure, with |*out_path| set to the path which failed
+  // and errno set.
+  bool Prepare(std::string* out_path);
+
+  size_t num_captures() const { return num_captures_; }
+  // Captures listed in the checkpoint.
+  size_t num_completed() const { return num_completed_; }
+  size_t num_pending() const { return pending_.size(); }
+
+  // Migrates the pending captures with |threads| workers, and stores the
+  // statistics of each into |out_stats|. Failed captures are reported on
+  // stderr.
+  void Run(std::vector<WorkerStats>* out_stats);
+
+ private:
+  class IoThrottle final {
+   public:
+    explicit IoThrottle(double bytes_per_s) : bytes_per_s_(bytes_per_s), start_(Clock::now()) {}
+
+    // Accounts for |bytes|, and sleeps until the budget allows them. Returns
+    // the time slept.
+    Clock::duration Consume(uint64_t bytes);
+
+   private:
+    const double bytes_per_s_;
+    const Clock::time_point start_;
+    std::mutex mutex_;
+    uint64_t total_bytes_ = 0;
+  };
+
+  void Work(WorkerStats* stats);
+  bool Migrate(const std::string& name, uint8_t* dst_bytes, uint8_t* verify_bytes,
+               uint64_t* out_index, Clock::duration* cpu_debt, WorkerStats* stats,
+               const char** out_error);
+  bool MigrateRecord(const CaptureRecord& record, uint8_t* dst_bytes, uint8_t* verify_bytes,
+                     uint64_t* old_messages, CaptureWriter* writer, WorkerStats* stats,
+                     const char** out_error);
+  void Commit(const std::string& name);
+
+  Options options_;
+  size_t num_captures_ = 0;
+  size_t num_completed_ = 0;
+  std::vector<std::string> pending_;
+  std::atomic<size_t> next_{0};
+  FILE* checkpoint_ = nullptr;
+  // Also serializes error reports.
+  std::mutex checkpoint_mutex_;
+  IoThrottle io_throttle_;
+};
+
+#endif  // MIGRATION_H_
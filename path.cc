@@ -0,0 +1,237 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/path.h>
+#include <lib/fidl/json_internal.h>
+#include <lib/fidl/view_internal.h>
+
+#include <cstring>
+
+namespace {
+
+using fidl::internal::JsonWriter;
+using fidl::internal::kViewMaxDepth;
+using fidl::internal::ViewedStruct;
+using fidl::internal::ViewedUnion;
+
+// Finds the path to the innermost object at an offset of a message, by
+// descending from the viewed object into the child which holds the offset.
+//
+// A child holds the offset if it lies within the child, or within its
+// out-of-line objects. Out-of-line objects are laid out in the order of their
+// parents, so the latter is the last child whose out-of-line objects start at
+// or before the offset (children without out-of-line objects start theirs
+// where the next child does).
+class PathFinder final {
+ public:
+  PathFinder(uint32_t offset, fidl_json_describe_t describe, void* context, char* out_path,
+             uint32_t capacity)
+      : offset_(offset), describe_(describe), context_(context), writer_(out_path, capacity) {}
+
+  zx_status_t Find(const fidl_view_t& view, uint32_t* out_size, const char** out_error_msg) {
+    if (offset_ >= view.num_bytes) {
+      return Fail(ZX_ERR_OUT_OF_RANGE, "offset is past the end of the message", out_error_msg);
+    }
+    const auto* coded_struct = ViewedStruct(view.type);
+    const char* name = coded_struct && coded_struct->name ? coded_struct->name : "";
+    // Only the last component of the fully qualified name, e.g. "Sandwich1" for
+    // "example/Sandwich1".
+    const char* slash = strrchr(name, '/');
+    name = slash ? slash + 1 : name;
+    writer_.Append(name, static_cast<uint32_t>(strlen(name)));
+
+    fidl_view_t current = view;
+    for (uint32_t depth = 0; depth < kViewMaxDepth && Descend(&current); depth++) {
+    }
+    if (writer_.full()) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "path does not fit", out_error_msg);
+    }
+    *out_size = writer_.size();
+    return ZX_OK;
+  }
+
+ private:
+  bool Holds(const fidl_view_t& child) const {
+    return (offset_ >= child.offset && offset_ - child.offset < child.size) ||
+           child.out_of_line_offset <= offset_;
+  }
+
+  bool Within(const fidl_view_t& child) const {
+    return offset_ >= child.offset && offset_ - child.offset < child.size;
+  }
+
+  // Replaces |*view| by its child which holds the offset, and appends the child
+  // to the path. Returns false if there is none.
+  bool Descend(fidl_view_t* view) {
+    const fidl_type_t* type = view->type;
+    if (!type) {
+      return false;
+    }
+    if (const auto* coded_struct = ViewedStruct(type)) {
+      return DescendStruct(*coded_struct, view);
+    }
+    if (const auto* coded_union = ViewedUnion(type)) {
+      return DescendVariant(coded_union->name, view);
+    }
+    switch (type->type_tag) {
+      case fidl::kFidlTypeXUnion:
+        return DescendVariant(type->coded_xunion.name, view);
+      case fidl::kFidlTypeTable:
+        return DescendTable(type->coded_table, view);
+      case fidl::kFidlTypeArray:
+      case fidl::kFidlTypeVector:
+        return DescendElements(view);
+      default:
+        return false;
+    }
+  }
+
+  bool DescendStruct(const fidl::FidlCodedStruct& coded_struct, fidl_view_t* view) {
+    // Fields are named by their offset in the old wire format.
+    const auto* old_struct =
+        view->wire_format == FIDL_WIRE_FORMAT_OLD ? &coded_struct : coded_struct.alt_type;
+    if (!old_struct) {
+      return false;
+    }
+    fidl_view_t child, found;
+    uint32_t found_key = 0;
+    bool has_found = false;
+    for (uint32_t i = 0, index = 0; i < old_struct->field_count; i++) {
+      const auto& old_field = old_struct->fields[i];
+      if (!old_field.type) {
+        continue;
+      }
+      const zx_status_t status = fidl_view_field(view, index++, &child, nullptr);
+      if (status == ZX_ERR_NOT_FOUND) {
+        continue;
+      }
+      if (status != ZX_OK) {
+        break;
+      }
+      if (Holds(child)) {
+        found = child;
+        found_key = old_field.offset;
+        has_found = true;
+        if (Within(child)) {
+          break;
+        }
+      }
+    }
+    if (!has_found) {
+      return false;
+    }
+    AppendField(old_struct->name, found_key);
+    *view = found;
+    return true;
+  }
+
+  bool DescendVariant(const char* type_name, fidl_view_t* view) {
+    uint32_t variant;
+    fidl_view_t child;
+    if (fidl_view_variant(view, &variant, &child, nullptr) != ZX_OK || !Holds(child)) {
+      return false;
+    }
+    AppendField(type_name, variant);
+    *view = child;
+    return true;
+  }
+
+  bool DescendTable(const fidl::FidlCodedTable& coded_table, fidl_view_t* view) {
+    fidl_view_t child, found;
+    uint32_t found_ordinal = 0;
+    for (uint32_t i = 0; i < coded_table.field_count; i++) {
+      const uint32_t ordinal = coded_table.fields[i].ordinal;
+      const zx_status_t status = fidl_view_table_field(view, ordinal, &child, nullptr);
+      if (status == ZX_ERR_NOT_FOUND) {
+        continue;
+      }
+      if (status != ZX_OK) {
+        break;
+      }
+      if (Holds(child)) {
+        found = child;
+        found_ordinal = ordinal;
+        if (Within(child)) {
+          break;
+        }
+      }
+    }
+    if (found_ordinal == 0) {
+      return false;
+    }
+    AppendField(coded_table.name, found_ordinal);
+    *view = found;
+    return true;
+  }
+
+  bool DescendElements(fidl_view_t* view) {
+    uint32_t count;
+    fidl_view_t first, child;
+    if (fidl_view_count(view, &count, nullptr) != ZX_OK || count == 0 ||
+        fidl_view_element(view, 0, &first, nullptr) != ZX_OK ||
+        (count > 1 && fidl_view_element(view, 1, &child, nullptr) != ZX_OK)) {
+      return false;
+    }
+    // Elements are contiguous, and their out-of-line objects in order, so the
+    // element is found by its offset or by bisection.
+    const uint32_t stride = count > 1 ? child.offset - first.offset : first.size;
+    uint32_t index;
+    if (offset_ >= first.offset && stride != 0 && (offset_ - first.offset) / stride < count) {
+      index = (offset_ - first.offset) / stride;
+    } else {
+      uint32_t low = 0, high = count;
+      while (high - low > 1) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (fidl_view_element(view, middle, &child, nullptr) != ZX_OK) {
+          return false;
+        }
+        if (child.out_of_line_offset <= offset_) {
+          low = middle;
+        } else {
+          high = middle;
+        }
+      }
+      index = low;
+    }
+    if (fidl_view_element(view, index, &child, nullptr) != ZX_OK || !Holds(child)) {
+      return false;
+    }
+    writer_.Put('[');
+    writer_.Unsigned(index);
+    writer_.Put(']');
+    *view = child;
+    return true;
+  }
+
+  void AppendField(const char* type_name, uint32_t key) {
+    fidl_json_field_t field = {};
+    writer_.Put('.');
+    if (describe_ && describe_(context_, type_name, key, &field) && field.name) {
+      writer_.Append(field.name, static_cast<uint32_t>(strlen(field.name)));
+    } else {
+      writer_.Unsigned(key);
+    }
+  }
+
+  static zx_status_t Fail(zx_status_t status, const char* error_msg, const char** out_error_msg) {
+    if (out_error_msg) {
+      *out_error_msg = error_msg;
+    }
+    return status;
+  }
+
+  const uint32_t offset_;
+  const fidl_json_describe_t describe_;
+  void* const context_;
+  JsonWriter writer_;
+};
+
+}  // namespace
+
+zx_status_t fidl_view_path(const fidl_view_t* view, uint32_t offset, fidl_json_describe_t describe,
+                           void* context, char* out_path, uint32_t capacity, uint32_t* out_size,
+                           const char** out_error_msg) {
+  return PathFinder(offset, describe, context, out_path, capacity)
+      .Find(*view, out_size, out_error_msg);
+}
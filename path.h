@@ -0,0 +1,35 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_PATH_H_
+#define LIB_FIDL_PATH_H_
+
+#include "fidl.h"
+#include "json.h"
+#include "view.h"
+
+// __BEGIN_CDECLS
+
+// Writes into |out_path| the path from the viewed struct to the innermost
+// object at |offset| of the message (e.g. the |src_offset| of a
+// `fidl_transform_failure_t`), and stores its size (it is not null-terminated)
+// into |out_size|. Fails with `ZX_ERR_BUFFER_TOO_SMALL` if it does not fit in
+// |capacity| bytes.
+//
+// The path starts with the name of the struct, without its library, followed
+// by the fields, variants and elements leading to the object, e.g.
+// "Sandwich6.the_union.vector_union[3]". Fields and variants are named by
+// |describe| (as in `fidl_view_dump_json`) if provided, and otherwise by their
+// key as a decimal number. The path stops at the deepest object which could be
+// read, so that it leads as close as possible to where malformed messages are
+// malformed, and at structs for their primitive members (which have no coding
+// table). This walks the message again, and is meant for reporting
+// failures, not for hot paths.
+zx_status_t fidl_view_path(const fidl_view_t* view, uint32_t offset, fidl_json_describe_t describe,
+                           void* context, char* out_path, uint32_t capacity, uint32_t* out_size,
+                           const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_PATH_H_
@@ -0,0 +1,363 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/projection.h>
+#include <lib/fidl/view_internal.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+using fidl::internal::InlineSize;
+using fidl::internal::VariantSize;
+using fidl::internal::VectorShape;
+using fidl::internal::ViewReader;
+using fidl::internal::WireFormat;
+
+// Writes the projection of a message onto a set of field paths, as a message in
+// the same wire format, into a buffer. Selected fields are copied along with
+// their out-of-line objects (which are contiguous in the source), and other
+// fields are written as their zero value without reading them.
+class Projector final {
+ public:
+  Projector(const fidl_view_t& message, const fidl_field_path_t* paths, uint32_t num_paths,
+            std::vector<uint8_t>* out_bytes)
+      : reader_(message),
+        message_(message),
+        wire_format_(message.wire_format == FIDL_WIRE_FORMAT_V1 ? WireFormat::kV1
+                                                                 : WireFormat::kOld),
+        paths_(paths),
+        num_paths_(num_paths),
+        out_bytes_(out_bytes) {}
+
+  bool Project() {
+    const auto& coded_struct = message_.type->coded_struct;
+    uint32_t src_out_of_line_offset = message_.out_of_line_offset;
+    uint32_t dst_offset;
+    return Allocate(coded_struct.size, &dst_offset) &&
+           ProjectStruct(coded_struct, message_.offset, &src_out_of_line_offset, dst_offset, 0,
+                         false);
+  }
+
+  zx_status_t Result(const char** out_error_msg) const { return reader_.Result(out_error_msg); }
+
+ private:
+  // Projects the struct at |src_offset| onto the paths, whose first |depth|
+  // elements lead to it. Its out-of-line objects are claimed from
+  // |*src_out_of_line_offset|, which is left past them if |need_end|.
+  bool ProjectStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t src_offset,
+                     uint32_t* src_out_of_line_offset, uint32_t dst_offset, uint32_t depth,
+                     bool need_end) {
+    // Fields after the last selected one need not be skipped, unless the
+    // objects after this struct are needed.
+    uint32_t num_coded_fields = 0, num_needed_fields = 0;
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      num_coded_fields += coded_struct.fields[i].type != nullptr;
+    }
+    for (uint32_t i = 0; i < num_paths_; i++) {
+      if (!OnPath(paths_[i], depth)) {
+        continue;
+      }
+      if (paths_[i].elements[depth] >= num_coded_fields) {
+        return reader_.Fail(ZX_ERR_OUT_OF_RANGE, "field path names no field");
+      }
+      num_needed_fields = std::max(num_needed_fields, paths_[i].elements[depth] + 1);
+    }
+    if (need_end) {
+      num_needed_fields = num_coded_fields;
+    }
+
+    memcpy(&(*out_bytes_)[dst_offset], &message_.bytes[src_offset], coded_struct.size);
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      const auto& field = coded_struct.fields[i];
+      if (!field.type) {
+        continue;
+      }
+      const uint32_t field_src_offset = src_offset + field.offset;
+      const uint32_t field_dst_offset = dst_offset + field.offset;
+      bool selected = false, on_path = false;
+      for (uint32_t j = 0; j < num_paths_; j++) {
+        if (OnPath(paths_[j], depth) && paths_[j].elements[depth] == index) {
+          on_path = true;
+          selected = selected || paths_[j].num_elements == depth + 1;
+        }
+      }
+      const bool needed = index++ < num_needed_fields;
+      if (selected) {
+        if (!Copy(field.type, field_src_offset, src_out_of_line_offset)) {
+          return false;
+        }
+      } else if (on_path) {
+        if (!Descend(field.type, field_src_offset, src_out_of_line_offset, field_dst_offset,
+                     depth + 1, index < num_needed_fields)) {
+          return false;
+        }
+      } else if ((needed && !reader_.Skip(field.type, field_src_offset, src_out_of_line_offset,
+                                          0)) ||
+                 !Clear(field.type, field_dst_offset, InlineSize(field.type, wire_format_))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Projects the struct or table of the field at |src_offset|, which is on
+  // the paths but not selected as a whole.
+  bool Descend(const fidl_type_t* type, uint32_t src_offset, uint32_t* src_out_of_line_offset,
+               uint32_t dst_offset, uint32_t depth, bool need_end) {
+    switch (type->type_tag) {
+      case fidl::kFidlTypeStruct:
+        return ProjectStruct(type->coded_struct, src_offset, src_out_of_line_offset, dst_offset,
+                             depth, need_end);
+      case fidl::kFidlTypeStructPointer: {
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        bool present;
+        uint32_t src_struct_offset, dst_struct_offset;
+        if (!reader_.ReadPresence(src_offset, &present)) {
+          return false;
+        }
+        return !present ||
+               (reader_.Claim(coded_struct.size, src_out_of_line_offset, &src_struct_offset) &&
+                Allocate(coded_struct.size, &dst_struct_offset) &&
+                ProjectStruct(coded_struct, src_struct_offset, src_out_of_line_offset,
+                              dst_struct_offset, depth, need_end));
+      }
+      case fidl::kFidlTypeTable:
+        return ProjectTable(src_offset, src_out_of_line_offset, depth, need_end);
+      default:
+        return reader_.Fail(ZX_ERR_INVALID_ARGS, "field path descends into a non-struct field");
+    }
+  }
+
+  // Copies the envelopes of the selected fields of a table, whose ordinals are
+  // the last elements of the paths; the others are left absent.
+  bool ProjectTable(uint32_t src_offset, uint32_t* src_out_of_line_offset, uint32_t depth,
+                    bool need_end) {
+    fidl_vector_t envelopes;
+    if (!reader_.Read(src_offset, &envelopes, sizeof(envelopes))) {
+      return false;
+    }
+    uint32_t num_needed_envelopes = 0;
+    for (uint32_t i = 0; i < num_paths_; i++) {
+      if (!OnPath(paths_[i], depth)) {
+        continue;
+      }
+      if (paths_[i].num_elements != depth + 1) {
+        return reader_.Fail(ZX_ERR_INVALID_ARGS, "field path continues past a table field");
+      }
+      num_needed_envelopes = std::max(num_needed_envelopes, paths_[i].elements[depth]);
+    }
+    uint32_t src_envelopes_offset, dst_envelopes_offset;
+    if (envelopes.count > message_.num_bytes ||
+        !reader_.Claim(envelopes.count * sizeof(fidl_envelope_t), src_out_of_line_offset,
+                       &src_envelopes_offset)) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+    }
+    const uint32_t count = static_cast<uint32_t>(envelopes.count);
+    if (need_end) {
+      num_needed_envelopes = count;
+    }
+    // The table keeps its envelopes, which are absent unless selected.
+    if (!Allocate(count * static_cast<uint32_t>(sizeof(fidl_envelope_t)), &dst_envelopes_offset)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count && i < num_needed_envelopes; i++) {
+      const uint32_t envelope_offset = i * static_cast<uint32_t>(sizeof(fidl_envelope_t));
+      fidl_envelope_t envelope;
+      bool present;
+      uint32_t src_contents_offset, dst_contents_offset;
+      if (!reader_.ReadEnvelope(src_envelopes_offset + envelope_offset, &envelope, &present)) {
+        return false;
+      }
+      if (!present) {
+        continue;
+      }
+      if (!reader_.Claim(envelope.num_bytes, src_out_of_line_offset, &src_contents_offset)) {
+        return false;
+      }
+      bool selected = false;
+      for (uint32_t j = 0; j < num_paths_; j++) {
+        selected = selected || (OnPath(paths_[j], depth) && paths_[j].elements[depth] == i + 1);
+      }
+      if (!selected) {
+        continue;
+      }
+      if (!Allocate(envelope.num_bytes, &dst_contents_offset)) {
+        return false;
+      }
+      memcpy(&(*out_bytes_)[dst_contents_offset], &message_.bytes[src_contents_offset],
+             envelope.num_bytes);
+      Write(dst_envelopes_offset + envelope_offset, envelope);
+    }
+    return true;
+  }
+
+  // Copies the out-of-line objects of the selected object at |src_offset|,
+  // whose inline part is already copied.
+  bool Copy(const fidl_type_t* type, uint32_t src_offset, uint32_t* src_out_of_line_offset) {
+    const uint32_t start = *src_out_of_line_offset;
+    uint32_t dst_out_of_line_offset;
+    if (!reader_.Skip(type, src_offset, src_out_of_line_offset, 0) ||
+        !Allocate(*src_out_of_line_offset - start, &dst_out_of_line_offset)) {
+      return false;
+    }
+    memcpy(&(*out_bytes_)[dst_out_of_line_offset], &message_.bytes[start],
+           *src_out_of_line_offset - start);
+    return true;
+  }
+
+  // Writes the zero value of |type| (|size| bytes if it has no coding table)
+  // at |dst_offset|.
+  bool Clear(const fidl_type_t* type, uint32_t dst_offset, uint32_t size) {
+    memset(&(*out_bytes_)[dst_offset], 0, size);
+    if (!type) {
+      return true;
+    }
+    switch (type->type_tag) {
+      case fidl::kFidlTypeStruct: {
+        const auto& coded_struct = type->coded_struct;
+        for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+          const auto& field = coded_struct.fields[i];
+          if (field.type && !Clear(field.type, dst_offset + field.offset,
+                                   InlineSize(field.type, wire_format_))) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeUnion: {
+        const auto& coded_union = type->coded_union;
+        const auto& field = coded_union.fields[0];
+        const uint32_t variant_size = VariantSize(coded_union, 0, wire_format_);
+        if (wire_format_ == WireFormat::kOld) {
+          return Clear(field.type, dst_offset + coded_union.data_offset, variant_size);
+        }
+        const uint32_t start = static_cast<uint32_t>(out_bytes_->size());
+        uint32_t contents_offset;
+        if (!Allocate(variant_size, &contents_offset) ||
+            !Clear(field.type, contents_offset, variant_size)) {
+          return false;
+        }
+        fidl_xunion_t xunion = {};
+        xunion.tag = field.xunion_ordinal;
+        xunion.envelope.num_bytes = static_cast<uint32_t>(out_bytes_->size()) - start;
+        xunion.envelope.presence = FIDL_ALLOC_PRESENT;
+        Write(dst_offset, xunion);
+        return true;
+      }
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        for (uint32_t element_offset = 0; coded_array.element &&
+                                          element_offset < coded_array.array_size;
+             element_offset += coded_array.element_size) {
+          if (!Clear(coded_array.element, dst_offset + element_offset,
+                     coded_array.element_size)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeString:
+      case fidl::kFidlTypeVector: {
+        const fidl_type_t* element;
+        uint32_t element_size, max_count;
+        bool nullable;
+        VectorShape(type, &element, &element_size, &nullable, &max_count);
+        if (!nullable) {
+          Write(dst_offset, fidl_vector_t{0, reinterpret_cast<void*>(FIDL_ALLOC_PRESENT)});
+        }
+        return true;
+      }
+      case fidl::kFidlTypeTable:
+        Write(dst_offset, fidl_vector_t{0, reinterpret_cast<void*>(FIDL_ALLOC_PRESENT)});
+        return true;
+      default:
+        // Zero is absent for handles, pointers and xunions.
+        return true;
+    }
+  }
+
+  static bool OnPath(const fidl_field_path_t& path, uint32_t depth) {
+    return path.num_elements > depth;
+  }
+
+  // Allocates (and zeroes) the next out-of-line object of the projection.
+  bool Allocate(uint32_t size, uint32_t* out_offset) {
+    const uint32_t offset = static_cast<uint32_t>(out_bytes_->size());
+    uint32_t new_offset;
+    if (!fidl::AddOutOfLine(offset, size, &new_offset)) {
+      return reader_.Fail(ZX_ERR_INVALID_ARGS, "projection is too large");
+    }
+    out_bytes_->resize(new_offset);
+    *out_offset = offset;
+    return true;
+  }
+
+  template <typename T>
+  void Write(uint32_t offset, const T& value) {
+    assert(offset + sizeof(T) <= out_bytes_->size());
+    memcpy(&(*out_bytes_)[offset], &value, sizeof(T));
+  }
+
+  ViewReader reader_;
+  const fidl_view_t message_;
+  const WireFormat wire_format_;
+  const fidl_field_path_t* const paths_;
+  const uint32_t num_paths_;
+  std::vector<uint8_t>* const out_bytes_;
+};
+
+}  // namespace
+
+zx_status_t fidl_transform_projection(fidl_transformation_t transformation,
+                                      const fidl_type_t* type, const fidl_field_path_t* paths,
+                                      uint32_t num_paths, const uint8_t* src_bytes,
+                                      uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                      uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  fidl_wire_format_t wire_format;
+  switch (transformation) {
+    case FIDL_TRANSFORMATION_OLD_TO_V1:
+    case FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT:
+      wire_format = FIDL_WIRE_FORMAT_OLD;
+      break;
+    case FIDL_TRANSFORMATION_V1_TO_OLD:
+    case FIDL_TRANSFORMATION_V1_TO_V1_COMPACT:
+      wire_format = FIDL_WIRE_FORMAT_V1;
+      break;
+    default:
+      if (out_error_msg) {
+        *out_error_msg = "unsupported transformation for projections";
+      }
+      return ZX_ERR_INVALID_ARGS;
+  }
+  fidl_view_t message;
+  zx_status_t status =
+      fidl_view_init(wire_format, type, src_bytes, src_num_bytes, &message, out_error_msg);
+  if (status != ZX_OK) {
+    return status;
+  }
+  for (uint32_t i = 0; i < num_paths; i++) {
+    if (paths[i].num_elements == 0) {
+      return fidl_transform(transformation, type, src_bytes, src_num_bytes, dst_bytes,
+                            out_dst_num_bytes, out_error_msg);
+    }
+  }
+
+  // The projection is kept in the source wire format, in a buffer of the
+  // calling thread which grows to the largest projection, and then transformed:
+  // only its bytes are walked twice, not those of the message.
+  thread_local std::vector<uint8_t> projection;
+  projection.clear();
+  Projector projector(message, paths, num_paths, &projection);
+  if (!projector.Project()) {
+    return projector.Result(out_error_msg);
+  }
+  return fidl_transform(transformation, type, projection.data(),
+                        static_cast<uint32_t>(projection.size()), dst_bytes, out_dst_num_bytes,
+                        out_error_msg);
+}
@@ -0,0 +1,37 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_PROJECTION_H_
+#define LIB_FIDL_PROJECTION_H_
+
+#include "fidl.h"
+#include "transformer.h"
+#include "view.h"
+
+// __BEGIN_CDECLS
+
+// Same as `fidl_transform`, except that only the fields selected by the
+// |num_paths| |paths| (and everything in them) are transformed. The structs
+// along the paths keep their primitive members; their other fields hold their
+// zero value: absent if nullable, and otherwise empty (strings, vectors, tables
+// and xunions), zeroed, or the zeroed first variant (static unions). Fields of
+// tables which are not selected are absent.
+//
+// Fields which are not selected are only walked when needed to locate later
+// selected fields, and then only as far as views do (see `view.h`), so that the
+// cost follows the size of the projection rather than that of the message.
+// The selected fields are first written in the source wire format into a buffer
+// of the calling thread (kept between calls), which is then transformed into
+// |dst_bytes|: the projection is walked twice, the message once.
+//
+// Only transformations from the old and v1 wire formats are supported.
+zx_status_t fidl_transform_projection(fidl_transformation_t transformation,
+                                      const fidl_type_t* type, const fidl_field_path_t* paths,
+                                      uint32_t num_paths, const uint8_t* src_bytes,
+                                      uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                      uint32_t* out_dst_num_bytes, const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_PROJECTION_H_
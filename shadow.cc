@@ -0,0 +1,168 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "shadow.h"
+
+#include <lib/fidl/storage.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char* TypeName(const fidl_type_t* type) {
+  return type->type_tag == fidl::kFidlTypeStruct && type->coded_struct.name
+             ? type->coded_struct.name
+             : "";
+}
+
+}  // namespace
+
+ShadowVerifier::ShadowVerifier(const Options& options)
+    : options_(options), slots_(std::max(options.max_backlog, 1u)) {
+  for (size_t i = slots_.size(); i > 0; i--) {
+    free_.push_back(i - 1);
+  }
+  thread_ = std::thread([this] { Run(); });
+}
+
+ShadowVerifier::~ShadowVerifier() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+  if (capture_open_) {
+    capture_.Close();
+  }
+}
+
+void ShadowVerifier::Observe(fidl_transformation_t transformation, const fidl_type_t* src_type,
+                             const fidl_type_t* dst_type, const uint8_t* src_bytes,
+                             uint32_t src_num_bytes, const uint8_t* dst_bytes,
+                             uint32_t dst_num_bytes) {
+  const uint64_t observed = observed_.fetch_add(1, std::memory_order_relaxed);
+  if (options_.sample_every == 0 || observed % options_.sample_every != 0 ||
+      (transformation != FIDL_TRANSFORMATION_OLD_TO_V1 &&
+       transformation != FIDL_TRANSFORMATION_V1_TO_OLD)) {
+    return;
+  }
+
+  size_t slot;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.sampled++;
+    if (free_.empty()) {
+      stats_.skipped++;
+      return;
+    }
+    slot = free_.back();
+    free_.pop_back();
+  }
+  // The slot is owned by this thread until it is pending. Its buffers keep
+  // their capacity from earlier samples.
+  Sample& sample = slots_[slot];
+  sample.transformation = transformation;
+  sample.src_type = src_type;
+  sample.dst_type = dst_type;
+  sample.src_bytes.assign(src_bytes, src_bytes + src_num_bytes);
+  sample.dst_bytes.assign(dst_bytes, dst_bytes + dst_num_bytes);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(slot);
+  }
+  wake_.notify_one();
+}
+
+void ShadowVerifier::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return pending_.empty() && !verifying_; });
+}
+
+ShadowVerifier::Stats ShadowVerifier::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = stats_;
+  stats.observed = observed_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void ShadowVerifier::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return !pending_.empty() || stopping_; });
+    if (pending_.empty()) {
+      return;
+    }
+    const size_t slot = pending_.front();
+    pending_.pop_front();
+    verifying_ = true;
+    lock.unlock();
+
+    const bool match = Verify(slots_[slot]);
+    if (!match) {
+      Record(slots_[slot]);
+    }
+
+    lock.lock();
+    stats_.verified++;
+    stats_.mismatches += match ? 0 : 1;
+    free_.push_back(slot);
+    verifying_ = false;
+    if (pending_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
+
+bool ShadowVerifier::Verify(const Sample& sample) {
+  const bool from_old = sample.transformation == FIDL_TRANSFORMATION_OLD_TO_V1;
+  const fidl_transformation_t reverse =
+      from_old ? FIDL_TRANSFORMATION_V1_TO_OLD : FIDL_TRANSFORMATION_OLD_TO_V1;
+  const fidl_wire_format_t src_wire_format = from_old ? FIDL_WIRE_FORMAT_OLD : FIDL_WIRE_FORMAT_V1;
+
+  // As with `fidl_transform`, the destination must have room for the whole
+  // message, which a faulty transformation could inflate.
+  back_bytes_.resize(std::max<size_t>(ZX_CHANNEL_MAX_MSG_BYTES, 2 * sample.dst_bytes.size()));
+  fidl_transform_options_t options = {};
+  options.canonicalize = true;
+  uint32_t back_num_bytes;
+  if (fidl_transform_with_options(reverse, &options, sample.dst_type, sample.dst_bytes.data(),
+                                  static_cast<uint32_t>(sample.dst_bytes.size()),
+                                  back_bytes_.data(), &back_num_bytes, nullptr) != ZX_OK) {
+    return false;
+  }
+  if (back_num_bytes == sample.src_bytes.size() &&
+      memcmp(back_bytes_.data(), sample.src_bytes.data(), back_num_bytes) == 0) {
+    return true;
+  }
+
+  // The source may differ only by its padding.
+  uint64_t src_hash, back_hash;
+  return fidl_structural_hash(src_wire_format, sample.src_type, sample.src_bytes.data(),
+                              static_cast<uint32_t>(sample.src_bytes.size()), 0, &src_hash,
+                              nullptr) == ZX_OK &&
+         fidl_structural_hash(src_wire_format, sample.src_type, back_bytes_.data(),
+                              back_num_bytes, 0, &back_hash, nullptr) == ZX_OK &&
+         src_hash == back_hash;
+}
+
+void ShadowVerifier::Record(const Sample& sample) {
+  const bool from_old = sample.transformation == FIDL_TRANSFORMATION_OLD_TO_V1;
+  if (!capture_open_ && options_.capture_path) {
+    capture_open_ = capture_.Open(options_.capture_path);
+  }
+  const bool recorded =
+      capture_open_ &&
+      capture_.Write(from_old ? kCaptureWireFormatOld : kCaptureWireFormatV1,
+                     TypeName(sample.src_type), sample.src_bytes.data(),
+                     static_cast<uint32_t>(sample.src_bytes.size()), 0) &&
+      capture_.Write(from_old ? kCaptureWireFormatV1 : kCaptureWireFormatOld,
+                     TypeName(sample.dst_type), sample.dst_bytes.data(),
+                     static_cast<uint32_t>(sample.dst_bytes.size()), 0);
+  if (!recorded) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.capture_errors++;
+  }
+}
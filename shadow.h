@@ -0,0 +1,115 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SHADOW_H_
+#define SHADOW_H_
+
+// Shadow verification of the transformer on live traffic.
+//
+// A `ShadowVerifier` samples 1 in N of the messages a service transforms, and
+// on a background thread transforms each sampled output back to the wire format
+// of its source, checking that it holds the same values as the source. Outputs
+// are transformed back with `canonicalize` set, and compared to the source
+// byte for byte; only if they differ are both hashed with
+// `fidl_structural_hash`, so that sources with non-zero padding still match.
+// Mismatches are recorded to a capture (see `capture.h`): the source, then the
+// output, both named after the top-level struct.
+//
+// Messages which are not sampled cost the foreground an atomic increment.
+// Sampled messages are copied into one of a fixed number of preallocated slots;
+// when all are waiting to be verified, further samples are skipped rather than
+// queued, so that the backlog (and memory) stays bounded however far behind
+// verification falls.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+#include "fidl.h"
+#include "transformer.h"
+
+class ShadowVerifier final {
+ public:
+  struct Options {
+    // Samples 1 in |sample_every| messages (none if 0).
+    uint32_t sample_every = 1000;
+    // Number of sampled messages waiting to be verified, past which samples are
+    // skipped.
+    uint32_t max_backlog = 16;
+    // Capture recording mismatches, created when the first one is found.
+    const char* capture_path = nullptr;
+  };
+
+  struct Stats {
+    uint64_t observed = 0;
+    uint64_t sampled = 0;
+    // Samples skipped because the backlog was full.
+    uint64_t skipped = 0;
+    uint64_t verified = 0;
+    // Outputs which failed to transform back, or did not match their source.
+    uint64_t mismatches = 0;
+    // Mismatches which could not be recorded.
+    uint64_t capture_errors = 0;
+  };
+
+  explicit ShadowVerifier(const Options& options);
+  // Verifies the samples still waiting, then stops the background thread.
+  ~ShadowVerifier();
+  ShadowVerifier(const ShadowVerifier&) = delete;
+  ShadowVerifier& operator=(const ShadowVerifier&) = delete;
+
+  // Observes the successful transformation of |src_bytes| (a message of
+  // top-level struct |src_type|) into |dst_bytes| (described by |dst_type|, the
+  // coding table of the same struct in the destination wire format). Only
+  // transformations between the old and v1 wire formats are sampled. Thread
+  // safe.
+  void Observe(fidl_transformation_t transformation, const fidl_type_t* src_type,
+               const fidl_type_t* dst_type, const uint8_t* src_bytes, uint32_t src_num_bytes,
+               const uint8_t* dst_bytes, uint32_t dst_num_bytes);
+
+  // Waits until every sample observed so far is verified.
+  void Drain();
+
+  Stats stats();
+
+ private:
+  struct Sample {
+    fidl_transformation_t transformation;
+    const fidl_type_t* src_type;
+    const fidl_type_t* dst_type;
+    std::vector<uint8_t> src_bytes;
+    std::vector<uint8_t> dst_bytes;
+  };
+
+  void Run();
+  bool Verify(const Sample& sample);
+  void Record(const Sample& sample);
+
+  const Options options_;
+  std::atomic<uint64_t> observed_{0};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  // Slots of samples, which are either free or pending (in order).
+  std::vector<Sample> slots_;
+  std::vector<size_t> free_;
+  std::deque<size_t> pending_;
+  bool verifying_ = false;
+  bool stopping_ = false;
+  Stats stats_;
+
+  // Only used by the background thread.
+  std::vector<uint8_t> back_bytes_;
+  CaptureWriter capture_;
+  bool capture_open_ = false;
+
+  std::thread thread_;
+};
+
+#endif  // SHADOW_H_
@@ -0,0 +1,954 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/storage.h>
+#include <lib/fidl/transformer_internal.h>
+
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+using fidl::internal::InlineSize;
+using fidl::internal::TableFieldType;
+using fidl::internal::VariantIndex;
+using fidl::internal::VariantSize;
+using fidl::internal::VectorShape;
+using fidl::internal::WireFormat;
+using fidl::internal::XUnionField;
+
+// Out-of-line objects nested deeper than this are rejected, so that corrupt
+// storage cannot exhaust the stack. Well above the nesting limit of FIDL
+// messages (32).
+constexpr uint32_t kMaxDepth = 128;
+
+// Receives the storage encoding of a message into a buffer. Returns false
+// when the buffer is too small.
+class StorageBuffer final {
+ public:
+  StorageBuffer(uint8_t* out_bytes, uint32_t capacity)
+      : out_bytes_(out_bytes), capacity_(capacity) {}
+
+  bool Emit(const void* data, uint32_t size) {
+    if (size > capacity_ - out_num_bytes_) {
+      return false;
+    }
+    memcpy(&out_bytes_[out_num_bytes_], data, size);
+    out_num_bytes_ += size;
+    return true;
+  }
+
+  bool EmitBit(bool bit) {
+    if (bit_index_ == 8) {
+      const uint8_t flags = 0;
+      flags_offset_ = out_num_bytes_;
+      bit_index_ = 0;
+      if (!Emit(&flags, 1)) {
+        return false;
+      }
+    }
+    out_bytes_[flags_offset_] |= static_cast<uint8_t>(bit ? 1u << bit_index_ : 0);
+    bit_index_++;
+    return true;
+  }
+
+  uint32_t out_num_bytes() const { return out_num_bytes_; }
+
+ private:
+  uint8_t* const out_bytes_;
+  const uint32_t capacity_;
+
+  uint32_t out_num_bytes_ = 0;
+  uint32_t flags_offset_ = 0;
+  uint32_t bit_index_ = 8;
+};
+
+// Streaming 64-bit xxHash (XXH64).
+class Xxh64 final {
+ public:
+  explicit Xxh64(uint64_t seed)
+      : seed_(seed), acc_{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1} {}
+
+  void Update(const void* data, size_t size) {
+    auto input = static_cast<const uint8_t*>(data);
+    total_size_ += size;
+    if (buffered_ + size < sizeof(buffer_)) {
+      memcpy(&buffer_[buffered_], input, size);
+      buffered_ += size;
+      return;
+    }
+    if (buffered_) {
+      const size_t fill = sizeof(buffer_) - buffered_;
+      memcpy(&buffer_[buffered_], input, fill);
+      Consume(buffer_);
+      input += fill;
+      size -= fill;
+      buffered_ = 0;
+    }
+    for (; size >= sizeof(buffer_); input += sizeof(buffer_), size -= sizeof(buffer_)) {
+      Consume(input);
+    }
+    memcpy(buffer_, input, size);
+    buffered_ = size;
+  }
+
+  uint64_t Digest() const {
+    uint64_t hash;
+    if (total_size_ >= sizeof(buffer_)) {
+      hash = Rotl(acc_[0], 1) + Rotl(acc_[1], 7) + Rotl(acc_[2], 12) + Rotl(acc_[3], 18);
+      for (uint64_t acc : acc_) {
+        hash = (hash ^ Round(0, acc)) * kPrime1 + kPrime4;
+      }
+    } else {
+      hash = seed_ + kPrime5;
+    }
+    hash += total_size_;
+
+    size_t i = 0;
+    for (; i + 8 <= buffered_; i += 8) {
+      hash ^= Round(0, Load<uint64_t>(&buffer_[i]));
+      hash = Rotl(hash, 27) * kPrime1 + kPrime4;
+    }
+    if (i + 4 <= buffered_) {
+      hash ^= Load<uint32_t>(&buffer_[i]) * kPrime1;
+      hash = Rotl(hash, 23) * kPrime2 + kPrime3;
+      i += 4;
+    }
+    for (; i < buffered_; i++) {
+      hash ^= buffer_[i] * kPrime5;
+      hash = Rotl(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+ private:
+  static constexpr uint64_t kPrime1 = 11400714785074694791ull;
+  static constexpr uint64_t kPrime2 = 14029467366897019727ull;
+  static constexpr uint64_t kPrime3 = 1609587929392839161ull;
+  static constexpr uint64_t kPrime4 = 9650029242287828579ull;
+  static constexpr uint64_t kPrime5 = 2870177450012600261ull;
+
+  static uint64_t Rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  static uint64_t Round(uint64_t acc, uint64_t input) {
+    return Rotl(acc + input * kPrime2, 31) * kPrime1;
+  }
+
+  // Inputs are little-endian, as FIDL messages are.
+  template <typename T>
+  static uint64_t Load(const uint8_t* bytes) {
+    T value;
+    memcpy(&value, bytes, sizeof(T));
+    return value;
+  }
+
+  void Consume(const uint8_t* stripe) {
+    for (int i = 0; i < 4; i++) {
+      acc_[i] = Round(acc_[i], Load<uint64_t>(&stripe[8 * i]));
+    }
+  }
+
+  const uint64_t seed_;
+  uint64_t acc_[4];
+  uint8_t buffer_[32];
+  size_t buffered_ = 0;
+  uint64_t total_size_ = 0;
+};
+
+// Receives the storage encoding of a message into a hash, each bit being
+// hashed as a byte (so that the encoding need not be buffered until flag bytes
+// are complete).
+class StorageHash final {
+ public:
+  explicit StorageHash(uint64_t seed) : hash_(seed) {}
+
+  bool Emit(const void* data, uint32_t size) {
+    hash_.Update(data, size);
+    return true;
+  }
+
+  bool EmitBit(bool bit) {
+    const uint8_t byte = bit;
+    hash_.Update(&byte, 1);
+    return true;
+  }
+
+  uint64_t Digest() const { return hash_.Digest(); }
+
+ private:
+  Xxh64 hash_;
+};
+
+// Walks a message in either wire format, following its out-of-line objects in
+// order, and writes its storage encoding into a `StorageBuffer` or
+// `StorageHash` |Sink|.
+template <typename Sink>
+class StorageEncoder final {
+ public:
+  StorageEncoder(WireFormat wire_format, const uint8_t* bytes, uint32_t num_bytes, Sink* sink)
+      : wire_format_(wire_format), bytes_(bytes), num_bytes_(num_bytes), sink_(sink) {}
+
+  zx_status_t EncodeMessage(const fidl::FidlCodedStruct& coded_struct) {
+    uint32_t offset;
+    if (!Claim(coded_struct.size, &offset) || !EncodeStruct(coded_struct, offset, 0)) {
+      return status_;
+    }
+    return ZX_OK;
+  }
+
+  const char* error() const { return error_; }
+
+ private:
+  bool Encode(const fidl_type_t* type, uint32_t offset, uint32_t size, uint32_t depth) {
+    if (depth > kMaxDepth) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is too deeply nested");
+    }
+    if (!type) {
+      return EmitBytes(offset, size);
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+        return EmitBytes(offset, InlineSize(type, wire_format_));
+      case fidl::kFidlTypeHandle: {
+        uint32_t handle = Read<uint32_t>(offset);
+        if (handle != FIDL_HANDLE_PRESENT && handle != FIDL_HANDLE_ABSENT) {
+          return Fail(ZX_ERR_INVALID_ARGS, "invalid handle presence");
+        }
+        if (handle == FIDL_HANDLE_PRESENT) {
+          num_handles_++;
+        }
+        return EmitBit(handle == FIDL_HANDLE_PRESENT);
+      }
+      case fidl::kFidlTypeStruct:
+        return EncodeStruct(type->coded_struct, offset, depth);
+      case fidl::kFidlTypeStructPointer: {
+        bool present;
+        uint32_t struct_offset;
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        if (!ReadPresence(offset, &present) || !EmitBit(present)) {
+          return false;
+        }
+        return !present ||
+               (Claim(coded_struct.size, &struct_offset) &&
+                EncodeStruct(coded_struct, struct_offset, depth + 1));
+      }
+      case fidl::kFidlTypeUnion:
+        return EncodeUnion(type->coded_union, offset, depth);
+      case fidl::kFidlTypeUnionPointer: {
+        const auto& coded_union = *type->coded_union_pointer.union_type;
+        if (wire_format_ == WireFormat::kV1) {
+          // Nullable static unions are inline xunions, which are empty when absent.
+          bool present = Read<uint32_t>(offset) != 0;
+          return EmitBit(present) && (!present || EncodeUnion(coded_union, offset, depth));
+        }
+        bool present;
+        uint32_t union_offset;
+        if (!ReadPresence(offset, &present) || !EmitBit(present)) {
+          return false;
+        }
+        return !present || (Claim(coded_union.size, &union_offset) &&
+                            EncodeUnion(coded_union, union_offset, depth + 1));
+      }
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        for (uint32_t element_offset = 0; element_offset < coded_array.array_size;
+             element_offset += coded_array.element_size) {
+          if (!Encode(coded_array.element, offset + element_offset, coded_array.element_size,
+                      depth)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeString:
+      case fidl::kFidlTypeVector:
+        return EncodeVector(type, offset, depth);
+      case fidl::kFidlTypeTable: {
+        const auto& coded_table = type->coded_table;
+        auto envelopes = Read<fidl_vector_t>(offset);
+        uint32_t envelopes_offset;
+        if (envelopes.count > UINT32_MAX / sizeof(fidl_envelope_t)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "table has too many envelopes");
+        }
+        uint32_t count = static_cast<uint32_t>(envelopes.count);
+        if (!EmitVarint(count) ||
+            !Claim(count * static_cast<uint32_t>(sizeof(fidl_envelope_t)), &envelopes_offset)) {
+          return false;
+        }
+        uint32_t cursor = 0;
+        for (uint32_t i = 0; i < count; i++) {
+          uint32_t envelope_offset =
+              envelopes_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t));
+          bool present = Read<fidl_envelope_t>(envelope_offset).presence != FIDL_ALLOC_ABSENT;
+          if (!EmitBit(present)) {
+            return false;
+          }
+          if (!present) {
+            continue;
+          }
+          const fidl_type_t* field_type = TableFieldType(coded_table, i + 1, &cursor);
+          uint32_t size = field_type ? InlineSize(field_type, wire_format_) : 0;
+          if (!EncodeEnvelope(field_type != nullptr, field_type, size, envelope_offset, depth)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeXUnion: {
+        auto xunion = Read<fidl_xunion_t>(offset);
+        if (!EmitVarint(xunion.tag)) {
+          return false;
+        }
+        if (xunion.tag == 0) {
+          return true;
+        }
+        const auto* field = XUnionField(type->coded_xunion, xunion.tag);
+        const fidl_type_t* field_type = field ? field->type : nullptr;
+        uint32_t size = field_type ? InlineSize(field_type, wire_format_) : 0;
+        return EncodeEnvelope(field_type != nullptr, field_type, size,
+                              offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                              depth);
+      }
+    }
+
+    assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+    return false;
+  }
+
+  // Writes the primitive members of the struct (everything but padding and
+  // coded fields), and encodes its coded fields in between.
+  bool EncodeStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t offset, uint32_t depth) {
+    uint32_t cursor = 0;
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      const auto& field = coded_struct.fields[i];
+      if (!field.type) {
+        if (!EmitBytes(offset + cursor, field.padding_offset - cursor)) {
+          return false;
+        }
+        cursor = field.padding_offset + field.padding;
+        continue;
+      }
+      uint32_t field_size = InlineSize(field.type, wire_format_);
+      if (!EmitBytes(offset + cursor, field.offset - cursor) ||
+          !Encode(field.type, offset + field.offset, field_size, depth)) {
+        return false;
+      }
+      cursor = field.offset + field_size + field.padding;
+    }
+    return cursor >= coded_struct.size || EmitBytes(offset + cursor, coded_struct.size - cursor);
+  }
+
+  bool EncodeUnion(const fidl::FidlCodedUnion& coded_union, uint32_t offset, uint32_t depth) {
+    uint32_t tag = Read<uint32_t>(offset);
+    uint32_t index = tag;
+    if (wire_format_ == WireFormat::kV1) {
+      if (!VariantIndex(coded_union, tag, &index)) {
+        return Fail(ZX_ERR_INVALID_ARGS, "unknown static-union ordinal");
+      }
+    } else if (tag >= coded_union.field_count) {
+      return Fail(ZX_ERR_INVALID_ARGS, "invalid static-union tag");
+    }
+    if (!EmitVarint(index)) {
+      return false;
+    }
+
+    const auto& field = coded_union.fields[index];
+    uint32_t size = VariantSize(coded_union, index, wire_format_);
+    if (wire_format_ == WireFormat::kV1) {
+      return EncodeEnvelope(true, field.type, size,
+                            offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                            depth);
+    }
+    return Encode(field.type, offset + coded_union.data_offset, size, depth);
+  }
+
+  bool EncodeVector(const fidl_type_t* type, uint32_t offset, uint32_t depth) {
+    const fidl_type_t* element;
+    uint32_t element_size, max_count;
+    bool nullable, present;
+    VectorShape(type, &element, &element_size, &nullable, &max_count);
+
+    auto vector = Read<fidl_vector_t>(offset);
+    if (!ReadPresence(offset + static_cast<uint32_t>(offsetof(fidl_vector_t, data)), &present)) {
+      return false;
+    }
+    if (!present) {
+      if (!nullable || vector.count != 0) {
+        return Fail(ZX_ERR_INVALID_ARGS, "absent vector or string");
+      }
+      return EmitBit(false);
+    }
+    if (vector.count > max_count) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector or string exceeds its bound");
+    }
+    uint64_t size = vector.count * element_size;
+    if (size > UINT32_MAX) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector or string is too large");
+    }
+    uint32_t count = static_cast<uint32_t>(vector.count);
+    uint32_t data_offset;
+    if ((nullable && !EmitBit(true)) || !EmitVarint(count) ||
+        !Claim(static_cast<uint32_t>(size), &data_offset)) {
+      return false;
+    }
+    if (!element) {
+      return EmitBytes(data_offset, static_cast<uint32_t>(size));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (!Encode(element, data_offset + i * element_size, element_size, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Encodes the contents of a present envelope. The contents of |known|
+  // envelopes are |size| bytes of |type|; others are copied raw.
+  bool EncodeEnvelope(bool known, const fidl_type_t* type, uint32_t size,
+                      uint32_t envelope_offset, uint32_t depth) {
+    auto envelope = Read<fidl_envelope_t>(envelope_offset);
+    if (envelope.presence != FIDL_ALLOC_PRESENT) {
+      return Fail(ZX_ERR_INVALID_ARGS, "invalid envelope presence");
+    }
+
+    const uint32_t start = next_out_of_line_;
+    const uint32_t handles_before = num_handles_;
+    uint32_t content_offset;
+    if (!known) {
+      if (!EmitVarint(envelope.num_bytes) || !EmitVarint(envelope.num_handles) ||
+          !Claim(envelope.num_bytes, &content_offset) ||
+          !EmitBytes(content_offset, envelope.num_bytes)) {
+        return false;
+      }
+      num_handles_ += envelope.num_handles;
+    } else if (!Claim(size, &content_offset) ||
+               !Encode(type, content_offset, size, depth + 1)) {
+      return false;
+    }
+    if (next_out_of_line_ - start != envelope.num_bytes ||
+        num_handles_ - handles_before != envelope.num_handles) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope size does not match its contents");
+    }
+    return true;
+  }
+
+  template <typename T>
+  T Read(uint32_t offset) const {
+    assert(offset + sizeof(T) <= num_bytes_);
+    T value;
+    memcpy(&value, &bytes_[offset], sizeof(T));
+    return value;
+  }
+
+  bool ReadPresence(uint32_t offset, bool* out_present) {
+    auto presence = Read<uintptr_t>(offset);
+    if (presence != FIDL_ALLOC_PRESENT && presence != FIDL_ALLOC_ABSENT) {
+      return Fail(ZX_ERR_INVALID_ARGS, "invalid presence marker");
+    }
+    *out_present = presence == FIDL_ALLOC_PRESENT;
+    return true;
+  }
+
+  // Claims the next out-of-line object of the message, of |size| bytes.
+  bool Claim(uint32_t size, uint32_t* out_offset) {
+    uint32_t new_offset;
+    if (!fidl::AddOutOfLine(next_out_of_line_, size, &new_offset) ||
+        next_out_of_line_ + size > num_bytes_) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+    }
+    *out_offset = next_out_of_line_;
+    next_out_of_line_ = new_offset;
+    return true;
+  }
+
+  bool Emit(const void* data, uint32_t size) {
+    if (!sink_->Emit(data, size)) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "storage buffer is too small");
+    }
+    return true;
+  }
+
+  bool EmitBytes(uint32_t offset, uint32_t size) { return Emit(&bytes_[offset], size); }
+
+  bool EmitVarint(uint64_t value) {
+    uint8_t buffer[10];
+    uint32_t size = 0;
+    do {
+      buffer[size++] = static_cast<uint8_t>((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+      value >>= 7;
+    } while (value);
+    return Emit(buffer, size);
+  }
+
+  bool EmitBit(bool bit) {
+    if (!sink_->EmitBit(bit)) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "storage buffer is too small");
+    }
+    return true;
+  }
+
+  bool Fail(zx_status_t status, const char* error) {
+    status_ = status;
+    error_ = error;
+    return false;
+  }
+
+  const WireFormat wire_format_;
+  const uint8_t* const bytes_;
+  const uint32_t num_bytes_;
+  Sink* const sink_;
+
+  uint32_t next_out_of_line_ = 0;
+  uint32_t num_handles_ = 0;
+  zx_status_t status_ = ZX_OK;
+  const char* error_ = nullptr;
+};
+
+// Reads a storage encoding and writes the message in either wire format,
+// allocating out-of-line objects in the order the encoding lists them.
+class StorageDecoder final {
+ public:
+  StorageDecoder(WireFormat wire_format, const uint8_t* bytes, uint32_t num_bytes,
+                 uint8_t* out_bytes, uint32_t capacity)
+      : wire_format_(wire_format),
+        bytes_(bytes),
+        num_bytes_(num_bytes),
+        out_bytes_(out_bytes),
+        capacity_(capacity) {}
+
+  zx_status_t DecodeMessage(const fidl::FidlCodedStruct& coded_struct) {
+    uint32_t offset;
+    if (!Allocate(coded_struct.size, &offset) || !DecodeStruct(coded_struct, offset, 0)) {
+      return status_;
+    }
+    if (in_offset_ != num_bytes_) {
+      Fail(ZX_ERR_INVALID_ARGS, "storage has trailing bytes");
+      return status_;
+    }
+    return ZX_OK;
+  }
+
+  uint32_t out_num_bytes() const { return next_out_of_line_; }
+  const char* error() const { return error_; }
+
+ private:
+  bool Decode(const fidl_type_t* type, uint32_t offset, uint32_t size, uint32_t depth) {
+    if (depth > kMaxDepth) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is too deeply nested");
+    }
+    if (!type) {
+      return TakeBytes(offset, size);
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+        return TakeBytes(offset, InlineSize(type, wire_format_));
+      case fidl::kFidlTypeHandle: {
+        bool present;
+        if (!TakeBit(&present)) {
+          return false;
+        }
+        if (present) {
+          num_handles_++;
+        }
+        Write<uint32_t>(offset, present ? FIDL_HANDLE_PRESENT : FIDL_HANDLE_ABSENT);
+        return true;
+      }
+      case fidl::kFidlTypeStruct:
+        return DecodeStruct(type->coded_struct, offset, depth);
+      case fidl::kFidlTypeStructPointer: {
+        bool present;
+        uint32_t struct_offset;
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        if (!TakeBit(&present)) {
+          return false;
+        }
+        Write<uintptr_t>(offset, present ? FIDL_ALLOC_PRESENT : FIDL_ALLOC_ABSENT);
+        return !present || (Allocate(coded_struct.size, &struct_offset) &&
+                            DecodeStruct(coded_struct, struct_offset, depth + 1));
+      }
+      case fidl::kFidlTypeUnion:
+        return DecodeUnion(type->coded_union, offset, depth);
+      case fidl::kFidlTypeUnionPointer: {
+        const auto& coded_union = *type->coded_union_pointer.union_type;
+        bool present;
+        uint32_t union_offset;
+        if (!TakeBit(&present)) {
+          return false;
+        }
+        if (wire_format_ == WireFormat::kV1) {
+          return !present || DecodeUnion(coded_union, offset, depth);
+        }
+        Write<uintptr_t>(offset, present ? FIDL_ALLOC_PRESENT : FIDL_ALLOC_ABSENT);
+        return !present || (Allocate(coded_union.size, &union_offset) &&
+                            DecodeUnion(coded_union, union_offset, depth + 1));
+      }
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        for (uint32_t element_offset = 0; element_offset < coded_array.array_size;
+             element_offset += coded_array.element_size) {
+          if (!Decode(coded_array.element, offset + element_offset, coded_array.element_size,
+                      depth)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeString:
+      case fidl::kFidlTypeVector:
+        return DecodeVector(type, offset, depth);
+      case fidl::kFidlTypeTable: {
+        const auto& coded_table = type->coded_table;
+        uint64_t count;
+        uint32_t envelopes_offset;
+        if (!TakeVarint(&count)) {
+          return false;
+        }
+        if (count > UINT32_MAX / sizeof(fidl_envelope_t)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "table has too many envelopes");
+        }
+        if (!Allocate(static_cast<uint32_t>(count * sizeof(fidl_envelope_t)), &envelopes_offset)) {
+          return false;
+        }
+        Write<fidl_vector_t>(offset,
+                             fidl_vector_t{count, reinterpret_cast<void*>(FIDL_ALLOC_PRESENT)});
+        uint32_t cursor = 0;
+        for (uint32_t i = 0; i < count; i++) {
+          bool present;
+          if (!TakeBit(&present)) {
+            return false;
+          }
+          if (!present) {
+            continue;
+          }
+          const fidl_type_t* field_type = TableFieldType(coded_table, i + 1, &cursor);
+          uint32_t size = field_type ? InlineSize(field_type, wire_format_) : 0;
+          if (!DecodeEnvelope(field_type != nullptr, field_type, size,
+                              envelopes_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t)),
+                              depth)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeXUnion: {
+        uint64_t ordinal;
+        if (!TakeVarint(&ordinal)) {
+          return false;
+        }
+        if (ordinal > UINT32_MAX) {
+          return Fail(ZX_ERR_INVALID_ARGS, "invalid xunion ordinal");
+        }
+        if (ordinal == 0) {
+          return true;
+        }
+        Write<uint32_t>(offset, static_cast<uint32_t>(ordinal));
+        const auto* field = XUnionField(type->coded_xunion, static_cast<uint32_t>(ordinal));
+        const fidl_type_t* field_type = field ? field->type : nullptr;
+        uint32_t size = field_type ? InlineSize(field_type, wire_format_) : 0;
+        return DecodeEnvelope(field_type != nullptr, field_type, size,
+                              offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                              depth);
+      }
+    }
+
+    assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+    return false;
+  }
+
+  // Mirrors StorageEncoder::EncodeStruct; padding stays zero from Allocate().
+  bool DecodeStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t offset, uint32_t depth) {
+    uint32_t cursor = 0;
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      const auto& field = coded_struct.fields[i];
+      if (!field.type) {
+        if (!TakeBytes(offset + cursor, field.padding_offset - cursor)) {
+          return false;
+        }
+        cursor = field.padding_offset + field.padding;
+        continue;
+      }
+      uint32_t field_size = InlineSize(field.type, wire_format_);
+      if (!TakeBytes(offset + cursor, field.offset - cursor) ||
+          !Decode(field.type, offset + field.offset, field_size, depth)) {
+        return false;
+      }
+      cursor = field.offset + field_size + field.padding;
+    }
+    return cursor >= coded_struct.size || TakeBytes(offset + cursor, coded_struct.size - cursor);
+  }
+
+  bool DecodeUnion(const fidl::FidlCodedUnion& coded_union, uint32_t offset, uint32_t depth) {
+    uint64_t index;
+    if (!TakeVarint(&index)) {
+      return false;
+    }
+    if (index >= coded_union.field_count) {
+      return Fail(ZX_ERR_INVALID_ARGS, "invalid static-union variant");
+    }
+
+    const auto& field = coded_union.fields[index];
+    uint32_t size = VariantSize(coded_union, static_cast<uint32_t>(index), wire_format_);
+    if (wire_format_ == WireFormat::kV1) {
+      Write<uint32_t>(offset, field.xunion_ordinal);
+      return DecodeEnvelope(true, field.type, size,
+                            offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                            depth);
+    }
+    Write<uint32_t>(offset, static_cast<uint32_t>(index));
+    return Decode(field.type, offset + coded_union.data_offset, size, depth);
+  }
+
+  bool DecodeVector(const fidl_type_t* type, uint32_t offset, uint32_t depth) {
+    const fidl_type_t* element;
+    uint32_t element_size, max_count;
+    bool nullable;
+    VectorShape(type, &element, &element_size, &nullable, &max_count);
+
+    bool present = true;
+    if (nullable && !TakeBit(&present)) {
+      return false;
+    }
+    if (!present) {
+      Write<fidl_vector_t>(offset, fidl_vector_t{0, reinterpret_cast<void*>(FIDL_ALLOC_ABSENT)});
+      return true;
+    }
+    uint64_t count;
+    if (!TakeVarint(&count)) {
+      return false;
+    }
+    if (count > max_count) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector or string exceeds its bound");
+    }
+    uint64_t size = count * element_size;
+    uint32_t data_offset;
+    if (size > UINT32_MAX) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector or string is too large");
+    }
+    if (!Allocate(static_cast<uint32_t>(size), &data_offset)) {
+      return false;
+    }
+    Write<fidl_vector_t>(offset, fidl_vector_t{count, reinterpret_cast<void*>(FIDL_ALLOC_PRESENT)});
+    if (!element) {
+      return TakeBytes(data_offset, static_cast<uint32_t>(size));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (!Decode(element, data_offset + i * element_size, element_size, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Mirrors StorageEncoder::EncodeEnvelope, and fills in the envelope header.
+  bool DecodeEnvelope(bool known, const fidl_type_t* type, uint32_t size,
+                      uint32_t envelope_offset, uint32_t depth) {
+    const uint32_t start = next_out_of_line_;
+    const uint32_t handles_before = num_handles_;
+    uint32_t content_offset;
+    if (!known) {
+      uint64_t num_bytes, num_handles;
+      if (!TakeVarint(&num_bytes) || !TakeVarint(&num_handles)) {
+        return false;
+      }
+      if (num_bytes > UINT32_MAX || num_bytes % FIDL_ALIGNMENT != 0 || num_handles > UINT32_MAX) {
+        return Fail(ZX_ERR_INVALID_ARGS, "invalid unknown envelope");
+      }
+      if (!Allocate(static_cast<uint32_t>(num_bytes), &content_offset) ||
+          !TakeBytes(content_offset, static_cast<uint32_t>(num_bytes))) {
+        return false;
+      }
+      num_handles_ += static_cast<uint32_t>(num_handles);
+    } else if (!Allocate(size, &content_offset) ||
+               !Decode(type, content_offset, size, depth + 1)) {
+      return false;
+    }
+
+    fidl_envelope_t envelope = {};
+    envelope.num_bytes = next_out_of_line_ - start;
+    envelope.num_handles = num_handles_ - handles_before;
+    envelope.presence = FIDL_ALLOC_PRESENT;
+    Write<fidl_envelope_t>(envelope_offset, envelope);
+    return true;
+  }
+
+  template <typename T>
+  void Write(uint32_t offset, const T& value) {
+    assert(offset + sizeof(T) <= next_out_of_line_);
+    memcpy(&out_bytes_[offset], &value, sizeof(T));
+  }
+
+  // Allocates (and zeroes) the next out-of-line object of the message.
+  bool Allocate(uint32_t size, uint32_t* out_offset) {
+    uint32_t new_offset;
+    if (!fidl::AddOutOfLine(next_out_of_line_, size, &new_offset) || new_offset > capacity_) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "message buffer is too small");
+    }
+    memset(&out_bytes_[next_out_of_line_], 0, new_offset - next_out_of_line_);
+    *out_offset = next_out_of_line_;
+    next_out_of_line_ = new_offset;
+    return true;
+  }
+
+  bool TakeBytes(uint32_t offset, uint32_t size) {
+    if (size > num_bytes_ - in_offset_) {
+      return Fail(ZX_ERR_INVALID_ARGS, "storage is truncated");
+    }
+    memcpy(&out_bytes_[offset], &bytes_[in_offset_], size);
+    in_offset_ += size;
+    return true;
+  }
+
+  bool TakeVarint(uint64_t* out_value) {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      if (in_offset_ == num_bytes_) {
+        return Fail(ZX_ERR_INVALID_ARGS, "storage is truncated");
+      }
+      uint8_t byte = bytes_[in_offset_++];
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        *out_value = value;
+        return true;
+      }
+    }
+    return Fail(ZX_ERR_INVALID_ARGS, "invalid varint");
+  }
+
+  bool TakeBit(bool* out_bit) {
+    if (bit_index_ == 8) {
+      if (in_offset_ == num_bytes_) {
+        return Fail(ZX_ERR_INVALID_ARGS, "storage is truncated");
+      }
+      flags_offset_ = in_offset_++;
+      bit_index_ = 0;
+    }
+    *out_bit = (bytes_[flags_offset_] >> bit_index_) & 1;
+    bit_index_++;
+    return true;
+  }
+
+  bool Fail(zx_status_t status, const char* error) {
+    status_ = status;
+    error_ = error;
+    return false;
+  }
+
+  const WireFormat wire_format_;
+  const uint8_t* const bytes_;
+  const uint32_t num_bytes_;
+  uint8_t* const out_bytes_;
+  const uint32_t capacity_;
+
+  uint32_t in_offset_ = 0;
+  uint32_t next_out_of_line_ = 0;
+  uint32_t num_handles_ = 0;
+  uint32_t flags_offset_ = 0;
+  uint32_t bit_index_ = 8;
+  zx_status_t status_ = ZX_OK;
+  const char* error_ = nullptr;
+};
+
+zx_status_t CheckArguments(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                           WireFormat* out_wire_format, const char** out_error_msg) {
+  switch (wire_format) {
+    case FIDL_WIRE_FORMAT_OLD:
+      *out_wire_format = WireFormat::kOld;
+      break;
+    case FIDL_WIRE_FORMAT_V1:
+      *out_wire_format = WireFormat::kV1;
+      break;
+    default:
+      if (out_error_msg) {
+        *out_error_msg = "unsupported wire format";
+      }
+      return ZX_ERR_INVALID_ARGS;
+  }
+  if (!type || type->type_tag != fidl::kFidlTypeStruct) {
+    if (out_error_msg) {
+      *out_error_msg = "top-level type must be a struct";
+    }
+    return ZX_ERR_INVALID_ARGS;
+  }
+  return ZX_OK;
+}
+
+}  // namespace
+
+zx_status_t fidl_storage_encode(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                const uint8_t* bytes, uint32_t num_bytes, uint8_t* out_bytes,
+                                uint32_t capacity, uint32_t* out_num_bytes,
+                                const char** out_error_msg) {
+  WireFormat format;
+  zx_status_t status = CheckArguments(wire_format, type, &format, out_error_msg);
+  if (status != ZX_OK) {
+    return status;
+  }
+  StorageBuffer buffer(out_bytes, capacity);
+  StorageEncoder<StorageBuffer> encoder(format, bytes, num_bytes, &buffer);
+  status = encoder.EncodeMessage(type->coded_struct);
+  if (status != ZX_OK) {
+    if (out_error_msg) {
+      *out_error_msg = encoder.error();
+    }
+    return status;
+  }
+  *out_num_bytes = buffer.out_num_bytes();
+  return ZX_OK;
+}
+
+zx_status_t fidl_structural_hash(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                 const uint8_t* bytes, uint32_t num_bytes, uint64_t seed,
+                                 uint64_t* out_hash, const char** out_error_msg) {
+  WireFormat format;
+  zx_status_t status = CheckArguments(wire_format, type, &format, out_error_msg);
+  if (status != ZX_OK) {
+    return status;
+  }
+  StorageHash hash(seed);
+  StorageEncoder<StorageHash> encoder(format, bytes, num_bytes, &hash);
+  status = encoder.EncodeMessage(type->coded_struct);
+  if (status != ZX_OK) {
+    if (out_error_msg) {
+      *out_error_msg = encoder.error();
+    }
+    return status;
+  }
+  *out_hash = hash.Digest();
+  return ZX_OK;
+}
+
+zx_status_t fidl_storage_decode(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                const uint8_t* bytes, uint32_t num_bytes, uint8_t* out_bytes,
+                                uint32_t capacity, uint32_t* out_num_bytes,
+                                const char** out_error_msg) {
+  WireFormat format;
+  zx_status_t status = CheckArguments(wire_format, type, &format, out_error_msg);
+  if (status != ZX_OK) {
+    return status;
+  }
+  StorageDecoder decoder(format, bytes, num_bytes, out_bytes, capacity);
+  status = decoder.DecodeMessage(type->coded_struct);
+  if (status != ZX_OK) {
+    if (out_error_msg) {
+      *out_error_msg = decoder.error();
+    }
+    return status;
+  }
+  *out_num_bytes = decoder.out_num_bytes();
+  return ZX_OK;
+}
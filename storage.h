@@ -0,0 +1,79 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_STORAGE_H_
+#define LIB_FIDL_STORAGE_H_
+
+#include "fidl.h"
+#include "transformer.h"
+
+// __BEGIN_CDECLS
+
+// The storage encoding is a dense, byte-aligned encoding of FIDL messages for
+// archives, derived from the coding tables. It holds the same values as the
+// wire formats, but none of their alignment padding, presence markers or
+// envelope headers, and is identical whichever wire format it was produced
+// from. Objects are written depth-first, in the order in which their
+// out-of-line data appears on the wire:
+//
+// - Primitives (and the primitive members of structs) are written as is, in
+//   little-endian order and without padding.
+// - Handles and the presence of nullable objects (pointers, nullable strings
+//   and vectors) are single bits. Bits are packed least significant first into
+//   flag bytes, a new flag byte being inserted in the stream wherever a bit is
+//   needed and the previous flag byte is full.
+// - Counts (of strings, vectors and table envelopes), union variant indices and
+//   xunion ordinals (0 for an empty xunion) are unsigned LEB128 varints.
+// - Each envelope of a table has a presence bit. The contents of envelopes of
+//   unknown fields and variants are written as their varint |num_bytes| and
+//   |num_handles|, followed by their raw bytes, and are therefore only
+//   meaningful in the wire format they were captured in.
+//
+// Storage is never larger than the wire formats, usually much smaller.
+//
+// See `fidl_wire_format_t` for the wire formats it converts from and to.
+
+// Encodes the message |bytes| of top-level struct |type|, in |wire_format|,
+// into |out_bytes|, which has room for |capacity| bytes.
+//
+// Upon success, returns `ZX_OK` and stores the size of the encoding into
+// |out_num_bytes|. Upon failure (and if provided) writes an error message to
+// |out_error_msg|.
+zx_status_t fidl_storage_encode(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                const uint8_t* bytes, uint32_t num_bytes, uint8_t* out_bytes,
+                                uint32_t capacity, uint32_t* out_num_bytes,
+                                const char** out_error_msg);
+
+// Decodes the storage encoding |bytes| of top-level struct |type| into a
+// message in |wire_format|, in |out_bytes|, which has room for |capacity|
+// bytes. |type| is the coding table for |wire_format|, which need not be the
+// wire format the message was encoded from.
+//
+// Upon success, returns `ZX_OK` and stores the size of the message into
+// |out_num_bytes|. Upon failure (and if provided) writes an error message to
+// |out_error_msg|.
+zx_status_t fidl_storage_decode(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                const uint8_t* bytes, uint32_t num_bytes, uint8_t* out_bytes,
+                                uint32_t capacity, uint32_t* out_num_bytes,
+                                const char** out_error_msg);
+
+// Hashes the message |bytes| of top-level struct |type|, in |wire_format|,
+// without transforming or encoding it: a 64-bit xxHash (XXH64), keyed by
+// |seed|, of its storage encoding, each presence bit being hashed as a byte
+// rather than packed into flag bytes.
+//
+// Messages holding the same values therefore hash identically in either wire
+// format, whatever their padding, except for the contents of envelopes of
+// unknown fields and variants (see above). Messages in the compact v1 wire
+// format must be transformed to v1 first.
+//
+// Upon success, returns `ZX_OK` and stores the hash into |out_hash|. Upon
+// failure (and if provided) writes an error message to |out_error_msg|.
+zx_status_t fidl_structural_hash(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                                 const uint8_t* bytes, uint32_t num_bytes, uint64_t seed,
+                                 uint64_t* out_hash, const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_STORAGE_H_
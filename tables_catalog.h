@@ -0,0 +1,89 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef TABLES_CATALOG_H_
+#define TABLES_CATALOG_H_
+
+// Lists every coding table of `tables.h`, in both wire formats, for tools which
+// operate on all of them.
+//
+// Note: `tables.h` defines the coding tables, so this header must only be
+// included by a single translation unit of a binary. Keep this list in sync
+// with `tables.h` when regenerating it.
+
+#include "generated/transformer_tables.test.h"
+
+struct CatalogEntry {
+  const char* name;
+  const fidl_type_t* old_type;
+  const fidl_type_t* v1_type;
+};
+
+static const CatalogEntry kCatalog[] = {
+    {"example/UnionSize8Aligned4", &example_UnionSize8Aligned4Table,
+     &v1_example_UnionSize8Aligned4Table},
+    {"example/Sandwich1", &example_Sandwich1Table, &v1_example_Sandwich1Table},
+    {"example/UnionSize36Alignment4", &example_UnionSize36Alignment4Table,
+     &v1_example_UnionSize36Alignment4Table},
+    {"example/Sandwich4", &example_Sandwich4Table, &v1_example_Sandwich4Table},
+    {"example/UnionSize16Aligned4", &example_UnionSize16Aligned4Table,
+     &v1_example_UnionSize16Aligned4Table},
+    {"example/XUnionWithUnions", &example_XUnionWithUnionsTable, &v1_example_XUnionWithUnionsTable},
+    {"example/XUnionWithUnionsNullableRef", &example_XUnionWithUnionsNullableRefTable,
+     &v1_v1_example_XUnionWithUnionsNullableRefTable},
+    {"example/Sandwich2", &example_Sandwich2Table, &v1_example_Sandwich2Table},
+    {"example/Table_TwoReservedFields", &example_Table_TwoReservedFieldsTable,
+     &v1_example_Table_TwoReservedFieldsTable},
+    {"example/Table_NoFields", &example_Table_NoFieldsTable, &v1_example_Table_NoFieldsTable},
+    {"example/StructSize3Alignment2", &example_StructSize3Alignment2Table,
+     &v1_example_StructSize3Alignment2Table},
+    {"example/StructSize3Alignment1", &example_StructSize3Alignment1Table,
+     &v1_example_StructSize3Alignment1Table},
+    {"example/XUnionWithStruct", &example_XUnionWithStructTable, &v1_example_XUnionWithStructTable},
+    {"example/XUnionWithStructNullableRef", &example_XUnionWithStructNullableRefTable,
+     &v1_v1_example_XUnionWithStructNullableRefTable},
+    {"example/XUnionWithXUnion", &example_XUnionWithXUnionTable, &v1_example_XUnionWithXUnionTable},
+    {"example/XUnionWithXUnionNullableRef", &example_XUnionWithXUnionNullableRefTable,
+     &v1_v1_example_XUnionWithXUnionNullableRefTable},
+    {"example/UnionWithVector", &example_UnionWithVectorTable, &v1_example_UnionWithVectorTable},
+    {"example/Table_UnionWithVector_StructSandwich",
+     &example_Table_UnionWithVector_StructSandwichTable,
+     &v1_example_Table_UnionWithVector_StructSandwichTable},
+    {"example/Table_UnionWithVector_ReservedSandwich",
+     &example_Table_UnionWithVector_ReservedSandwichTable,
+     &v1_example_Table_UnionWithVector_ReservedSandwichTable},
+    {"example/Sandwich6", &example_Sandwich6Table, &v1_example_Sandwich6Table},
+    {"example/Table_StructWithUint32Sandwich", &example_Table_StructWithUint32SandwichTable,
+     &v1_example_Table_StructWithUint32SandwichTable},
+    {"example/Table_StructWithReservedSandwich", &example_Table_StructWithReservedSandwichTable,
+     &v1_example_Table_StructWithReservedSandwichTable},
+    {"example/StructSize16Alignement8", &example_StructSize16Alignement8Table,
+     &v1_example_StructSize16Alignement8Table},
+    {"example/UnionSize24Alignement8", &example_UnionSize24Alignement8Table,
+     &v1_example_UnionSize24Alignement8Table},
+    {"example/UnionOfUnion", &example_UnionOfUnionTable, &v1_example_UnionOfUnionTable},
+    {"example/Sandwich8", &example_Sandwich8Table, &v1_example_Sandwich8Table},
+    {"example/Sandwich5", &example_Sandwich5Table, &v1_example_Sandwich5Table},
+    {"example/Sandwich3", &example_Sandwich3Table, &v1_example_Sandwich3Table},
+    {"example/StringUnion", &example_StringUnionTable, &v1_example_StringUnionTable},
+    {"example/ArrayStruct", &example_ArrayStructTable, &v1_example_ArrayStructTable},
+    {"example/Size5Alignment4", &example_Size5Alignment4Table, &v1_example_Size5Alignment4Table},
+    {"example/Size5Alignment4Vector", &example_Size5Alignment4VectorTable,
+     &v1_example_Size5Alignment4VectorTable},
+    {"example/Size5Alignment4Array", &example_Size5Alignment4ArrayTable,
+     &v1_example_Size5Alignment4ArrayTable},
+    {"example/Size5Alignment1", &example_Size5Alignment1Table, &v1_example_Size5Alignment1Table},
+    {"example/Size5Alignment1Vector", &example_Size5Alignment1VectorTable,
+     &v1_example_Size5Alignment1VectorTable},
+    {"example/Size5Alignment1Array", &example_Size5Alignment1ArrayTable,
+     &v1_example_Size5Alignment1ArrayTable},
+    {"example/Sandwich7", &example_Sandwich7Table, &v1_example_Sandwich7Table},
+    {"example/Sandwich1WithOptUnion", &example_Sandwich1WithOptUnionTable,
+     &v1_example_Sandwich1WithOptUnionTable},
+    {"example/Regression3", &example_Regression3Table, &v1_example_Regression3Table},
+    {"example/Regression1", &example_Regression1Table, &v1_example_Regression1Table},
+    {"example/Regression2", &example_Regression2Table, &v1_example_Regression2Table},
+};
+
+#endif  // TABLES_CATALOG_H_
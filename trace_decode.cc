@@ -0,0 +1,50 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Prints the last events of a transformer trace.
+//
+// The input is a file of raw `fidl_transform_trace_event_t` records, as
+// obtained by writing out the result of `fidl_transform_trace_snapshot` after a
+// failure. Usage:
+//
+//     ./trace_decode trace.bin [N]
+//
+// where N (default: all) is the number of most recent events to print.
+
+#include <lib/fidl/transformer.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s <trace file> [N]\n", argv[0]);
+    return 1;
+  }
+
+  FILE* file = fopen(argv[1], "rb");
+  if (!file) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  fidl_transform_trace_event_t events[FIDL_TRANSFORM_TRACE_CAPACITY];
+  size_t count = fread(events, sizeof(events[0]), FIDL_TRANSFORM_TRACE_CAPACITY, file);
+  fclose(file);
+
+  size_t first = 0;
+  if (argc == 3) {
+    size_t n = strtoul(argv[2], nullptr, 10);
+    if (n < count) {
+      first = count - n;
+    }
+  }
+
+  char line[160];
+  for (size_t i = first; i < count; i++) {
+    fidl_transform_trace_format(&events[i], line, sizeof(line));
+    printf("%s\n", line);
+  }
+  return 0;
+}
@@ -4,10 +4,20 @@
 
 #include <lib/fidl/internal.h>
 #include <lib/fidl/transformer.h>
+#include <lib/fidl/transformer_internal.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <cstring>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 // Disable warning about implicit fallthrough, since it's intentionally used a lot in this code, and
 // the switch()es end up being harder to read without it. Note that "#pragma GCC" works for both GCC
 // & Clang.
@@ -16,22 +26,31 @@
 
 namespace {
 
-enum struct WireFormat {
-  kOld,
-  kV1,
-};
+using fidl::internal::AlignedAltInlineSize;
+using fidl::internal::AlignedInlineSize;
+using fidl::internal::CompactInlineSize;
+using fidl::internal::InlineSize;
+using fidl::internal::kCompactEnvelopeMaxInlineSize;
+using fidl::internal::VariantIndex;
+using fidl::internal::VariantSize;
+using fidl::internal::WireFormat;
+using fidl::internal::XUnionField;
 
 // Every Transform() method outputs a TraversalResult, which indicates how many out-of-line bytes
 // that transform method consumed, and the actual (not max) number of handles that were encountered
 // during the transformation. This is needed for writing the correct size and handle information in
 // an envelope. (This isn't a great name. A better name would be welcome!)
-struct TraversalResult {
-  uint32_t src_out_of_line_size = 0u;
-  uint32_t dst_out_of_line_size = 0u;
+//
+// Offsets and sizes within a message are of type |Offset|: uint32_t for channel-sized messages (see
+// `fidl_transform`), and uint64_t for large messages (see `fidl_transform_large`).
+template <typename Offset>
+struct BasicTraversalResult {
+  Offset src_out_of_line_size = 0u;
+  Offset dst_out_of_line_size = 0u;
   uint32_t handle_count = 0u;
 
   // TODO(apang): Can we delete this?
-  TraversalResult& operator+=(const TraversalResult rhs) {
+  BasicTraversalResult& operator+=(const BasicTraversalResult rhs) {
     src_out_of_line_size += rhs.src_out_of_line_size;
     dst_out_of_line_size += rhs.dst_out_of_line_size;
     handle_count += rhs.handle_count;
@@ -40,208 +59,581 @@ struct TraversalResult {
   }
 };
 
-// TODO(apang): I think we can get rid of the wire_format parameter by just doing union.alt.
-// TODO(apang): This may not return the aligned size, since e.g. "type->coded_struct.size" below may
-// be unaligned
-uint32_t AlignedInlineSize(const fidl_type_t* type, WireFormat wire_format) {
-  if (!type) {
-    // For integral types (i.e. primitive, enum, bits).
-    // TODO(apang): This returns the aligned size... but structs etc below don't return the aligned
-    // size :/
-    return 8;
-  }
-  switch (type->type_tag) {
-    case fidl::kFidlTypePrimitive:
-    case fidl::kFidlTypeEnum:
-    case fidl::kFidlTypeBits:
-      return 8;
-    case fidl::kFidlTypeStructPointer:
-      return 8;
-    case fidl::kFidlTypeUnionPointer:
-      switch (wire_format) {
-        case WireFormat::kOld:
-          return 8;
-        case WireFormat::kV1:
-          return 24;  // xunion
-      }
-    case fidl::kFidlTypeVector:
-    case fidl::kFidlTypeString:
-      return 16;
-    case fidl::kFidlTypeStruct:
-      return type->coded_struct.size;
-    case fidl::kFidlTypeUnion:
-      switch (wire_format) {
-        case WireFormat::kOld:
-          return type->coded_union.size;
-        case WireFormat::kV1:
-          return 24;  // xunion
-      }
-    case fidl::kFidlTypeArray:
-      return type->coded_array.array_size;
-    case fidl::kFidlTypeXUnion:
-      return 24;
-    case fidl::kFidlTypeHandle:
-      return 8;
-    case fidl::kFidlTypeTable:
-      return 16;
-  }
-
-  // This is needed to suppress a GCC warning "control reaches end of non-void function", since GCC
-  // treats switch() on enums as non-exhaustive without a default case.
-  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
-  return 0;
-}
-
-uint32_t AlignedAltInlineSize(const fidl_type_t* type) {
-  if (!type) {
-    // For integral types (i.e. primitive, enum, bits).
-    return 8;
-  }
-  switch (type->type_tag) {
-    case fidl::kFidlTypePrimitive:
-    case fidl::kFidlTypeEnum:
-    case fidl::kFidlTypeBits:
-      return 8;
-    case fidl::kFidlTypeStructPointer:
-    case fidl::kFidlTypeUnionPointer:
-      return 8;
-    case fidl::kFidlTypeVector:
-    case fidl::kFidlTypeString:
-      return 16;
-    case fidl::kFidlTypeStruct:
-      return FIDL_ALIGN(type->coded_struct.alt_type->size);
-    case fidl::kFidlTypeUnion:
-      return FIDL_ALIGN(type->coded_union.alt_type->size);
-    case fidl::kFidlTypeArray:
-      return FIDL_ALIGN(type->coded_array.alt_type->array_size);
-    case fidl::kFidlTypeXUnion:
-      return 24;
-    case fidl::kFidlTypeHandle:
-      return 8;
-    case fidl::kFidlTypeTable:
-      return 16;
-  }
-
-  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
-  return 0;
-}
-
-struct Position {
-  uint32_t src_inline_offset = 0;
-  uint32_t src_out_of_line_offset = 0;
-  uint32_t dst_inline_offset = 0;
-  uint32_t dst_out_of_line_offset = 0;
+template <typename Offset>
+struct BasicPosition {
+  Offset src_inline_offset = 0;
+  Offset src_out_of_line_offset = 0;
+  Offset dst_inline_offset = 0;
+  Offset dst_out_of_line_offset = 0;
 
-  Position(uint32_t src_inline_offset, uint32_t src_out_of_line_offset, uint32_t dst_inline_offset,
-           uint32_t dst_out_of_line_offset)
+  BasicPosition(Offset src_inline_offset, Offset src_out_of_line_offset, Offset dst_inline_offset,
+                Offset dst_out_of_line_offset)
       : src_inline_offset(src_inline_offset),
         src_out_of_line_offset(src_out_of_line_offset),
         dst_inline_offset(dst_inline_offset),
         dst_out_of_line_offset(dst_out_of_line_offset) {}
 
-  inline Position IncreaseInlineOffset(uint32_t increase) const
+  inline BasicPosition IncreaseInlineOffset(Offset increase) const
       __attribute__((warn_unused_result)) {
     return IncreaseSrcInlineOffset(increase).IncreaseDstInlineOffset(increase);
   }
 
-  inline Position IncreaseSrcInlineOffset(uint32_t increase) const
+  inline BasicPosition IncreaseSrcInlineOffset(Offset increase) const
       __attribute__((warn_unused_result)) {
-    return Position(src_inline_offset + increase, src_out_of_line_offset, dst_inline_offset,
-                    dst_out_of_line_offset);
+    return BasicPosition(src_inline_offset + increase, src_out_of_line_offset, dst_inline_offset,
+                         dst_out_of_line_offset);
   }
 
-  inline Position IncreaseSrcOutOfLineOffset(uint32_t increase) const
+  inline BasicPosition IncreaseSrcOutOfLineOffset(Offset increase) const
       __attribute__((warn_unused_result)) {
-    return Position(src_inline_offset, src_out_of_line_offset + increase, dst_inline_offset,
-                    dst_out_of_line_offset);
+    return BasicPosition(src_inline_offset, src_out_of_line_offset + increase, dst_inline_offset,
+                         dst_out_of_line_offset);
   }
 
-  inline Position IncreaseDstInlineOffset(uint32_t increase) const
+  inline BasicPosition IncreaseDstInlineOffset(Offset increase) const
       __attribute__((warn_unused_result)) {
-    return Position(src_inline_offset, src_out_of_line_offset, dst_inline_offset + increase,
-                    dst_out_of_line_offset);
+    return BasicPosition(src_inline_offset, src_out_of_line_offset, dst_inline_offset + increase,
+                         dst_out_of_line_offset);
   }
 
-  inline Position IncreaseDstOutOfLineOffset(uint32_t increase) const
+  inline BasicPosition IncreaseDstOutOfLineOffset(Offset increase) const
       __attribute__((warn_unused_result)) {
-    return Position(src_inline_offset, src_out_of_line_offset, dst_inline_offset,
-                    dst_out_of_line_offset + increase);
+    return BasicPosition(src_inline_offset, src_out_of_line_offset, dst_inline_offset,
+                         dst_out_of_line_offset + increase);
+  }
+};
+
+// FIDL_ALIGN for offsets and sizes of out-of-line objects, which may exceed 32 bits.
+template <typename Offset>
+inline Offset AlignOffset(Offset offset) {
+  constexpr Offset kMask = FIDL_ALIGNMENT - 1;
+  return static_cast<Offset>((offset + kMask) & ~kMask);
+}
+
+// Computes the aligned size of |count| elements of |element_size| bytes, which is false if it does
+// not fit in |Offset|.
+template <typename Offset>
+inline bool ArraySize(uint64_t count, uint32_t element_size, Offset* out_size) {
+  uint64_t size;
+  if (__builtin_mul_overflow(count, element_size, &size) ||
+      size > static_cast<Offset>(~static_cast<Offset>(FIDL_ALIGNMENT - 1))) {
+    return false;
+  }
+  *out_size = AlignOffset(static_cast<Offset>(size));
+  return true;
+}
+
+// Copies (unless |kCopy| is false) the bytes of a string from |i| on, 16 at a
+// time while they are ASCII. Returns the offset of the first other byte, or of
+// the last bytes once fewer than 16 remain.
+template <bool kCopy>
+inline size_t CopyAscii(uint8_t* dst, const uint8_t* src, size_t i, size_t size) {
+  constexpr uint64_t kHighBits = 0x8080808080808080ull;
+  for (; size - i >= 16; i += 16) {
+    uint64_t words[2];
+    memcpy(words, &src[i], sizeof(words));
+    if (kCopy) {
+      memcpy(&dst[i], words, sizeof(words));
+    }
+    const uint64_t high_bits[2] = {words[0] & kHighBits, words[1] & kHighBits};
+    if ((high_bits[0] | high_bits[1]) != 0) {
+      // Words are little-endian, as FIDL messages are.
+      return i + (high_bits[0] ? static_cast<size_t>(__builtin_ctzll(high_bits[0]) / 8)
+                               : sizeof(uint64_t) +
+                                     static_cast<size_t>(__builtin_ctzll(high_bits[1]) / 8));
+    }
+  }
+  return i;
+}
+
+#if defined(__x86_64__)
+// Same as CopyAscii(), 32 bytes at a time.
+template <bool kCopy>
+__attribute__((target("avx2"))) size_t CopyAsciiAvx2(uint8_t* dst, const uint8_t* src, size_t i,
+                                                     size_t size) {
+  for (; size - i >= 32; i += 32) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    if (kCopy) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dst[i]), block);
+    }
+    const auto high_bits = static_cast<uint32_t>(_mm256_movemask_epi8(block));
+    if (high_bits != 0) {
+      return i + static_cast<size_t>(__builtin_ctz(high_bits));
+    }
+  }
+  return CopyAscii<kCopy>(dst, src, i, size);
+}
+#endif
+
+// Same as CopyAscii(), with AVX2 where the CPU has it. Kept out of line, so as
+// not to slow down short strings.
+template <bool kCopy>
+__attribute__((noinline)) size_t CopyAsciiRun(uint8_t* dst, const uint8_t* src, size_t i,
+                                              size_t size) {
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    return CopyAsciiAvx2<kCopy>(dst, src, i, size);
+  }
+#endif
+  return CopyAscii<kCopy>(dst, src, i, size);
+}
+
+#if defined(__x86_64__)
+// Errors of pairs of bytes, as the bits of three lookups on the previous byte
+// and the high nibble of the current one (the algorithm of Keiser and Lemire,
+// "Validating UTF-8 In Less Than One Instruction Per Byte"). A pair is invalid
+// if all three lookups share a bit, except for continuations which must be the
+// third or fourth byte of a sequence, checked separately.
+constexpr uint8_t kUtf8TooShort = 1 << 0;    // 11______ 0_______, 11______ 11______
+constexpr uint8_t kUtf8TooLong = 1 << 1;     // 0_______ 10______
+constexpr uint8_t kUtf8Overlong3 = 1 << 2;   // 11100000 100_____
+constexpr uint8_t kUtf8TooLarge = 1 << 3;    // 11110100 1001____, 11110100 101_____, 11110101+
+constexpr uint8_t kUtf8Surrogate = 1 << 4;   // 11101101 101_____
+constexpr uint8_t kUtf8Overlong2 = 1 << 5;   // 1100000_ 10______
+constexpr uint8_t kUtf8TooLarge1000 = 1 << 6;  // 11110101+ 1000____
+constexpr uint8_t kUtf8Overlong4 = 1 << 6;   // 11110000 1000____
+constexpr uint8_t kUtf8TwoConts = 1 << 7;    // 10______ 10______
+constexpr uint8_t kUtf8Carry = kUtf8TooShort | kUtf8TooLong | kUtf8TwoConts;
+
+__attribute__((target("avx2"))) inline __m256i Lookup16(__m256i nibbles, const uint8_t* table) {
+  const __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+  return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(half), nibbles);
+}
+
+__attribute__((target("avx2"))) inline __m256i HighNibbles(__m256i bytes) {
+  return _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0f));
+}
+
+// Returns the errors of the 32 bytes of |block|, preceded by those of |prev|.
+__attribute__((target("avx2"))) inline __m256i Utf8BlockErrors(__m256i block, __m256i prev) {
+  static const uint8_t kByte1High[16] = {
+      // 0_______ ________
+      kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong,
+      kUtf8TooLong, kUtf8TooLong,
+      // 10______ ________
+      kUtf8TwoConts, kUtf8TwoConts, kUtf8TwoConts, kUtf8TwoConts,
+      // 1100____ ________
+      kUtf8TooShort | kUtf8Overlong2,
+      // 1101____ ________
+      kUtf8TooShort,
+      // 1110____ ________
+      kUtf8TooShort | kUtf8Overlong3 | kUtf8Surrogate,
+      // 1111____ ________
+      kUtf8TooShort | kUtf8TooLarge | kUtf8TooLarge1000 | kUtf8Overlong4};
+  static const uint8_t kByte1Low[16] = {
+      // ____0000 ________
+      kUtf8Carry | kUtf8Overlong3 | kUtf8Overlong2 | kUtf8Overlong4,
+      // ____0001 ________
+      kUtf8Carry | kUtf8Overlong2,
+      // ____001_ ________
+      kUtf8Carry, kUtf8Carry,
+      // ____0100 ________
+      kUtf8Carry | kUtf8TooLarge,
+      // ____0101 ________ to ____1100 ________
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      // ____1101 ________
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000 | kUtf8Surrogate,
+      // ____111_ ________
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+      kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000};
+  static const uint8_t kByte2High[16] = {
+      // ________ 0_______
+      kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+      kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+      // ________ 1000____
+      kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Overlong3 | kUtf8TooLarge1000 |
+          kUtf8Overlong4,
+      // ________ 1001____
+      kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Overlong3 | kUtf8TooLarge,
+      // ________ 101_____
+      kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Surrogate | kUtf8TooLarge,
+      kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Surrogate | kUtf8TooLarge,
+      // ________ 11______
+      kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort};
+
+  // The last bytes of |prev| followed by the first bytes of |block|.
+  const __m256i spanning = _mm256_permute2x128_si256(prev, block, 0x21);
+  const __m256i prev1 = _mm256_alignr_epi8(block, spanning, 15);
+  const __m256i prev2 = _mm256_alignr_epi8(block, spanning, 14);
+  const __m256i prev3 = _mm256_alignr_epi8(block, spanning, 13);
+  const __m256i special = _mm256_and_si256(
+      _mm256_and_si256(Lookup16(HighNibbles(prev1), kByte1High),
+                       Lookup16(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)), kByte1Low)),
+      Lookup16(HighNibbles(block), kByte2High));
+  // Continuations must follow a lead of three bytes two bytes before, or of
+  // four bytes three bytes before (kUtf8TwoConts flags all others).
+  const __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xe0 - 0x80)));
+  const __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xf0 - 0x80)));
+  const __m256i continuations =
+      _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+  return _mm256_xor_si256(continuations, special);
+}
+
+// Returns whether the last bytes of |block| start a sequence which does not end
+// within it.
+__attribute__((target("avx2"))) inline __m256i Utf8Incomplete(__m256i block) {
+  const __m256i max = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, static_cast<char>(0xf0 - 1), static_cast<char>(0xe0 - 1),
+      static_cast<char>(0xc0 - 1));
+  return _mm256_subs_epu8(block, max);
+}
+
+// Accumulates the errors of consecutive blocks.
+struct Utf8Checker {
+  __attribute__((target("avx2"))) Utf8Checker()
+      : prev(_mm256_setzero_si256()),
+        errors(_mm256_setzero_si256()),
+        incomplete(_mm256_setzero_si256()) {}
+
+  __attribute__((target("avx2"))) void Check(__m256i block) {
+    if (_mm256_movemask_epi8(block) == 0) {
+      errors = _mm256_or_si256(errors, incomplete);
+    } else {
+      errors = _mm256_or_si256(errors, Utf8BlockErrors(block, prev));
+      incomplete = Utf8Incomplete(block);
+    }
+    prev = block;
+  }
+
+  __attribute__((target("avx2"))) bool Valid() const {
+    const __m256i all = _mm256_or_si256(errors, incomplete);
+    return _mm256_testz_si256(all, all);
+  }
+
+  __m256i prev;
+  __m256i errors;
+  // Sequences started by the last block which do not end within it.
+  __m256i incomplete;
+};
+
+// Copies (unless |kCopy| is false) the bytes of a string from |i| on, which
+// starts a character, checking 32 at a time that they are valid UTF-8. Returns
+// false if they are not, without saying why.
+template <bool kCopy>
+__attribute__((target("avx2"))) bool CopyAndValidateUtf8Avx2(uint8_t* dst,
+                                                                       const uint8_t* src,
+                                                                       size_t i, size_t size) {
+  Utf8Checker checker;
+  for (; size - i >= 32; i += 32) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    if (kCopy) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dst[i]), block);
+    }
+    checker.Check(block);
+  }
+  if (i < size) {
+    // The rest, followed by zeros (ASCII).
+    alignas(32) uint8_t tail[32] = {};
+    memcpy(tail, &src[i], size - i);
+    if (kCopy) {
+      memcpy(&dst[i], &src[i], size - i);
+    }
+    checker.Check(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+  }
+  return checker.Valid();
+}
+#endif
+
+// Same as CopyAndValidateUtf8Avx2() where the CPU has AVX2, and otherwise
+// returns false without checking anything. Kept out of line, so as not to slow
+// down short strings.
+template <bool kCopy>
+__attribute__((noinline)) bool CopyAndValidateUtf8Run(uint8_t* dst, const uint8_t* src, size_t i,
+                                                      size_t size) {
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    return CopyAndValidateUtf8Avx2<kCopy>(dst, src, i, size);
+  }
+#endif
+  return false;
+}
+
+// Copies the |size| bytes of a string from |src| to |dst| (unless |kCopy| is
+// false, when |dst| is unused), checking that they are valid UTF-8 along the
+// way. Returns nullptr, or why they are not.
+//
+// Runs of ASCII are copied and checked a block at a time (16 bytes, then 32
+// with AVX2 where the CPU has it). Other characters are decoded one at a time,
+// unless the CPU has AVX2 and at least 32 bytes remain: these are then checked
+// 32 at a time, and only decoded one at a time to say why if they are invalid.
+template <bool kCopy>
+const char* CopyAndValidateUtf8(uint8_t* dst, const uint8_t* src, size_t size) {
+  size_t i = 0;
+  bool avx2 = true;
+  while (i < size) {
+    const uint8_t lead = src[i];
+    if (lead < 0x80) {
+      if (size - i < 16) {
+        if (kCopy) {
+          dst[i] = lead;
+        }
+        i++;
+        continue;
+      }
+      const size_t end = CopyAscii<kCopy>(dst, src, i, i + 16);
+      if (end != i + 16 || size - end < 32) {
+        i = end;
+        continue;
+      }
+      // A whole block of ASCII, so the run may be long.
+      i = CopyAsciiRun<kCopy>(dst, src, end, size);
+      continue;
+    }
+    if (avx2 && size - i >= 32) {
+      if (CopyAndValidateUtf8Run<kCopy>(dst, src, i, size)) {
+        return nullptr;
+      }
+      avx2 = false;
+    }
+    size_t length;
+    uint32_t code_point, min_code_point;
+    if ((lead & 0xe0) == 0xc0) {
+      length = 2, code_point = lead & 0x1fu, min_code_point = 0x80;
+    } else if ((lead & 0xf0) == 0xe0) {
+      length = 3, code_point = lead & 0x0fu, min_code_point = 0x800;
+    } else if ((lead & 0xf8) == 0xf0) {
+      length = 4, code_point = lead & 0x07u, min_code_point = 0x10000;
+    } else {
+      return "string has an invalid UTF-8 leading byte";
+    }
+    if (length > size - i) {
+      return "string ends within a UTF-8 sequence";
+    }
+    for (size_t j = 1; j < length; j++) {
+      if ((src[i + j] & 0xc0) != 0x80) {
+        return "string has a truncated UTF-8 sequence";
+      }
+      code_point = (code_point << 6) | (src[i + j] & 0x3fu);
+    }
+    if (code_point < min_code_point) {
+      return "string has an overlong UTF-8 sequence";
+    }
+    if (code_point >= 0xd800 && code_point <= 0xdfff) {
+      return "string encodes a UTF-16 surrogate";
+    }
+    if (code_point > 0x10ffff) {
+      return "string encodes a code point above U+10FFFF";
+    }
+    if (kCopy) {
+      memcpy(&dst[i], &src[i], length);
+    }
+    i += length;
   }
+  return nullptr;
+}
+
+static_assert((FIDL_TRANSFORM_TRACE_CAPACITY & (FIDL_TRANSFORM_TRACE_CAPACITY - 1)) == 0,
+              "trace capacity must be a power of two");
+
+// Per-thread trace ring buffer. It is zero-initialized POD, so accessing it does
+// not go through a TLS initialization wrapper.
+struct TraceRing {
+  fidl_transform_trace_event_t events[FIDL_TRANSFORM_TRACE_CAPACITY];
+  uint32_t next_seq;
+};
+
+thread_local TraceRing trace_ring;
+
+// Offsets of large messages are truncated to 32 bits in trace events.
+template <typename Offset>
+inline void Trace(fidl_transform_trace_kind_t kind, uint8_t type_tag,
+                  const BasicPosition<Offset>& position, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+#if FIDL_TRANSFORMER_TRACE
+  const uint32_t seq = trace_ring.next_seq++;
+  auto& event = trace_ring.events[seq & (FIDL_TRANSFORM_TRACE_CAPACITY - 1)];
+  event.kind = kind;
+  event.type_tag = type_tag;
+  event.reserved = 0;
+  event.seq = seq;
+  event.src_inline_offset = static_cast<uint32_t>(position.src_inline_offset);
+  event.src_out_of_line_offset = static_cast<uint32_t>(position.src_out_of_line_offset);
+  event.dst_inline_offset = static_cast<uint32_t>(position.dst_inline_offset);
+  event.dst_out_of_line_offset = static_cast<uint32_t>(position.dst_out_of_line_offset);
+  event.arg0 = arg0;
+  event.arg1 = arg1;
+#else
+  (void)kind;
+  (void)type_tag;
+  (void)position;
+  (void)arg0;
+  (void)arg1;
+#endif
+}
+
+// The last failure on this thread (see `fidl_transform_last_failure`). It is
+// only written when a transformation fails, so that successful ones pay
+// nothing for it.
+struct LastFailure {
+  fidl_transform_failure_t failure;
+  bool recorded;
 };
 
-class SrcDst final {
+thread_local LastFailure last_failure;
+
+// Records where the walk of a message failed. The transformation and type are
+// recorded by the caller of the walk.
+template <typename Offset>
+void RecordFailure(zx_status_t status, const char* error_msg,
+                   const BasicPosition<Offset>& position) {
+  last_failure.failure.status = status;
+  last_failure.failure.error_msg = error_msg;
+  last_failure.failure.src_offset = position.src_inline_offset;
+}
+
+void RecordFailedTransformation(fidl_transformation_t transformation, const fidl_type_t* type) {
+  last_failure.failure.transformation = transformation;
+  last_failure.failure.type = type;
+  last_failure.recorded = true;
+}
+
+inline uint8_t TraceTypeTag(const fidl_type_t* type) {
+  return type ? static_cast<uint8_t>(type->type_tag) : FIDL_TRANSFORM_TRACE_NO_TYPE;
+}
+
+// Reads the source and writes the destination of a transformation. If
+// |kValidateOnly| is set, writes are dropped (and the destination may be null),
+// but still account for the size of the destination, so that the walk checks
+// the source exactly as a transformation would.
+template <typename Offset, bool kValidateOnly = false>
+class BasicSrcDst final {
  public:
-  SrcDst(const uint8_t* src_bytes, const uint32_t src_num_bytes, uint8_t* dst_bytes,
-         uint32_t* out_dst_num_bytes)
+  using Position = BasicPosition<Offset>;
+
+  BasicSrcDst(const uint8_t* src_bytes, const Offset src_num_bytes, uint8_t* dst_bytes,
+              Offset* out_dst_num_bytes)
       : src_bytes_(src_bytes),
         src_num_bytes_(src_num_bytes),
         dst_bytes_(dst_bytes),
         out_dst_num_bytes_(out_dst_num_bytes) {}
-  SrcDst(const SrcDst&) = delete;
+  BasicSrcDst(const BasicSrcDst&) = delete;
 
-  ~SrcDst() { *out_dst_num_bytes_ = dst_max_offset_; }
+  ~BasicSrcDst() { *out_dst_num_bytes_ = dst_max_offset_; }
 
   // TODO(apang): Change |position| arg to src_offset
   template <typename T>  // TODO(apang): restrict T should be pointer type
   const T* __attribute__((warn_unused_result)) Read(const Position& position) const {
-    uint32_t size = sizeof(T);
-    if (!(position.src_inline_offset + size <= src_num_bytes_)) {
+    if (!SrcContains(position.src_inline_offset, sizeof(T))) {
       return nullptr;
     }
 
     return reinterpret_cast<const T*>(src_bytes_ + position.src_inline_offset);
   }
 
+  // Whether the |size| bytes at |src_offset| lie within the source, without overflowing.
+  bool SrcContains(Offset src_offset, uint64_t size) const {
+    return src_offset <= src_num_bytes_ && size <= src_num_bytes_ - src_offset;
+  }
+
   // TODO(apang): Rename to CopyInline?
-  void Copy(const Position& position, uint32_t size) {
-    assert(position.src_inline_offset + size <= src_num_bytes_);
+  void Copy(const Position& position, Offset size) {
+    assert(SrcContains(position.src_inline_offset, size));
+
+    Trace(FIDL_TRANSFORM_TRACE_COPY, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(size));
+    if (!kValidateOnly) {
+      memcpy(dst_bytes_ + position.dst_inline_offset, src_bytes_ + position.src_inline_offset,
+             size);
+    }
+    UpdateMaxOffset(position.dst_inline_offset + size);
+  }
+
+  // Same as Copy(), for the contents of a string. Returns nullptr, or why they
+  // are not valid UTF-8.
+  const char* CopyUtf8(const Position& position, Offset size) {
+    assert(SrcContains(position.src_inline_offset, size));
 
-    memcpy(dst_bytes_ + position.dst_inline_offset, src_bytes_ + position.src_inline_offset, size);
+    Trace(FIDL_TRANSFORM_TRACE_COPY, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(size));
     UpdateMaxOffset(position.dst_inline_offset + size);
+    return CopyAndValidateUtf8<!kValidateOnly>(dst_bytes_ + position.dst_inline_offset,
+                                               src_bytes_ + position.src_inline_offset, size);
   }
 
   // TODO(apang): Rename to PadInline
-  void Pad(const Position& position, uint32_t size) {
-    memset(dst_bytes_ + position.dst_inline_offset, 0, size);
+  void Pad(const Position& position, Offset size) {
+    Trace(FIDL_TRANSFORM_TRACE_PAD, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(size), 0);
+    if (!kValidateOnly) {
+      memset(dst_bytes_ + position.dst_inline_offset, 0, size);
+    }
     UpdateMaxOffset(position.dst_inline_offset + size);
   }
 
-  void PadOutOfLine(const Position& position, uint32_t size) {
-    memset(dst_bytes_ + position.dst_out_of_line_offset, 0, size);
+  void PadOutOfLine(const Position& position, Offset size) {
+    Trace(FIDL_TRANSFORM_TRACE_PAD, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(size), 1);
+    if (!kValidateOnly) {
+      memset(dst_bytes_ + position.dst_out_of_line_offset, 0, size);
+    }
     UpdateMaxOffset(position.dst_out_of_line_offset + size);
   }
 
   template <typename T>
   void Write(const Position& position, T value) {
-    auto ptr = reinterpret_cast<T*>(dst_bytes_ + position.dst_inline_offset);
-    *ptr = value;
-    UpdateMaxOffset(position.dst_inline_offset + static_cast<uint32_t>(sizeof(value)));
+    Trace(FIDL_TRANSFORM_TRACE_WRITE, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(sizeof(value)));
+    if (!kValidateOnly) {
+      auto ptr = reinterpret_cast<T*>(dst_bytes_ + position.dst_inline_offset);
+      *ptr = value;
+    }
+    UpdateMaxOffset(position.dst_inline_offset + static_cast<Offset>(sizeof(value)));
   }
 
  private:
-  void UpdateMaxOffset(uint32_t dst_offset) {
+  void UpdateMaxOffset(Offset dst_offset) {
     if (dst_offset > dst_max_offset_) {
       dst_max_offset_ = dst_offset;
     }
   }
 
   const uint8_t* src_bytes_;
-  const uint32_t src_num_bytes_;
+  const Offset src_num_bytes_;
   uint8_t* dst_bytes_;
-  uint32_t* out_dst_num_bytes_;
+  Offset* out_dst_num_bytes_;
 
-  uint32_t dst_max_offset_ = 0;
+  Offset dst_max_offset_ = 0;
 };
 
+template <typename Offset, bool kValidateOnly>
 class TransformerBase {
  public:
-  TransformerBase(SrcDst* src_dst, const char** out_error_msg)
-      : src_dst(src_dst), out_error_msg_(out_error_msg) {}
+  using Position = BasicPosition<Offset>;
+  using TraversalResult = BasicTraversalResult<Offset>;
+  using SrcDst = BasicSrcDst<Offset, kValidateOnly>;
+
+  // If |compact| is set, the v1 side of the transformation uses the compact v1
+  // wire format (see `FIDL_ENVELOPE_INLINED`).
+  TransformerBase(SrcDst* src_dst, const char** out_error_msg, bool compact,
+                  const fidl_transform_options_t& options)
+      : src_dst(src_dst),
+        compact_(compact),
+        canonicalize_(options.canonicalize),
+        validate_strings_(options.validate_strings),
+        index_(options.index),
+        index_capacity_(options.index_capacity),
+        out_index_count_(options.out_index_count),
+        check_handles_(options.check_handles),
+        handles_(options.handles),
+        num_handles_(options.num_handles),
+        envelope_handles_(options.envelope_handles),
+        envelope_handles_capacity_(options.envelope_handles_capacity),
+        out_envelope_handles_count_(options.out_envelope_handles_count),
+        out_error_msg_(out_error_msg) {}
   virtual ~TransformerBase() = default;
 
   zx_status_t TransformTopLevelStruct(const fidl_type_t* type) {
     if (type->type_tag != fidl::kFidlTypeStruct) {
-      return Fail(ZX_ERR_INVALID_ARGS, "only top-level structs supported");
+      return Fail(ZX_ERR_INVALID_ARGS, "only top-level structs supported", Position(0, 0, 0, 0));
     }
 
     const auto& src_coded_struct = type->coded_struct;
@@ -250,15 +642,64 @@ class TransformerBase {
     // out-of-line offset) is exactly placed after this struct, i.e. the
     // struct's inline size.
     const auto start_position = Position(0, src_coded_struct.size, 0, dst_coded_struct.size);
+    if (!src_dst->SrcContains(0, FIDL_ALIGN(src_coded_struct.size))) {
+      return Truncated(start_position);
+    }
 
+    if (index_ && !IndexOpen(type, start_position, FIDL_ALIGN(dst_coded_struct.size))) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "field index capacity exceeded", start_position);
+    }
     TraversalResult discarded_traversal_result;
-    return TransformStruct(src_coded_struct, dst_coded_struct, start_position,
-                           FIDL_ALIGN(dst_coded_struct.size), &discarded_traversal_result);
+    const zx_status_t status =
+        TransformStruct(src_coded_struct, dst_coded_struct, start_position,
+                        FIDL_ALIGN(dst_coded_struct.size), &discarded_traversal_result);
+    if (status == ZX_OK && index_) {
+      IndexClose();
+      *out_index_count_ = index_count_;
+    }
+    if (status == ZX_OK && check_handles_) {
+      if (handle_count_ != num_handles_) {
+        return Fail(ZX_ERR_INVALID_ARGS, "handle array has more handles than the message",
+                    start_position);
+      }
+      if (envelope_handles_) {
+        *out_envelope_handles_count_ = envelope_handles_count_;
+      }
+    }
+    return status;
   }
 
  protected:
-  zx_status_t Transform(const fidl_type_t* type, const Position& position, const uint32_t dst_size,
+  zx_status_t Transform(const fidl_type_t* type, const Position& position, const Offset dst_size,
                         TraversalResult* out_traversal_result) {
+    Trace(FIDL_TRANSFORM_TRACE_NODE, TraceTypeTag(type), position, static_cast<uint32_t>(dst_size));
+
+    if (!index_) {
+      return TransformNode(type, position, dst_size, out_traversal_result);
+    }
+    if (!IndexOpen(type, position, dst_size)) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "field index capacity exceeded", position);
+    }
+    const zx_status_t status = TransformNode(type, position, dst_size, out_traversal_result);
+    IndexClose();
+    return status;
+  }
+
+  // Records a node of the field index without descendants, for contents
+  // copied without being walked (i.e. inlined envelope contents).
+  zx_status_t IndexLeaf(const fidl_type_t* type, const Position& position, Offset dst_size) {
+    if (!index_) {
+      return ZX_OK;
+    }
+    if (!IndexOpen(type, position, dst_size)) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "field index capacity exceeded", position);
+    }
+    IndexClose();
+    return ZX_OK;
+  }
+
+  zx_status_t TransformNode(const fidl_type_t* type, const Position& position,
+                            const Offset dst_size, TraversalResult* out_traversal_result) {
     auto copy = [&] {
       src_dst->Copy(position, dst_size);
       return ZX_OK;
@@ -270,10 +711,25 @@ class TransformerBase {
 
     switch (type->type_tag) {
       case fidl::kFidlTypeHandle: {
-        auto presence = *src_dst->Read<uint32_t>(position);
+        const auto* src_presence = src_dst->template Read<uint32_t>(position);
+        if (!src_presence) {
+          return Truncated(position);
+        }
+        const uint32_t presence = *src_presence;
+        if (check_handles_) {
+          if (const zx_status_t status = CheckHandle(type->coded_handle, presence, position)) {
+            return status;
+          }
+        }
         if (presence == FIDL_HANDLE_PRESENT) {
           out_traversal_result->handle_count++;
         }
+        if (canonicalize_) {
+          copy();
+          src_dst->Write(position, presence == FIDL_HANDLE_PRESENT ? FIDL_HANDLE_PRESENT
+                                                                  : FIDL_HANDLE_ABSENT);
+          return ZX_OK;
+        }
         // fallthrough
       }
       case fidl::kFidlTypePrimitive:
@@ -313,11 +769,11 @@ class TransformerBase {
         auto src_coded_array = convert(type->coded_array);
         auto dst_coded_array = convert(*type->coded_array.alt_type);
         uint32_t dst_array_size = type->coded_array.alt_type->array_size;
-        return TransformArray(src_coded_array, dst_coded_array, position, dst_array_size,
-                              out_traversal_result);
+        return TransformArray(src_coded_array, dst_coded_array, src_coded_array.element_count,
+                              position, dst_array_size, out_traversal_result);
       }
       case fidl::kFidlTypeString:
-        return TransformString(position, out_traversal_result);
+        return TransformString(type->coded_string, position, out_traversal_result);
       case fidl::kFidlTypeVector: {
         const auto& src_coded_vector = type->coded_vector;
         const auto& dst_coded_vector = *src_coded_vector.alt_type;
@@ -329,7 +785,7 @@ class TransformerBase {
         return TransformXUnion(type->coded_xunion, position, out_traversal_result);
     }
 
-    return Fail(ZX_ERR_BAD_STATE, "unknown type tag");
+    return Fail(ZX_ERR_BAD_STATE, "unknown type tag", position);
 
     // TODO(apang): Think about putting logic for updating out_traversal_result in Copy/etc
     // functions.
@@ -341,8 +797,17 @@ class TransformerBase {
                                      const fidl::FidlCodedStruct& dst_coded_struct,
                                      const Position& position,
                                      TraversalResult* out_traversal_result) {
-    auto presence = *src_dst->Read<uint64_t>(position);
-    src_dst->Copy(position, sizeof(uint64_t));
+    const auto* src_presence = src_dst->template Read<uint64_t>(position);
+    if (!src_presence) {
+      return Truncated(position);
+    }
+    const uint64_t presence = *src_presence;
+    if (canonicalize_) {
+      src_dst->Write(position, presence == FIDL_ALLOC_PRESENT ? FIDL_ALLOC_PRESENT
+                                                              : FIDL_ALLOC_ABSENT);
+    } else {
+      src_dst->Copy(position, sizeof(uint64_t));
+    }
 
     if (presence != FIDL_ALLOC_PRESENT) {
       return ZX_OK;
@@ -350,6 +815,9 @@ class TransformerBase {
 
     uint32_t aligned_src_size = FIDL_ALIGN(src_coded_struct.size);
     uint32_t aligned_dst_size = FIDL_ALIGN(dst_coded_struct.size);
+    if (!SrcContainsOutOfLine(position, aligned_src_size)) {
+      return Truncated(position);
+    }
     const auto struct_position = Position{
         position.src_out_of_line_offset,
         position.src_out_of_line_offset + aligned_src_size,
@@ -366,22 +834,29 @@ class TransformerBase {
 
   zx_status_t TransformStruct(const fidl::FidlCodedStruct& src_coded_struct,
                               const fidl::FidlCodedStruct&,
-                              const Position& position, uint32_t dst_size,
+                              const Position& position, Offset dst_size,
                               TraversalResult* out_traversal_result) {
     // Note: we cannot use dst_coded_struct.size, and must instead rely on
     // the provided dst_size since this struct could be placed in an alignment
     // context that is larger than its inherent size.
 
-    // Copy structs without any coded fields, and done.
+    // Copy structs without any coded fields, and done. The destination may be
+    // larger than the struct (e.g. out-of-line), and end with padding.
     if (src_coded_struct.field_count == 0) {
+      if (canonicalize_ && dst_size > src_coded_struct.size) {
+        src_dst->Copy(position, src_coded_struct.size);
+        src_dst->Pad(position.IncreaseInlineOffset(src_coded_struct.size),
+                     dst_size - src_coded_struct.size);
+        return ZX_OK;
+      }
       src_dst->Copy(position, dst_size);
 
       return ZX_OK;
     }
 
-    const uint32_t src_start_of_struct = position.src_inline_offset;
-    const uint32_t dst_start_of_struct = position.dst_inline_offset;
-    const uint32_t dst_end_of_struct = position.dst_inline_offset + dst_size;
+    const Offset src_start_of_struct = position.src_inline_offset;
+    const Offset dst_start_of_struct = position.dst_inline_offset;
+    const Offset dst_end_of_struct = position.dst_inline_offset + dst_size;
 
     auto current_position = position;
 
@@ -409,11 +884,21 @@ class TransformerBase {
 
       // Copy fields without coding tables.
       if (!src_field.type) {
-        const uint32_t dst_field_size =
+        const Offset dst_field_size =
             src_field.padding_offset + (src_start_of_struct - current_position.src_inline_offset);
         src_dst->Copy(current_position, dst_field_size);
         current_position = current_position.IncreaseInlineOffset(dst_field_size);
 
+        // Padding is otherwise copied along with the fields after it. It is
+        // laid out for the source, so stop at the end of the destination
+        // struct; fields transformed next overwrite whatever overlaps them.
+        if (canonicalize_) {
+          const Offset padding = std::min<Offset>(
+              src_field.padding, dst_end_of_struct - current_position.dst_inline_offset);
+          src_dst->Pad(current_position, padding);
+          current_position = current_position.IncreaseInlineOffset(padding);
+        }
+
         continue;
       }
 
@@ -421,8 +906,9 @@ class TransformerBase {
       const auto& dst_field = *src_field.alt_field;
 
       // Pad between fields (if needed).
-      if (current_position.dst_inline_offset < dst_field.offset) {
-        uint32_t padding_size = dst_field.offset - current_position.dst_inline_offset;
+      if (current_position.dst_inline_offset < dst_start_of_struct + dst_field.offset) {
+        Offset padding_size =
+            dst_start_of_struct + dst_field.offset - current_position.dst_inline_offset;
         src_dst->Pad(current_position, padding_size);
         current_position = current_position.IncreaseInlineOffset(padding_size);
       }
@@ -436,11 +922,11 @@ class TransformerBase {
       current_position.dst_inline_offset = dst_start_of_struct + dst_field.offset;
 
       // Transform field.
-      uint32_t src_next_field_offset =
+      Offset src_next_field_offset =
           current_position.src_inline_offset + AlignedInlineSize(src_field.type, From());
-      uint32_t dst_next_field_offset =
+      Offset dst_next_field_offset =
           current_position.dst_inline_offset + AlignedInlineSize(dst_field.type, To());
-      uint32_t dst_field_size = dst_next_field_offset - dst_field.offset;
+      Offset dst_field_size = dst_next_field_offset - current_position.dst_inline_offset;
 
       TraversalResult field_traversal_result;
       const zx_status_t status =
@@ -461,7 +947,7 @@ class TransformerBase {
     // Copy everything after the last non-primitive field.
     // TODO(apang): Fix this
     if (From() == WireFormat::kOld) {
-      uint32_t src_inline_remaining =
+      Offset src_inline_remaining =
           position.src_inline_offset + src_coded_struct.size - current_position.src_inline_offset;
       src_dst->Copy(current_position, src_inline_remaining);
       current_position = current_position.IncreaseSrcInlineOffset(src_inline_remaining)
@@ -470,7 +956,7 @@ class TransformerBase {
 
     // Pad end (if needed).
     if (current_position.dst_inline_offset < dst_end_of_struct) {
-      uint32_t size = dst_end_of_struct - current_position.dst_inline_offset;
+      Offset size = dst_end_of_struct - current_position.dst_inline_offset;
       src_dst->Pad(current_position, size);
     }
 
@@ -480,7 +966,11 @@ class TransformerBase {
   zx_status_t TransformVector(const fidl::FidlCodedVector& src_coded_vector,
                               const fidl::FidlCodedVector& dst_coded_vector,
                               const Position& position, TraversalResult* out_traversal_result) {
-    const auto& src_vector = *src_dst->Read<fidl_vector_t>(position);
+    const auto* src_vector_header = src_dst->template Read<fidl_vector_t>(position);
+    if (!src_vector_header) {
+      return Truncated(position);
+    }
+    const auto& src_vector = *src_vector_header;
 
     // Copy vector header.
     src_dst->Copy(position, sizeof(fidl_vector_t));
@@ -489,31 +979,44 @@ class TransformerBase {
     // ABSENT (and eveyrwhere elese)
     auto presence = reinterpret_cast<uint64_t>(src_vector.data);
     if (presence != FIDL_ALLOC_PRESENT) {
+      if (canonicalize_) {
+        src_dst->Write(position, fidl_vector_t{0, reinterpret_cast<void*>(FIDL_ALLOC_ABSENT)});
+      }
       return ZX_OK;
     }
 
+    // The count of a vector may not fit the 32-bit element count of an array
+    // (in large messages), and is passed to TransformArray() separately.
     const auto convert = [&](const fidl::FidlCodedVector& coded_vector) {
-      return fidl::FidlCodedArrayNew(coded_vector.element, static_cast<uint32_t>(src_vector.count),
+      return fidl::FidlCodedArrayNew(coded_vector.element, 0 /* element_count unused */,
                                      coded_vector.element_size, 0,
                                      nullptr /* alt_type unused, we provide both src and dst */);
     };
     const auto src_vector_data_as_coded_array = convert(src_coded_vector);
     const auto dst_vector_data_as_coded_array = convert(dst_coded_vector);
 
-    // Calculate vector size. They fit in uint32_t due to automatic bounds.
-    uint32_t src_vector_size =
-        FIDL_ALIGN(static_cast<uint32_t>(src_vector.count * (src_coded_vector.element_size)));
-    uint32_t dst_vector_size =
-        FIDL_ALIGN(static_cast<uint32_t>(src_vector.count * (dst_coded_vector.element_size)));
+    // Calculate vector size. The count is not trusted: the source must hold
+    // the whole vector, and the destination offsets must not overflow.
+    Offset src_vector_size, dst_vector_size, dst_vector_end;
+    if (!ArraySize(src_vector.count, src_coded_vector.element_size, &src_vector_size) ||
+        !SrcContainsOutOfLine(position, src_vector_size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the message", position);
+    }
+    if (!ArraySize(src_vector.count, dst_coded_vector.element_size, &dst_vector_size) ||
+        add_overflow(position.dst_out_of_line_offset, dst_vector_size, &dst_vector_end)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the maximum message size", position);
+    }
 
     // Transform elements.
     auto vector_data_position = Position{
         position.src_out_of_line_offset, position.src_out_of_line_offset + src_vector_size,
         position.dst_out_of_line_offset, position.dst_out_of_line_offset + dst_vector_size};
 
-    const zx_status_t status =
-        TransformArray(src_vector_data_as_coded_array, dst_vector_data_as_coded_array,
-                       vector_data_position, dst_vector_size, out_traversal_result);
+    // The count fits in an Offset, as the vector size did.
+    const zx_status_t status = TransformArray(
+        src_vector_data_as_coded_array, dst_vector_data_as_coded_array,
+        static_cast<Offset>(src_vector.count), vector_data_position, dst_vector_size,
+        out_traversal_result);
     if (status != ZX_OK) {
       return status;
     }
@@ -524,38 +1027,150 @@ class TransformerBase {
     return ZX_OK;
   }
 
-  zx_status_t TransformString(const Position& position, TraversalResult* out_traversal_result) {
+  zx_status_t TransformString(const fidl::FidlCodedString& coded_string, const Position& position,
+                              TraversalResult* out_traversal_result) {
     static const auto string_as_coded_vector = fidl::FidlCodedVector(
         nullptr /* element */, 0 /*max count, unused */, 1 /* element_size */,
         fidl::FidlNullability::kNullable /* constraints are not checked, i.e. unused */,
         nullptr /* alt_type unused, we provide both src and dst */);
-    return TransformVector(string_as_coded_vector, string_as_coded_vector, position,
-                           out_traversal_result);
+    const auto* src_string_header = src_dst->template Read<fidl_vector_t>(position);
+    if (!src_string_header) {
+      return Truncated(position);
+    }
+    const auto& src_string = *src_string_header;
+    if (!validate_strings_ || reinterpret_cast<uint64_t>(src_string.data) != FIDL_ALLOC_PRESENT) {
+      return TransformVector(string_as_coded_vector, string_as_coded_vector, position,
+                             out_traversal_result);
+    }
+
+    // Same as TransformVector(), validating the contents as they are copied.
+    if (src_string.count > coded_string.max_size) {
+      return Fail(ZX_ERR_INVALID_ARGS, "string exceeds its maximum size", position);
+    }
+    const Offset count = static_cast<Offset>(src_string.count);
+    Offset size, dst_string_end;
+    if (!ArraySize(src_string.count, 1, &size) || !SrcContainsOutOfLine(position, size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the message", position);
+    }
+    if (add_overflow(position.dst_out_of_line_offset, size, &dst_string_end)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the maximum message size", position);
+    }
+    src_dst->Copy(position, sizeof(fidl_vector_t));
+
+    const auto data_position =
+        Position{position.src_out_of_line_offset, position.src_out_of_line_offset + size,
+                 position.dst_out_of_line_offset, position.dst_out_of_line_offset + size};
+    if (const char* error = src_dst->CopyUtf8(data_position, count)) {
+      return Fail(ZX_ERR_INVALID_ARGS, error, position);
+    }
+    if (canonicalize_) {
+      src_dst->Pad(data_position.IncreaseInlineOffset(count), size - count);
+    } else {
+      src_dst->Copy(data_position.IncreaseInlineOffset(count), size - count);
+    }
+
+    out_traversal_result->src_out_of_line_size += size;
+    out_traversal_result->dst_out_of_line_size += size;
+    return ZX_OK;
   }
 
   // TODO(apang): Replace |known_type| & |type| parameters below with a single fit::optional<const
   // fidl_type_t*> parameter.
   zx_status_t TransformEnvelope(bool known_type, const fidl_type_t* type, const Position& position,
                                 TraversalResult* out_traversal_result) {
-    auto src_envelope = src_dst->Read<const fidl_envelope_t>(position);
+    auto src_envelope = src_dst->template Read<const fidl_envelope_t>(position);
+    if (!src_envelope) {
+      return Truncated(position);
+    }
 
     if (src_envelope->presence == FIDL_ALLOC_ABSENT) {
-      src_dst->Copy(position, sizeof(fidl_envelope_t));
+      if (canonicalize_) {
+        src_dst->Write(position, fidl_envelope_t{});
+      } else {
+        src_dst->Copy(position, sizeof(fidl_envelope_t));
+      }
       return ZX_OK;
     }
 
+    if (!check_handles_) {
+      return TransformPresentEnvelope(known_type, type, position, out_traversal_result);
+    }
+    const uint32_t first_handle = handle_count_;
+    uint32_t entry;
+    if (const zx_status_t status = EnvelopeHandlesOpen(
+            From() == WireFormat::kV1 ? position.src_inline_offset : position.dst_inline_offset,
+            position, &entry)) {
+      return status;
+    }
+    if (const zx_status_t status =
+            TransformPresentEnvelope(known_type, type, position, out_traversal_result)) {
+      return status;
+    }
+    return EnvelopeHandlesClose(entry, first_handle, src_envelope->num_handles, position);
+  }
+
+  zx_status_t TransformPresentEnvelope(bool known_type, const fidl_type_t* type,
+                                       const Position& position,
+                                       TraversalResult* out_traversal_result) {
+    auto src_envelope = src_dst->template Read<const fidl_envelope_t>(position);
+    if (!src_envelope) {
+      return Truncated(position);
+    }
+
+    if (compact_ && From() == WireFormat::kV1 &&
+        src_envelope->presence == FIDL_ENVELOPE_INLINED) {
+      const zx_status_t status =
+          ExpandInlinedEnvelope(known_type, type, position, out_traversal_result);
+      if (status != ZX_OK || !known_type) {
+        return status;
+      }
+      return IndexLeaf(type, Position{position.src_inline_offset, position.src_out_of_line_offset,
+                                      position.dst_out_of_line_offset,
+                                      position.dst_out_of_line_offset},
+                       CompactInlineSize(type, 0));
+    }
+
+    if (compact_ && To() == WireFormat::kV1 && known_type) {
+      const uint32_t inline_size = CompactInlineSize(type, 0);
+      if (inline_size != 0) {
+        if (!SrcContainsOutOfLine(position, FIDL_ALIGN(AlignedInlineSize(type, From())))) {
+          return Truncated(position);
+        }
+        if (const zx_status_t status = IndexLeaf(type, position, inline_size)) {
+          return status;
+        }
+        WriteInlinedEnvelope(position, position.src_out_of_line_offset, inline_size);
+        out_traversal_result->src_out_of_line_size += FIDL_ALIGN(AlignedInlineSize(type, From()));
+        return ZX_OK;
+      }
+    }
+
     if (!known_type) {
       // Unknown type, so we don't know what type of data the envelope contains.
+      if (!SrcContainsOutOfLine(position, src_envelope->num_bytes)) {
+        return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+      }
+      if (check_handles_) {
+        if (const zx_status_t status = MatchHandles(src_envelope->num_handles, position)) {
+          return status;
+        }
+      }
       src_dst->Copy(Position{position.src_out_of_line_offset,
                              position.src_out_of_line_offset + src_envelope->num_bytes,
                              position.dst_out_of_line_offset,
                              position.dst_out_of_line_offset + src_envelope->num_bytes},
                     src_envelope->num_bytes);
+      out_traversal_result->src_out_of_line_size += src_envelope->num_bytes;
+      out_traversal_result->dst_out_of_line_size += src_envelope->num_bytes;
+      out_traversal_result->handle_count += src_envelope->num_handles;
       return ZX_OK;
     }
 
     const uint32_t src_field_size = AlignedInlineSize(type, From());
     const uint32_t dst_field_size = AlignedAltInlineSize(type);
+    if (!SrcContainsOutOfLine(position, FIDL_ALIGN(src_field_size))) {
+      return Truncated(position);
+    }
     Position data_position =
         Position{position.src_out_of_line_offset,
                  position.src_out_of_line_offset + FIDL_ALIGN(AlignedInlineSize(type, From())),
@@ -565,12 +1180,27 @@ class TransformerBase {
     if (result != ZX_OK) {
       return result;
     }
+    // Contents smaller than their alignment (e.g. primitives) were copied along
+    // with the padding after them.
+    if (canonicalize_) {
+      const uint32_t dst_inline_size = InlineSize(type, To());
+      src_dst->Pad(data_position.IncreaseDstInlineOffset(dst_inline_size),
+                   dst_field_size - dst_inline_size);
+    }
 
-    const uint32_t src_contents_size = FIDL_ALIGN(src_field_size) + contents_traversal_result.src_out_of_line_size; // here
-    const uint32_t dst_contents_size = dst_field_size + contents_traversal_result.dst_out_of_line_size;
+    const Offset src_contents_size =
+        FIDL_ALIGN(src_field_size) + contents_traversal_result.src_out_of_line_size;
+    if (src_contents_size != src_envelope->num_bytes) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope num_bytes does not match its contents", position);
+    }
+    const Offset dst_contents_size =
+        dst_field_size + contents_traversal_result.dst_out_of_line_size;
+    if (dst_contents_size > UINT32_MAX) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope contents exceed 4 GiB", position);
+    }
 
     fidl_envelope_t dst_envelope = *src_envelope;
-    dst_envelope.num_bytes = dst_contents_size;
+    dst_envelope.num_bytes = static_cast<uint32_t>(dst_contents_size);
     src_dst->Write(position, dst_envelope);
 
     out_traversal_result->src_out_of_line_size += src_contents_size;
@@ -582,8 +1212,14 @@ class TransformerBase {
 
   zx_status_t TransformXUnion(const fidl::FidlCodedXUnion& coded_xunion, const Position& position,
                               TraversalResult* out_traversal_result) {
-    auto xunion = src_dst->Read<const fidl_xunion_t>(position);
+    auto xunion = src_dst->template Read<const fidl_xunion_t>(position);
+    if (!xunion) {
+      return Truncated(position);
+    }
     src_dst->Copy(position, sizeof(fidl_xunion_t));
+    if (canonicalize_) {
+      src_dst->Write(position.IncreaseDstInlineOffset(sizeof(fidl_xunion_tag_t)), uint32_t{0});
+    }
 
     const fidl::FidlXUnionField* field = nullptr;
     for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
@@ -595,9 +1231,9 @@ class TransformerBase {
     }
 
     const Position envelope_position = {
-        position.src_inline_offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+        position.src_inline_offset + static_cast<Offset>(offsetof(fidl_xunion_t, envelope)),
         position.src_out_of_line_offset,
-        position.dst_inline_offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+        position.dst_inline_offset + static_cast<Offset>(offsetof(fidl_xunion_t, envelope)),
         position.dst_out_of_line_offset,
     };
 
@@ -607,52 +1243,52 @@ class TransformerBase {
 
   zx_status_t TransformTable(const fidl::FidlCodedTable& coded_table, const Position& position,
                              TraversalResult* out_traversal_result) {
-    auto table = src_dst->Read<const fidl_table_t>(position);
+    auto table = src_dst->template Read<const fidl_table_t>(position);
+    if (!table) {
+      return Truncated(position);
+    }
     src_dst->Copy(position, sizeof(fidl_table_t));
 
-    const Position envelopes_vector_position = position.IncreaseInlineOffset(sizeof(fidl_table_t));
-    const fidl_envelope_t* envelopes_vector =
-        src_dst->Read<fidl_envelope_t>(envelopes_vector_position);
-    const uint32_t envelopes_vector_size =
-        static_cast<uint32_t>(table->envelopes.count * sizeof(fidl_envelope_t));
-    src_dst->Copy(envelopes_vector_position, envelopes_vector_size);
-
-    uint32_t src_envelope_data_offset = envelopes_vector_size;
-    uint32_t dst_envelope_data_offset = src_envelope_data_offset;
-
-    for (uint32_t i = 0, field_index = 0; i < table->envelopes.count; i++) {
-      const fidl::FidlTableField& field = coded_table.fields[field_index];
-
-      // TODO(apang): Comment about why i+1 below.
-      if (i + 1 < field.ordinal) {
-        // This coded_table has some reserved fields before the first
-        // non-reserved field. The vector<envelope> includes all
-        // fields--including reserved fields--so skip reserved fields in the
-        // vector<envelope>.
-        continue;
-      }
-
-      field_index++;
+    Offset envelopes_vector_size;
+    if (!ArraySize(table->envelopes.count, sizeof(fidl_envelope_t), &envelopes_vector_size) ||
+        !SrcContainsOutOfLine(position, envelopes_vector_size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "table envelopes exceed the message", position);
+    }
 
-      assert(field.ordinal == i + 1);
+    out_traversal_result->src_out_of_line_size += envelopes_vector_size;
+    out_traversal_result->dst_out_of_line_size += envelopes_vector_size;
+    Offset src_envelope_data_offset = envelopes_vector_size;
+    Offset dst_envelope_data_offset = src_envelope_data_offset;
+
+    for (Offset i = 0, field_index = 0; i < table->envelopes.count; i++) {
+      // Fields are sorted by ordinal. Envelopes of reserved fields, and past the
+      // last field, are unknown.
+      const fidl::FidlTableField* field = nullptr;
+      if (field_index < coded_table.field_count &&
+          coded_table.fields[field_index].ordinal == i + 1) {
+        field = &coded_table.fields[field_index++];
+      }
 
       // TODO(apang): De-dupe below.
       auto envelope_position = Position{
-          position.src_out_of_line_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t)),
+          position.src_out_of_line_offset + i * static_cast<Offset>(sizeof(fidl_envelope_t)),
           position.src_out_of_line_offset + src_envelope_data_offset,
-          position.dst_out_of_line_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t)),
+          position.dst_out_of_line_offset + i * static_cast<Offset>(sizeof(fidl_envelope_t)),
           position.dst_out_of_line_offset + dst_envelope_data_offset,
       };
 
       TraversalResult envelope_traversal_result;
-      zx_status_t status =
-          TransformEnvelope(true, field.type, envelope_position, &envelope_traversal_result);
+      const uint32_t node = index_count_;
+      zx_status_t status = TransformEnvelope(field != nullptr, field ? field->type : nullptr,
+                                             envelope_position, &envelope_traversal_result);
 
       if (status != ZX_OK) {
         return status;
       }
+      if (field && index_count_ != node) {
+        index_[node].ordinal = field->ordinal;
+      }
 
-      assert(envelope_traversal_result.src_out_of_line_size == envelopes_vector[i].num_bytes);
       src_envelope_data_offset += envelope_traversal_result.src_out_of_line_size;
       dst_envelope_data_offset += envelope_traversal_result.dst_out_of_line_size;
 
@@ -663,21 +1299,28 @@ class TransformerBase {
     return ZX_OK;
   }
 
+  // Transforms |element_count| elements, instead of the element count of the
+  // coded arrays, which is 32-bit.
   zx_status_t TransformArray(const fidl::FidlCodedArrayNew& src_coded_array,
-                             const fidl::FidlCodedArrayNew& dst_coded_array,
-                             const Position& position, uint32_t dst_array_size,
+                             const fidl::FidlCodedArrayNew& dst_coded_array, Offset element_count,
+                             const Position& position, Offset dst_array_size,
                              TraversalResult* out_traversal_result) {
-    assert(src_coded_array.element_count == dst_coded_array.element_count);
-
     // Fast path for elements without coding tables (e.g. strings).
     if (!src_coded_array.element) {
+      const Offset data_size = element_count * src_coded_array.element_size;
+      if (canonicalize_ && data_size < dst_array_size) {
+        // Out-of-line data ends with padding.
+        src_dst->Copy(position, data_size);
+        src_dst->Pad(position.IncreaseInlineOffset(data_size), dst_array_size - data_size);
+        return ZX_OK;
+      }
       src_dst->Copy(position, dst_array_size);
       return ZX_OK;
     }
 
     // Slow path otherwise.
     auto current_element_position = position;
-    for (uint32_t i = 0; i < src_coded_array.element_count; i++) {
+    for (Offset i = 0; i < element_count; i++) {
       TraversalResult element_traversal_result;
       const zx_status_t status = Transform(src_coded_array.element, current_element_position,
                                            dst_coded_array.element_size, &element_traversal_result);
@@ -702,7 +1345,7 @@ class TransformerBase {
     }
 
     // Pad end of elements.
-    uint32_t padding =
+    Offset padding =
         dst_array_size + position.dst_inline_offset - current_element_position.dst_inline_offset;
     src_dst->Pad(current_element_position, padding);
 
@@ -722,13 +1365,180 @@ class TransformerBase {
                                      const Position& position,
                                      TraversalResult* out_traversal_result) = 0;
 
-  inline zx_status_t Fail(zx_status_t status, const char* error_msg) {
+  inline zx_status_t Fail(zx_status_t status, const char* error_msg, const Position& position) {
+    Trace(FIDL_TRANSFORM_TRACE_FAIL, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(status));
+    RecordFailure(status, error_msg, position);
     if (out_error_msg_)
       *out_error_msg_ = error_msg;
     return status;
   }
 
+  // Enters a node of the field index at |position|, returning false if the
+  // index is full.
+  bool IndexOpen(const fidl_type_t* type, const Position& position, Offset dst_size) {
+    if (index_count_ == index_capacity_) {
+      return false;
+    }
+    fidl_transform_index_entry_t& entry = index_[index_count_];
+    entry.type = type;
+    entry.parent = index_parent_;
+    entry.end = 0;
+    entry.ordinal = 0;
+    entry.dst_offset = static_cast<uint32_t>(position.dst_inline_offset);
+    entry.dst_size = static_cast<uint32_t>(dst_size);
+    entry.dst_out_of_line_offset = static_cast<uint32_t>(position.dst_out_of_line_offset);
+    index_parent_ = index_count_++;
+    return true;
+  }
+
+  // Leaves the node of the field index entered last.
+  void IndexClose() {
+    index_[index_parent_].end = index_count_;
+    index_parent_ = index_[index_parent_].parent;
+  }
+
+  // Matches the next |count| handles of the handle array.
+  zx_status_t MatchHandles(uint32_t count, const Position& position) {
+    if (count > num_handles_ - handle_count_) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message has more handles than the handle array",
+                  position);
+    }
+    handle_count_ += count;
+    return ZX_OK;
+  }
+
+  zx_status_t CheckHandle(const fidl::FidlCodedHandle& coded_handle, uint32_t presence,
+                          const Position& position) {
+    switch (presence) {
+      case FIDL_HANDLE_ABSENT:
+        if (coded_handle.nullable != fidl::kNullable) {
+          return Fail(ZX_ERR_INVALID_ARGS, "non-nullable handle is absent", position);
+        }
+        return ZX_OK;
+      case FIDL_HANDLE_PRESENT: {
+        if (const zx_status_t status = MatchHandles(1, position)) {
+          return status;
+        }
+        const uint32_t object_type = handles_[handle_count_ - 1].type;
+        if (coded_handle.handle_subtype != ZX_OBJ_TYPE_NONE &&
+            coded_handle.handle_subtype != object_type) {
+          return Fail(ZX_ERR_INVALID_ARGS, "handle has the wrong object type", position);
+        }
+        return ZX_OK;
+      }
+      default:
+        return Fail(ZX_ERR_INVALID_ARGS, "handle presence neither FIDL_HANDLE_PRESENT nor "
+                    "FIDL_HANDLE_ABSENT", position);
+    }
+  }
+
+  // Enters a present envelope at |v1_offset| (see
+  // `fidl_transform_envelope_handles_t`), storing its entry into |out_entry|
+  // if handles of envelopes are recorded.
+  zx_status_t EnvelopeHandlesOpen(Offset v1_offset, const Position& position,
+                                  uint32_t* out_entry) {
+    *out_entry = envelope_handles_count_;
+    if (!envelope_handles_) {
+      return ZX_OK;
+    }
+    if (envelope_handles_count_ == envelope_handles_capacity_) {
+      return Fail(ZX_ERR_BUFFER_TOO_SMALL, "envelope handles capacity exceeded", position);
+    }
+    envelope_handles_[envelope_handles_count_++].v1_offset = static_cast<uint32_t>(v1_offset);
+    return ZX_OK;
+  }
+
+  // Leaves the envelope of |entry|, whose contents started at |first_handle|
+  // of the handle array, checking that it has |num_handles| handles.
+  zx_status_t EnvelopeHandlesClose(uint32_t entry, uint32_t first_handle, uint32_t num_handles,
+                                   const Position& position) {
+    if (handle_count_ - first_handle != num_handles) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope num_handles does not match its contents",
+                  position);
+    }
+    if (envelope_handles_) {
+      envelope_handles_[entry].first_handle = first_handle;
+      envelope_handles_[entry].num_handles = num_handles;
+    }
+    return ZX_OK;
+  }
+
+  // Whether the source holds |size| bytes of out-of-line data at |position|.
+  bool SrcContainsOutOfLine(const Position& position, uint64_t size) const {
+    return src_dst->SrcContains(position.src_out_of_line_offset, size);
+  }
+
+  // Fails on a read or out-of-line object past the end of the source.
+  zx_status_t Truncated(const Position& position) {
+    return Fail(ZX_ERR_INVALID_ARGS, "message is truncated", position);
+  }
+
+  // Writes an envelope of the compact v1 wire format at |position|, holding the
+  // |size| bytes found in the source at |src_contents_offset|.
+  void WriteInlinedEnvelope(const Position& position, Offset src_contents_offset,
+                            uint32_t size) {
+    fidl_envelope_t envelope = {};
+    envelope.presence = FIDL_ENVELOPE_INLINED;
+    src_dst->Write(position, envelope);
+    src_dst->Copy(Position{src_contents_offset, position.src_out_of_line_offset,
+                           position.dst_inline_offset, position.dst_out_of_line_offset},
+                  size);
+  }
+
+  // Expands the inlined envelope of the compact v1 wire format at |position|,
+  // moving its contents out-of-line.
+  zx_status_t ExpandInlinedEnvelope(bool known_type, const fidl_type_t* type,
+                                    const Position& position,
+                                    TraversalResult* out_traversal_result) {
+    auto src_envelope = src_dst->template Read<const fidl_envelope_t>(position);
+    if (!src_envelope) {
+      return Truncated(position);
+    }
+    const uint32_t size = known_type ? CompactInlineSize(type, 0) : kCompactEnvelopeMaxInlineSize;
+    if (size == 0 || src_envelope->num_handles != 0) {
+      return Fail(ZX_ERR_BAD_STATE, "inlined envelope holds contents which cannot be inlined",
+                  position);
+    }
+
+    const uint32_t dst_contents_size = FIDL_ALIGN(size);
+    src_dst->Copy(Position{position.src_inline_offset, position.src_out_of_line_offset,
+                           position.dst_out_of_line_offset, position.dst_out_of_line_offset},
+                  size);
+    src_dst->PadOutOfLine(position.IncreaseDstOutOfLineOffset(size), dst_contents_size - size);
+
+    fidl_envelope_t dst_envelope = {};
+    dst_envelope.num_bytes = dst_contents_size;
+    dst_envelope.presence = FIDL_ALLOC_PRESENT;
+    src_dst->Write(position, dst_envelope);
+
+    out_traversal_result->dst_out_of_line_size += dst_contents_size;
+    return ZX_OK;
+  }
+
   SrcDst* src_dst;
+  const bool compact_;
+  // See `fidl_transform_options_t`.
+  const bool canonicalize_;
+  const bool validate_strings_;
+
+  // Field index (see `fidl_transform_options_t`), and the node being walked.
+  fidl_transform_index_entry_t* const index_;
+  const uint32_t index_capacity_;
+  uint32_t* const out_index_count_;
+  uint32_t index_count_ = 0;
+  uint32_t index_parent_ = FIDL_TRANSFORM_INDEX_NO_PARENT;
+
+  // Handle array (see `fidl_transform_options_t`), and the number of its
+  // handles matched so far.
+  const bool check_handles_;
+  const fidl_transform_handle_info_t* const handles_;
+  const uint32_t num_handles_;
+  fidl_transform_envelope_handles_t* const envelope_handles_;
+  const uint32_t envelope_handles_capacity_;
+  uint32_t* const out_envelope_handles_count_;
+  uint32_t handle_count_ = 0;
+  uint32_t envelope_handles_count_ = 0;
 
  private:
   const char** out_error_msg_;
@@ -736,9 +1546,29 @@ class TransformerBase {
 
 // TODO(apang): Mark everything override
 
-class V1ToOld final : public TransformerBase {
+template <typename Offset, bool kValidateOnly>
+class V1ToOld final : public TransformerBase<Offset, kValidateOnly> {
+  using Base = TransformerBase<Offset, kValidateOnly>;
+  using typename Base::Position;
+  using typename Base::SrcDst;
+  using typename Base::TraversalResult;
+  using Base::canonicalize_;
+  using Base::check_handles_;
+  using Base::compact_;
+  using Base::EnvelopeHandlesClose;
+  using Base::EnvelopeHandlesOpen;
+  using Base::Fail;
+  using Base::handle_count_;
+  using Base::IndexLeaf;
+  using Base::src_dst;
+  using Base::SrcContainsOutOfLine;
+  using Base::Transform;
+  using Base::Truncated;
+
  public:
-  V1ToOld(SrcDst* src_dst, const char** out_error_msg) : TransformerBase(src_dst, out_error_msg) {}
+  V1ToOld(SrcDst* src_dst, const char** out_error_msg, bool compact,
+          const fidl_transform_options_t& options)
+      : Base(src_dst, out_error_msg, compact, options) {}
 
   WireFormat From() const { return WireFormat::kV1; }
   WireFormat To() const { return WireFormat::kOld; }
@@ -747,8 +1577,12 @@ class V1ToOld final : public TransformerBase {
                                     const fidl::FidlCodedUnion& dst_coded_union,
                                     const Position& position,
                                     TraversalResult* out_traversal_result) {
-    auto src_xunion = src_dst->Read<const fidl_xunion_t>(position);
-    if (src_xunion->envelope.presence != FIDL_ALLOC_PRESENT) {
+    auto src_xunion = src_dst->template Read<const fidl_xunion_t>(position);
+    if (!src_xunion) {
+      return Truncated(position);
+    }
+    if (src_xunion->envelope.presence != FIDL_ALLOC_PRESENT &&
+        !(compact_ && src_xunion->envelope.presence == FIDL_ENVELOPE_INLINED)) {
       src_dst->Write(position, FIDL_ALLOC_ABSENT);
       return ZX_OK;
     }
@@ -775,11 +1609,14 @@ class V1ToOld final : public TransformerBase {
     assert(src_coded_union.field_count == dst_coded_union.field_count);
 
     // Read: extensible-union ordinal.
-    auto src_xunion = src_dst->Read<const fidl_xunion_t>(position);
+    auto src_xunion = src_dst->template Read<const fidl_xunion_t>(position);
+    if (!src_xunion) {
+      return Truncated(position);
+    }
     uint32_t xunion_ordinal = src_xunion->tag;
 
     if (src_xunion->padding != static_cast<decltype(src_xunion->padding)>(0)) {
-      return Fail(ZX_ERR_BAD_STATE, "xunion padding is non-zero");
+      return Fail(ZX_ERR_BAD_STATE, "xunion padding is non-zero", position);
     }
 
     // TODO(apang): Can probably remove this validation here, the walker will validate it for us.
@@ -788,10 +1625,16 @@ class V1ToOld final : public TransformerBase {
         // OK
         break;
       case FIDL_ALLOC_ABSENT:
-        return Fail(ZX_ERR_BAD_STATE, "xunion envelope is invalid FIDL_ALLOC_ABSENT");
+        return Fail(ZX_ERR_BAD_STATE, "xunion envelope is invalid FIDL_ALLOC_ABSENT", position);
+      case FIDL_ENVELOPE_INLINED:
+        if (compact_) {
+          break;
+        }
+        // fallthrough
       default:
         return Fail(ZX_ERR_BAD_STATE,
-                    "xunion envelope presence neither FIDL_ALLOC_PRESENT nor FIDL_ALLOC_ABSENT");
+                    "xunion envelope presence neither FIDL_ALLOC_PRESENT nor FIDL_ALLOC_ABSENT",
+                    position);
     }
 
     // Retrieve: flexible-union field (or variant).
@@ -808,10 +1651,26 @@ class V1ToOld final : public TransformerBase {
       }
     }
     if (!src_field_found) {
-      return Fail(ZX_ERR_BAD_STATE, "ordinal has no corresponding variant");
+      return Fail(ZX_ERR_BAD_STATE, "ordinal has no corresponding variant", position);
     }
 
+    Trace(FIDL_TRANSFORM_TRACE_UNION_TAG, fidl::kFidlTypeUnion, position, xunion_ordinal,
+          src_field_index);
+
     const fidl::FidlUnionField& dst_field = dst_coded_union.fields[src_field_index];
+    const uint32_t dst_variant_size =
+        dst_coded_union.size - dst_coded_union.data_offset - dst_field.padding;
+
+    const Offset envelope_offset =
+        position.src_inline_offset + static_cast<Offset>(offsetof(fidl_xunion_t, envelope));
+    const uint32_t first_handle = handle_count_;
+    uint32_t handles_entry = 0;
+    if (check_handles_) {
+      if (const zx_status_t status =
+              EnvelopeHandlesOpen(envelope_offset, position, &handles_entry)) {
+        return status;
+      }
+    }
 
     // Write: static-union tag, and pad (if needed).
     switch (dst_coded_union.data_offset) {
@@ -825,35 +1684,95 @@ class V1ToOld final : public TransformerBase {
         assert(false && "static-union data offset can only be 4 or 8");
     }
 
+    // Move: inlined envelope contents (compact v1 wire format) to static-union
+    // data.
+    if (src_xunion->envelope.presence == FIDL_ENVELOPE_INLINED) {
+      if (CompactInlineSize(src_field->type, dst_variant_size) == 0 ||
+          src_xunion->envelope.num_handles != 0) {
+        return Fail(ZX_ERR_BAD_STATE, "inlined envelope holds contents which cannot be inlined",
+                    position);
+      }
+      if (check_handles_) {
+        if (const zx_status_t status =
+                EnvelopeHandlesClose(handles_entry, first_handle, 0, position)) {
+          return status;
+        }
+      }
+      auto data_position = Position{
+          envelope_offset,
+          position.src_out_of_line_offset,
+          position.dst_inline_offset + dst_coded_union.data_offset,
+          position.dst_out_of_line_offset,
+      };
+      src_dst->Copy(data_position, dst_variant_size);
+      src_dst->Pad(data_position.IncreaseDstInlineOffset(dst_variant_size), dst_field.padding);
+      return IndexLeaf(src_field->type, data_position, dst_variant_size);
+    }
+
     // Transform: xunion field to static-union field (or variant).
+    //
+    // Variants without a coding table (i.e. primitives, or arrays thereof) only
+    // occupy their own size in the envelope, which may be less than the size of
+    // the static-union data, so only that much is read from the source.
+    const uint32_t src_variant_size = FIDL_ALIGN(
+        src_field->type ? AlignedInlineSize(src_field->type, From()) : dst_variant_size);
+    if (!SrcContainsOutOfLine(position, src_variant_size)) {
+      return Truncated(position);
+    }
     auto field_position = Position{
         position.src_out_of_line_offset,
-        position.src_out_of_line_offset + AlignedInlineSize(src_field->type, WireFormat::kOld),
+        position.src_out_of_line_offset + src_variant_size,
         position.dst_inline_offset + dst_coded_union.data_offset,
         position.dst_out_of_line_offset,
     };
-    uint32_t dst_field_size = dst_coded_union.size - dst_coded_union.data_offset;
 
     zx_status_t status =
-        Transform(src_field->type, field_position, dst_field_size, out_traversal_result);
+        Transform(src_field->type, field_position, dst_variant_size, out_traversal_result);
     if (status != ZX_OK) {
       return status;
     }
+    if (check_handles_) {
+      status = EnvelopeHandlesClose(handles_entry, first_handle,
+                                    src_xunion->envelope.num_handles, position);
+      if (status != ZX_OK) {
+        return status;
+      }
+    }
 
     // Pad after static-union data.
-    auto field_padding_position =
-        field_position.IncreaseDstInlineOffset(dst_field_size - dst_field.padding);
+    auto field_padding_position = field_position.IncreaseDstInlineOffset(dst_variant_size);
     src_dst->Pad(field_padding_position, dst_field.padding);
 
-    out_traversal_result->src_out_of_line_size += AlignedInlineSize(src_field->type, From());
+    out_traversal_result->src_out_of_line_size += src_variant_size;
 
     return ZX_OK;
   }
 };
 
-class OldToV1 final : public TransformerBase {
+template <typename Offset, bool kValidateOnly>
+class OldToV1 final : public TransformerBase<Offset, kValidateOnly> {
+  using Base = TransformerBase<Offset, kValidateOnly>;
+  using typename Base::Position;
+  using typename Base::SrcDst;
+  using typename Base::TraversalResult;
+  using Base::canonicalize_;
+  using Base::check_handles_;
+  using Base::compact_;
+  using Base::EnvelopeHandlesClose;
+  using Base::EnvelopeHandlesOpen;
+  using Base::Fail;
+  using Base::handle_count_;
+  using Base::IndexLeaf;
+  using Base::src_dst;
+  using Base::SrcContainsOutOfLine;
+  using Base::Transform;
+  using Base::Truncated;
+  using Base::WriteInlinedEnvelope;
+
  public:
-  OldToV1(SrcDst* src_dst, const char** out_error_msg) : TransformerBase(src_dst, out_error_msg) {}
+  OldToV1(SrcDst* src_dst, const char** out_error_msg, bool compact,
+          const fidl_transform_options_t& options)
+      : Base(src_dst, out_error_msg, compact, options) {}
 
  private:
   // TODO(apang): Could CRTP this.
@@ -864,14 +1783,20 @@ class OldToV1 final : public TransformerBase {
                                     const fidl::FidlCodedUnion& dst_coded_union,
                                     const Position& position,
                                     TraversalResult* out_traversal_result) {
-    auto presence = *src_dst->Read<uint64_t>(position);
-    if (presence != FIDL_ALLOC_PRESENT) {
+    auto src_presence = src_dst->template Read<uint64_t>(position);
+    if (!src_presence) {
+      return Truncated(position);
+    }
+    if (*src_presence != FIDL_ALLOC_PRESENT) {
       fidl_xunion_t absent = {};
       src_dst->Write(position, absent);
       return ZX_OK;
     }
 
     uint32_t aligned_src_size = FIDL_ALIGN(src_coded_union.size);
+    if (!SrcContainsOutOfLine(position, aligned_src_size)) {
+      return Truncated(position);
+    }
     const auto union_position = Position{
         position.src_out_of_line_offset,
         position.src_out_of_line_offset + aligned_src_size,
@@ -889,16 +1814,23 @@ class OldToV1 final : public TransformerBase {
     assert(src_coded_union.field_count == dst_coded_union.field_count);
 
     // Read: union tag.
-    const fidl_union_tag_t union_tag = *src_dst->Read<const fidl_union_tag_t>(position);
+    const auto src_union_tag = src_dst->template Read<const fidl_union_tag_t>(position);
+    if (!src_union_tag) {
+      return Truncated(position);
+    }
+    const fidl_union_tag_t union_tag = *src_union_tag;
 
     // Retrieve: union field/variant.
     if (union_tag >= src_coded_union.field_count) {
-      return Fail(ZX_ERR_BAD_STATE, "invalid union tag");
+      return Fail(ZX_ERR_BAD_STATE, "invalid union tag", position);
     }
 
     const fidl::FidlUnionField& src_field = src_coded_union.fields[union_tag];
     const fidl::FidlUnionField& dst_field = dst_coded_union.fields[union_tag];
 
+    Trace(FIDL_TRANSFORM_TRACE_UNION_TAG, fidl::kFidlTypeUnion, position, union_tag,
+          dst_field.xunion_ordinal);
+
     // Write: xunion tag & envelope.
     const uint32_t dst_inline_field_size = [&] {
       if (src_field.type && src_field.type->type_tag == fidl::kFidlTypeUnion) {
@@ -908,9 +1840,40 @@ class OldToV1 final : public TransformerBase {
       }
     }();
 
-    // Transform: static-union field to xunion field.
-    auto field_position = Position{
-        position.src_inline_offset + src_coded_union.data_offset,
+    // Write: xunion with the variant inlined in its envelope (compact v1 wire
+    // format).
+    const Offset envelope_offset =
+        position.dst_inline_offset + static_cast<Offset>(offsetof(fidl_xunion_t, envelope));
+    const uint32_t first_handle = handle_count_;
+    uint32_t handles_entry = 0;
+    if (check_handles_) {
+      if (const zx_status_t status =
+              EnvelopeHandlesOpen(envelope_offset, position, &handles_entry)) {
+        return status;
+      }
+    }
+
+    const uint32_t inline_size =
+        compact_ ? CompactInlineSize(src_field.type, dst_inline_field_size) : 0;
+    if (inline_size != 0) {
+      if (check_handles_) {
+        if (const zx_status_t status =
+                EnvelopeHandlesClose(handles_entry, first_handle, 0, position)) {
+          return status;
+        }
+      }
+      const auto envelope_position = position.IncreaseDstInlineOffset(
+          static_cast<Offset>(offsetof(fidl_xunion_t, envelope)));
+      src_dst->Write(position, dst_field.xunion_ordinal);
+      src_dst->Write(position.IncreaseDstInlineOffset(sizeof(fidl_xunion_tag_t)), uint32_t{0});
+      WriteInlinedEnvelope(envelope_position,
+                           position.src_inline_offset + src_coded_union.data_offset, inline_size);
+      return IndexLeaf(src_field.type, envelope_position, inline_size);
+    }
+
+    // Transform: static-union field to xunion field.
+    auto field_position = Position{
+        position.src_inline_offset + src_coded_union.data_offset,
         position.src_out_of_line_offset,
         position.dst_out_of_line_offset,
         position.dst_out_of_line_offset + FIDL_ALIGN(dst_inline_field_size),
@@ -923,52 +1886,1015 @@ class OldToV1 final : public TransformerBase {
       return status;
     }
 
-    const uint32_t dst_field_size = dst_inline_field_size + traversal_result.dst_out_of_line_size;
+    const Offset dst_field_size = dst_inline_field_size + traversal_result.dst_out_of_line_size;
+    if (AlignOffset(dst_field_size) > UINT32_MAX) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope contents exceed 4 GiB", position);
+    }
+    if (check_handles_) {
+      status = EnvelopeHandlesClose(handles_entry, first_handle, traversal_result.handle_count,
+                                    position);
+      if (status != ZX_OK) {
+        return status;
+      }
+    }
 
     fidl_xunion_t xunion;
     xunion.tag = dst_field.xunion_ordinal;
     xunion.padding = 0;
-    xunion.envelope.num_bytes = FIDL_ALIGN(dst_field_size);
+    xunion.envelope.num_bytes = static_cast<uint32_t>(AlignOffset(dst_field_size));
     xunion.envelope.num_handles = traversal_result.handle_count;
     xunion.envelope.presence = FIDL_ALLOC_PRESENT;
     src_dst->Write(position, xunion);
 
     // Pad xunion data to object alignment.
-    const uint32_t dst_padding = FIDL_ALIGN(dst_field_size) - dst_field_size;
+    const Offset dst_padding = AlignOffset(dst_field_size) - dst_field_size;
     src_dst->PadOutOfLine(position.IncreaseDstOutOfLineOffset(dst_field_size), dst_padding);
 
     out_traversal_result->src_out_of_line_size += traversal_result.src_out_of_line_size;
-    out_traversal_result->dst_out_of_line_size += FIDL_ALIGN(dst_field_size);
+    out_traversal_result->dst_out_of_line_size += AlignOffset(dst_field_size);
     out_traversal_result->handle_count += traversal_result.handle_count;
 
     return ZX_OK;
   }
 };
 
+// Converts between the v1 and compact v1 wire formats. Both are described by v1
+// coding tables and only differ in envelopes, so every object is copied as is,
+// and only envelopes (with the out-of-line objects after them) are rewritten.
+//
+// Objects are copied in bulk when their storage is first reached (i.e. the
+// top-level struct, and each out-of-line object), and Walk() then follows the
+// out-of-line objects and envelopes they contain.
+template <typename Offset, bool kValidateOnly>
+class V1CompactConverter final {
+  using Position = BasicPosition<Offset>;
+  using SrcDst = BasicSrcDst<Offset, kValidateOnly>;
+  using TraversalResult = BasicTraversalResult<Offset>;
+
+ public:
+  V1CompactConverter(SrcDst* src_dst, const char** out_error_msg, bool to_compact,
+                     const fidl_transform_options_t& options)
+      : src_dst_(src_dst),
+        out_error_msg_(out_error_msg),
+        to_compact_(to_compact),
+        canonicalize_(options.canonicalize),
+        validate_strings_(options.validate_strings) {}
+
+  zx_status_t TransformTopLevelStruct(const fidl_type_t* type) {
+    if (type->type_tag != fidl::kFidlTypeStruct) {
+      return Fail(ZX_ERR_INVALID_ARGS, "only top-level structs supported", Position(0, 0, 0, 0));
+    }
+
+    const uint32_t size = type->coded_struct.size;
+    const auto start_position = Position(0, FIDL_ALIGN(size), 0, FIDL_ALIGN(size));
+    if (!src_dst_->SrcContains(0, size)) {
+      return Truncated(start_position);
+    }
+    src_dst_->Copy(start_position, size);
+    src_dst_->Pad(start_position.IncreaseInlineOffset(size), FIDL_ALIGN(size) - size);
+
+    TraversalResult discarded_traversal_result;
+    return Walk(type, start_position, &discarded_traversal_result);
+  }
+
+ private:
+  zx_status_t Walk(const fidl_type_t* type, const Position& position,
+                   TraversalResult* out_traversal_result) {
+    Trace(FIDL_TRANSFORM_TRACE_NODE, TraceTypeTag(type), position);
+
+    if (!type) {
+      return ZX_OK;
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+        return ZX_OK;
+      case fidl::kFidlTypeHandle:
+        if (canonicalize_) {
+          const auto handle = src_dst_->template Read<uint32_t>(position);
+          if (!handle) {
+            return Truncated(position);
+          }
+          const bool present = *handle == FIDL_HANDLE_PRESENT;
+          src_dst_->Write(position, present ? FIDL_HANDLE_PRESENT : FIDL_HANDLE_ABSENT);
+        }
+        return ZX_OK;
+      case fidl::kFidlTypeStruct:
+        return WalkStruct(type->coded_struct, position, out_traversal_result);
+      case fidl::kFidlTypeStructPointer: {
+        const auto presence = src_dst_->template Read<uint64_t>(position);
+        if (!presence) {
+          return Truncated(position);
+        }
+        if (*presence != FIDL_ALLOC_PRESENT) {
+          if (canonicalize_) {
+            src_dst_->Write(position, FIDL_ALLOC_ABSENT);
+          }
+          return ZX_OK;
+        }
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        const uint32_t size = FIDL_ALIGN(coded_struct.size);
+        if (!src_dst_->SrcContains(position.src_out_of_line_offset, size)) {
+          return Truncated(position);
+        }
+        const auto struct_position =
+            Position{position.src_out_of_line_offset, position.src_out_of_line_offset + size,
+                     position.dst_out_of_line_offset, position.dst_out_of_line_offset + size};
+        CopyOutOfLine(struct_position, coded_struct.size, size);
+        out_traversal_result->src_out_of_line_size += size;
+        out_traversal_result->dst_out_of_line_size += size;
+        return WalkStruct(coded_struct, struct_position, out_traversal_result);
+      }
+      case fidl::kFidlTypeUnion:
+        return WalkUnion(type->coded_union, position, out_traversal_result);
+      case fidl::kFidlTypeUnionPointer:
+        return WalkUnion(*type->coded_union_pointer.union_type, position, out_traversal_result);
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        if (!coded_array.element) {
+          return ZX_OK;
+        }
+        auto element_position = position;
+        for (uint32_t offset = 0; offset < coded_array.array_size;
+             offset += coded_array.element_size) {
+          TraversalResult element_traversal_result;
+          zx_status_t status =
+              Walk(coded_array.element, element_position, &element_traversal_result);
+          if (status != ZX_OK) {
+            return status;
+          }
+          element_position =
+              element_position.IncreaseInlineOffset(coded_array.element_size)
+                  .IncreaseSrcOutOfLineOffset(element_traversal_result.src_out_of_line_size)
+                  .IncreaseDstOutOfLineOffset(element_traversal_result.dst_out_of_line_size);
+          *out_traversal_result += element_traversal_result;
+        }
+        return ZX_OK;
+      }
+      case fidl::kFidlTypeString: {
+        const auto string = src_dst_->template Read<const fidl_vector_t>(position);
+        if (!string) {
+          return Truncated(position);
+        }
+        if (validate_strings_ && string->count > type->coded_string.max_size) {
+          return Fail(ZX_ERR_INVALID_ARGS, "string exceeds its maximum size", position);
+        }
+        return WalkVector(nullptr, 1, position, out_traversal_result, validate_strings_);
+      }
+      case fidl::kFidlTypeVector:
+        return WalkVector(type->coded_vector.element, type->coded_vector.element_size, position,
+                          out_traversal_result);
+      case fidl::kFidlTypeTable:
+        return WalkTable(type->coded_table, position, out_traversal_result);
+      case fidl::kFidlTypeXUnion: {
+        const auto& coded_xunion = type->coded_xunion;
+        const auto xunion = src_dst_->template Read<const fidl_xunion_t>(position);
+        if (!xunion) {
+          return Truncated(position);
+        }
+        const fidl_xunion_tag_t tag = xunion->tag;
+        if (canonicalize_) {
+          src_dst_->Write(position.IncreaseDstInlineOffset(sizeof(fidl_xunion_tag_t)), uint32_t{0});
+        }
+        const fidl::FidlXUnionField* field = nullptr;
+        for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
+          if (coded_xunion.fields[i].ordinal == tag) {
+            field = &coded_xunion.fields[i];
+            break;
+          }
+        }
+        return WalkEnvelope(field != nullptr, field ? field->type : nullptr, 0,
+                            position.IncreaseInlineOffset(
+                                static_cast<Offset>(offsetof(fidl_xunion_t, envelope))),
+                            out_traversal_result);
+      }
+    }
+
+    return Fail(ZX_ERR_BAD_STATE, "unknown type tag", position);
+  }
+
+  zx_status_t WalkStruct(const fidl::FidlCodedStruct& coded_struct, const Position& position,
+                         TraversalResult* out_traversal_result) {
+    auto field_position = position;
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      const auto& field = coded_struct.fields[i];
+      if (!field.type) {
+        if (canonicalize_) {
+          src_dst_->Pad(position.IncreaseDstInlineOffset(field.padding_offset), field.padding);
+        }
+        continue;
+      }
+      field_position.src_inline_offset = position.src_inline_offset + field.offset;
+      field_position.dst_inline_offset = position.dst_inline_offset + field.offset;
+
+      TraversalResult field_traversal_result;
+      zx_status_t status = Walk(field.type, field_position, &field_traversal_result);
+      if (status != ZX_OK) {
+        return status;
+      }
+      field_position =
+          field_position.IncreaseSrcOutOfLineOffset(field_traversal_result.src_out_of_line_size)
+              .IncreaseDstOutOfLineOffset(field_traversal_result.dst_out_of_line_size);
+      *out_traversal_result += field_traversal_result;
+    }
+    return ZX_OK;
+  }
+
+  // Static-unions are encoded as (possibly absent) extensible-unions in both
+  // formats. Variants without a coding table take their size from the old
+  // coding table.
+  zx_status_t WalkUnion(const fidl::FidlCodedUnion& coded_union, const Position& position,
+                        TraversalResult* out_traversal_result) {
+    auto xunion = src_dst_->template Read<const fidl_xunion_t>(position);
+    if (!xunion) {
+      return Truncated(position);
+    }
+    if (xunion->envelope.presence == FIDL_ALLOC_ABSENT) {
+      if (canonicalize_) {
+        src_dst_->Write(position, fidl_xunion_t{});
+      }
+      return ZX_OK;
+    }
+    if (canonicalize_) {
+      src_dst_->Write(position.IncreaseDstInlineOffset(sizeof(fidl_xunion_tag_t)), uint32_t{0});
+    }
+
+    for (uint32_t i = 0; i < coded_union.field_count; i++) {
+      const auto& field = coded_union.fields[i];
+      if (field.xunion_ordinal != xunion->tag) {
+        continue;
+      }
+      const auto& old_coded_union = *coded_union.alt_type;
+      const uint32_t variant_size =
+          old_coded_union.size - old_coded_union.data_offset - old_coded_union.fields[i].padding;
+      return WalkEnvelope(true, field.type, variant_size,
+                          position.IncreaseInlineOffset(
+                              static_cast<Offset>(offsetof(fidl_xunion_t, envelope))),
+                          out_traversal_result);
+    }
+    return Fail(ZX_ERR_BAD_STATE, "ordinal has no corresponding variant", position);
+  }
+
+  // Strings are vectors of bytes whose contents are checked to be |utf8|.
+  zx_status_t WalkVector(const fidl_type_t* element, uint32_t element_size,
+                         const Position& position, TraversalResult* out_traversal_result,
+                         bool utf8 = false) {
+    auto vector = src_dst_->template Read<const fidl_vector_t>(position);
+    if (!vector) {
+      return Truncated(position);
+    }
+    if (reinterpret_cast<uintptr_t>(vector->data) != FIDL_ALLOC_PRESENT) {
+      if (canonicalize_) {
+        src_dst_->Write(position, fidl_vector_t{0, reinterpret_cast<void*>(FIDL_ALLOC_ABSENT)});
+      }
+      return ZX_OK;
+    }
+
+    Offset size;
+    if (!ArraySize(vector->count, element_size, &size) ||
+        !src_dst_->SrcContains(position.src_out_of_line_offset, size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the message", position);
+    }
+    const Offset count = static_cast<Offset>(vector->count);
+    const auto data_position =
+        Position{position.src_out_of_line_offset, 0, position.dst_out_of_line_offset, 0};
+    if (utf8) {
+      if (const char* error = src_dst_->CopyUtf8(data_position, count)) {
+        return Fail(ZX_ERR_INVALID_ARGS, error, position);
+      }
+      CopyOutOfLine(data_position.IncreaseInlineOffset(count), 0, size - count);
+    } else {
+      CopyOutOfLine(data_position, count * element_size, size);
+    }
+    out_traversal_result->src_out_of_line_size += size;
+    out_traversal_result->dst_out_of_line_size += size;
+    if (!element) {
+      return ZX_OK;
+    }
+
+    auto element_position =
+        Position{position.src_out_of_line_offset, position.src_out_of_line_offset + size,
+                 position.dst_out_of_line_offset, position.dst_out_of_line_offset + size};
+    for (Offset i = 0; i < count; i++) {
+      TraversalResult element_traversal_result;
+      zx_status_t status = Walk(element, element_position, &element_traversal_result);
+      if (status != ZX_OK) {
+        return status;
+      }
+      element_position =
+          element_position.IncreaseInlineOffset(element_size)
+              .IncreaseSrcOutOfLineOffset(element_traversal_result.src_out_of_line_size)
+              .IncreaseDstOutOfLineOffset(element_traversal_result.dst_out_of_line_size);
+      *out_traversal_result += element_traversal_result;
+    }
+    return ZX_OK;
+  }
+
+  zx_status_t WalkTable(const fidl::FidlCodedTable& coded_table, const Position& position,
+                        TraversalResult* out_traversal_result) {
+    auto table = src_dst_->template Read<const fidl_table_t>(position);
+    if (!table) {
+      return Truncated(position);
+    }
+    if (reinterpret_cast<uintptr_t>(table->envelopes.data) != FIDL_ALLOC_PRESENT) {
+      if (canonicalize_) {
+        src_dst_->Write(position, fidl_table_t{});
+      }
+      return ZX_OK;
+    }
+
+    Offset size;
+    if (!ArraySize(table->envelopes.count, sizeof(fidl_envelope_t), &size) ||
+        !src_dst_->SrcContains(position.src_out_of_line_offset, size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "table envelopes exceed the message", position);
+    }
+    const Offset count = static_cast<Offset>(table->envelopes.count);
+    src_dst_->Copy(Position{position.src_out_of_line_offset, 0, position.dst_out_of_line_offset, 0},
+                   size);
+    out_traversal_result->src_out_of_line_size += size;
+    out_traversal_result->dst_out_of_line_size += size;
+
+    auto envelope_position =
+        Position{position.src_out_of_line_offset, position.src_out_of_line_offset + size,
+                 position.dst_out_of_line_offset, position.dst_out_of_line_offset + size};
+    for (Offset i = 0; i < count; i++) {
+      const fidl::FidlTableField* field = nullptr;
+      for (uint32_t j = 0; j < coded_table.field_count; j++) {
+        if (coded_table.fields[j].ordinal == i + 1) {
+          field = &coded_table.fields[j];
+          break;
+        }
+      }
+
+      TraversalResult envelope_traversal_result;
+      zx_status_t status = WalkEnvelope(field != nullptr, field ? field->type : nullptr, 0,
+                                        envelope_position, &envelope_traversal_result);
+      if (status != ZX_OK) {
+        return status;
+      }
+      envelope_position =
+          envelope_position.IncreaseInlineOffset(static_cast<Offset>(sizeof(fidl_envelope_t)))
+              .IncreaseSrcOutOfLineOffset(envelope_traversal_result.src_out_of_line_size)
+              .IncreaseDstOutOfLineOffset(envelope_traversal_result.dst_out_of_line_size);
+      *out_traversal_result += envelope_traversal_result;
+    }
+    return ZX_OK;
+  }
+
+  // Rewrites the envelope at |position| (already copied to the destination) and
+  // its contents. |size| is the size of contents without a coding table.
+  zx_status_t WalkEnvelope(bool known_type, const fidl_type_t* type, uint32_t size,
+                           const Position& position, TraversalResult* out_traversal_result) {
+    auto src_envelope = src_dst_->template Read<const fidl_envelope_t>(position);
+    if (!src_envelope) {
+      return Truncated(position);
+    }
+    if (src_envelope->presence == FIDL_ALLOC_ABSENT) {
+      if (canonicalize_) {
+        src_dst_->Write(position, fidl_envelope_t{});
+      }
+      return ZX_OK;
+    }
+
+    // Compact to v1: move inlined contents out-of-line.
+    if (src_envelope->presence == FIDL_ENVELOPE_INLINED && !to_compact_) {
+      const uint32_t inline_size =
+          known_type ? CompactInlineSize(type, size) : kCompactEnvelopeMaxInlineSize;
+      if (inline_size == 0 || src_envelope->num_handles != 0) {
+        return Fail(ZX_ERR_BAD_STATE, "inlined envelope holds contents which cannot be inlined",
+                    position);
+      }
+      const uint32_t contents_size = FIDL_ALIGN(inline_size);
+      src_dst_->Copy(Position{position.src_inline_offset, position.src_out_of_line_offset,
+                              position.dst_out_of_line_offset, position.dst_out_of_line_offset},
+                     inline_size);
+      src_dst_->PadOutOfLine(position.IncreaseDstOutOfLineOffset(inline_size),
+                             contents_size - inline_size);
+      fidl_envelope_t dst_envelope = {};
+      dst_envelope.num_bytes = contents_size;
+      dst_envelope.presence = FIDL_ALLOC_PRESENT;
+      src_dst_->Write(position, dst_envelope);
+      out_traversal_result->dst_out_of_line_size += contents_size;
+      return ZX_OK;
+    }
+
+    if (src_envelope->presence != FIDL_ALLOC_PRESENT) {
+      return Fail(ZX_ERR_BAD_STATE, "envelope presence invalid", position);
+    }
+
+    // Contents of unknown type are copied as is.
+    if (!known_type) {
+      if (!src_dst_->SrcContains(position.src_out_of_line_offset, src_envelope->num_bytes)) {
+        return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+      }
+      src_dst_->Copy(Position{position.src_out_of_line_offset, 0, position.dst_out_of_line_offset,
+                              0},
+                     src_envelope->num_bytes);
+      out_traversal_result->src_out_of_line_size += src_envelope->num_bytes;
+      out_traversal_result->dst_out_of_line_size += src_envelope->num_bytes;
+      return ZX_OK;
+    }
+
+    // V1 to compact: inline small contents.
+    if (to_compact_) {
+      const uint32_t inline_size = CompactInlineSize(type, size);
+      if (inline_size != 0) {
+        if (src_envelope->num_bytes != FIDL_ALIGN(inline_size)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "envelope num_bytes does not match its contents",
+                      position);
+        }
+        if (!src_dst_->SrcContains(position.src_out_of_line_offset, src_envelope->num_bytes)) {
+          return Truncated(position);
+        }
+        fidl_envelope_t dst_envelope = {};
+        dst_envelope.presence = FIDL_ENVELOPE_INLINED;
+        src_dst_->Write(position, dst_envelope);
+        src_dst_->Copy(Position{position.src_out_of_line_offset, position.src_out_of_line_offset,
+                                position.dst_inline_offset, position.dst_out_of_line_offset},
+                       inline_size);
+        out_traversal_result->src_out_of_line_size += src_envelope->num_bytes;
+        return ZX_OK;
+      }
+    }
+
+    const uint32_t contents_size =
+        FIDL_ALIGN(type ? AlignedInlineSize(type, WireFormat::kV1) : size);
+    if (!src_dst_->SrcContains(position.src_out_of_line_offset, contents_size)) {
+      return Truncated(position);
+    }
+    const auto contents_position = Position{
+        position.src_out_of_line_offset, position.src_out_of_line_offset + contents_size,
+        position.dst_out_of_line_offset, position.dst_out_of_line_offset + contents_size};
+    CopyOutOfLine(contents_position, type ? InlineSize(type, WireFormat::kV1) : size,
+                  contents_size);
+
+    TraversalResult contents_traversal_result;
+    zx_status_t status = Walk(type, contents_position, &contents_traversal_result);
+    if (status != ZX_OK) {
+      return status;
+    }
+
+    if (contents_size + contents_traversal_result.src_out_of_line_size !=
+        src_envelope->num_bytes) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope num_bytes does not match its contents", position);
+    }
+    const Offset dst_contents_size = contents_size + contents_traversal_result.dst_out_of_line_size;
+    if (dst_contents_size > UINT32_MAX) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope contents exceed 4 GiB", position);
+    }
+    fidl_envelope_t dst_envelope = *src_envelope;
+    dst_envelope.num_bytes = static_cast<uint32_t>(dst_contents_size);
+    src_dst_->Write(position, dst_envelope);
+
+    out_traversal_result->src_out_of_line_size +=
+        contents_size + contents_traversal_result.src_out_of_line_size;
+    out_traversal_result->dst_out_of_line_size += dst_envelope.num_bytes;
+    return ZX_OK;
+  }
+
+  // Copies the out-of-line object of |size| bytes (|aligned_size| with its
+  // padding) at the inline offsets of |position|. Canonicalization zeroes the
+  // padding instead of copying it.
+  void CopyOutOfLine(const Position& position, Offset size, Offset aligned_size) {
+    if (!canonicalize_) {
+      src_dst_->Copy(position, aligned_size);
+      return;
+    }
+    src_dst_->Copy(position, size);
+    src_dst_->Pad(position.IncreaseDstInlineOffset(size), aligned_size - size);
+  }
+
+  zx_status_t Fail(zx_status_t status, const char* error_msg, const Position& position) {
+    Trace(FIDL_TRANSFORM_TRACE_FAIL, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(status));
+    RecordFailure(status, error_msg, position);
+    if (out_error_msg_)
+      *out_error_msg_ = error_msg;
+    return status;
+  }
+
+  // Fails on a read or out-of-line object past the end of the source.
+  zx_status_t Truncated(const Position& position) {
+    return Fail(ZX_ERR_INVALID_ARGS, "message is truncated", position);
+  }
+
+  SrcDst* src_dst_;
+  const char** out_error_msg_;
+  const bool to_compact_;
+  // See `fidl_transform_options_t`.
+  const bool canonicalize_;
+  const bool validate_strings_;
+};
+
+// Transforms v1 messages between two versions of the same type (see
+// `fidl_transform_evolve`). Objects of both versions are walked in lockstep,
+// the source and destination out-of-line offsets diverging as fields of tables
+// are dropped.
+class V1Evolver final {
+  using Offset = uint32_t;
+  using Position = BasicPosition<Offset>;
+  using SrcDst = BasicSrcDst<Offset>;
+  using TraversalResult = BasicTraversalResult<Offset>;
+
+ public:
+  V1Evolver(SrcDst* src_dst, const char** out_error_msg, const fidl_evolve_options_t& options)
+      : src_dst_(src_dst),
+        out_error_msg_(out_error_msg),
+        drop_unknown_fields_(options.drop_unknown_fields) {}
+
+  zx_status_t TransformTopLevelStruct(const fidl_type_t* src_type, const fidl_type_t* dst_type) {
+    if (src_type->type_tag != fidl::kFidlTypeStruct ||
+        dst_type->type_tag != fidl::kFidlTypeStruct) {
+      return Fail(ZX_ERR_INVALID_ARGS, "only top-level structs supported", Position(0, 0, 0, 0));
+    }
+
+    const uint32_t size = FIDL_ALIGN(src_type->coded_struct.size);
+    const auto start_position = Position(0, size, 0, size);
+    if (!src_dst_->SrcContains(0, size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is smaller than its top-level struct",
+                  start_position);
+    }
+    src_dst_->Copy(start_position, size);
+
+    TraversalResult discarded_traversal_result;
+    return Walk(src_type, dst_type, start_position, &discarded_traversal_result);
+  }
+
+ private:
+  // Walks the object of |src_type| at |position|, already copied to the
+  // destination, as an object of |dst_type|.
+  zx_status_t Walk(const fidl_type_t* src_type, const fidl_type_t* dst_type,
+                   const Position& position, TraversalResult* out_traversal_result) {
+    Trace(FIDL_TRANSFORM_TRACE_NODE, TraceTypeTag(src_type), position);
+
+    if (!src_type || !dst_type) {
+      if (src_type != dst_type) {
+        return Fail(ZX_ERR_INVALID_ARGS, "field has a coding table in one version only", position);
+      }
+      return ZX_OK;
+    }
+    if (src_type->type_tag != dst_type->type_tag ||
+        InlineSize(src_type, WireFormat::kV1) != InlineSize(dst_type, WireFormat::kV1)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "field types differ between versions", position);
+    }
+
+    switch (src_type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+      case fidl::kFidlTypeHandle:
+        return ZX_OK;
+      case fidl::kFidlTypeStruct:
+        return WalkStruct(src_type->coded_struct, dst_type->coded_struct, position,
+                          out_traversal_result);
+      case fidl::kFidlTypeStructPointer: {
+        const auto& src_coded_struct = *src_type->coded_struct_pointer.struct_type;
+        const auto& dst_coded_struct = *dst_type->coded_struct_pointer.struct_type;
+        auto presence = src_dst_->Read<uint64_t>(position);
+        if (!presence) {
+          return Fail(ZX_ERR_INVALID_ARGS, "struct pointer exceeds the message", position);
+        }
+        if (*presence != FIDL_ALLOC_PRESENT) {
+          return ZX_OK;
+        }
+        const uint32_t size = FIDL_ALIGN(src_coded_struct.size);
+        if (!src_dst_->SrcContains(position.src_out_of_line_offset, size)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "struct exceeds the message", position);
+        }
+        const auto struct_position =
+            Position{position.src_out_of_line_offset, position.src_out_of_line_offset + size,
+                     position.dst_out_of_line_offset, position.dst_out_of_line_offset + size};
+        src_dst_->Copy(struct_position, size);
+        out_traversal_result->src_out_of_line_size += size;
+        out_traversal_result->dst_out_of_line_size += size;
+        return WalkStruct(src_coded_struct, dst_coded_struct, struct_position,
+                          out_traversal_result);
+      }
+      case fidl::kFidlTypeUnion:
+        return WalkUnion(src_type->coded_union, dst_type->coded_union, position,
+                         out_traversal_result);
+      case fidl::kFidlTypeUnionPointer:
+        return WalkUnion(*src_type->coded_union_pointer.union_type,
+                         *dst_type->coded_union_pointer.union_type, position,
+                         out_traversal_result);
+      case fidl::kFidlTypeArray: {
+        const auto& src_coded_array = src_type->coded_array;
+        const auto& dst_coded_array = dst_type->coded_array;
+        if (src_coded_array.element_size != dst_coded_array.element_size) {
+          return Fail(ZX_ERR_INVALID_ARGS, "array elements differ between versions", position);
+        }
+        if (!src_coded_array.element && !dst_coded_array.element) {
+          return ZX_OK;
+        }
+        auto element_position = position;
+        for (uint32_t offset = 0; offset < src_coded_array.array_size;
+             offset += src_coded_array.element_size) {
+          TraversalResult element_traversal_result;
+          zx_status_t status = Walk(src_coded_array.element, dst_coded_array.element,
+                                    element_position, &element_traversal_result);
+          if (status != ZX_OK) {
+            return status;
+          }
+          element_position =
+              element_position.IncreaseInlineOffset(src_coded_array.element_size)
+                  .IncreaseSrcOutOfLineOffset(element_traversal_result.src_out_of_line_size)
+                  .IncreaseDstOutOfLineOffset(element_traversal_result.dst_out_of_line_size);
+          *out_traversal_result += element_traversal_result;
+        }
+        return ZX_OK;
+      }
+      case fidl::kFidlTypeString:
+        return WalkVector(nullptr, nullptr, 1, position, out_traversal_result);
+      case fidl::kFidlTypeVector:
+        if (src_type->coded_vector.element_size != dst_type->coded_vector.element_size) {
+          return Fail(ZX_ERR_INVALID_ARGS, "vector elements differ between versions", position);
+        }
+        return WalkVector(src_type->coded_vector.element, dst_type->coded_vector.element,
+                          src_type->coded_vector.element_size, position, out_traversal_result);
+      case fidl::kFidlTypeTable:
+        return WalkTable(src_type->coded_table, dst_type->coded_table, position,
+                         out_traversal_result);
+      case fidl::kFidlTypeXUnion: {
+        auto xunion = src_dst_->Read<const fidl_xunion_t>(position);
+        if (!xunion) {
+          return Fail(ZX_ERR_INVALID_ARGS, "xunion exceeds the message", position);
+        }
+        const auto* src_field = XUnionField(src_type->coded_xunion, xunion->tag);
+        const auto* dst_field = XUnionField(dst_type->coded_xunion, xunion->tag);
+        if (!dst_field && xunion->tag != 0 &&
+            dst_type->coded_xunion.strictness == fidl::kStrict) {
+          return Fail(ZX_ERR_INVALID_ARGS, "strict xunion has no such variant", position);
+        }
+        return WalkEnvelope(src_field ? src_field->type : nullptr,
+                            dst_field ? dst_field->type : nullptr, src_field && dst_field, 0,
+                            position.IncreaseInlineOffset(
+                                static_cast<Offset>(offsetof(fidl_xunion_t, envelope))),
+                            out_traversal_result);
+      }
+    }
+
+    return Fail(ZX_ERR_BAD_STATE, "unknown type tag", position);
+  }
+
+  // Fields without a coding table are primitives, already copied with the
+  // struct, and need not match.
+  zx_status_t WalkStruct(const fidl::FidlCodedStruct& src_coded_struct,
+                         const fidl::FidlCodedStruct& dst_coded_struct, const Position& position,
+                         TraversalResult* out_traversal_result) {
+    if (src_coded_struct.size != dst_coded_struct.size) {
+      return Fail(ZX_ERR_INVALID_ARGS, "struct sizes differ between versions", position);
+    }
+    auto field_position = position;
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < src_coded_struct.field_count; i++) {
+      const auto& src_field = src_coded_struct.fields[i];
+      if (!src_field.type) {
+        continue;
+      }
+      while (j < dst_coded_struct.field_count && !dst_coded_struct.fields[j].type) {
+        j++;
+      }
+      if (j == dst_coded_struct.field_count ||
+          dst_coded_struct.fields[j].offset != src_field.offset) {
+        return Fail(ZX_ERR_INVALID_ARGS, "struct fields differ between versions", position);
+      }
+      const auto& dst_field = dst_coded_struct.fields[j++];
+      field_position.src_inline_offset = position.src_inline_offset + src_field.offset;
+      field_position.dst_inline_offset = position.dst_inline_offset + src_field.offset;
+
+      TraversalResult field_traversal_result;
+      zx_status_t status =
+          Walk(src_field.type, dst_field.type, field_position, &field_traversal_result);
+      if (status != ZX_OK) {
+        return status;
+      }
+      field_position =
+          field_position.IncreaseSrcOutOfLineOffset(field_traversal_result.src_out_of_line_size)
+              .IncreaseDstOutOfLineOffset(field_traversal_result.dst_out_of_line_size);
+      *out_traversal_result += field_traversal_result;
+    }
+    while (j < dst_coded_struct.field_count && !dst_coded_struct.fields[j].type) {
+      j++;
+    }
+    if (j != dst_coded_struct.field_count) {
+      return Fail(ZX_ERR_INVALID_ARGS, "struct fields differ between versions", position);
+    }
+    return ZX_OK;
+  }
+
+  // Static-unions are encoded as (possibly absent) extensible-unions, whose
+  // ordinal must be a variant of both versions.
+  zx_status_t WalkUnion(const fidl::FidlCodedUnion& src_coded_union,
+                        const fidl::FidlCodedUnion& dst_coded_union, const Position& position,
+                        TraversalResult* out_traversal_result) {
+    auto xunion = src_dst_->Read<const fidl_xunion_t>(position);
+    if (!xunion) {
+      return Fail(ZX_ERR_INVALID_ARGS, "union exceeds the message", position);
+    }
+    if (xunion->envelope.presence == FIDL_ALLOC_ABSENT) {
+      return ZX_OK;
+    }
+    uint32_t src_index, dst_index;
+    if (!VariantIndex(src_coded_union, xunion->tag, &src_index)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "ordinal has no corresponding variant", position);
+    }
+    if (!VariantIndex(dst_coded_union, xunion->tag, &dst_index)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "union variant is unknown to the destination version",
+                  position);
+    }
+    const uint32_t size = VariantSize(src_coded_union, src_index, WireFormat::kV1);
+    if (size != VariantSize(dst_coded_union, dst_index, WireFormat::kV1)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "union variants differ between versions", position);
+    }
+    return WalkEnvelope(src_coded_union.fields[src_index].type,
+                        dst_coded_union.fields[dst_index].type, true, size,
+                        position.IncreaseInlineOffset(
+                            static_cast<Offset>(offsetof(fidl_xunion_t, envelope))),
+                        out_traversal_result);
+  }
+
+  zx_status_t WalkVector(const fidl_type_t* src_element, const fidl_type_t* dst_element,
+                         uint32_t element_size, const Position& position,
+                         TraversalResult* out_traversal_result) {
+    auto vector = src_dst_->Read<const fidl_vector_t>(position);
+    if (!vector) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the message", position);
+    }
+    if (reinterpret_cast<uintptr_t>(vector->data) != FIDL_ALLOC_PRESENT) {
+      return ZX_OK;
+    }
+
+    Offset size;
+    if (!ArraySize(vector->count, element_size, &size) ||
+        !src_dst_->SrcContains(position.src_out_of_line_offset, size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "vector exceeds the message", position);
+    }
+    src_dst_->Copy(Position{position.src_out_of_line_offset, 0, position.dst_out_of_line_offset, 0},
+                   size);
+    out_traversal_result->src_out_of_line_size += size;
+    out_traversal_result->dst_out_of_line_size += size;
+    if (!src_element && !dst_element) {
+      return ZX_OK;
+    }
+
+    const Offset count = static_cast<Offset>(vector->count);
+    auto element_position =
+        Position{position.src_out_of_line_offset, position.src_out_of_line_offset + size,
+                 position.dst_out_of_line_offset, position.dst_out_of_line_offset + size};
+    for (Offset i = 0; i < count; i++) {
+      TraversalResult element_traversal_result;
+      zx_status_t status =
+          Walk(src_element, dst_element, element_position, &element_traversal_result);
+      if (status != ZX_OK) {
+        return status;
+      }
+      element_position =
+          element_position.IncreaseInlineOffset(element_size)
+              .IncreaseSrcOutOfLineOffset(element_traversal_result.src_out_of_line_size)
+              .IncreaseDstOutOfLineOffset(element_traversal_result.dst_out_of_line_size);
+      *out_traversal_result += element_traversal_result;
+    }
+    return ZX_OK;
+  }
+
+  // The destination vector of envelopes ends at the last field which is kept,
+  // found from the source envelopes alone before any contents are walked.
+  zx_status_t WalkTable(const fidl::FidlCodedTable& src_coded_table,
+                        const fidl::FidlCodedTable& dst_coded_table, const Position& position,
+                        TraversalResult* out_traversal_result) {
+    auto table = src_dst_->Read<const fidl_table_t>(position);
+    if (!table) {
+      return Fail(ZX_ERR_INVALID_ARGS, "table exceeds the message", position);
+    }
+    if (reinterpret_cast<uintptr_t>(table->envelopes.data) != FIDL_ALLOC_PRESENT) {
+      return ZX_OK;
+    }
+
+    Offset src_size;
+    if (!ArraySize(table->envelopes.count, sizeof(fidl_envelope_t), &src_size) ||
+        !src_dst_->SrcContains(position.src_out_of_line_offset, src_size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "table envelopes exceed the message", position);
+    }
+    const Offset src_count = static_cast<Offset>(table->envelopes.count);
+    const auto* src_envelopes =
+        src_dst_->Read<const fidl_envelope_t>(Position{position.src_out_of_line_offset, 0, 0, 0});
+
+    Offset dst_count = src_count;
+    if (drop_unknown_fields_) {
+      dst_count = 0;
+      uint32_t cursor = 0;
+      for (Offset i = 0; i < src_count; i++) {
+        if (src_envelopes[i].presence != FIDL_ALLOC_ABSENT &&
+            HasOrdinal(dst_coded_table, i + 1, &cursor)) {
+          dst_count = i + 1;
+        }
+      }
+    }
+    const Offset dst_size = dst_count * static_cast<Offset>(sizeof(fidl_envelope_t));
+    fidl_table_t dst_table = *table;
+    dst_table.envelopes.count = dst_count;
+    src_dst_->Write(position, dst_table);
+    out_traversal_result->src_out_of_line_size += src_size;
+    out_traversal_result->dst_out_of_line_size += dst_size;
+
+    auto envelope_position =
+        Position{position.src_out_of_line_offset, position.src_out_of_line_offset + src_size,
+                 position.dst_out_of_line_offset, position.dst_out_of_line_offset + dst_size};
+    uint32_t src_cursor = 0, dst_cursor = 0;
+    for (Offset i = 0; i < src_count; i++) {
+      const uint32_t ordinal = i + 1;
+      const bool src_known = HasOrdinal(src_coded_table, ordinal, &src_cursor);
+      const bool dst_known = HasOrdinal(dst_coded_table, ordinal, &dst_cursor);
+      const fidl_type_t* src_field_type = src_known ? src_coded_table.fields[src_cursor].type
+                                                    : nullptr;
+      const fidl_type_t* dst_field_type = dst_known ? dst_coded_table.fields[dst_cursor].type
+                                                    : nullptr;
+
+      TraversalResult envelope_traversal_result;
+      zx_status_t status;
+      if (i >= dst_count || (!dst_known && drop_unknown_fields_)) {
+        status = DropEnvelope(envelope_position, i < dst_count, &envelope_traversal_result);
+      } else {
+        src_dst_->Copy(envelope_position, static_cast<Offset>(sizeof(fidl_envelope_t)));
+        status = WalkEnvelope(src_field_type, dst_field_type, src_known && dst_known, 0,
+                              envelope_position, &envelope_traversal_result);
+      }
+      if (status != ZX_OK) {
+        return status;
+      }
+      envelope_position =
+          envelope_position.IncreaseInlineOffset(static_cast<Offset>(sizeof(fidl_envelope_t)))
+              .IncreaseSrcOutOfLineOffset(envelope_traversal_result.src_out_of_line_size)
+              .IncreaseDstOutOfLineOffset(envelope_traversal_result.dst_out_of_line_size);
+      *out_traversal_result += envelope_traversal_result;
+    }
+    return ZX_OK;
+  }
+
+  // Whether |coded_table| has a field |ordinal|, which is then at |*cursor|.
+  // Fields are sorted by ordinal, and looked up in increasing order.
+  static bool HasOrdinal(const fidl::FidlCodedTable& coded_table, uint32_t ordinal,
+                         uint32_t* cursor) {
+    while (*cursor < coded_table.field_count && coded_table.fields[*cursor].ordinal < ordinal) {
+      (*cursor)++;
+    }
+    return *cursor < coded_table.field_count && coded_table.fields[*cursor].ordinal == ordinal;
+  }
+
+  // Skips the contents of the source envelope at |position|, and writes an
+  // absent envelope in its place if the destination vector of envelopes
+  // extends that far.
+  zx_status_t DropEnvelope(const Position& position, bool in_dst,
+                           TraversalResult* out_traversal_result) {
+    auto src_envelope = src_dst_->Read<const fidl_envelope_t>(position);
+    if (!src_envelope) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+    }
+    if (src_envelope->presence != FIDL_ALLOC_ABSENT &&
+        src_envelope->presence != FIDL_ALLOC_PRESENT) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope presence invalid", position);
+    }
+    if (src_envelope->num_handles != 0) {
+      return Fail(ZX_ERR_INVALID_ARGS, "dropped field holds handles", position);
+    }
+    const uint32_t num_bytes =
+        src_envelope->presence == FIDL_ALLOC_PRESENT ? src_envelope->num_bytes : 0;
+    if (!src_dst_->SrcContains(position.src_out_of_line_offset, num_bytes)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+    }
+    if (in_dst) {
+      src_dst_->Write(position, fidl_envelope_t{});
+    }
+    out_traversal_result->src_out_of_line_size += num_bytes;
+    return ZX_OK;
+  }
+
+  // Rewrites the envelope at |position| (already copied to the destination) and
+  // its contents. Unless |known_type| (in both versions), the contents are
+  // copied as is. |size| is the size of contents without a coding table.
+  zx_status_t WalkEnvelope(const fidl_type_t* src_type, const fidl_type_t* dst_type,
+                           bool known_type, uint32_t size, const Position& position,
+                           TraversalResult* out_traversal_result) {
+    auto src_envelope = src_dst_->Read<const fidl_envelope_t>(position);
+    if (!src_envelope) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+    }
+    if (src_envelope->presence == FIDL_ALLOC_ABSENT) {
+      return ZX_OK;
+    }
+    if (src_envelope->presence == FIDL_ENVELOPE_INLINED) {
+      return Fail(ZX_ERR_INVALID_ARGS, "compact v1 messages must be expanded to v1 first",
+                  position);
+    }
+    if (src_envelope->presence != FIDL_ALLOC_PRESENT) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope presence invalid", position);
+    }
+
+    if (!known_type) {
+      if (!src_dst_->SrcContains(position.src_out_of_line_offset, src_envelope->num_bytes)) {
+        return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+      }
+      src_dst_->Copy(Position{position.src_out_of_line_offset, 0, position.dst_out_of_line_offset,
+                              0},
+                     src_envelope->num_bytes);
+      out_traversal_result->src_out_of_line_size += src_envelope->num_bytes;
+      out_traversal_result->dst_out_of_line_size += src_envelope->num_bytes;
+      return ZX_OK;
+    }
+
+    const uint32_t contents_size =
+        FIDL_ALIGN(src_type ? AlignedInlineSize(src_type, WireFormat::kV1) : size);
+    if (!src_dst_->SrcContains(position.src_out_of_line_offset, contents_size)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope exceeds the message", position);
+    }
+    const auto contents_position = Position{
+        position.src_out_of_line_offset, position.src_out_of_line_offset + contents_size,
+        position.dst_out_of_line_offset, position.dst_out_of_line_offset + contents_size};
+    src_dst_->Copy(contents_position, contents_size);
+
+    TraversalResult contents_traversal_result;
+    zx_status_t status = Walk(src_type, dst_type, contents_position, &contents_traversal_result);
+    if (status != ZX_OK) {
+      return status;
+    }
+    if (contents_size + contents_traversal_result.src_out_of_line_size !=
+        src_envelope->num_bytes) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope num_bytes does not match its contents", position);
+    }
+
+    fidl_envelope_t dst_envelope = *src_envelope;
+    dst_envelope.num_bytes = contents_size + contents_traversal_result.dst_out_of_line_size;
+    src_dst_->Write(position, dst_envelope);
+
+    out_traversal_result->src_out_of_line_size +=
+        contents_size + contents_traversal_result.src_out_of_line_size;
+    out_traversal_result->dst_out_of_line_size += dst_envelope.num_bytes;
+    return ZX_OK;
+  }
+
+  zx_status_t Fail(zx_status_t status, const char* error_msg, const Position& position) {
+    Trace(FIDL_TRANSFORM_TRACE_FAIL, FIDL_TRANSFORM_TRACE_NO_TYPE, position,
+          static_cast<uint32_t>(status));
+    RecordFailure(status, error_msg, position);
+    if (out_error_msg_)
+      *out_error_msg_ = error_msg;
+    return status;
+  }
+
+  SrcDst* src_dst_;
+  const char** out_error_msg_;
+  // See `fidl_evolve_options_t`.
+  const bool drop_unknown_fields_;
+};
+
 }  // namespace
 
-zx_status_t fidl_transform(fidl_transformation_t transformation, const fidl_type_t* type,
-                           const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
-                           uint32_t* out_dst_num_bytes, const char** out_error_msg) {
-  assert(type);
-  assert(src_bytes);
-  assert(dst_bytes);
-  assert(out_dst_num_bytes);
+namespace {
 
+template <typename Offset, bool kValidateOnly>
+zx_status_t TransformDispatch(fidl_transformation_t transformation,
+                              const fidl_transform_options_t& options, const fidl_type_t* type,
+                              const uint8_t* src_bytes, Offset src_num_bytes, uint8_t* dst_bytes,
+                              Offset* out_dst_num_bytes, const char** out_error_msg) {
   switch (transformation) {
     case FIDL_TRANSFORMATION_NONE:
-      memcpy(dst_bytes, src_bytes, src_num_bytes);
+      if (!kValidateOnly) {
+        memcpy(dst_bytes, src_bytes, src_num_bytes);
+      }
       *out_dst_num_bytes = src_num_bytes;
       return ZX_OK;
-    case FIDL_TRANSFORMATION_V1_TO_OLD: {
-      SrcDst src_dst(src_bytes, src_num_bytes, dst_bytes, out_dst_num_bytes);
-      return V1ToOld(&src_dst, out_error_msg).TransformTopLevelStruct(type);
+    case FIDL_TRANSFORMATION_V1_TO_OLD:
+    case FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD: {
+      BasicSrcDst<Offset, kValidateOnly> src_dst(src_bytes, src_num_bytes, dst_bytes,
+                                                 out_dst_num_bytes);
+      return V1ToOld<Offset, kValidateOnly>(
+                 &src_dst, out_error_msg, transformation == FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD,
+                 options)
+          .TransformTopLevelStruct(type);
+    }
+    case FIDL_TRANSFORMATION_OLD_TO_V1:
+    case FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT: {
+      BasicSrcDst<Offset, kValidateOnly> src_dst(src_bytes, src_num_bytes, dst_bytes,
+                                                 out_dst_num_bytes);
+      return OldToV1<Offset, kValidateOnly>(
+                 &src_dst, out_error_msg, transformation == FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT,
+                 options)
+          .TransformTopLevelStruct(type);
     }
-    case FIDL_TRANSFORMATION_OLD_TO_V1: {
-      SrcDst src_dst(src_bytes, src_num_bytes, dst_bytes, out_dst_num_bytes);
-      return OldToV1(&src_dst, out_error_msg).TransformTopLevelStruct(type);
+    case FIDL_TRANSFORMATION_V1_TO_V1_COMPACT:
+    case FIDL_TRANSFORMATION_V1_COMPACT_TO_V1: {
+      BasicSrcDst<Offset, kValidateOnly> src_dst(src_bytes, src_num_bytes, dst_bytes,
+                                                 out_dst_num_bytes);
+      return V1CompactConverter<Offset, kValidateOnly>(
+                 &src_dst, out_error_msg, transformation == FIDL_TRANSFORMATION_V1_TO_V1_COMPACT,
+                 options)
+          .TransformTopLevelStruct(type);
     }
     default: {
+      RecordFailure(ZX_ERR_INVALID_ARGS, "unsupported transformation",
+                    BasicPosition<Offset>(0, 0, 0, 0));
       if (out_error_msg)
         *out_error_msg = "unsupported transformation";
       return ZX_ERR_INVALID_ARGS;
@@ -976,4 +2902,307 @@ zx_status_t fidl_transform(fidl_transformation_t transformation, const fidl_type
   }
 }
 
+// CRC32C (Castagnoli polynomial, reflected), without the initial and final
+// inversions, one byte at a time.
+uint32_t Crc32cSoftware(uint32_t crc, const uint8_t* bytes, size_t size) {
+  static const struct Table {
+    Table() {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t entry = i;
+        for (int bit = 0; bit < 8; bit++) {
+          entry = (entry >> 1) ^ (entry & 1 ? 0x82f63b78u : 0);
+        }
+        entries[i] = entry;
+      }
+    }
+    uint32_t entries[256];
+  } table;
+  for (size_t i = 0; i < size; i++) {
+    crc = table.entries[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t Crc32cSse42(uint32_t crc, const uint8_t* bytes,
+                                                       size_t size) {
+  uint64_t crc64 = crc;
+  for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; size > 0; bytes++, size--) {
+    crc = _mm_crc32_u8(crc, *bytes);
+  }
+  return crc;
+}
+#endif
+
+uint32_t Crc32c(const uint8_t* bytes, size_t size) {
+  uint32_t crc = ~0u;
+#if defined(__x86_64__)
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42) {
+    return ~Crc32cSse42(crc, bytes, size);
+  }
+#elif defined(__ARM_FEATURE_CRC32)
+  for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+#endif
+  return ~Crc32cSoftware(crc, bytes, size);
+}
+
+template <typename Offset, bool kValidateOnly = false>
+zx_status_t TransformTraced(fidl_transformation_t transformation,
+                            const fidl_transform_options_t& options, const fidl_type_t* type,
+                            const uint8_t* src_bytes, Offset src_num_bytes, uint8_t* dst_bytes,
+                            Offset* out_dst_num_bytes, const char** out_error_msg) {
+  assert(type);
+  assert(src_bytes);
+  assert(kValidateOnly || dst_bytes);
+  assert(out_dst_num_bytes);
+
+  *out_dst_num_bytes = 0;
+  const BasicPosition<Offset> start(0, 0, 0, 0);
+  Trace(FIDL_TRANSFORM_TRACE_BEGIN, TraceTypeTag(type), start, transformation,
+        static_cast<uint32_t>(src_num_bytes));
+  zx_status_t status = TransformDispatch<Offset, kValidateOnly>(
+      transformation, options, type, src_bytes, src_num_bytes, dst_bytes, out_dst_num_bytes,
+      out_error_msg);
+  Trace(FIDL_TRANSFORM_TRACE_END, TraceTypeTag(type), start, static_cast<uint32_t>(status),
+        static_cast<uint32_t>(*out_dst_num_bytes));
+  if (status != ZX_OK) {
+    RecordFailedTransformation(transformation, type);
+    if (options.on_failure) {
+      options.on_failure(options.on_failure_context);
+    }
+  }
+  return status;
+}
+
+// Checks that |options| are supported by |transformation|.
+zx_status_t CheckOptions(fidl_transformation_t transformation,
+                         const fidl_transform_options_t& options, const char** out_error_msg) {
+  if (options.checksum != FIDL_CHECKSUM_NONE && options.checksum != FIDL_CHECKSUM_CRC32C) {
+    if (out_error_msg)
+      *out_error_msg = "unsupported checksum";
+    return ZX_ERR_INVALID_ARGS;
+  }
+  if (options.index && transformation != FIDL_TRANSFORMATION_V1_TO_OLD &&
+      transformation != FIDL_TRANSFORMATION_OLD_TO_V1 &&
+      transformation != FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD &&
+      transformation != FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT) {
+    if (out_error_msg)
+      *out_error_msg = "field index unsupported by this transformation";
+    return ZX_ERR_INVALID_ARGS;
+  }
+  assert(!options.index || options.out_index_count);
+  if (options.check_handles && transformation != FIDL_TRANSFORMATION_V1_TO_OLD &&
+      transformation != FIDL_TRANSFORMATION_OLD_TO_V1 &&
+      transformation != FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD &&
+      transformation != FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT) {
+    if (out_error_msg)
+      *out_error_msg = "handle checks unsupported by this transformation";
+    return ZX_ERR_INVALID_ARGS;
+  }
+  assert(!options.check_handles || options.num_handles == 0 || options.handles);
+  assert(!options.envelope_handles || options.out_envelope_handles_count);
+  return ZX_OK;
+}
+
+}  // namespace
+
+zx_status_t fidl_transform(fidl_transformation_t transformation, const fidl_type_t* type,
+                           const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
+                           uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  return TransformTraced(transformation, fidl_transform_options_t{}, type, src_bytes,
+                         src_num_bytes, dst_bytes, out_dst_num_bytes, out_error_msg);
+}
+
+zx_status_t fidl_transform_large(fidl_transformation_t transformation, const fidl_type_t* type,
+                                 const uint8_t* src_bytes, uint64_t src_num_bytes,
+                                 uint8_t* dst_bytes, uint64_t* out_dst_num_bytes,
+                                 const char** out_error_msg) {
+  return TransformTraced(transformation, fidl_transform_options_t{}, type, src_bytes,
+                         src_num_bytes, dst_bytes, out_dst_num_bytes, out_error_msg);
+}
+
+zx_status_t fidl_transform_with_options(fidl_transformation_t transformation,
+                                        const fidl_transform_options_t* options,
+                                        const fidl_type_t* type, const uint8_t* src_bytes,
+                                        uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                        uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  assert(options);
+  zx_status_t status = CheckOptions(transformation, *options, out_error_msg);
+  if (status != ZX_OK) {
+    return status;
+  }
+  status = TransformTraced(transformation, *options, type, src_bytes, src_num_bytes,
+                           dst_bytes, out_dst_num_bytes, out_error_msg);
+
+  // Objects are not written in order, and presence markers and padding may be
+  // rewritten after being copied, so the checksum is only computed once the
+  // destination is complete (and still in cache), in a single in-order pass.
+  if (status == ZX_OK && options->checksum == FIDL_CHECKSUM_CRC32C) {
+    assert(options->out_checksum);
+    *options->out_checksum = Crc32c(dst_bytes, *out_dst_num_bytes);
+  }
+  return status;
+}
+
+zx_status_t fidl_transform_validate(fidl_transformation_t transformation,
+                                    const fidl_transform_options_t* options,
+                                    const fidl_type_t* type, const uint8_t* src_bytes,
+                                    uint32_t src_num_bytes, uint32_t* out_dst_num_bytes,
+                                    const char** out_error_msg) {
+  assert(options);
+  if (options->checksum != FIDL_CHECKSUM_NONE) {
+    if (out_error_msg)
+      *out_error_msg = "checksum unsupported when validating";
+    return ZX_ERR_INVALID_ARGS;
+  }
+  const zx_status_t status = CheckOptions(transformation, *options, out_error_msg);
+  if (status != ZX_OK) {
+    return status;
+  }
+  return TransformTraced<uint32_t, true>(transformation, *options, type, src_bytes,
+                                         src_num_bytes, nullptr, out_dst_num_bytes,
+                                         out_error_msg);
+}
+
+zx_status_t fidl_transform_index_lookup(const fidl_transform_index_entry_t* index, uint32_t count,
+                                        const fidl_field_path_t* path, uint32_t* out_node,
+                                        const char** out_error_msg) {
+  auto fail = [&](zx_status_t status, const char* error_msg) {
+    if (out_error_msg) {
+      *out_error_msg = error_msg;
+    }
+    return status;
+  };
+  if (count == 0 || index[0].end != count) {
+    return fail(ZX_ERR_INVALID_ARGS, "field index is incomplete");
+  }
+
+  // Children of a node are found by hopping from sibling to sibling, which are
+  // the descendants of struct nodes, in field order, or the present fields of
+  // table nodes, in ordinal order.
+  uint32_t node = 0;
+  for (uint32_t i = 0; i < path->num_elements; i++) {
+    const uint32_t element = path->elements[i];
+    const fidl_type_t* type = index[node].type;
+    uint32_t child = node + 1;
+    const fidl::FidlCodedStruct* coded_struct = nullptr;
+    if (type && type->type_tag == fidl::kFidlTypeStruct) {
+      coded_struct = &type->coded_struct;
+    } else if (type && type->type_tag == fidl::kFidlTypeStructPointer) {
+      coded_struct = type->coded_struct_pointer.struct_type;
+    }
+    if (coded_struct) {
+      uint32_t num_fields = 0;
+      for (uint32_t j = 0; j < coded_struct->field_count; j++) {
+        num_fields += coded_struct->fields[j].type ? 1 : 0;
+      }
+      if (element >= num_fields) {
+        return fail(ZX_ERR_OUT_OF_RANGE, "field index out of range");
+      }
+      for (uint32_t skipped = 0; skipped < element && child < index[node].end; skipped++) {
+        child = index[child].end;
+      }
+    } else if (type && type->type_tag == fidl::kFidlTypeTable) {
+      if (i + 1 != path->num_elements) {
+        return fail(ZX_ERR_INVALID_ARGS, "field path continues past a table field");
+      }
+      while (child < index[node].end && index[child].ordinal < element) {
+        child = index[child].end;
+      }
+      if (child < index[node].end && index[child].ordinal != element) {
+        child = index[node].end;
+      }
+    } else {
+      return fail(ZX_ERR_INVALID_ARGS, "field path descends into neither a struct nor a table");
+    }
+    if (child >= index[node].end) {
+      return fail(ZX_ERR_NOT_FOUND, "field is absent");
+    }
+    node = child;
+  }
+  *out_node = node;
+  return ZX_OK;
+}
+
+zx_status_t fidl_transform_evolve(const fidl_type_t* src_type, const fidl_type_t* dst_type,
+                                  const fidl_evolve_options_t* options, const uint8_t* src_bytes,
+                                  uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                  uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  assert(src_type);
+  assert(dst_type);
+  assert(options);
+  assert(src_bytes);
+  assert(dst_bytes);
+  assert(out_dst_num_bytes);
+
+  *out_dst_num_bytes = 0;
+  BasicSrcDst<uint32_t> src_dst(src_bytes, src_num_bytes, dst_bytes, out_dst_num_bytes);
+  const zx_status_t status =
+      V1Evolver(&src_dst, out_error_msg, *options).TransformTopLevelStruct(src_type, dst_type);
+  if (status != ZX_OK) {
+    RecordFailedTransformation(FIDL_TRANSFORMATION_EVOLVE, src_type);
+  }
+  return status;
+}
+
+bool fidl_transform_last_failure(fidl_transform_failure_t* out_failure) {
+  if (!last_failure.recorded) {
+    return false;
+  }
+  *out_failure = last_failure.failure;
+  return true;
+}
+
+uint32_t fidl_transform_trace_snapshot(fidl_transform_trace_event_t* out_events,
+                                       uint32_t max_events) {
+  const uint32_t next_seq = trace_ring.next_seq;
+  uint32_t count = next_seq < FIDL_TRANSFORM_TRACE_CAPACITY ? next_seq
+                                                            : FIDL_TRANSFORM_TRACE_CAPACITY;
+  if (count > max_events) {
+    count = max_events;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const uint32_t seq = next_seq - count + i;
+    out_events[i] = trace_ring.events[seq & (FIDL_TRANSFORM_TRACE_CAPACITY - 1)];
+  }
+  return count;
+}
+
+void fidl_transform_trace_clear(void) { trace_ring.next_seq = 0; }
+
+size_t fidl_transform_trace_format(const fidl_transform_trace_event_t* event, char* buf,
+                                   size_t buf_size) {
+  static const char* const kKindNames[] = {
+      "?", "begin", "node", "copy", "pad", "write", "union_tag", "fail", "end",
+  };
+  static const char* const kTypeTagNames[] = {
+      "primitive", "enum",   "bits",   "struct", "struct_ptr", "union",  "union_ptr",
+      "array",     "string", "handle", "vector", "table",      "xunion",
+  };
+  const char* kind = event->kind < sizeof(kKindNames) / sizeof(kKindNames[0])
+                         ? kKindNames[event->kind]
+                         : kKindNames[0];
+  const char* type_tag = event->type_tag < sizeof(kTypeTagNames) / sizeof(kTypeTagNames[0])
+                             ? kTypeTagNames[event->type_tag]
+                             : "-";
+  int length = snprintf(buf, buf_size,
+                        "#%u %-9s %-10s src=%u/%u dst=%u/%u arg0=%u(0x%x) arg1=%u(0x%x)",
+                        event->seq, kind, type_tag, event->src_inline_offset,
+                        event->src_out_of_line_offset, event->dst_inline_offset,
+                        event->dst_out_of_line_offset, event->arg0, event->arg0, event->arg1,
+                        event->arg1);
+  return length < 0 ? 0 : static_cast<size_t>(length);
+}
+
 #pragma GCC diagnostic pop  // "-Wimplicit-fallthrough"
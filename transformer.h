@@ -33,6 +33,36 @@ typedef uint32_t fidl_transformation_t;
 
 #define FIDL_TRANSFORMATION_OLD_TO_V1 ((fidl_transformation_t)2u)
 
+// The compact v1 wire format is the v1 wire format, except that envelopes
+// whose contents are at most 4 bytes and hold neither handles nor out-of-line
+// objects (e.g. a `uint32` variant of a static-union) store their contents in
+// place of |num_bytes|. Such envelopes have |num_handles| set to zero and their
+// presence set to `FIDL_ENVELOPE_INLINED`, and have no out-of-line data.
+//
+// Envelopes of unknown xunion variants are never inlined; inlined envelopes of
+// unknown variants are expanded to 8 bytes of out-of-line data.
+//
+// Messages in the compact v1 wire format are described by v1 coding tables.
+#define FIDL_ENVELOPE_INLINED ((uintptr_t)1)
+
+#define FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT ((fidl_transformation_t)3u)
+#define FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD ((fidl_transformation_t)4u)
+#define FIDL_TRANSFORMATION_V1_TO_V1_COMPACT ((fidl_transformation_t)5u)
+#define FIDL_TRANSFORMATION_V1_COMPACT_TO_V1 ((fidl_transformation_t)6u)
+
+// Recorded in `fidl_transform_failure_t` for failures of
+// `fidl_transform_evolve`, whose source is in the v1 wire format. It is not a
+// transformation: `fidl_transform` rejects it as unsupported.
+#define FIDL_TRANSFORMATION_EVOLVE ((fidl_transformation_t)7u)
+
+// Wire formats of messages, for the functions which read messages in either
+// without transforming them (see `storage.h` and `view.h`). Messages in either
+// are described by the coding tables of that wire format.
+typedef uint32_t fidl_wire_format_t;
+
+#define FIDL_WIRE_FORMAT_OLD ((fidl_wire_format_t)1u)
+#define FIDL_WIRE_FORMAT_V1 ((fidl_wire_format_t)2u)
+
 // Transforms an encoded FIDL buffer from one wire format to another.
 //
 // Starting from the root of the encoded objects present in the |src_bytes|
@@ -52,6 +82,358 @@ zx_status_t fidl_transform(fidl_transformation_t transformation, const fidl_type
                            const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
                            uint32_t* out_dst_num_bytes, const char** out_error_msg);
 
+// Transforms large encoded FIDL buffers, such as persisted messages far larger
+// than `ZX_CHANNEL_MAX_MSG_BYTES` (e.g. memory-mapped files).
+//
+// Same as `fidl_transform`, except that offsets and sizes are 64-bit. Prefer
+// `fidl_transform` for channel-sized messages, which is faster. In both, counts
+// of vectors and tables are checked against the size of the source, so that
+// malformed messages fail instead of overflowing offsets. Envelopes (which
+// record their size in 32 bits) are still limited to 4 GiB of contents.
+//
+// Events recorded while tracing (see below) truncate offsets to 32 bits.
+zx_status_t fidl_transform_large(fidl_transformation_t transformation, const fidl_type_t* type,
+                                 const uint8_t* src_bytes, uint64_t src_num_bytes,
+                                 uint8_t* dst_bytes, uint64_t* out_dst_num_bytes,
+                                 const char** out_error_msg);
+
+// Checksums which `fidl_transform_with_options` can compute over the bytes it
+// writes.
+typedef uint32_t fidl_checksum_t;
+
+#define FIDL_CHECKSUM_NONE ((fidl_checksum_t)0u)
+
+// CRC32C (Castagnoli polynomial, as used by iSCSI and ext4), using the CRC32
+// instructions of the CPU where available.
+#define FIDL_CHECKSUM_CRC32C ((fidl_checksum_t)1u)
+
+// A node of a transformed message, recorded in the field index of
+// `fidl_transform_with_options`.
+//
+// Nodes are the top-level struct, and the objects which the transformation
+// walks: fields of structs which have a coding table, elements of arrays and
+// vectors which have a coding table, union and xunion variants, and fields of
+// tables. A struct pointer and the struct it points to are a single node, as
+// are a union pointer and its union. Nodes are numbered in the order in which
+// they are entered (depth-first), from 0 for the top-level struct, so that the
+// descendants of node |n| are nodes |n + 1| to |end - 1|.
+typedef struct {
+  // Source coding table of the node, or null for primitives without one.
+  const fidl_type_t* type;
+  // Node of the parent, or `FIDL_TRANSFORM_INDEX_NO_PARENT` for the top-level
+  // struct.
+  uint32_t parent;
+  // Node after the last descendant of the node (and therefore its next
+  // sibling, if any).
+  uint32_t end;
+  // Ordinal of fields of tables, 0 otherwise.
+  uint32_t ordinal;
+  // Offset and size of the node in the destination (with the padding after it,
+  // if any), and the offset of its first out-of-line object (e.g. the data of
+  // a vector, or the struct a struct pointer points to).
+  uint32_t dst_offset;
+  uint32_t dst_size;
+  uint32_t dst_out_of_line_offset;
+} fidl_transform_index_entry_t;
+
+#define FIDL_TRANSFORM_INDEX_NO_PARENT UINT32_MAX
+
+// A path to a field of a message: the indices of the fields of nested structs
+// (as in `fidl_view_field`, see `view.h`), from the top-level struct down,
+// optionally followed by the ordinal of a field of a table. Paths descend
+// through structs, including struct pointers; a path without elements selects
+// the whole message.
+typedef struct {
+  const uint32_t* elements;
+  uint32_t num_elements;
+} fidl_field_path_t;
+
+// A handle of a transformed message, as read from a channel along with it (see
+// `zx_handle_info_t` and `zx_channel_read_etc`).
+typedef struct {
+  uint32_t handle;
+  // Object type (`ZX_OBJ_TYPE_...`), checked against the `handle_subtype` of
+  // the coding table.
+  uint32_t type;
+  uint32_t rights;
+  uint32_t unused;
+} fidl_transform_handle_info_t;
+
+// The handles of a present envelope of a transformed message, recorded by
+// `fidl_transform_with_options`.
+typedef struct {
+  // Offset of the envelope in the v1 wire format side of the transformation
+  // (the destination of `FIDL_TRANSFORMATION_OLD_TO_V1`, the source of
+  // `FIDL_TRANSFORMATION_V1_TO_OLD`).
+  uint32_t v1_offset;
+  // Range of the handles of the envelope in the handle array.
+  uint32_t first_handle;
+  uint32_t num_handles;
+} fidl_transform_envelope_handles_t;
+
+// Options of `fidl_transform_with_options`. Zero-initialized options behave
+// as `fidl_transform`.
+typedef struct {
+  // Produces canonical bytes: two messages holding the same values transform
+  // to identical bytes, whatever the contents of their padding, of absent
+  // objects, or of the destination buffer beforehand. This allows hashing or
+  // comparing transformed messages directly.
+  //
+  // Padding (inline, between and after out-of-line objects) is zeroed rather
+  // than copied, present and absent markers are rewritten as
+  // `FIDL_ALLOC_PRESENT` / `FIDL_ALLOC_ABSENT` (`FIDL_HANDLE_...` for handles),
+  // and absent vectors, strings, tables, envelopes and xunions are zeroed.
+  // Contents of envelopes of unknown type are still copied as is. Has no effect
+  // on `FIDL_TRANSFORMATION_NONE`.
+  bool canonicalize;
+
+  // Checks that strings are valid UTF-8 (without surrogates, overlong
+  // sequences or code points above U+10FFFF) and within their maximum size,
+  // failing with `ZX_ERR_INVALID_ARGS` and an error message saying why
+  // otherwise. Strings are checked as they are copied, a block of bytes at a
+  // time: runs of ASCII on any CPU, and multibyte characters too where the CPU
+  // has AVX2 (elsewhere these are decoded one at a time).
+  bool validate_strings;
+
+  // Upon success, the checksum of the |out_dst_num_bytes| destination bytes
+  // is stored into |out_checksum| (unless `FIDL_CHECKSUM_NONE`). It is computed
+  // as soon as the destination is complete, while it is still in cache.
+  fidl_checksum_t checksum;
+  uint32_t* out_checksum;
+
+  // If |index| is set, records every node of the destination into it, in the
+  // same pass (see `fidl_transform_index_entry_t`), so that objects can later
+  // be found and patched in place without walking the message again (e.g.
+  // with `fidl_transform_index_lookup`). Fails with `ZX_ERR_BUFFER_TOO_SMALL`
+  // if the message has more than |index_capacity| nodes. Upon success, the
+  // number of nodes is stored into |out_index_count|.
+  //
+  // Only transformations between the old and v1 wire formats (compact or not)
+  // are supported. The contents of envelopes inlined in the compact v1 wire
+  // format are copied without being walked, and recorded as a single node.
+  fidl_transform_index_entry_t* index;
+  uint32_t index_capacity;
+  uint32_t* out_index_count;
+
+  // If |check_handles| is set, checks the message against its |num_handles|
+  // |handles| in the same pass, as decoding it would: present handles are
+  // matched with the handle array in order, and must be of the object type of
+  // their coding table (unless it is `ZX_OBJ_TYPE_NONE`), absent handles must
+  // be nullable, the |num_handles| of every envelope must match its contents,
+  // and every handle of the array must be matched. Fails with
+  // `ZX_ERR_INVALID_ARGS` and an error message saying why otherwise.
+  //
+  // If |envelope_handles| is also set, the handles of present envelopes are
+  // recorded into it in the order in which envelopes are entered (depth-first),
+  // so that a receiver can e.g. close the handles of unknown fields without
+  // walking the message again. Fails with `ZX_ERR_BUFFER_TOO_SMALL` if the
+  // message has more than |envelope_handles_capacity| present envelopes. Upon
+  // success, their number is stored into |out_envelope_handles_count|.
+  //
+  // Only transformations between the old and v1 wire formats (compact or not)
+  // are supported. Handles of envelopes of unknown type are matched, but their
+  // object types are not checked.
+  bool check_handles;
+  const fidl_transform_handle_info_t* handles;
+  uint32_t num_handles;
+  fidl_transform_envelope_handles_t* envelope_handles;
+  uint32_t envelope_handles_capacity;
+  uint32_t* out_envelope_handles_count;
+
+  // If set, called on the calling thread with |on_failure_context| when the
+  // transformation fails, once the failure and the last trace events have been
+  // recorded, so that they can be persisted (e.g. with
+  // `fidl_transform_last_failure` and `fidl_transform_trace_snapshot`) before
+  // further transformations overwrite them. Nothing is persisted otherwise.
+  void (*on_failure)(void* context);
+  void* on_failure_context;
+} fidl_transform_options_t;
+
+// Same as `fidl_transform`, configured by |options|.
+zx_status_t fidl_transform_with_options(fidl_transformation_t transformation,
+                                        const fidl_transform_options_t* options,
+                                        const fidl_type_t* type, const uint8_t* src_bytes,
+                                        uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                        uint32_t* out_dst_num_bytes, const char** out_error_msg);
+
+// Same as `fidl_transform_with_options`, without a destination: the message is
+// walked and checked exactly as it would be transformed (bounds, presence
+// markers, union tags and ordinals, envelope sizes, table envelopes, and
+// strings and handles if set in |options|), failing with the same status and
+// error message, but nothing is written. Rejecting malformed messages thus
+// only reads them, and the contents of vectors and strings are not touched
+// (unless strings are validated). Upon success, the size the destination would
+// have is stored into |out_dst_num_bytes|.
+//
+// The |checksum| option, which covers the destination, is not supported.
+zx_status_t fidl_transform_validate(fidl_transformation_t transformation,
+                                    const fidl_transform_options_t* options,
+                                    const fidl_type_t* type, const uint8_t* src_bytes,
+                                    uint32_t src_num_bytes, uint32_t* out_dst_num_bytes,
+                                    const char** out_error_msg);
+
+// Stores into |out_node| the node of the field index |index| (of |count|
+// entries, see `fidl_transform_options_t`) which holds the field selected by
+// |path|, in a number of steps which follows the number of fields before it
+// rather than the size of the message. Fails with `ZX_ERR_NOT_FOUND` if the
+// field is absent (i.e. behind an absent struct pointer, or an absent field of
+// a table), `ZX_ERR_OUT_OF_RANGE` if an index is past the last field of a
+// struct, and `ZX_ERR_INVALID_ARGS` if the path does not apply to the message.
+zx_status_t fidl_transform_index_lookup(const fidl_transform_index_entry_t* index, uint32_t count,
+                                        const fidl_field_path_t* path, uint32_t* out_node,
+                                        const char** out_error_msg);
+
+// Schema evolution.
+//
+// Options of `fidl_transform_evolve`. Zero-initialized options forward unknown
+// fields.
+typedef struct {
+  // Drops fields of tables whose ordinal the destination table does not have
+  // (e.g. fields added since, or reserved in, the destination version), rather
+  // than forwarding them as is. Dropping a field which holds handles fails, as
+  // the handles would leak.
+  bool drop_unknown_fields;
+} fidl_evolve_options_t;
+
+// Transforms an encoded FIDL buffer of top-level struct |src_type| into one of
+// |dst_type|, another version of the same struct (e.g. from two versions of a
+// library), in the v1 wire format, in a single pass and without allocating.
+//
+// Objects of both versions are matched by position, and fields of tables and
+// variants of xunions and static unions by ordinal:
+//
+// - Fields of tables that the destination does not have are forwarded or
+//   dropped (see `fidl_evolve_options_t`), and fields that the source does not
+//   have are absent, their default. The destination vector of envelopes ends
+//   at its last present field.
+// - Variants of xunions that the destination does not have are forwarded as
+//   unknown variants, unless the destination xunion is strict. Static unions
+//   must have the variant in both versions.
+// - Contents of envelopes that either version does not know are copied as is.
+//
+// Other objects must have the same layout in both versions (structs must have
+// the same size, and the same fields with a coding table at the same offsets),
+// and the same type tag and size, failing with `ZX_ERR_INVALID_ARGS` and an
+// error message saying why otherwise. The destination is never larger than
+// the source, so |dst_bytes| can be as large as |src_bytes|.
+//
+// Messages in the old wire format must be transformed to v1 first, and those
+// in the compact v1 wire format expanded to v1.
+zx_status_t fidl_transform_evolve(const fidl_type_t* src_type, const fidl_type_t* dst_type,
+                                  const fidl_evolve_options_t* options, const uint8_t* src_bytes,
+                                  uint32_t src_num_bytes, uint8_t* dst_bytes,
+                                  uint32_t* out_dst_num_bytes, const char** out_error_msg);
+
+// Failures.
+//
+// When the walk of a message by `fidl_transform` (or one of its variants)
+// fails, the calling thread records where: the source offset of the object
+// being transformed (e.g. the union whose tag is invalid), along with the
+// top-level type and the error message. Nothing is recorded while
+// transformations succeed. The field path of the object can then be
+// reconstructed from the source with `fidl_view_init_failure` and
+// `fidl_view_path` (see `view.h` and `path.h`).
+typedef struct {
+  // `FIDL_TRANSFORMATION_EVOLVE` for `fidl_transform_evolve`.
+  fidl_transformation_t transformation;
+  zx_status_t status;
+  // Top-level struct of the source.
+  const fidl_type_t* type;
+  const char* error_msg;
+  // Offset of the failing object in the source, or 0 if the transformation
+  // failed before walking the message.
+  uint64_t src_offset;
+} fidl_transform_failure_t;
+
+// Stores the last failure recorded on the calling thread into |out_failure|.
+// Returns false if no transformation failed on the calling thread.
+bool fidl_transform_last_failure(fidl_transform_failure_t* out_failure);
+
+// Tracing.
+//
+// Unless compiled with `FIDL_TRANSFORMER_TRACE` set to 0, every thread records
+// the last `FIDL_TRANSFORM_TRACE_CAPACITY` steps taken by `fidl_transform` into
+// a thread-local ring buffer of fixed-size binary events. Recording is a
+// handful of plain stores (no locks, atomics, clocks or allocations), so it is
+// cheap enough to leave enabled in canary builds, and does not perturb timing
+// enough to hide races.
+//
+// The ring buffer is never persisted by the library. After a failure, retrieve
+// the events with `fidl_transform_trace_snapshot` (e.g. from the `on_failure`
+// callback of `fidl_transform_options_t`) and print them with
+// `fidl_transform_trace_format`, or persist the raw events and print them later
+// with the `trace_decode` tool.
+#ifndef FIDL_TRANSFORMER_TRACE
+#define FIDL_TRANSFORMER_TRACE 1
+#endif
+
+// Number of events retained per thread. Must be a power of two.
+#define FIDL_TRANSFORM_TRACE_CAPACITY 256u
+
+typedef uint8_t fidl_transform_trace_kind_t;
+
+// A call to `fidl_transform` started. |arg0| is the transformation, and |arg1|
+// the number of source bytes.
+#define FIDL_TRANSFORM_TRACE_BEGIN ((fidl_transform_trace_kind_t)1u)
+
+// A node of the coding table graph was entered. |type_tag| is its
+// `fidl::FidlTypeTag`, or `FIDL_TRANSFORM_TRACE_NO_TYPE` for primitives without
+// a coding table, and |arg0| the size of the node in the destination.
+#define FIDL_TRANSFORM_TRACE_NODE ((fidl_transform_trace_kind_t)2u)
+
+// |arg0| bytes were copied from the source inline offset to the destination
+// inline offset.
+#define FIDL_TRANSFORM_TRACE_COPY ((fidl_transform_trace_kind_t)3u)
+
+// |arg0| bytes of padding were written at the destination inline offset (|arg1|
+// is 0), or at the destination out-of-line offset (|arg1| is 1).
+#define FIDL_TRANSFORM_TRACE_PAD ((fidl_transform_trace_kind_t)4u)
+
+// |arg0| bytes were written at the destination inline offset.
+#define FIDL_TRANSFORM_TRACE_WRITE ((fidl_transform_trace_kind_t)5u)
+
+// A union variant was mapped from source tag or ordinal |arg0| to destination
+// tag or ordinal |arg1|.
+#define FIDL_TRANSFORM_TRACE_UNION_TAG ((fidl_transform_trace_kind_t)6u)
+
+// The transformation failed with status |arg0| at the recorded position.
+#define FIDL_TRANSFORM_TRACE_FAIL ((fidl_transform_trace_kind_t)7u)
+
+// A call to `fidl_transform` ended with status |arg0|, having written |arg1|
+// destination bytes.
+#define FIDL_TRANSFORM_TRACE_END ((fidl_transform_trace_kind_t)8u)
+
+#define FIDL_TRANSFORM_TRACE_NO_TYPE ((uint8_t)0xffu)
+
+typedef struct {
+  fidl_transform_trace_kind_t kind;
+  uint8_t type_tag;
+  uint16_t reserved;
+  // Monotonically increasing per thread, used to order events and detect wrap.
+  uint32_t seq;
+  // The `Position` at which the event was recorded.
+  uint32_t src_inline_offset;
+  uint32_t src_out_of_line_offset;
+  uint32_t dst_inline_offset;
+  uint32_t dst_out_of_line_offset;
+  uint32_t arg0;
+  uint32_t arg1;
+} fidl_transform_trace_event_t;
+
+// Copies the most recent (up to |max_events|) events recorded on the calling
+// thread into |out_events|, oldest first, and returns how many were copied.
+uint32_t fidl_transform_trace_snapshot(fidl_transform_trace_event_t* out_events,
+                                       uint32_t max_events);
+
+// Discards all events recorded on the calling thread.
+void fidl_transform_trace_clear(void);
+
+// Formats |event| as a single human readable line (without a trailing newline)
+// into |buf|, truncating if needed, and returns the length of the untruncated
+// line.
+size_t fidl_transform_trace_format(const fidl_transform_trace_event_t* event, char* buf,
+                                   size_t buf_size);
+
 // __END_CDECLS
 
 #endif  // LIB_FIDL_TRANSFORMER_H_
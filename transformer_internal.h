@@ -0,0 +1,384 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_TRANSFORMER_INTERNAL_H_
+#define LIB_FIDL_TRANSFORMER_INTERNAL_H_
+
+// Helpers shared by the transformer and the other walkers over old and v1
+// coding tables. Not part of the public API.
+
+#include <cassert>
+
+#include "fidl.h"
+
+// See transformer.cc on why implicit fallthrough is allowed here.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+
+namespace fidl {
+namespace internal {
+
+enum struct WireFormat {
+  kOld,
+  kV1,
+};
+
+inline uint32_t PrimitiveSize(FidlCodedPrimitive primitive) {
+  switch (primitive) {
+    case FidlCodedPrimitive::kBool:
+    case FidlCodedPrimitive::kInt8:
+    case FidlCodedPrimitive::kUint8:
+      return 1;
+    case FidlCodedPrimitive::kInt16:
+    case FidlCodedPrimitive::kUint16:
+      return 2;
+    case FidlCodedPrimitive::kInt32:
+    case FidlCodedPrimitive::kUint32:
+    case FidlCodedPrimitive::kFloat32:
+      return 4;
+    case FidlCodedPrimitive::kInt64:
+    case FidlCodedPrimitive::kUint64:
+    case FidlCodedPrimitive::kFloat64:
+      return 8;
+  }
+
+  assert(false && "unexpected non-exhaustive switch on fidl::FidlCodedPrimitive");
+  return 0;
+}
+
+// Returns the inline size of |type| in |wire_format|, without alignment (e.g. 4
+// for a handle, 3 for a struct of 3 bytes).
+inline uint32_t InlineSize(const fidl_type_t* type, WireFormat wire_format) {
+  switch (type->type_tag) {
+    case kFidlTypePrimitive:
+      return PrimitiveSize(type->coded_primitive);
+    case kFidlTypeEnum:
+      return PrimitiveSize(type->coded_enum.underlying_type);
+    case kFidlTypeBits:
+      return PrimitiveSize(type->coded_bits.underlying_type);
+    case kFidlTypeStruct:
+      return type->coded_struct.size;
+    case kFidlTypeArray:
+      return type->coded_array.array_size;
+    case kFidlTypeHandle:
+      return sizeof(uint32_t);
+    case kFidlTypeStructPointer:
+      return sizeof(uint64_t);
+    case kFidlTypeUnion:
+    case kFidlTypeUnionPointer:
+      switch (wire_format) {
+        case WireFormat::kOld:
+          return type->type_tag == kFidlTypeUnion ? type->coded_union.size : sizeof(uint64_t);
+        case WireFormat::kV1:
+          return sizeof(fidl_xunion_t);
+      }
+    case kFidlTypeString:
+    case kFidlTypeVector:
+    case kFidlTypeTable:
+      return sizeof(fidl_vector_t);
+    case kFidlTypeXUnion:
+      return sizeof(fidl_xunion_t);
+  }
+
+  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+  return 0;
+}
+
+// Largest envelope contents stored in place of |num_bytes| by the compact v1
+// wire format (see `FIDL_ENVELOPE_INLINED`).
+constexpr uint32_t kCompactEnvelopeMaxInlineSize = 4;
+
+// Returns the size of an envelope's contents of type |type| if they are inlined
+// in the compact v1 wire format, or 0 if they stay out-of-line. |size| is the
+// size of contents without a coding table (e.g. primitive union variants).
+inline uint32_t CompactInlineSize(const fidl_type_t* type, uint32_t size) {
+  if (!type) {
+    return size <= kCompactEnvelopeMaxInlineSize ? size : 0;
+  }
+  switch (type->type_tag) {
+    case kFidlTypePrimitive:
+      size = PrimitiveSize(type->coded_primitive);
+      break;
+    case kFidlTypeEnum:
+      size = PrimitiveSize(type->coded_enum.underlying_type);
+      break;
+    case kFidlTypeBits:
+      size = PrimitiveSize(type->coded_bits.underlying_type);
+      break;
+    case kFidlTypeStruct:
+      // Structs whose coding table only holds padding have no handles nor
+      // out-of-line objects.
+      for (uint32_t i = 0; i < type->coded_struct.field_count; i++) {
+        if (type->coded_struct.fields[i].type) {
+          return 0;
+        }
+      }
+      size = type->coded_struct.size;
+      break;
+    case kFidlTypeArray: {
+      const auto& coded_array = type->coded_array;
+      if (coded_array.element &&
+          CompactInlineSize(coded_array.element, coded_array.element_size) == 0) {
+        return 0;
+      }
+      size = coded_array.array_size;
+      break;
+    }
+    default:
+      return 0;
+  }
+  return size <= kCompactEnvelopeMaxInlineSize ? size : 0;
+}
+
+// TODO(apang): I think we can get rid of the wire_format parameter by just doing union.alt.
+// TODO(apang): This may not return the aligned size, since e.g. "type->coded_struct.size" below may
+// be unaligned
+inline uint32_t AlignedInlineSize(const fidl_type_t* type, WireFormat wire_format) {
+  if (!type) {
+    // For integral types (i.e. primitive, enum, bits).
+    // TODO(apang): This returns the aligned size... but structs etc below don't return the aligned
+    // size :/
+    return 8;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypePrimitive:
+    case fidl::kFidlTypeEnum:
+    case fidl::kFidlTypeBits:
+      return 8;
+    case fidl::kFidlTypeStructPointer:
+      return 8;
+    case fidl::kFidlTypeUnionPointer:
+      switch (wire_format) {
+        case WireFormat::kOld:
+          return 8;
+        case WireFormat::kV1:
+          return 24;  // xunion
+      }
+    case fidl::kFidlTypeVector:
+    case fidl::kFidlTypeString:
+      return 16;
+    case fidl::kFidlTypeStruct:
+      return type->coded_struct.size;
+    case fidl::kFidlTypeUnion:
+      switch (wire_format) {
+        case WireFormat::kOld:
+          return type->coded_union.size;
+        case WireFormat::kV1:
+          return 24;  // xunion
+      }
+    case fidl::kFidlTypeArray:
+      return type->coded_array.array_size;
+    case fidl::kFidlTypeXUnion:
+      return 24;
+    case fidl::kFidlTypeHandle:
+      return 8;
+    case fidl::kFidlTypeTable:
+      return 16;
+  }
+
+  // This is needed to suppress a GCC warning "control reaches end of non-void function", since GCC
+  // treats switch() on enums as non-exhaustive without a default case.
+  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+  return 0;
+}
+
+inline uint32_t AlignedAltInlineSize(const fidl_type_t* type) {
+  if (!type) {
+    // For integral types (i.e. primitive, enum, bits).
+    return 8;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypePrimitive:
+    case fidl::kFidlTypeEnum:
+    case fidl::kFidlTypeBits:
+      return 8;
+    case fidl::kFidlTypeStructPointer:
+    case fidl::kFidlTypeUnionPointer:
+      return 8;
+    case fidl::kFidlTypeVector:
+    case fidl::kFidlTypeString:
+      return 16;
+    case fidl::kFidlTypeStruct:
+      return FIDL_ALIGN(type->coded_struct.alt_type->size);
+    case fidl::kFidlTypeUnion:
+      return FIDL_ALIGN(type->coded_union.alt_type->size);
+    case fidl::kFidlTypeArray:
+      return FIDL_ALIGN(type->coded_array.alt_type->array_size);
+    case fidl::kFidlTypeXUnion:
+      return 24;
+    case fidl::kFidlTypeHandle:
+      return 8;
+    case fidl::kFidlTypeTable:
+      return 16;
+  }
+
+  assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+  return 0;
+}
+
+// Size of the data of variant |index| of a static union. Variants without a
+// coding table are primitives (or arrays thereof), whose size is the same in
+// both wire formats, and is recorded in the old union.
+inline uint32_t VariantSize(const FidlCodedUnion& coded_union, uint32_t index,
+                            WireFormat wire_format) {
+  const auto& field = coded_union.fields[index];
+  if (field.type) {
+    return InlineSize(field.type, wire_format);
+  }
+  const auto& old_union = wire_format == WireFormat::kOld ? coded_union : *coded_union.alt_type;
+  return old_union.size - old_union.data_offset - old_union.fields[index].padding;
+}
+
+// Looks up the field of the static union for a v1 xunion ordinal.
+inline bool VariantIndex(const FidlCodedUnion& coded_union, uint32_t ordinal, uint32_t* out_index) {
+  for (uint32_t i = 0; i < coded_union.field_count; i++) {
+    if (coded_union.fields[i].xunion_ordinal == ordinal) {
+      *out_index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline const FidlXUnionField* XUnionField(const FidlCodedXUnion& coded_xunion,
+                                          uint32_t ordinal) {
+  for (uint32_t i = 0; i < coded_xunion.field_count; i++) {
+    if (coded_xunion.fields[i].ordinal == ordinal) {
+      return &coded_xunion.fields[i];
+    }
+  }
+  return nullptr;
+}
+
+// Fields of tables are sorted by ordinal; |*cursor| is advanced past fields
+// with a smaller ordinal.
+inline const fidl_type_t* TableFieldType(const FidlCodedTable& coded_table, uint32_t ordinal,
+                                         uint32_t* cursor) {
+  while (*cursor < coded_table.field_count && coded_table.fields[*cursor].ordinal < ordinal) {
+    (*cursor)++;
+  }
+  if (*cursor < coded_table.field_count && coded_table.fields[*cursor].ordinal == ordinal) {
+    return coded_table.fields[*cursor].type;
+  }
+  return nullptr;
+}
+
+// Iterates over the non-empty runs of primitive members of |coded_struct|
+// (everything but padding and coded fields), in order. The runs of a struct
+// hold the same bytes in both wire formats (see `StorageEncoder::EncodeStruct`
+// in storage.cc), although they may be split differently.
+class MemberRuns {
+ public:
+  MemberRuns(const FidlCodedStruct& coded_struct, WireFormat wire_format)
+      : coded_struct_(coded_struct), wire_format_(wire_format) {}
+
+  // Stores the next run into |*out_start| and |*out_end|, or returns false
+  // past the last one.
+  bool Next(uint32_t* out_start, uint32_t* out_end) {
+    while (field_ < coded_struct_.field_count) {
+      const auto& field = coded_struct_.fields[field_++];
+      const uint32_t start = cursor_;
+      const uint32_t end = field.type ? field.offset : field.padding_offset;
+      cursor_ = field.type ? field.offset + InlineSize(field.type, wire_format_) + field.padding
+                           : field.padding_offset + field.padding;
+      if (start < end) {
+        *out_start = start;
+        *out_end = end;
+        return true;
+      }
+    }
+    if (cursor_ < coded_struct_.size) {
+      *out_start = cursor_;
+      *out_end = cursor_ = coded_struct_.size;
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  const FidlCodedStruct& coded_struct_;
+  const WireFormat wire_format_;
+  uint32_t field_ = 0;
+  uint32_t cursor_ = 0;
+};
+
+// Calls |run(start, end)| for each run of primitive members of |coded_struct|
+// (see `MemberRuns`), in order, until it returns true.
+template <typename Run>
+void ForEachMemberRun(const FidlCodedStruct& coded_struct, WireFormat wire_format, Run run) {
+  MemberRuns runs(coded_struct, wire_format);
+  uint32_t start, end;
+  while (runs.Next(&start, &end)) {
+    if (run(start, end)) {
+      return;
+    }
+  }
+}
+
+// Maps the old wire format |offset| of |size| bytes of primitive members of
+// |coded_struct| (in |wire_format|) to their offset in the struct, in
+// |wire_format|. Returns an error message if the bytes are not within primitive
+// members, and null otherwise.
+inline const char* MemberOffset(const FidlCodedStruct& coded_struct, WireFormat wire_format,
+                                uint32_t offset, uint32_t size, uint32_t* out_offset) {
+  const auto* old_struct = wire_format == WireFormat::kOld ? &coded_struct : coded_struct.alt_type;
+  if (!old_struct) {
+    return "struct has no old wire format coding table";
+  }
+  const uint64_t end = static_cast<uint64_t>(offset) + size;
+  // Position of the bytes among all primitive members of the struct.
+  uint32_t position = 0, runs_size = 0;
+  bool found = false;
+  ForEachMemberRun(*old_struct, WireFormat::kOld, [&](uint32_t start, uint32_t run_end) {
+    if (start <= offset && end <= run_end) {
+      position = runs_size + (offset - start);
+      found = true;
+    }
+    runs_size += run_end - start;
+    return found;
+  });
+  if (!found) {
+    return "read is not within primitive struct members";
+  }
+  if (wire_format == WireFormat::kOld) {
+    *out_offset = offset;
+    return nullptr;
+  }
+  found = false;
+  runs_size = 0;
+  ForEachMemberRun(coded_struct, WireFormat::kV1, [&](uint32_t start, uint32_t run_end) {
+    if (runs_size <= position && position + size <= runs_size + (run_end - start)) {
+      *out_offset = start + (position - runs_size);
+      found = true;
+    }
+    runs_size += run_end - start;
+    return found;
+  });
+  if (!found) {
+    return "read spans primitive struct members split in v1";
+  }
+  return nullptr;
+}
+
+inline void VectorShape(const fidl_type_t* type, const fidl_type_t** out_element,
+                        uint32_t* out_element_size, bool* out_nullable, uint32_t* out_max_count) {
+  if (type->type_tag == kFidlTypeString) {
+    *out_element = nullptr;
+    *out_element_size = 1;
+    *out_nullable = type->coded_string.nullable;
+    *out_max_count = type->coded_string.max_size;
+    return;
+  }
+  *out_element = type->coded_vector.element;
+  *out_element_size = type->coded_vector.element_size;
+  *out_nullable = type->coded_vector.nullable;
+  *out_max_count = type->coded_vector.max_count;
+}
+
+}  // namespace internal
+}  // namespace fidl
+
+#pragma GCC diagnostic pop  // "-Wimplicit-fallthrough"
+
+#endif  // LIB_FIDL_TRANSFORMER_INTERNAL_H_
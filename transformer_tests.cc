@@ -2,14 +2,39 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <lib/fidl/columns.h>
+#include <lib/fidl/detect.h>
+#include <lib/fidl/explain.h>
+#include <lib/fidl/filter.h>
+#include <lib/fidl/ir.h>
+#include <lib/fidl/json.h>
+#include <lib/fidl/path.h>
+#include <lib/fidl/projection.h>
+#include <lib/fidl/storage.h>
 #include <lib/fidl/transformer.h>
-
+#include <lib/fidl/view.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
 
 #include <unittest/unittest.h>
 
-#include "generated/transformer_tables.test.h"
+#include "capture.h"
+#include "engine.h"
+#include "message_generator.h"
+#include "migration.h"
+#include "shadow.h"
+#include "tables_catalog.h"
 
 namespace {
 
@@ -60,6 +85,28 @@ uint8_t sandwich1_case1_old[] = {
     0x05, 0x06, 0x07, 0x08,  // Sandwich1.after
 };
 
+uint8_t sandwich1_case1_storage[] = {
+    0x01, 0x02, 0x03, 0x04,  // Sandwich1.before
+    0x02,                    // UnionSize8Aligned4 variant index
+    0x09, 0x0a, 0x0b, 0x0c,  // UnionSize8Aligned4.data
+    0x05, 0x06, 0x07, 0x08,  // Sandwich1.after
+};
+
+uint8_t sandwich1_case1_v1_compact[] = {
+    0x01, 0x02, 0x03, 0x04,  // Sandwich1.before
+    0x00, 0x00, 0x00, 0x00,  // Sandwich1.before (padding)
+
+    0xdb, 0xf0, 0xc2, 0x7f,  // UnionSize8Aligned4.tag, i.e. Sandwich1.the_union
+    0x00, 0x00, 0x00, 0x00,  // UnionSize8Aligned4.padding
+    0x09, 0x0a, 0x0b, 0x0c,  // UnionSize8Aligned4.env (inlined data)
+    0x00, 0x00, 0x00, 0x00,  // UnionSize8Aligned4.env.num_handle
+    0x01, 0x00, 0x00, 0x00,  // UnionSize8Aligned4.env.presence (inlined)
+    0x00, 0x00, 0x00, 0x00,  // UnionSize8Aligned4.presence [cont.]
+
+    0x05, 0x06, 0x07, 0x08,  // Sandwich1.after
+    0x00, 0x00, 0x00, 0x00,  // Sandwich1.after (padding)
+};
+
 uint8_t sandwich1_with_opt_union_present_v1[] = {
     0x01, 0x02, 0x03, 0x04,  // Sandwich1WithOptUnion.before
     0x00, 0x00, 0x00, 0x00,  // Sandwich1WithOptUnion.before (padding)
@@ -896,6 +943,29 @@ uint8_t table_structwithuint32sandwich_v1_and_old[] = {
     0x00, 0x00, 0x00, 0x00,  // i2 padding
 };
 
+uint8_t table_structwithuint32sandwich_v1_compact[] = {
+    0x04, 0x00, 0x00, 0x00,  // Table_StructWithUint32Sandwich.vector<envelope>.size
+    0x00, 0x00, 0x00, 0x00,  // [cont.]
+    0xFF, 0xFF, 0xFF, 0xFF,  // Table_StructWithUint32Sandwich.vector<envelope>.presence
+    0xFF, 0xFF, 0xFF, 0xFF,  // [cont.]
+    0x01, 0x02, 0x03, 0x04,  // vector<envelope>[0] (inlined i)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[0].num_handles
+    0x01, 0x00, 0x00, 0x00,  // vector<envelope>[0].presence (inlined)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[0].presence [cont.]
+    0x09, 0x0A, 0x0B, 0x00,  // vector<envelope>[1] (inlined StructSize3Alignment1)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[1].num_handles
+    0x01, 0x00, 0x00, 0x00,  // vector<envelope>[1].presence (inlined)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[1].presence [cont.]
+    0x19, 0x1A, 0x1B, 0x00,  // vector<envelope>[2] (inlined StructSize3Alignment1)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[2].num_handles
+    0x01, 0x00, 0x00, 0x00,  // vector<envelope>[2].presence (inlined)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[2].presence [cont.]
+    0x0A, 0x0B, 0x0C, 0x0D,  // vector<envelope>[3] (inlined i2)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[3].num_handles
+    0x01, 0x00, 0x00, 0x00,  // vector<envelope>[3].presence (inlined)
+    0x00, 0x00, 0x00, 0x00,  // vector<envelope>[3].presence [cont.]
+};
+
 uint8_t table_unionwithvector_reservedsandwich_v1[] = {
     0x02, 0x00, 0x00, 0x00,  // Table_UnionWithVector_ReservedSandwich.vector<envelope>.size
     0x00, 0x00, 0x00, 0x00,  // [cont.]
@@ -1183,6 +1253,16 @@ uint8_t arraystruct_old[] = {
     0x00, 0x00, 0x00, 0x00,  // optional_unions[2].s data padding
 };
 
+void print_trace(uint32_t max_events) {
+  fidl_transform_trace_event_t events[FIDL_TRANSFORM_TRACE_CAPACITY];
+  uint32_t count = fidl_transform_trace_snapshot(events, max_events);
+  char line[160];
+  for (uint32_t i = 0; i < count; i++) {
+    fidl_transform_trace_format(&events[i], line, sizeof(line));
+    printf("  %s\n", line);
+  }
+}
+
 bool run_fidl_transform(const fidl_type_t* v1_type, const fidl_type_t* old_type,
                         const uint8_t* v1_bytes, uint32_t v1_num_bytes, const uint8_t* old_bytes,
                         uint32_t old_num_bytes) {
@@ -1202,6 +1282,7 @@ bool run_fidl_transform(const fidl_type_t* v1_type, const fidl_type_t* old_type,
                        actual_old_bytes, &actual_old_num_bytes, &error);
     if (error) {
       printf("ERROR: %s\n", error);
+      print_trace(16);
     }
 
     ASSERT_EQ(status, ZX_OK);
@@ -1219,6 +1300,7 @@ bool run_fidl_transform(const fidl_type_t* v1_type, const fidl_type_t* old_type,
                        actual_v1_bytes, &actual_v1_num_bytes, &error);
     if (error) {
       printf("ERROR: %s\n", error);
+      print_trace(16);
     }
 
     ASSERT_EQ(status, ZX_OK);
@@ -1580,8 +1662,3565 @@ bool arraystruct() {
   END_TEST;
 }
 
+bool trace_records_failure() {
+  BEGIN_TEST;
+
+  uint8_t invalid_tag_old[sizeof(sandwich1_case1_old)];
+  memcpy(invalid_tag_old, sandwich1_case1_old, sizeof(invalid_tag_old));
+  invalid_tag_old[4] = 0x07;  // UnionSize8Aligned4.tag, out of range
+
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+  fidl_transform_trace_clear();
+  zx_status_t status =
+      fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich1Table, invalid_tag_old,
+                     sizeof(invalid_tag_old), dst_bytes, &dst_num_bytes, &error);
+  ASSERT_EQ(status, ZX_ERR_BAD_STATE);
+
+  fidl_transform_trace_event_t events[FIDL_TRANSFORM_TRACE_CAPACITY];
+  uint32_t count = fidl_transform_trace_snapshot(events, FIDL_TRANSFORM_TRACE_CAPACITY);
+  ASSERT_TRUE(count >= 3);
+  ASSERT_EQ(events[0].kind, FIDL_TRANSFORM_TRACE_BEGIN);
+  ASSERT_EQ(events[0].arg0, FIDL_TRANSFORMATION_OLD_TO_V1);
+
+  const fidl_transform_trace_event_t& fail = events[count - 2];
+  ASSERT_EQ(fail.kind, FIDL_TRANSFORM_TRACE_FAIL);
+  ASSERT_EQ(static_cast<zx_status_t>(fail.arg0), ZX_ERR_BAD_STATE);
+  ASSERT_EQ(fail.src_inline_offset, 4u);
+  ASSERT_EQ(fail.dst_inline_offset, 8u);
+
+  const fidl_transform_trace_event_t& end = events[count - 1];
+  ASSERT_EQ(end.kind, FIDL_TRANSFORM_TRACE_END);
+  ASSERT_EQ(end.seq, fail.seq + 1);
+
+  char line[160];
+  ASSERT_TRUE(fidl_transform_trace_format(&fail, line, sizeof(line)) > 0);
+  ASSERT_TRUE(strstr(line, "fail") != nullptr);
+
+  END_TEST;
+}
+
+struct PersistedTrace {
+  int calls;
+  fidl_transform_failure_t failure;
+  fidl_transform_trace_event_t events[FIDL_TRANSFORM_TRACE_CAPACITY];
+  uint32_t count;
+};
+
+void persist_trace(void* context) {
+  auto* persisted = static_cast<PersistedTrace*>(context);
+  persisted->calls++;
+  fidl_transform_last_failure(&persisted->failure);
+  persisted->count =
+      fidl_transform_trace_snapshot(persisted->events, FIDL_TRANSFORM_TRACE_CAPACITY);
+}
+
+bool trace_persisted_on_failure() {
+  BEGIN_TEST;
+
+  uint8_t invalid_tag_old[sizeof(sandwich1_case1_old)];
+  memcpy(invalid_tag_old, sandwich1_case1_old, sizeof(invalid_tag_old));
+  invalid_tag_old[4] = 0x07;  // UnionSize8Aligned4.tag, out of range
+
+  PersistedTrace persisted = {};
+  fidl_transform_options_t options = {};
+  options.on_failure = persist_trace;
+  options.on_failure_context = &persisted;
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                        &example_Sandwich1Table, sandwich1_case1_old,
+                                        sizeof(sandwich1_case1_old), dst_bytes, &dst_num_bytes,
+                                        nullptr),
+            ZX_OK);
+  ASSERT_EQ(persisted.calls, 0);
+
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                        &example_Sandwich1Table, invalid_tag_old,
+                                        sizeof(invalid_tag_old), dst_bytes, &dst_num_bytes,
+                                        nullptr),
+            ZX_ERR_BAD_STATE);
+  ASSERT_EQ(persisted.calls, 1);
+  ASSERT_EQ(persisted.failure.transformation, FIDL_TRANSFORMATION_OLD_TO_V1);
+  ASSERT_EQ(persisted.failure.src_offset, 4u);
+  ASSERT_TRUE(persisted.count >= 3);
+  ASSERT_EQ(persisted.events[persisted.count - 2].kind, FIDL_TRANSFORM_TRACE_FAIL);
+  ASSERT_EQ(persisted.events[persisted.count - 1].kind, FIDL_TRANSFORM_TRACE_END);
+
+  // Also when validating.
+  uint32_t size;
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                    &example_Sandwich1Table, invalid_tag_old,
+                                    sizeof(invalid_tag_old), &size, nullptr),
+            ZX_ERR_BAD_STATE);
+  ASSERT_EQ(persisted.calls, 2);
+
+  END_TEST;
+}
+
+bool explain_sandwich1() {
+  BEGIN_TEST;
+
+  fidl_transform_cost_t cost;
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich1Table, nullptr,
+                                   &cost, nullptr),
+            ZX_OK);
+  ASSERT_EQ(cost.src_inline_size, 16u);
+  ASSERT_EQ(cost.dst_inline_size, 40u);
+  ASSERT_EQ(cost.src_size, sizeof(sandwich1_case1_old));
+  ASSERT_EQ(cost.dst_size, sizeof(sandwich1_case1_v1));
+  ASSERT_EQ(cost.num_unions, 1u);
+  ASSERT_EQ(cost.num_envelopes, 1u);
+  ASSERT_EQ(cost.bulk_bytes + cost.moved_bytes, cost.src_size);
+  ASSERT_TRUE(!cost.identity_eligible);
+  ASSERT_TRUE(cost.estimated_cycles > 0);
+
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich1Table,
+                                   nullptr, &cost, nullptr),
+            ZX_OK);
+  ASSERT_EQ(cost.src_size, sizeof(sandwich1_case1_v1));
+  ASSERT_EQ(cost.dst_size, sizeof(sandwich1_case1_old));
+
+  END_TEST;
+}
+
+bool explain_identity() {
+  BEGIN_TEST;
+
+  fidl_transform_cost_t cost;
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_OLD_TO_V1,
+                                   &example_Size5Alignment1VectorTable, nullptr, &cost, nullptr),
+            ZX_OK);
+  ASSERT_TRUE(cost.identity_eligible);
+  ASSERT_EQ(cost.num_unions, 0u);
+  ASSERT_EQ(cost.src_size, cost.dst_size);
+  ASSERT_EQ(cost.bulk_bytes, cost.src_size);
+  ASSERT_EQ(cost.moved_bytes, 0u);
+
+  END_TEST;
+}
+
+bool explain_compact() {
+  BEGIN_TEST;
+
+  fidl_transform_cost_t cost;
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, &example_Sandwich1Table,
+                                   nullptr, &cost, nullptr),
+            ZX_OK);
+  ASSERT_EQ(cost.src_size, sizeof(sandwich1_case1_old));
+  ASSERT_EQ(cost.dst_size, sizeof(sandwich1_case1_v1_compact));
+  ASSERT_EQ(cost.num_unions, 1u);
+  ASSERT_TRUE(!cost.identity_eligible);
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD,
+                                   &v1_example_Sandwich1Table, nullptr, &cost, nullptr),
+            ZX_OK);
+  ASSERT_EQ(cost.src_size, sizeof(sandwich1_case1_v1_compact));
+  ASSERT_EQ(cost.dst_size, sizeof(sandwich1_case1_old));
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT,
+                                   &v1_example_Sandwich1Table, nullptr, &cost, nullptr),
+            ZX_OK);
+  ASSERT_EQ(cost.src_size, sizeof(sandwich1_case1_v1));
+  ASSERT_EQ(cost.dst_size, sizeof(sandwich1_case1_v1_compact));
+  ASSERT_EQ(cost.num_unions, 0u);
+  ASSERT_EQ(cost.num_envelopes, 1u);
+  ASSERT_EQ(cost.bulk_bytes + cost.moved_bytes, cost.src_size);
+  ASSERT_TRUE(!cost.identity_eligible);
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_V1_COMPACT_TO_V1,
+                                   &v1_example_Sandwich1Table, nullptr, &cost, nullptr),
+            ZX_OK);
+  ASSERT_EQ(cost.src_size, sizeof(sandwich1_case1_v1_compact));
+  ASSERT_EQ(cost.dst_size, sizeof(sandwich1_case1_v1));
+
+  // All the fields of the table are inlined.
+  fidl::FidlStructField field(&example_Table_StructWithUint32SandwichTable, 0u, 0u, &field);
+  fidl::FidlCodedStruct coded_struct(&field, 1, 16, "Table_StructWithUint32Sandwich",
+                                     &coded_struct);
+  fidl_type coded_struct_type(coded_struct);
+  for (auto transformation :
+       {FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, FIDL_TRANSFORMATION_V1_TO_V1_COMPACT}) {
+    ASSERT_EQ(fidl_transform_explain(transformation, &coded_struct_type, nullptr, &cost, nullptr),
+              ZX_OK);
+    ASSERT_EQ(cost.src_size, sizeof(table_structwithuint32sandwich_v1_and_old));
+    ASSERT_EQ(cost.dst_size, sizeof(table_structwithuint32sandwich_v1_compact));
+    ASSERT_EQ(cost.num_envelopes, 4u);
+  }
+  for (auto transformation :
+       {FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, FIDL_TRANSFORMATION_V1_COMPACT_TO_V1}) {
+    ASSERT_EQ(fidl_transform_explain(transformation, &coded_struct_type, nullptr, &cost, nullptr),
+              ZX_OK);
+    ASSERT_EQ(cost.src_size, sizeof(table_structwithuint32sandwich_v1_compact));
+    ASSERT_EQ(cost.dst_size, sizeof(table_structwithuint32sandwich_v1_and_old));
+  }
+
+  // Without envelopes to inline, the compact v1 wire format is v1.
+  ASSERT_EQ(fidl_transform_explain(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT,
+                                   &v1_example_Size5Alignment1VectorTable, nullptr, &cost,
+                                   nullptr),
+            ZX_OK);
+  ASSERT_TRUE(cost.identity_eligible);
+  ASSERT_EQ(cost.src_size, cost.dst_size);
+  ASSERT_EQ(cost.moved_bytes, 0u);
+
+  END_TEST;
+}
+
+bool cost_model_fit() {
+  BEGIN_TEST;
+
+  const double counts[][3] = {{3, 10, 64}, {12, 40, 96}, {40, 90, 4096}, {7, 7, 7}, {1, 30, 12}};
+  fidl_transform_cost_sample_t samples[5];
+  for (uint32_t i = 0; i < 5; i++) {
+    samples[i] = {counts[i][0], counts[i][1], counts[i][2],
+                  20 * counts[i][0] + 4 * counts[i][1] + 0.5 * counts[i][2]};
+  }
+  fidl_transform_cost_model_t model;
+  ASSERT_EQ(fidl_transform_cost_model_fit(samples, 5, &model, nullptr), ZX_OK);
+  ASSERT_TRUE(model.cycles_per_node > 19.999 && model.cycles_per_node < 20.001);
+  ASSERT_TRUE(model.cycles_per_op > 3.999 && model.cycles_per_op < 4.001);
+  ASSERT_TRUE(model.cycles_per_byte > 0.4999 && model.cycles_per_byte < 0.5001);
+
+  // Costs which would fit best as negative are zero instead.
+  for (uint32_t i = 0; i < 5; i++) {
+    samples[i].cycles = 20 * counts[i][0] + 4 * counts[i][1] - 0.01 * counts[i][2];
+  }
+  ASSERT_EQ(fidl_transform_cost_model_fit(samples, 5, &model, nullptr), ZX_OK);
+  ASSERT_TRUE(model.cycles_per_node >= 0);
+  ASSERT_TRUE(model.cycles_per_op >= 0);
+  ASSERT_EQ(model.cycles_per_byte, 0.0);
+
+  const char* error = nullptr;
+  ASSERT_EQ(fidl_transform_cost_model_fit(samples, 2, &model, &error), ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "too few samples to fit a cost model"), 0);
+
+  END_TEST;
+}
+
+bool generated_messages_round_trip() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t round_trip_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(42, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 50; i++) {
+      uint32_t old_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+
+      uint32_t v1_num_bytes, round_trip_num_bytes;
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, v1_bytes,
+                               v1_num_bytes, round_trip_bytes, &round_trip_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(
+          cmp_payload(round_trip_bytes, round_trip_num_bytes, old_bytes, old_num_bytes));
+    }
+  }
+
+  END_TEST;
+}
+
+bool run_transform(fidl_transformation_t transformation, const fidl_type_t* type,
+                   const uint8_t* src_bytes, uint32_t src_num_bytes, const uint8_t* expected_bytes,
+                   uint32_t expected_num_bytes) {
+  BEGIN_HELPER;
+
+  uint8_t actual_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t actual_num_bytes;
+  memset(actual_bytes, 0xcc /* poison */, ZX_CHANNEL_MAX_MSG_BYTES);
+
+  const char* error = nullptr;
+  zx_status_t status = fidl_transform(transformation, type, src_bytes, src_num_bytes,
+                                      actual_bytes, &actual_num_bytes, &error);
+  if (error) {
+    printf("ERROR: %s\n", error);
+    print_trace(16);
+  }
+
+  ASSERT_EQ(status, ZX_OK);
+  ASSERT_TRUE(cmp_payload(actual_bytes, actual_num_bytes, expected_bytes, expected_num_bytes));
+
+  END_HELPER;
+}
+
+bool sandwich1_compact() {
+  BEGIN_TEST;
+
+  ASSERT_TRUE(run_transform(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, &example_Sandwich1Table,
+                            sandwich1_case1_old, sizeof(sandwich1_case1_old),
+                            sandwich1_case1_v1_compact, sizeof(sandwich1_case1_v1_compact)));
+  ASSERT_TRUE(run_transform(FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, &v1_example_Sandwich1Table,
+                            sandwich1_case1_v1_compact, sizeof(sandwich1_case1_v1_compact),
+                            sandwich1_case1_old, sizeof(sandwich1_case1_old)));
+  ASSERT_TRUE(run_transform(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, &v1_example_Sandwich1Table,
+                            sandwich1_case1_v1, sizeof(sandwich1_case1_v1),
+                            sandwich1_case1_v1_compact, sizeof(sandwich1_case1_v1_compact)));
+  ASSERT_TRUE(run_transform(FIDL_TRANSFORMATION_V1_COMPACT_TO_V1, &v1_example_Sandwich1Table,
+                            sandwich1_case1_v1_compact, sizeof(sandwich1_case1_v1_compact),
+                            sandwich1_case1_v1, sizeof(sandwich1_case1_v1)));
+
+  END_TEST;
+}
+
+bool table_structwithuint32sandwich_compact() {
+  BEGIN_TEST;
+
+  fidl::FidlStructField field(&example_Table_StructWithUint32SandwichTable, 0u, 0u, &field);
+  fidl::FidlCodedStruct coded_struct(&field, 1, 16, "Table_StructWithUint32Sandwich",
+                                     &coded_struct);
+  fidl_type coded_struct_type(coded_struct);
+
+  for (auto transformation :
+       {FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, FIDL_TRANSFORMATION_V1_TO_V1_COMPACT}) {
+    ASSERT_TRUE(run_transform(transformation, &coded_struct_type,
+                              table_structwithuint32sandwich_v1_and_old,
+                              sizeof(table_structwithuint32sandwich_v1_and_old),
+                              table_structwithuint32sandwich_v1_compact,
+                              sizeof(table_structwithuint32sandwich_v1_compact)));
+  }
+  for (auto transformation :
+       {FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, FIDL_TRANSFORMATION_V1_COMPACT_TO_V1}) {
+    ASSERT_TRUE(run_transform(transformation, &coded_struct_type,
+                              table_structwithuint32sandwich_v1_compact,
+                              sizeof(table_structwithuint32sandwich_v1_compact),
+                              table_structwithuint32sandwich_v1_and_old,
+                              sizeof(table_structwithuint32sandwich_v1_and_old)));
+  }
+
+  END_TEST;
+}
+
+// Checks that all paths between the old, v1 and compact v1 wire formats agree.
+bool generated_messages_compact_round_trip() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t compact_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t other_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(7, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 50; i++) {
+      uint32_t old_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+
+      uint32_t v1_num_bytes, compact_num_bytes, other_num_bytes;
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, entry.old_type, old_bytes,
+                               old_num_bytes, compact_bytes, &compact_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(compact_num_bytes <= v1_num_bytes);
+
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, entry.v1_type, v1_bytes,
+                               v1_num_bytes, other_bytes, &other_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(other_bytes, other_num_bytes, compact_bytes, compact_num_bytes));
+
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_COMPACT_TO_V1, entry.v1_type, compact_bytes,
+                               compact_num_bytes, other_bytes, &other_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(other_bytes, other_num_bytes, v1_bytes, v1_num_bytes));
+
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, entry.v1_type, compact_bytes,
+                               compact_num_bytes, other_bytes, &other_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(other_bytes, other_num_bytes, old_bytes, old_num_bytes));
+    }
+  }
+
+  END_TEST;
+}
+
+bool sandwich1_storage() {
+  BEGIN_TEST;
+
+  uint8_t storage[sizeof(sandwich1_case1_old)];
+  uint8_t message[sizeof(sandwich1_case1_v1)];
+  uint32_t num_bytes = 0;
+  const char* error = nullptr;
+
+  ASSERT_EQ(fidl_storage_encode(FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table,
+                                sandwich1_case1_old, sizeof(sandwich1_case1_old), storage,
+                                sizeof(storage), &num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(storage, num_bytes, sandwich1_case1_storage,
+                          sizeof(sandwich1_case1_storage)));
+  ASSERT_EQ(fidl_storage_encode(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table,
+                                sandwich1_case1_v1, sizeof(sandwich1_case1_v1), storage,
+                                sizeof(storage), &num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(storage, num_bytes, sandwich1_case1_storage,
+                          sizeof(sandwich1_case1_storage)));
+
+  ASSERT_EQ(fidl_storage_decode(FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table,
+                                sandwich1_case1_storage, sizeof(sandwich1_case1_storage), message,
+                                sizeof(message), &num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(message, num_bytes, sandwich1_case1_old, sizeof(sandwich1_case1_old)));
+  ASSERT_EQ(fidl_storage_decode(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table,
+                                sandwich1_case1_storage, sizeof(sandwich1_case1_storage), message,
+                                sizeof(message), &num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(message, num_bytes, sandwich1_case1_v1, sizeof(sandwich1_case1_v1)));
+
+  // Truncated storage, and a message buffer which is too small.
+  ASSERT_EQ(fidl_storage_decode(FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table,
+                                sandwich1_case1_storage, sizeof(sandwich1_case1_storage) - 1,
+                                message, sizeof(message), &num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(fidl_storage_decode(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table,
+                                sandwich1_case1_storage, sizeof(sandwich1_case1_storage), message,
+                                sizeof(sandwich1_case1_old), &num_bytes, &error),
+            ZX_ERR_BUFFER_TOO_SMALL);
+
+  END_TEST;
+}
+
+bool generated_messages_storage_round_trip() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t storage[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t other_storage[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t other_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  uint64_t total_old_bytes = 0;
+  uint64_t total_storage_bytes = 0;
+  MessageGenerator generator(11, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 50; i++) {
+      uint32_t old_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+      uint32_t v1_num_bytes;
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+
+      // Both wire formats have the same storage encoding, which is smaller.
+      uint32_t storage_num_bytes, other_storage_num_bytes, other_num_bytes;
+      ASSERT_EQ(fidl_storage_encode(FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes,
+                                    old_num_bytes, storage, sizeof(storage), &storage_num_bytes,
+                                    nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_storage_encode(FIDL_WIRE_FORMAT_V1, entry.v1_type, v1_bytes, v1_num_bytes,
+                                    other_storage, sizeof(other_storage),
+                                    &other_storage_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(other_storage, other_storage_num_bytes, storage,
+                              storage_num_bytes));
+      ASSERT_TRUE(storage_num_bytes <= old_num_bytes);
+      total_old_bytes += old_num_bytes;
+      total_storage_bytes += storage_num_bytes;
+
+      ASSERT_EQ(fidl_storage_decode(FIDL_WIRE_FORMAT_OLD, entry.old_type, storage,
+                                    storage_num_bytes, other_bytes, sizeof(other_bytes),
+                                    &other_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(other_bytes, other_num_bytes, old_bytes, old_num_bytes));
+      ASSERT_EQ(fidl_storage_decode(FIDL_WIRE_FORMAT_V1, entry.v1_type, storage,
+                                    storage_num_bytes, other_bytes, sizeof(other_bytes),
+                                    &other_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(other_bytes, other_num_bytes, v1_bytes, v1_num_bytes));
+    }
+  }
+  ASSERT_TRUE(2 * total_storage_bytes < total_old_bytes);
+
+  END_TEST;
+}
+
+bool generated_messages_large_mode() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t large_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(13, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 20; i++) {
+      uint32_t old_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+
+      uint32_t v1_num_bytes;
+      uint64_t large_num_bytes;
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform_large(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                                     old_num_bytes, large_bytes, &large_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(large_bytes, static_cast<uint32_t>(large_num_bytes), v1_bytes,
+                              v1_num_bytes));
+
+      ASSERT_EQ(fidl_transform_large(FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, v1_bytes,
+                                     v1_num_bytes, large_bytes, &large_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(large_bytes, static_cast<uint32_t>(large_num_bytes), old_bytes,
+                              old_num_bytes));
+    }
+  }
+
+  END_TEST;
+}
+
+bool vector_size_overflow() {
+  BEGIN_TEST;
+
+  // 2^29 elements of 8 bytes: the size of the vector does not fit in 32 bits,
+  // and the vector is not in the message either.
+  uint8_t old_bytes[] = {
+      0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00,  // Size5Alignment4Vector.v.count
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  // Size5Alignment4Vector.v.data
+  };
+  uint8_t dst_bytes[64];
+  uint32_t dst_num_bytes;
+  uint64_t large_dst_num_bytes;
+  const char* error = nullptr;
+
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Size5Alignment4VectorTable,
+                           old_bytes, sizeof(old_bytes), dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "vector exceeds the message"), 0);
+  ASSERT_EQ(fidl_transform_large(FIDL_TRANSFORMATION_OLD_TO_V1,
+                                 &example_Size5Alignment4VectorTable, old_bytes, sizeof(old_bytes),
+                                 dst_bytes, &large_dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT,
+                           &v1_example_Size5Alignment4VectorTable, old_bytes, sizeof(old_bytes),
+                           dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+
+  END_TEST;
+}
+
+bool vector_count_above_32_bits() {
+  BEGIN_TEST;
+
+  // Sandwich6 with a vector of 2^32 + 1 unions, in sparse mappings: only the
+  // pages written to are backed. The second union has an invalid tag, which is
+  // only reached if the count is not truncated to 32 bits.
+  const uint64_t count = (uint64_t{1} << 32) + 1;
+  const uint64_t src_num_bytes = 40 + count * 8;
+  const uint64_t dst_capacity = 64 + count * 24 + 64;
+  void* src = mmap(nullptr, src_num_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  void* dst = mmap(nullptr, dst_capacity, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  ASSERT_TRUE(src != MAP_FAILED);
+  ASSERT_TRUE(dst != MAP_FAILED);
+  uint8_t* src_bytes = static_cast<uint8_t*>(src);
+  memcpy(src_bytes, sandwich6_case8_old, sizeof(sandwich6_case8_old));
+  memcpy(&src_bytes[16], &count, sizeof(count));
+  src_bytes[48] = 0x07;  // Second UnionSize8Aligned4.tag
+
+  uint64_t dst_num_bytes;
+  const char* error = nullptr;
+  const zx_status_t status =
+      fidl_transform_large(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich6Table, src_bytes,
+                           src_num_bytes, static_cast<uint8_t*>(dst), &dst_num_bytes, &error);
+  fidl_transform_failure_t failure;
+  const bool failed = fidl_transform_last_failure(&failure);
+  munmap(src, src_num_bytes);
+  munmap(dst, dst_capacity);
+
+  ASSERT_EQ(status, ZX_ERR_BAD_STATE);
+  ASSERT_EQ(strcmp(error, "invalid union tag"), 0);
+  ASSERT_TRUE(failed);
+  ASSERT_EQ(failure.src_offset, 48u);
+
+  END_TEST;
+}
+
 }  // namespace
 
+bool sandwich1_canonical() {
+  BEGIN_TEST;
+
+  // Sandwich1 with garbage in its padding.
+  uint8_t dirty_v1[sizeof(sandwich1_case1_v1)];
+  memcpy(dirty_v1, sandwich1_case1_v1, sizeof(dirty_v1));
+  memset(&dirty_v1[4], 0xee, 4);   // Sandwich1.before (padding)
+  memset(&dirty_v1[36], 0xee, 4);  // Sandwich1.after (padding)
+  memset(&dirty_v1[44], 0xee, 4);  // UnionSize8Aligned4.data (padding)
+
+  fidl_transform_options_t options = {};
+  options.canonicalize = true;
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+
+  memset(dst_bytes, 0xaa, sizeof(dst_bytes));
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, &options,
+                                        &v1_example_Sandwich1Table, dirty_v1, sizeof(dirty_v1),
+                                        dst_bytes, &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, sandwich1_case1_v1_compact,
+                          sizeof(sandwich1_case1_v1_compact)));
+
+  // Without canonicalization, the padding is copied as is.
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, &v1_example_Sandwich1Table,
+                           dirty_v1, sizeof(dirty_v1), dst_bytes, &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_EQ(dst_bytes[4], 0xee);
+
+  uint8_t dirty_compact[sizeof(sandwich1_case1_v1_compact)];
+  memcpy(dirty_compact, sandwich1_case1_v1_compact, sizeof(dirty_compact));
+  memset(&dirty_compact[4], 0xee, 4);   // Sandwich1.before (padding)
+  memset(&dirty_compact[36], 0xee, 4);  // Sandwich1.after (padding)
+
+  memset(dst_bytes, 0xaa, sizeof(dst_bytes));
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_COMPACT_TO_V1, &options,
+                                        &v1_example_Sandwich1Table, dirty_compact,
+                                        sizeof(dirty_compact), dst_bytes, &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(
+      cmp_payload(dst_bytes, dst_num_bytes, sandwich1_case1_v1, sizeof(sandwich1_case1_v1)));
+
+  memset(dst_bytes, 0xaa, sizeof(dst_bytes));
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_TO_OLD, &options,
+                                        &v1_example_Sandwich1Table, dirty_v1, sizeof(dirty_v1),
+                                        dst_bytes, &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(
+      cmp_payload(dst_bytes, dst_num_bytes, sandwich1_case1_old, sizeof(sandwich1_case1_old)));
+
+  END_TEST;
+}
+
+bool generated_messages_canonical() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t compact_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t garbage_old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t garbage_v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t garbage_compact_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t canonical_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t garbage_canonical_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  fidl_transform_options_t options = {};
+  options.canonicalize = true;
+  struct {
+    fidl_transformation_t transformation;
+    bool from_old;
+    const uint8_t* src_bytes;
+    const uint32_t* src_num_bytes;
+    const uint8_t* garbage_src_bytes;
+    const uint8_t* expected_bytes;
+    const uint32_t* expected_num_bytes;
+  } steps[4];
+  uint32_t old_num_bytes, v1_num_bytes, compact_num_bytes;
+  steps[0] = {FIDL_TRANSFORMATION_OLD_TO_V1, true, old_bytes, &old_num_bytes, garbage_old_bytes,
+              v1_bytes, &v1_num_bytes};
+  steps[1] = {FIDL_TRANSFORMATION_V1_TO_OLD, false, v1_bytes, &v1_num_bytes, garbage_v1_bytes,
+              old_bytes, &old_num_bytes};
+  steps[2] = {FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, false, v1_bytes, &v1_num_bytes,
+              garbage_v1_bytes, compact_bytes, &compact_num_bytes};
+  steps[3] = {FIDL_TRANSFORMATION_V1_COMPACT_TO_V1, false, compact_bytes, &compact_num_bytes,
+              garbage_compact_bytes, v1_bytes, &v1_num_bytes};
+
+  // Generated messages have zero padding, so their canonical transformations
+  // match the regular ones, whatever the destination held before. The same
+  // messages with garbage in their padding and absent objects (which regular
+  // transformations copy, in any wire format) have identical canonical
+  // transformations.
+  MessageGenerator generator(17, 8);
+  MessageGenerator garbage_generator(17, 8, /* garbage */ true);
+  uint32_t num_garbage_copied = 0;
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 20; i++) {
+      uint32_t num_handles, garbage_num_bytes;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+      ASSERT_TRUE(garbage_generator.Generate(entry.old_type, garbage_old_bytes,
+                                             sizeof(garbage_old_bytes), &garbage_num_bytes,
+                                             &num_handles));
+      ASSERT_EQ(garbage_num_bytes, old_num_bytes);
+      memset(v1_bytes, 0, sizeof(v1_bytes));
+      memset(compact_bytes, 0, sizeof(compact_bytes));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, entry.v1_type, v1_bytes,
+                               v1_num_bytes, compact_bytes, &compact_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, garbage_old_bytes,
+                               old_num_bytes, garbage_v1_bytes, &garbage_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(garbage_num_bytes, v1_num_bytes);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, entry.v1_type,
+                               garbage_v1_bytes, v1_num_bytes, garbage_compact_bytes,
+                               &garbage_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(garbage_num_bytes, compact_num_bytes);
+
+      for (const auto& step : steps) {
+        const fidl_type_t* type = step.from_old ? entry.old_type : entry.v1_type;
+        uint32_t canonical_num_bytes;
+        memset(canonical_bytes, 0xaa, sizeof(canonical_bytes));
+        ASSERT_EQ(fidl_transform_with_options(step.transformation, &options, type, step.src_bytes,
+                                              *step.src_num_bytes, canonical_bytes,
+                                              &canonical_num_bytes, nullptr),
+                  ZX_OK);
+        ASSERT_TRUE(cmp_payload(canonical_bytes, canonical_num_bytes, step.expected_bytes,
+                                *step.expected_num_bytes));
+
+        uint32_t garbage_canonical_num_bytes;
+        memset(garbage_canonical_bytes, 0x55, sizeof(garbage_canonical_bytes));
+        ASSERT_EQ(fidl_transform_with_options(step.transformation, &options, type,
+                                              step.garbage_src_bytes, *step.src_num_bytes,
+                                              garbage_canonical_bytes,
+                                              &garbage_canonical_num_bytes, nullptr),
+                  ZX_OK);
+        ASSERT_TRUE(cmp_payload(garbage_canonical_bytes, garbage_canonical_num_bytes,
+                                canonical_bytes, canonical_num_bytes));
+
+        // Without canonicalize, some garbage makes it to the destination.
+        ASSERT_EQ(fidl_transform(step.transformation, type, step.garbage_src_bytes,
+                                 *step.src_num_bytes, garbage_canonical_bytes,
+                                 &garbage_canonical_num_bytes, nullptr),
+                  ZX_OK);
+        ASSERT_EQ(garbage_canonical_num_bytes, canonical_num_bytes);
+        if (memcmp(garbage_canonical_bytes, canonical_bytes, canonical_num_bytes) != 0) {
+          num_garbage_copied++;
+        }
+      }
+    }
+  }
+  ASSERT_TRUE(num_garbage_copied > 0);
+
+  END_TEST;
+}
+
+bool structural_hash() {
+  BEGIN_TEST;
+
+  uint64_t old_hash, v1_hash, hash;
+  ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table,
+                                 sandwich1_case1_old, sizeof(sandwich1_case1_old), 0, &old_hash,
+                                 nullptr),
+            ZX_OK);
+  ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table,
+                                 sandwich1_case1_v1, sizeof(sandwich1_case1_v1), 0, &v1_hash,
+                                 nullptr),
+            ZX_OK);
+  ASSERT_EQ(old_hash, v1_hash);
+
+  // Padding does not contribute to the hash; values and the seed do.
+  uint8_t v1_bytes[sizeof(sandwich1_case1_v1)];
+  memcpy(v1_bytes, sandwich1_case1_v1, sizeof(v1_bytes));
+  memset(&v1_bytes[4], 0xee, 4);  // Sandwich1.before (padding)
+  ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table, v1_bytes,
+                                 sizeof(v1_bytes), 0, &hash, nullptr),
+            ZX_OK);
+  ASSERT_EQ(hash, v1_hash);
+  v1_bytes[0]++;  // Sandwich1.before
+  ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table, v1_bytes,
+                                 sizeof(v1_bytes), 0, &hash, nullptr),
+            ZX_OK);
+  ASSERT_TRUE(hash != v1_hash);
+  ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table,
+                                 sandwich1_case1_old, sizeof(sandwich1_case1_old), 1, &hash,
+                                 nullptr),
+            ZX_OK);
+  ASSERT_TRUE(hash != old_hash);
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t generated_v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  MessageGenerator generator(19, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 20; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, generated_v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes,
+                                     old_num_bytes, 0, &old_hash, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_structural_hash(FIDL_WIRE_FORMAT_V1, entry.v1_type, generated_v1_bytes,
+                                     v1_num_bytes, 0, &v1_hash, nullptr),
+                ZX_OK);
+      ASSERT_EQ(old_hash, v1_hash);
+    }
+  }
+
+  END_TEST;
+}
+
+// Bitwise CRC32C, as a reference.
+uint32_t reference_crc32c(const uint8_t* bytes, uint32_t size) {
+  uint32_t crc = ~0u;
+  for (uint32_t i = 0; i < size; i++) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78u : 0);
+    }
+  }
+  return ~crc;
+}
+
+bool transform_checksum() {
+  BEGIN_TEST;
+
+  uint32_t checksum = 0;
+  fidl_transform_options_t options = {};
+  options.checksum = FIDL_CHECKSUM_CRC32C;
+  options.out_checksum = &checksum;
+
+  static uint8_t dst_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+
+  // The standard check value of CRC32C.
+  const char check[] = "123456789";
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_NONE, &options,
+                                        &example_Sandwich1Table,
+                                        reinterpret_cast<const uint8_t*>(check), 9, dst_bytes,
+                                        &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_EQ(checksum, 0xe3069283u);
+
+  options.checksum = 42;
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                        &example_Sandwich1Table, sandwich1_case1_old,
+                                        sizeof(sandwich1_case1_old), dst_bytes, &dst_num_bytes,
+                                        &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "unsupported checksum"), 0);
+  options.checksum = FIDL_CHECKSUM_CRC32C;
+
+  // The checksum is folded in as the transformations write, out of order and
+  // rewriting some bytes: it must match the destination whatever it held
+  // before.
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t compact_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  MessageGenerator generator(23, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 20; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, compact_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes),
+                                     &old_num_bytes, &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, entry.old_type, old_bytes,
+                               old_num_bytes, compact_bytes, &compact_num_bytes, nullptr),
+                ZX_OK);
+
+      const struct {
+        fidl_transformation_t transformation;
+        const fidl_type_t* type;
+        const uint8_t* bytes;
+        uint32_t num_bytes;
+      } sources[] = {
+          {FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes, old_num_bytes},
+          {FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, entry.old_type, old_bytes, old_num_bytes},
+          {FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, v1_bytes, v1_num_bytes},
+          {FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, entry.v1_type, v1_bytes, v1_num_bytes},
+          {FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD, entry.v1_type, compact_bytes,
+           compact_num_bytes},
+          {FIDL_TRANSFORMATION_V1_COMPACT_TO_V1, entry.v1_type, compact_bytes,
+           compact_num_bytes},
+      };
+      for (const auto& source : sources) {
+        for (bool canonicalize : {false, true}) {
+          options.canonicalize = canonicalize;
+          memset(dst_bytes, 0xa5, 4 * source.num_bytes);
+          ASSERT_EQ(fidl_transform_with_options(source.transformation, &options, source.type,
+                                                source.bytes, source.num_bytes, dst_bytes,
+                                                &dst_num_bytes, nullptr),
+                    ZX_OK);
+          ASSERT_EQ(checksum, reference_crc32c(dst_bytes, dst_num_bytes));
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+// struct BoundedString { string:96 s; }, which is the same in both wire
+// formats.
+extern const fidl::FidlStructField bounded_string_fields[];
+const fidl_type_t bounded_string_s_type =
+    fidl_type_t(fidl::FidlCodedString(96u, fidl::kNonnullable));
+const fidl::FidlStructField bounded_string_fields[] = {
+    fidl::FidlStructField(&bounded_string_s_type, 0u, 0u, &bounded_string_fields[0]),
+};
+const fidl_type_t bounded_string_type = fidl_type_t(fidl::FidlCodedStruct(
+    bounded_string_fields, 1u, 16u, "BoundedString", &bounded_string_type.coded_struct));
+
+constexpr uint32_t kBoundedStringMaxBytes = sizeof(fidl_vector_t) + 128;
+
+// Transforms a BoundedString holding |string| (of |size| bytes) into
+// |dst_bytes|, and returns the status and error message.
+zx_status_t transform_bounded_string(fidl_transformation_t transformation,
+                                     const fidl_transform_options_t& options, const char* string,
+                                     uint32_t size, uint8_t* dst_bytes, const char** out_error) {
+  uint8_t src_bytes[kBoundedStringMaxBytes] = {};
+  const fidl_vector_t header = {size, reinterpret_cast<void*>(FIDL_ALLOC_PRESENT)};
+  memcpy(src_bytes, &header, sizeof(header));
+  memcpy(&src_bytes[sizeof(header)], string, size);
+  uint32_t dst_num_bytes;
+  *out_error = nullptr;
+  return fidl_transform_with_options(transformation, &options, &bounded_string_type, src_bytes,
+                                     static_cast<uint32_t>(sizeof(header) + FIDL_ALIGN(size)),
+                                     dst_bytes, &dst_num_bytes, out_error);
+}
+
+bool string_validation() {
+  BEGIN_TEST;
+
+  fidl_transform_options_t options = {};
+  options.validate_strings = true;
+  const char* error;
+
+  const struct {
+    const char* string;
+    const char* error;
+  } cases[] = {
+      {"", nullptr},
+      {"h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80", nullptr},
+      {"a prefix of 16+ ASCII bytes \xc3\xa9", nullptr},
+      {"\x80", "string has an invalid UTF-8 leading byte"},
+      {"\xf8\x88\x80\x80\x80", "string has an invalid UTF-8 leading byte"},
+      {"ab\xe2\x82", "string ends within a UTF-8 sequence"},
+      {"\xe2\x28\xa1", "string has a truncated UTF-8 sequence"},
+      {"\xc0\xaf", "string has an overlong UTF-8 sequence"},
+      {"\xe0\x80\xaf", "string has an overlong UTF-8 sequence"},
+      {"\xed\xa0\x80", "string encodes a UTF-16 surrogate"},
+      {"\xf4\x90\x80\x80", "string encodes a code point above U+10FFFF"},
+      {"0123456789abcdef0\xff", "string has an invalid UTF-8 leading byte"},
+      // Long runs of ASCII are checked 32 bytes at a time with AVX2.
+      {"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\xc3\xa9", nullptr},
+      {"0123456789abcdef0123\xe2\x82\xac"
+       "456789abcdef0123456789abcdef0123456789abcdef",
+       nullptr},
+      {"0123456789abcdef0123456789abcdef01234567\xff"
+       "89abcdef",
+       "string has an invalid UTF-8 leading byte"},
+      {"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\xed\xa0\x80",
+       "string encodes a UTF-16 surrogate"},
+      // As are those of multibyte characters, which are only decoded one at a
+      // time to say why they are invalid.
+      {"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80 ascii",
+       nullptr},
+      {"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98",
+       "string ends within a UTF-8 sequence"},
+      {"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xe0\x80\xaf\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80",
+       "string has an overlong UTF-8 sequence"},
+      {"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf4\x90\x80\x80",
+       "string encodes a code point above U+10FFFF"},
+      {"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xed\xa0\x80",
+       "string encodes a UTF-16 surrogate"},
+      {"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+       "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3\xa9\xe2\x82\xac\x80\x80",
+       "string has an invalid UTF-8 leading byte"},
+      {"0123456789abcdef0123456789abcdef0123456789abcdef"
+       "0123456789abcdef0123456789abcdef0123456789abcdef0",
+       "string exceeds its maximum size"},
+  };
+  const fidl_transformation_t transformations[] = {
+      FIDL_TRANSFORMATION_OLD_TO_V1,
+      FIDL_TRANSFORMATION_V1_TO_OLD,
+      FIDL_TRANSFORMATION_V1_TO_V1_COMPACT,
+  };
+  for (const auto& test_case : cases) {
+    const uint32_t size = static_cast<uint32_t>(strlen(test_case.string));
+    for (fidl_transformation_t transformation : transformations) {
+      uint8_t validated_bytes[kBoundedStringMaxBytes], dst_bytes[kBoundedStringMaxBytes];
+      zx_status_t status = transform_bounded_string(transformation, options, test_case.string,
+                                                    size, validated_bytes, &error);
+      if (test_case.error) {
+        ASSERT_EQ(status, ZX_ERR_INVALID_ARGS);
+        ASSERT_EQ(strcmp(error, test_case.error), 0);
+      } else {
+        ASSERT_EQ(status, ZX_OK);
+      }
+      // Strings are not checked unless requested, and copied the same.
+      ASSERT_EQ(transform_bounded_string(transformation, fidl_transform_options_t{},
+                                         test_case.string, size, dst_bytes, &error),
+                ZX_OK);
+      if (!test_case.error) {
+        ASSERT_EQ(memcmp(validated_bytes, dst_bytes, sizeof(fidl_vector_t) + FIDL_ALIGN(size)),
+                  0);
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+// Checks that |view| is a string holding |expected|.
+bool view_holds_string(const fidl_view_t& view, const char* expected) {
+  BEGIN_HELPER;
+
+  char data[32] = {};
+  uint32_t count;
+  ASSERT_EQ(fidl_view_count(&view, &count, nullptr), ZX_OK);
+  ASSERT_EQ(count, strlen(expected));
+  ASSERT_EQ(fidl_view_read(&view, 0, data, count, nullptr), ZX_OK);
+  ASSERT_EQ(strcmp(data, expected), 0);
+
+  END_HELPER;
+}
+
+bool sandwich1_view() {
+  BEGIN_TEST;
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+    fidl_wire_format_t other_wire_format;
+    const uint8_t* other_bytes;
+    uint32_t other_num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table, sandwich1_case1_old,
+       sizeof(sandwich1_case1_old), FIDL_WIRE_FORMAT_V1, sandwich1_case1_v1,
+       sizeof(sandwich1_case1_v1)},
+      {FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table, sandwich1_case1_v1,
+       sizeof(sandwich1_case1_v1), FIDL_WIRE_FORMAT_OLD, sandwich1_case1_old,
+       sizeof(sandwich1_case1_old)},
+  };
+  for (const auto& test_case : cases) {
+    fidl_view_t message, the_union, data;
+    uint32_t value, variant;
+    const char* error = nullptr;
+    ASSERT_EQ(fidl_view_init(test_case.wire_format, test_case.type, test_case.bytes,
+                             test_case.num_bytes, &message, &error),
+              ZX_OK);
+
+    // Primitive members are read at their offset in the old wire format.
+    ASSERT_EQ(fidl_view_read(&message, 0, &value, sizeof(value), nullptr), ZX_OK);
+    ASSERT_EQ(value, 0x04030201u);
+    ASSERT_EQ(fidl_view_read(&message, 12, &value, sizeof(value), nullptr), ZX_OK);
+    ASSERT_EQ(value, 0x08070605u);
+    ASSERT_EQ(fidl_view_read(&message, 4, &value, sizeof(value), &error), ZX_ERR_INVALID_ARGS);
+    ASSERT_EQ(strcmp(error, "read is not within primitive struct members"), 0);
+
+    ASSERT_EQ(fidl_view_field(&message, 0, &the_union, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_variant(&the_union, &variant, &data, nullptr), ZX_OK);
+    ASSERT_EQ(variant, 2u);
+    ASSERT_EQ(fidl_view_read(&data, 0, &value, sizeof(value), nullptr), ZX_OK);
+    ASSERT_EQ(value, 0x0c0b0a09u);
+    ASSERT_EQ(fidl_view_field(&message, 1, &data, nullptr), ZX_ERR_OUT_OF_RANGE);
+
+    uint8_t bytes[64];
+    uint32_t num_bytes;
+    ASSERT_EQ(fidl_view_materialize(&message, test_case.other_wire_format, bytes, &num_bytes,
+                                    &error),
+              ZX_OK);
+    ASSERT_TRUE(cmp_payload(bytes, num_bytes, test_case.other_bytes, test_case.other_num_bytes));
+  }
+
+  END_TEST;
+}
+
+bool table_view() {
+  BEGIN_TEST;
+
+  // Tables are viewed as the only field of a struct (see DO_X_TEST).
+  fidl::FidlStructField old_field(&example_Table_UnionWithVector_StructSandwichTable, 0u, 0u);
+  fidl::FidlCodedStruct old_struct(&old_field, 1, 16, "", nullptr);
+  const fidl_type old_type(old_struct);
+  fidl::FidlStructField v1_field(&v1_example_Table_UnionWithVector_StructSandwichTable, 0u, 0u);
+  fidl::FidlCodedStruct v1_struct(&v1_field, 1, 16, "", nullptr);
+  const fidl_type v1_type(v1_struct);
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &old_type, table_unionwithvector_structsandwich_old,
+       sizeof(table_unionwithvector_structsandwich_old)},
+      {FIDL_WIRE_FORMAT_V1, &v1_type, table_unionwithvector_structsandwich_v1,
+       sizeof(table_unionwithvector_structsandwich_v1)},
+  };
+  for (const auto& test_case : cases) {
+    fidl_view_t message, table, field, string, element;
+    uint32_t variant;
+    uint8_t bytes[16];
+    const char* error = nullptr;
+    ASSERT_EQ(fidl_view_init(test_case.wire_format, test_case.type, test_case.bytes,
+                             test_case.num_bytes, &message, nullptr),
+              ZX_OK);
+    ASSERT_EQ(fidl_view_field(&message, 0, &table, nullptr), ZX_OK);
+
+    ASSERT_EQ(fidl_view_table_field(&table, 2, &field, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_variant(&field, &variant, &string, nullptr), ZX_OK);
+    ASSERT_EQ(variant, 2u);
+    ASSERT_TRUE(fidl_view_is_present(&string));
+    ASSERT_TRUE(view_holds_string(string, "hello"));
+    ASSERT_EQ(fidl_view_element(&string, 4, &element, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_read(&element, 0, bytes, 1, nullptr), ZX_OK);
+    ASSERT_EQ(bytes[0], 'o');
+    ASSERT_EQ(fidl_view_element(&string, 5, &element, nullptr), ZX_ERR_OUT_OF_RANGE);
+
+    // The union before the last field is skipped by the size of its envelope.
+    ASSERT_EQ(fidl_view_table_field(&table, 3, &field, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_read(&field, 0, bytes, 3, nullptr), ZX_OK);
+    ASSERT_EQ(bytes[0], 0x04);
+    ASSERT_EQ(bytes[2], 0x06);
+    uint32_t num_bytes;
+    ASSERT_EQ(fidl_view_materialize(&field, FIDL_WIRE_FORMAT_V1, bytes, &num_bytes, &error),
+              ZX_OK);
+    ASSERT_EQ(num_bytes, 8u);
+    ASSERT_EQ(bytes[1], 0x05);
+
+    ASSERT_EQ(fidl_view_table_field(&table, 4, &field, &error), ZX_ERR_NOT_FOUND);
+    ASSERT_EQ(strcmp(error, "table field is absent"), 0);
+    ASSERT_EQ(fidl_view_variant(&table, &variant, &field, nullptr), ZX_ERR_INVALID_ARGS);
+  }
+
+  END_TEST;
+}
+
+bool arraystruct_view() {
+  BEGIN_TEST;
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &example_ArrayStructTable, arraystruct_old, sizeof(arraystruct_old)},
+      {FIDL_WIRE_FORMAT_V1, &v1_example_ArrayStructTable, arraystruct_v1, sizeof(arraystruct_v1)},
+  };
+  for (const auto& test_case : cases) {
+    fidl_view_t message, array, the_union, string;
+    uint32_t count, variant;
+    ASSERT_EQ(fidl_view_init(test_case.wire_format, test_case.type, test_case.bytes,
+                             test_case.num_bytes, &message, nullptr),
+              ZX_OK);
+
+    // Elements of arrays of unions, and of arrays of union pointers (which
+    // follow all of the former).
+    ASSERT_EQ(fidl_view_field(&message, 0, &array, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_count(&array, &count, nullptr), ZX_OK);
+    ASSERT_EQ(count, 3u);
+    ASSERT_EQ(fidl_view_element(&array, 2, &the_union, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_variant(&the_union, &variant, &string, nullptr), ZX_OK);
+    ASSERT_EQ(variant, 0u);
+    ASSERT_TRUE(view_holds_string(string, "three"));
+
+    ASSERT_EQ(fidl_view_field(&message, 1, &array, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_element(&array, 2, &the_union, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_variant(&the_union, &variant, &string, nullptr), ZX_OK);
+    ASSERT_TRUE(view_holds_string(string, "six"));
+    ASSERT_EQ(fidl_view_element(&array, 3, &the_union, nullptr), ZX_ERR_OUT_OF_RANGE);
+  }
+
+  END_TEST;
+}
+
+bool generated_messages_view() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t old_materialized[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_materialized[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(19, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 20; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, num_handles, num_bytes;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      fidl_view_t old_message, v1_message;
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes, old_num_bytes,
+                               &old_message, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_V1, entry.v1_type, v1_bytes, v1_num_bytes,
+                               &v1_message, nullptr),
+                ZX_OK);
+
+      // Materializing the whole message is transforming it.
+      ASSERT_EQ(fidl_view_materialize(&old_message, FIDL_WIRE_FORMAT_V1, v1_materialized,
+                                      &num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(v1_materialized, num_bytes, v1_bytes, v1_num_bytes));
+      ASSERT_EQ(fidl_view_materialize(&v1_message, FIDL_WIRE_FORMAT_OLD, old_materialized,
+                                      &num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(old_materialized, num_bytes, old_bytes, old_num_bytes));
+
+      // Fields are found in both wire formats alike, and nested structs
+      // materialize identically from either.
+      for (uint32_t index = 0;; index++) {
+        fidl_view_t old_field, v1_field;
+        zx_status_t status = fidl_view_field(&old_message, index, &old_field, nullptr);
+        ASSERT_EQ(fidl_view_field(&v1_message, index, &v1_field, nullptr), status);
+        if (status == ZX_ERR_OUT_OF_RANGE) {
+          break;
+        }
+        if (status != ZX_OK) {
+          continue;
+        }
+        ASSERT_EQ(fidl_view_is_present(&old_field), fidl_view_is_present(&v1_field));
+        uint32_t old_materialized_num_bytes;
+        status = fidl_view_materialize(&old_field, FIDL_WIRE_FORMAT_OLD, old_materialized,
+                                       &old_materialized_num_bytes, nullptr);
+        ASSERT_EQ(fidl_view_materialize(&v1_field, FIDL_WIRE_FORMAT_OLD, v1_materialized,
+                                        &num_bytes, nullptr),
+                  status);
+        if (status == ZX_OK) {
+          ASSERT_TRUE(cmp_payload(v1_materialized, num_bytes, old_materialized,
+                                  old_materialized_num_bytes));
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool table_projection() {
+  BEGIN_TEST;
+
+  // Tables are projected as the only field of a struct (see DO_X_TEST).
+  fidl::FidlStructField old_field(&example_Table_UnionWithVector_StructSandwichTable, 0u, 0u);
+  fidl::FidlStructField v1_field(&v1_example_Table_UnionWithVector_StructSandwichTable, 0u, 0u,
+                                 &old_field);
+  old_field.alt_field = &v1_field;
+  fidl::FidlCodedStruct old_struct(&old_field, 1, 16, "", nullptr);
+  fidl::FidlCodedStruct v1_struct(&v1_field, 1, 16, "", &old_struct);
+  old_struct.alt_type = &v1_struct;
+  const fidl_type old_type(old_struct);
+  const fidl_type v1_type(v1_struct);
+
+  // Only s2 is selected; the union before it is skipped by the size of its
+  // envelope, and dropped.
+  uint8_t expected_old[] = {
+      0x03, 0x00, 0x00, 0x00,  // Table_UnionWithVector_StructSandwich.vector<envelope>.size
+      0x00, 0x00, 0x00, 0x00,  // [cont.]
+      0xFF, 0xFF, 0xFF, 0xFF,  // Table_UnionWithVector_StructSandwich.vector<envelope>.presence
+      0xFF, 0xFF, 0xFF, 0xFF,  // [cont.]
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[0].num_bytes  0x10
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[0].num_handles
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[0].presence
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[0].presence [cont.]
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[1].num_bytes  0x20
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[1].num_handles
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[1].presence
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[1].presence [cont.]
+      0x08, 0x00, 0x00, 0x00,  // vector<envelope>[2].num_bytes  0x30
+      0x00, 0x00, 0x00, 0x00,  // vector<envelope>[2].num_handles
+      0xFF, 0xFF, 0xFF, 0xFF,  // vector<envelope>[2].presence
+      0xFF, 0xFF, 0xFF, 0xFF,  // vector<envelope>[2].presence [cont.]
+      0x04, 0x05, 0x06, 0x00,  // s2.three_bytes and padding  0x40
+      0x00, 0x00, 0x00, 0x00,  // s2 padding
+  };
+  const uint32_t path_elements[] = {0, 3};
+  const fidl_field_path_t path = {path_elements, 2};
+  uint8_t dst_bytes[sizeof(table_unionwithvector_structsandwich_v1)];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+  ASSERT_EQ(fidl_transform_projection(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_type, &path, 1,
+                                      table_unionwithvector_structsandwich_v1,
+                                      sizeof(table_unionwithvector_structsandwich_v1), dst_bytes,
+                                      &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, expected_old, sizeof(expected_old)));
+  ASSERT_EQ(fidl_transform_projection(FIDL_TRANSFORMATION_OLD_TO_V1, &old_type, &path, 1,
+                                      table_unionwithvector_structsandwich_old,
+                                      sizeof(table_unionwithvector_structsandwich_old), dst_bytes,
+                                      &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, expected_old, sizeof(expected_old)));
+
+  // Paths end at table fields.
+  const uint32_t long_path_elements[] = {0, 3, 0};
+  const fidl_field_path_t long_path = {long_path_elements, 3};
+  ASSERT_EQ(fidl_transform_projection(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_type, &long_path, 1,
+                                      table_unionwithvector_structsandwich_v1,
+                                      sizeof(table_unionwithvector_structsandwich_v1), dst_bytes,
+                                      &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "field path continues past a table field"), 0);
+
+  END_TEST;
+}
+
+bool generated_messages_projection() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t projected_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t old_materialized[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t projected_materialized[ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(23, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, projected_num_bytes, num_handles, num_bytes;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      fidl_view_t old_message;
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes, old_num_bytes,
+                               &old_message, nullptr),
+                ZX_OK);
+
+      uint32_t elements[64];
+      fidl_field_path_t paths[64];
+      uint32_t num_fields = 0;
+      fidl_view_t field;
+      while (fidl_view_field(&old_message, num_fields, &field, nullptr) != ZX_ERR_OUT_OF_RANGE) {
+        ASSERT_TRUE(num_fields < 64);
+        elements[num_fields] = num_fields;
+        paths[num_fields] = {&elements[num_fields], 1};
+        num_fields++;
+      }
+
+      // Selecting every field is transforming the whole message.
+      ASSERT_EQ(fidl_transform_projection(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, paths,
+                                          num_fields, old_bytes, old_num_bytes, projected_bytes,
+                                          &projected_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(projected_bytes, projected_num_bytes, v1_bytes, v1_num_bytes));
+      ASSERT_EQ(fidl_transform_projection(FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, paths,
+                                          num_fields, v1_bytes, v1_num_bytes, projected_bytes,
+                                          &projected_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(projected_bytes, projected_num_bytes, old_bytes, old_num_bytes));
+
+      // A single selected field is transformed as in the whole message.
+      for (uint32_t index = 0; index < num_fields; index++) {
+        ASSERT_EQ(fidl_transform_projection(FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type,
+                                            &paths[index], 1, v1_bytes, v1_num_bytes,
+                                            projected_bytes, &projected_num_bytes, nullptr),
+                  ZX_OK);
+        ASSERT_TRUE(projected_num_bytes <= old_num_bytes);
+        fidl_view_t projected_message, old_field, projected_field;
+        ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, entry.old_type, projected_bytes,
+                                 projected_num_bytes, &projected_message, nullptr),
+                  ZX_OK);
+        zx_status_t status = fidl_view_field(&old_message, index, &old_field, nullptr);
+        ASSERT_EQ(fidl_view_field(&projected_message, index, &projected_field, nullptr), status);
+        if (status != ZX_OK) {
+          continue;
+        }
+        ASSERT_EQ(fidl_view_is_present(&projected_field), fidl_view_is_present(&old_field));
+        status = fidl_view_materialize(&old_field, FIDL_WIRE_FORMAT_OLD, old_materialized,
+                                       &num_bytes, nullptr);
+        uint32_t projected_materialized_num_bytes;
+        ASSERT_EQ(fidl_view_materialize(&projected_field, FIDL_WIRE_FORMAT_OLD,
+                                        projected_materialized, &projected_materialized_num_bytes,
+                                        nullptr),
+                  status);
+        if (status == ZX_OK) {
+          ASSERT_TRUE(cmp_payload(projected_materialized, projected_materialized_num_bytes,
+                                  old_materialized, num_bytes));
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+// The offset of the object viewed by |view| recorded in |entry|: that of what
+// pointers point to in the old wire format, and of the object otherwise.
+uint32_t indexed_view_offset(const fidl_transform_index_entry_t& entry,
+                             fidl_wire_format_t wire_format) {
+  if (entry.type && (entry.type->type_tag == fidl::kFidlTypeStructPointer ||
+                     (entry.type->type_tag == fidl::kFidlTypeUnionPointer &&
+                      wire_format == FIDL_WIRE_FORMAT_OLD))) {
+    return entry.dst_out_of_line_offset;
+  }
+  return entry.dst_offset;
+}
+
+bool table_index() {
+  BEGIN_TEST;
+
+  // Tables are indexed as the only field of a struct (see DO_X_TEST).
+  fidl::FidlStructField old_field(&example_Table_UnionWithVector_StructSandwichTable, 0u, 0u);
+  fidl::FidlStructField v1_field(&v1_example_Table_UnionWithVector_StructSandwichTable, 0u, 0u,
+                                 &old_field);
+  old_field.alt_field = &v1_field;
+  fidl::FidlCodedStruct old_struct(&old_field, 1, 16, "", nullptr);
+  fidl::FidlCodedStruct v1_struct(&v1_field, 1, 16, "", &old_struct);
+  old_struct.alt_type = &v1_struct;
+  const fidl_type old_type(old_struct);
+  const fidl_type v1_type(v1_struct);
+
+  fidl_transform_index_entry_t index[8];
+  uint32_t count = 0;
+  fidl_transform_options_t options = {};
+  options.index = index;
+  options.index_capacity = 8;
+  options.out_index_count = &count;
+  uint8_t dst_bytes[sizeof(table_unionwithvector_structsandwich_old)];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_TO_OLD, &options, &v1_type,
+                                        table_unionwithvector_structsandwich_v1,
+                                        sizeof(table_unionwithvector_structsandwich_v1),
+                                        dst_bytes, &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, table_unionwithvector_structsandwich_old,
+                          sizeof(table_unionwithvector_structsandwich_old)));
+
+  // The struct, the table, and its struct, union (with its string variant)
+  // and struct fields.
+  ASSERT_EQ(count, 6u);
+  ASSERT_EQ(index[0].end, 6u);
+  ASSERT_EQ(index[1].parent, 0u);
+  ASSERT_EQ(index[2].ordinal, 1u);
+  ASSERT_EQ(index[3].parent, 1u);
+  ASSERT_EQ(index[3].ordinal, 2u);
+  ASSERT_EQ(index[3].end, 5u);
+  ASSERT_EQ(index[4].parent, 3u);
+  ASSERT_EQ(index[5].parent, 1u);
+
+  fidl_view_t message, table, field;
+  ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, &old_type, dst_bytes, dst_num_bytes, &message,
+                           nullptr),
+            ZX_OK);
+  ASSERT_EQ(fidl_view_field(&message, 0, &table, nullptr), ZX_OK);
+  const uint32_t elements[] = {0, 3, 0};
+  fidl_field_path_t path = {elements, 2};
+  uint32_t node;
+  ASSERT_EQ(fidl_transform_index_lookup(index, count, &path, &node, nullptr), ZX_OK);
+  ASSERT_EQ(node, 5u);
+  ASSERT_EQ(index[node].ordinal, 3u);
+  ASSERT_EQ(fidl_view_table_field(&table, 3, &field, nullptr), ZX_OK);
+  ASSERT_EQ(index[node].dst_offset, field.offset);
+
+  const uint32_t absent_elements[] = {0, 4};
+  path = {absent_elements, 2};
+  ASSERT_EQ(fidl_transform_index_lookup(index, count, &path, &node, &error), ZX_ERR_NOT_FOUND);
+  path = {elements, 3};
+  ASSERT_EQ(fidl_transform_index_lookup(index, count, &path, &node, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "field path continues past a table field"), 0);
+  path = {&elements[1], 1};
+  ASSERT_EQ(fidl_transform_index_lookup(index, count, &path, &node, &error),
+            ZX_ERR_OUT_OF_RANGE);
+
+  options.index_capacity = 4;
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_TO_OLD, &options, &v1_type,
+                                        table_unionwithvector_structsandwich_v1,
+                                        sizeof(table_unionwithvector_structsandwich_v1),
+                                        dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_BUFFER_TOO_SMALL);
+  ASSERT_EQ(strcmp(error, "field index capacity exceeded"), 0);
+  ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_NONE, &options, &v1_type,
+                                        table_unionwithvector_structsandwich_v1,
+                                        sizeof(table_unionwithvector_structsandwich_v1),
+                                        dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "field index unsupported by this transformation"), 0);
+
+  END_TEST;
+}
+
+bool generated_messages_index() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t dst_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static fidl_transform_index_entry_t index[ZX_CHANNEL_MAX_MSG_BYTES];
+
+  uint32_t count = 0;
+  fidl_transform_options_t options = {};
+  options.index = index;
+  options.index_capacity = ZX_CHANNEL_MAX_MSG_BYTES;
+  options.out_index_count = &count;
+
+  MessageGenerator generator(23, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, dst_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+
+      const struct {
+        fidl_transformation_t transformation;
+        const fidl_type_t* type;
+        const uint8_t* src_bytes;
+        uint32_t src_num_bytes;
+        fidl_wire_format_t dst_wire_format;
+        const fidl_type_t* dst_type;
+        const uint8_t* expected_bytes;
+        uint32_t expected_num_bytes;
+      } cases[] = {
+          {FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes, old_num_bytes,
+           FIDL_WIRE_FORMAT_V1, entry.v1_type, v1_bytes, v1_num_bytes},
+          {FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, v1_bytes, v1_num_bytes,
+           FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes, old_num_bytes},
+      };
+      for (const auto& test_case : cases) {
+        // Indexing does not change the destination, and every field of the
+        // top-level struct is recorded where views find it.
+        ASSERT_EQ(fidl_transform_with_options(test_case.transformation, &options, test_case.type,
+                                              test_case.src_bytes, test_case.src_num_bytes,
+                                              dst_bytes, &dst_num_bytes, nullptr),
+                  ZX_OK);
+        ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, test_case.expected_bytes,
+                                test_case.expected_num_bytes));
+        fidl_view_t message, field;
+        ASSERT_EQ(fidl_view_init(test_case.dst_wire_format, test_case.dst_type, dst_bytes,
+                                 dst_num_bytes, &message, nullptr),
+                  ZX_OK);
+        for (uint32_t index_in_struct = 0;; index_in_struct++) {
+          const fidl_field_path_t path = {&index_in_struct, 1};
+          uint32_t node;
+          const zx_status_t status =
+              fidl_transform_index_lookup(index, count, &path, &node, nullptr);
+          if (status == ZX_ERR_OUT_OF_RANGE) {
+            ASSERT_EQ(fidl_view_field(&message, index_in_struct, &field, nullptr),
+                      ZX_ERR_OUT_OF_RANGE);
+            break;
+          }
+          ASSERT_EQ(status, ZX_OK);
+          ASSERT_EQ(index[node].parent, 0u);
+          if (fidl_view_field(&message, index_in_struct, &field, nullptr) == ZX_OK) {
+            ASSERT_EQ(indexed_view_offset(index[node], test_case.dst_wire_format), field.offset);
+          }
+        }
+      }
+
+      // Inlined envelope contents are recorded without their descendants.
+      const uint32_t num_nodes = count;
+      ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT, &options,
+                                            entry.old_type, old_bytes, old_num_bytes, dst_bytes,
+                                            &dst_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(count <= num_nodes);
+      ASSERT_EQ(index[0].end, count);
+    }
+  }
+
+  END_TEST;
+}
+
+// Transforms |src_bytes| with the handles of the message checked against
+// |num_handles| (at most 8) handles of object type |object_type|.
+zx_status_t transform_with_handles(fidl_transformation_t transformation, const fidl_type_t* type,
+                                   const uint8_t* src_bytes, uint32_t src_num_bytes,
+                                   uint32_t num_handles, uint32_t object_type,
+                                   fidl_transform_envelope_handles_t* envelope_handles,
+                                   uint32_t* out_envelope_handles_count, uint8_t* dst_bytes,
+                                   uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  fidl_transform_handle_info_t handles[8] = {};
+  for (uint32_t i = 0; i < num_handles; i++) {
+    handles[i].handle = i + 1;
+    handles[i].type = object_type;
+  }
+  fidl_transform_options_t options = {};
+  options.check_handles = true;
+  options.handles = handles;
+  options.num_handles = num_handles;
+  options.envelope_handles = envelope_handles;
+  options.envelope_handles_capacity = envelope_handles ? 1 : 0;
+  options.out_envelope_handles_count = out_envelope_handles_count;
+  return fidl_transform_with_options(transformation, &options, type, src_bytes, src_num_bytes,
+                                     dst_bytes, out_dst_num_bytes, out_error_msg);
+}
+
+bool sandwich6_case5_handles() {
+  BEGIN_TEST;
+
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  fidl_transform_envelope_handles_t envelope_handles;
+  uint32_t count = 0;
+  const char* error = nullptr;
+
+  // The 3 handles of the vector are in the envelope of the xunion, at offset 16
+  // of the v1 message.
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich6Table,
+                                   sandwich6_case5_old, sizeof(sandwich6_case5_old), 3,
+                                   ZX_OBJ_TYPE_NONE, &envelope_handles, &count, dst_bytes,
+                                   &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, sandwich6_case5_v1,
+                          sizeof(sandwich6_case5_v1)));
+  ASSERT_EQ(count, 1u);
+  ASSERT_EQ(envelope_handles.v1_offset, 16u);
+  ASSERT_EQ(envelope_handles.first_handle, 0u);
+  ASSERT_EQ(envelope_handles.num_handles, 3u);
+
+  count = 0;
+  envelope_handles = {};
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich6Table,
+                                   sandwich6_case5_v1, sizeof(sandwich6_case5_v1), 3,
+                                   ZX_OBJ_TYPE_NONE, &envelope_handles, &count, dst_bytes,
+                                   &dst_num_bytes, &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, sandwich6_case5_old,
+                          sizeof(sandwich6_case5_old)));
+  ASSERT_EQ(count, 1u);
+  ASSERT_EQ(envelope_handles.v1_offset, 16u);
+  ASSERT_EQ(envelope_handles.num_handles, 3u);
+
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich6Table,
+                                   sandwich6_case5_old, sizeof(sandwich6_case5_old), 2,
+                                   ZX_OBJ_TYPE_NONE, nullptr, nullptr, dst_bytes, &dst_num_bytes,
+                                   &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "message has more handles than the handle array"), 0);
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich6Table,
+                                   sandwich6_case5_v1, sizeof(sandwich6_case5_v1), 4,
+                                   ZX_OBJ_TYPE_NONE, nullptr, nullptr, dst_bytes, &dst_num_bytes,
+                                   &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "handle array has more handles than the message"), 0);
+
+  uint8_t v1_bytes[sizeof(sandwich6_case5_v1)];
+  memcpy(v1_bytes, sandwich6_case5_v1, sizeof(v1_bytes));
+  v1_bytes[20] = 2;  // UnionWithVector.env.num_handle
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich6Table,
+                                   v1_bytes, sizeof(v1_bytes), 3, ZX_OBJ_TYPE_NONE, nullptr,
+                                   nullptr, dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "envelope num_handles does not match its contents"), 0);
+
+  memcpy(v1_bytes, sandwich6_case5_v1, sizeof(v1_bytes));
+  memset(&v1_bytes[60], 0, 4);  // vector<handle>.data[1]
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich6Table,
+                                   v1_bytes, sizeof(v1_bytes), 2, ZX_OBJ_TYPE_NONE, nullptr,
+                                   nullptr, dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "non-nullable handle is absent"), 0);
+
+  // Without handle checks, the transformation succeeds.
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich6Table, v1_bytes,
+                           sizeof(v1_bytes), dst_bytes, &dst_num_bytes, &error),
+            ZX_OK);
+
+  END_TEST;
+}
+
+bool handle_object_type() {
+  BEGIN_TEST;
+
+  constexpr uint32_t kObjTypeChannel = 4;  // ZX_OBJ_TYPE_CHANNEL
+  constexpr uint32_t kObjTypeVmo = 3;      // ZX_OBJ_TYPE_VMO
+  const fidl_type_t channel(fidl::FidlCodedHandle(kObjTypeChannel, fidl::kNullable));
+  const fidl::FidlStructField field(&channel, 0u, 0u, &field);
+  const fidl::FidlCodedStruct coded_struct(&field, 1, 8, "", &coded_struct);
+  const fidl_type_t type(coded_struct);
+
+  uint8_t bytes[] = {
+      0xff, 0xff, 0xff, 0xff,  // handle<channel>?
+      0x01, 0x02, 0x03, 0x04,  // uint32
+  };
+  uint8_t dst_bytes[sizeof(bytes)];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_OLD_TO_V1, &type, bytes, sizeof(bytes), 1,
+                                   kObjTypeChannel, nullptr, nullptr, dst_bytes, &dst_num_bytes,
+                                   &error),
+            ZX_OK);
+  ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, bytes, sizeof(bytes)));
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_OLD_TO_V1, &type, bytes, sizeof(bytes), 1,
+                                   kObjTypeVmo, nullptr, nullptr, dst_bytes, &dst_num_bytes,
+                                   &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "handle has the wrong object type"), 0);
+
+  // Absent nullable handles are not matched with the handle array.
+  memset(bytes, 0, 4);
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_OLD, &type, bytes, sizeof(bytes), 0,
+                                   kObjTypeChannel, nullptr, nullptr, dst_bytes, &dst_num_bytes,
+                                   &error),
+            ZX_OK);
+  bytes[0] = 1;
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_OLD, &type, bytes, sizeof(bytes), 0,
+                                   kObjTypeChannel, nullptr, nullptr, dst_bytes, &dst_num_bytes,
+                                   &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(transform_with_handles(FIDL_TRANSFORMATION_V1_TO_V1_COMPACT, &type, bytes,
+                                   sizeof(bytes), 0, kObjTypeChannel, nullptr, nullptr, dst_bytes,
+                                   &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "handle checks unsupported by this transformation"), 0);
+
+  END_TEST;
+}
+
+bool generated_messages_handles() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t dst_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static fidl_transform_handle_info_t handles[ZX_CHANNEL_MAX_MSG_BYTES / 4];
+  static fidl_transform_envelope_handles_t envelope_handles[ZX_CHANNEL_MAX_MSG_BYTES];
+
+  uint32_t count = 0;
+  fidl_transform_options_t options = {};
+  options.check_handles = true;
+  options.handles = handles;
+  options.envelope_handles = envelope_handles;
+  options.envelope_handles_capacity = ZX_CHANNEL_MAX_MSG_BYTES;
+  options.out_envelope_handles_count = &count;
+
+  MessageGenerator generator(29, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, dst_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+
+      // Checking handles does not change the destination, and the handles of
+      // envelopes are those they declare, within the handle array.
+      options.num_handles = num_handles;
+      ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                            entry.old_type, old_bytes, old_num_bytes, dst_bytes,
+                                            &dst_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, v1_bytes, v1_num_bytes));
+      for (uint32_t j = 0; j < count; j++) {
+        fidl_envelope_t envelope;
+        memcpy(&envelope, &v1_bytes[envelope_handles[j].v1_offset], sizeof(envelope));
+        ASSERT_EQ(envelope.num_handles, envelope_handles[j].num_handles);
+        ASSERT_TRUE(envelope_handles[j].first_handle + envelope_handles[j].num_handles <=
+                    num_handles);
+      }
+      const uint32_t num_envelopes = count;
+      ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_TO_OLD, &options,
+                                            entry.v1_type, v1_bytes, v1_num_bytes, dst_bytes,
+                                            &dst_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(dst_bytes, dst_num_bytes, old_bytes, old_num_bytes));
+      ASSERT_EQ(count, num_envelopes);
+
+      if (num_handles > 0) {
+        options.num_handles = num_handles - 1;
+        ASSERT_EQ(fidl_transform_with_options(FIDL_TRANSFORMATION_V1_TO_OLD, &options,
+                                              entry.v1_type, v1_bytes, v1_num_bytes, dst_bytes,
+                                              &dst_num_bytes, nullptr),
+                  ZX_ERR_INVALID_ARGS);
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+// A predicate on the |size| bytes at |offset| of the top-level struct.
+fidl_predicate_t member_predicate(fidl_predicate_op_t op, uint32_t offset, uint32_t size,
+                                  uint64_t min, uint64_t max) {
+  fidl_predicate_t predicate = {};
+  predicate.op = op;
+  predicate.offset = offset;
+  predicate.size = size;
+  predicate.min = min;
+  predicate.max = max;
+  return predicate;
+}
+
+// Compiles |predicate| for |type| in |wire_format|, and matches it against
+// |bytes|.
+bool filter_matches(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                    const fidl_predicate_t& predicate, const uint8_t* bytes, uint32_t num_bytes) {
+  fidl_compiled_predicate_t compiled;
+  bool match = false;
+  return fidl_filter_compile(wire_format, type, &predicate, 1, &compiled, nullptr) == ZX_OK &&
+         fidl_filter_match(&compiled, 1, bytes, num_bytes, &match, nullptr) == ZX_OK && match;
+}
+
+bool sandwich6_case8_validate() {
+  BEGIN_TEST;
+
+  fidl_transform_options_t options = {};
+  uint32_t dst_num_bytes;
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                    &example_Sandwich6Table, sandwich6_case8_old,
+                                    sizeof(sandwich6_case8_old), &dst_num_bytes, nullptr),
+            ZX_OK);
+  ASSERT_EQ(dst_num_bytes, sizeof(sandwich6_case8_v1));
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_V1_TO_OLD, &options,
+                                    &v1_example_Sandwich6Table, sandwich6_case8_v1,
+                                    sizeof(sandwich6_case8_v1), &dst_num_bytes, nullptr),
+            ZX_OK);
+  ASSERT_EQ(dst_num_bytes, sizeof(sandwich6_case8_old));
+
+  // Rejected as by the transformation, and recorded as its failures are.
+  uint8_t src[sizeof(sandwich6_case8_old)];
+  memcpy(src, sandwich6_case8_old, sizeof(src));
+  src[40] = 0x07;
+  const char* error_msg = nullptr;
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                    &example_Sandwich6Table, src, sizeof(src), &dst_num_bytes,
+                                    &error_msg),
+            ZX_ERR_BAD_STATE);
+  ASSERT_TRUE(error_msg != nullptr);
+  ASSERT_EQ(strcmp(error_msg, "invalid union tag"), 0);
+  fidl_transform_failure_t failure;
+  ASSERT_TRUE(fidl_transform_last_failure(&failure));
+  ASSERT_EQ(failure.src_offset, 40u);
+
+  options.checksum = FIDL_CHECKSUM_CRC32C;
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_OLD_TO_V1, &options,
+                                    &example_Sandwich6Table, sandwich6_case8_old,
+                                    sizeof(sandwich6_case8_old), &dst_num_bytes, nullptr),
+            ZX_ERR_INVALID_ARGS);
+
+  END_TEST;
+}
+
+bool sandwich5_truncated() {
+  BEGIN_TEST;
+
+  // The inline part of the message, with the union envelope present and its
+  // contents past the end. The copy is sized exactly, so that reads past the
+  // end are not hidden by the rest of a larger buffer.
+  const uint32_t src_num_bytes = 40;
+  std::unique_ptr<uint8_t[]> src(new uint8_t[src_num_bytes]);
+  memcpy(src.get(), sandwich5_case1_v1, src_num_bytes);
+
+  fidl_transform_options_t options = {};
+  uint8_t dst_bytes[sizeof(sandwich5_case1_old)];
+  uint32_t dst_num_bytes;
+  const char* error_msg = nullptr;
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich5Table, src.get(),
+                           src_num_bytes, dst_bytes, &dst_num_bytes, &error_msg),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error_msg, "message is truncated"), 0);
+  error_msg = nullptr;
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_V1_TO_OLD, &options,
+                                    &v1_example_Sandwich5Table, src.get(), src_num_bytes,
+                                    &dst_num_bytes, &error_msg),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error_msg, "message is truncated"), 0);
+
+  // Same with the envelope claiming more than the message holds.
+  memcpy(src.get(), sandwich5_case1_v1, src_num_bytes);
+  src[16] = 0x40;
+  error_msg = nullptr;
+  ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_V1_TO_OLD, &options,
+                                    &v1_example_Sandwich5Table, src.get(), src_num_bytes,
+                                    &dst_num_bytes, &error_msg),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error_msg, "message is truncated"), 0);
+
+  END_TEST;
+}
+
+// Copies the |num_bytes| first bytes of |bytes| to a buffer of exactly that
+// size, so that reads past the end are caught, adds |num_bytes| to the word at
+// |inflated_offset| (if within the copy), then checks that validating the copy
+// fails exactly when, and as, transforming it does.
+bool validate_as_transform(fidl_transformation_t transformation,
+                           const fidl_transform_options_t* options, const fidl_type_t* type,
+                           const uint8_t* bytes, uint32_t num_bytes, uint32_t inflated_offset,
+                           uint8_t* dst_bytes, zx_status_t* out_status) {
+  BEGIN_HELPER;
+
+  std::unique_ptr<uint8_t[]> src(new uint8_t[num_bytes]);
+  memcpy(src.get(), bytes, num_bytes);
+  if (inflated_offset < num_bytes) {
+    uint32_t word;
+    memcpy(&word, &src[inflated_offset], sizeof(word));
+    word += num_bytes;
+    memcpy(&src[inflated_offset], &word, sizeof(word));
+  }
+
+  const char* transform_error_msg = nullptr;
+  const char* validate_error_msg = nullptr;
+  uint32_t transform_num_bytes, validate_num_bytes;
+  *out_status = fidl_transform_with_options(transformation, options, type, src.get(), num_bytes,
+                                            dst_bytes, &transform_num_bytes, &transform_error_msg);
+  ASSERT_EQ(fidl_transform_validate(transformation, options, type, src.get(), num_bytes,
+                                    &validate_num_bytes, &validate_error_msg),
+            *out_status);
+  if (*out_status == ZX_OK) {
+    ASSERT_EQ(validate_num_bytes, transform_num_bytes);
+  } else {
+    ASSERT_EQ(strcmp(validate_error_msg, transform_error_msg), 0);
+  }
+
+  END_HELPER;
+}
+
+bool generated_messages_validate() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t dst_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  fidl_transform_options_t options = {};
+  options.validate_strings = true;
+
+  MessageGenerator generator(31, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, dst_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+
+      // Valid messages are accepted, with the size of their transformation.
+      ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_OLD_TO_V1, &options, entry.old_type,
+                                        old_bytes, old_num_bytes, &dst_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(dst_num_bytes, v1_num_bytes);
+      ASSERT_EQ(fidl_transform_validate(FIDL_TRANSFORMATION_V1_TO_OLD, &options, entry.v1_type,
+                                        v1_bytes, v1_num_bytes, &dst_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(dst_num_bytes, old_num_bytes);
+
+      // Corrupted messages are rejected exactly when, and as, they fail to
+      // transform.
+      struct {
+        fidl_transformation_t transformation;
+        const fidl_type_t* type;
+        uint8_t* bytes;
+        uint32_t num_bytes;
+      } sources[] = {
+          {FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes, old_num_bytes},
+          {FIDL_TRANSFORMATION_V1_TO_OLD, entry.v1_type, v1_bytes, v1_num_bytes},
+      };
+      for (const auto& source : sources) {
+        for (uint32_t offset = static_cast<uint32_t>(i); offset < source.num_bytes; offset += 13) {
+          const uint8_t byte = source.bytes[offset];
+          source.bytes[offset] = static_cast<uint8_t>(byte ^ 0x81);
+          const char* transform_error_msg = nullptr;
+          const char* validate_error_msg = nullptr;
+          uint32_t transform_num_bytes;
+          const zx_status_t transform_status = fidl_transform_with_options(
+              source.transformation, &options, source.type, source.bytes, source.num_bytes,
+              dst_bytes, &transform_num_bytes, &transform_error_msg);
+          ASSERT_EQ(fidl_transform_validate(source.transformation, &options, source.type,
+                                            source.bytes, source.num_bytes, &dst_num_bytes,
+                                            &validate_error_msg),
+                    transform_status);
+          if (transform_status == ZX_OK) {
+            ASSERT_EQ(dst_num_bytes, transform_num_bytes);
+          } else {
+            ASSERT_EQ(strcmp(validate_error_msg, transform_error_msg), 0);
+          }
+          source.bytes[offset] = byte;
+        }
+
+        // Truncated messages, and messages whose sizes (vector and table
+        // counts, envelope num_bytes) are inflated, are rejected without
+        // reading past their end.
+        for (uint32_t num_bytes = 0; num_bytes < source.num_bytes; num_bytes += 8) {
+          zx_status_t status;
+          ASSERT_TRUE(validate_as_transform(source.transformation, &options, source.type,
+                                            source.bytes, num_bytes, UINT32_MAX, dst_bytes,
+                                            &status));
+          ASSERT_EQ(status, ZX_ERR_INVALID_ARGS);
+        }
+        for (uint32_t offset = 0; offset < source.num_bytes; offset += 4) {
+          zx_status_t status;
+          ASSERT_TRUE(validate_as_transform(source.transformation, &options, source.type,
+                                            source.bytes, source.num_bytes, offset, dst_bytes,
+                                            &status));
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool describe_sandwich6(void* context, const char* type_name, uint32_t key,
+                        fidl_json_field_t* out_field) {
+  static_cast<void>(context);
+  if (strcmp(type_name, "example/Sandwich6") == 0) {
+    out_field->name = key == 0 ? "before" : key == 8 ? "the_union" : key == 32 ? "after" : nullptr;
+  } else if (strcmp(type_name, "example/UnionWithVector") == 0 && key == 8) {
+    out_field->name = "vector_union";
+  }
+  return out_field->name != nullptr;
+}
+
+bool sandwich6_case8_failure_path() {
+  BEGIN_TEST;
+
+  // The tag of the first element of the vector of unions is out of range.
+  uint8_t src[sizeof(sandwich6_case8_old)];
+  memcpy(src, sandwich6_case8_old, sizeof(src));
+  src[40] = 0x07;
+  uint8_t dst[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  ASSERT_TRUE(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich6Table, src,
+                             sizeof(src), dst, &dst_num_bytes, nullptr) != ZX_OK);
+
+  fidl_transform_failure_t failure;
+  ASSERT_TRUE(fidl_transform_last_failure(&failure));
+  ASSERT_EQ(failure.transformation, FIDL_TRANSFORMATION_OLD_TO_V1);
+  ASSERT_TRUE(failure.type == &example_Sandwich6Table);
+  ASSERT_TRUE(failure.status != ZX_OK);
+  ASSERT_TRUE(failure.error_msg != nullptr);
+  ASSERT_EQ(failure.src_offset, 40u);
+
+  // Successful transformations leave the failure in place.
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich6Table,
+                           sandwich6_case8_old, sizeof(sandwich6_case8_old), dst, &dst_num_bytes,
+                           nullptr),
+            ZX_OK);
+  ASSERT_TRUE(fidl_transform_last_failure(&failure));
+  ASSERT_EQ(failure.src_offset, 40u);
+
+  fidl_view_t message;
+  ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, &example_Sandwich6Table, src, sizeof(src),
+                           &message, nullptr),
+            ZX_OK);
+  char path[64];
+  uint32_t size;
+  const uint32_t offset = static_cast<uint32_t>(failure.src_offset);
+  ASSERT_EQ(fidl_view_path(&message, offset, nullptr, nullptr, path, sizeof(path), &size, nullptr),
+            ZX_OK);
+  const char kAnonymous[] = "Sandwich6.8.8[0]";
+  ASSERT_EQ(size, strlen(kAnonymous));
+  ASSERT_EQ(memcmp(path, kAnonymous, size), 0);
+
+  ASSERT_EQ(fidl_view_path(&message, offset, describe_sandwich6, nullptr, path, sizeof(path),
+                           &size, nullptr),
+            ZX_OK);
+  const char kNamed[] = "Sandwich6.the_union.vector_union[0]";
+  ASSERT_EQ(size, strlen(kNamed));
+  ASSERT_EQ(memcmp(path, kNamed, size), 0);
+
+  // Paths are the same in the v1 wire format, and stop at the deepest object
+  // holding the offset.
+  ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich6Table, sandwich6_case8_v1,
+                           sizeof(sandwich6_case8_v1), &message, nullptr),
+            ZX_OK);
+  ASSERT_EQ(fidl_view_path(&message, 12, describe_sandwich6, nullptr, path, sizeof(path), &size,
+                           nullptr),
+            ZX_OK);
+  ASSERT_EQ(size, strlen("Sandwich6.the_union"));
+  ASSERT_EQ(memcmp(path, "Sandwich6.the_union", size), 0);
+  ASSERT_EQ(fidl_view_path(&message, 0, describe_sandwich6, nullptr, path, sizeof(path), &size,
+                           nullptr),
+            ZX_OK);
+  ASSERT_EQ(size, strlen("Sandwich6"));
+  ASSERT_EQ(memcmp(path, "Sandwich6", size), 0);
+  ASSERT_EQ(fidl_view_path(&message, sizeof(sandwich6_case8_v1) - 8, describe_sandwich6, nullptr,
+                           path, sizeof(path), &size, nullptr),
+            ZX_OK);
+  const char kVariant[] = "Sandwich6.the_union.vector_union[0].2";
+  ASSERT_EQ(size, strlen(kVariant));
+  ASSERT_EQ(memcmp(path, kVariant, size), 0);
+
+  ASSERT_EQ(fidl_view_path(&message, offset, describe_sandwich6, nullptr, path, 12, &size,
+                           nullptr),
+            ZX_ERR_BUFFER_TOO_SMALL);
+  ASSERT_EQ(fidl_view_path(&message, sizeof(sandwich6_case8_v1), nullptr, nullptr, path,
+                           sizeof(path), &size, nullptr),
+            ZX_ERR_OUT_OF_RANGE);
+
+  END_TEST;
+}
+
+bool sandwich1_filter() {
+  BEGIN_TEST;
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+    uint32_t after_offset;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table, sandwich1_case1_old,
+       sizeof(sandwich1_case1_old), 12},
+      {FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table, sandwich1_case1_v1,
+       sizeof(sandwich1_case1_v1), 32},
+  };
+  for (const auto& test_case : cases) {
+    auto matches = [&](const fidl_predicate_t& predicate) {
+      return filter_matches(test_case.wire_format, test_case.type, predicate, test_case.bytes,
+                            test_case.num_bytes);
+    };
+
+    // Primitive members are selected by their offset in the old wire format.
+    ASSERT_TRUE(matches(member_predicate(FIDL_PREDICATE_EQUAL, 0, 4, 0x04030201u, 0)));
+    ASSERT_TRUE(matches(member_predicate(FIDL_PREDICATE_EQUAL, 12, 4, 0x08070605u, 0)));
+    ASSERT_TRUE(!matches(member_predicate(FIDL_PREDICATE_EQUAL, 12, 4, 0x08070604u, 0)));
+    ASSERT_TRUE(matches(member_predicate(FIDL_PREDICATE_RANGE, 12, 1, 0, 5)));
+    ASSERT_TRUE(!matches(member_predicate(FIDL_PREDICATE_RANGE, 12, 1, 6, 300)));
+    ASSERT_TRUE(matches(member_predicate(FIDL_PREDICATE_SIGNED_RANGE, 12, 1,
+                                         static_cast<uint64_t>(-5), 5)));
+    ASSERT_TRUE(!matches(member_predicate(FIDL_PREDICATE_SIGNED_RANGE, 12, 1,
+                                          static_cast<uint64_t>(-5), 4)));
+
+    const uint32_t elements[] = {0, 0};
+    fidl_predicate_t variant = member_predicate(FIDL_PREDICATE_VARIANT, 0, 0, 2, 0);
+    variant.path = {elements, 1};
+    ASSERT_TRUE(matches(variant));
+    variant.min = 1;
+    ASSERT_TRUE(!matches(variant));
+
+    // Both are at fixed offsets, and evaluated in batches.
+    const fidl_predicate_t predicates[] = {
+        member_predicate(FIDL_PREDICATE_EQUAL, 12, 4, 0x08070605u, 0),
+        variant,
+    };
+    fidl_compiled_predicate_t compiled[2];
+    ASSERT_EQ(fidl_filter_compile(test_case.wire_format, test_case.type, predicates, 2, compiled,
+                                  nullptr),
+              ZX_OK);
+    ASSERT_EQ(compiled[0].fixed_offset, test_case.after_offset);
+    ASSERT_EQ(compiled[1].fixed_offset, test_case.after_offset == 12 ? 4u : 8u);
+    const uint8_t* messages[] = {test_case.bytes, test_case.bytes, test_case.bytes};
+    const uint32_t num_bytes[] = {test_case.num_bytes, test_case.after_offset, 0};
+    bool batch_matches[3];
+    fidl_filter_match_batch(compiled, 1, messages, num_bytes, 3, batch_matches);
+    ASSERT_TRUE(batch_matches[0]);
+    ASSERT_TRUE(!batch_matches[1]);
+    ASSERT_TRUE(!batch_matches[2]);
+    fidl_filter_match_batch(compiled, 2, messages, num_bytes, 1, batch_matches);
+    ASSERT_TRUE(!batch_matches[0]);
+
+    // A full block then a partial one, whose entries past the last message
+    // still hold the previous block.
+    const uint8_t* many_messages[67];
+    uint32_t many_num_bytes[67];
+    bool many_matches[67];
+    for (uint32_t i = 0; i < 67; i++) {
+      many_messages[i] = test_case.bytes;
+      many_num_bytes[i] = i % 3 == 1 ? test_case.after_offset : test_case.num_bytes;
+    }
+    fidl_filter_match_batch(compiled, 1, many_messages, many_num_bytes, 67, many_matches);
+    for (uint32_t i = 0; i < 67; i++) {
+      ASSERT_EQ(many_matches[i], i % 3 != 1);
+    }
+
+    const char* error = nullptr;
+    fidl_predicate_t invalid = member_predicate(FIDL_PREDICATE_EQUAL, 4, 4, 0, 0);
+    ASSERT_EQ(fidl_filter_compile(test_case.wire_format, test_case.type, &invalid, 1, compiled,
+                                  &error),
+              ZX_ERR_INVALID_ARGS);
+    ASSERT_EQ(strcmp(error, "read is not within primitive struct members"), 0);
+    invalid = variant;
+    invalid.path = {elements, 2};
+    ASSERT_EQ(fidl_filter_compile(test_case.wire_format, test_case.type, &invalid, 1, compiled,
+                                  &error),
+              ZX_ERR_INVALID_ARGS);
+    ASSERT_EQ(strcmp(error, "field path descends into neither a struct nor a table"), 0);
+    invalid = member_predicate(FIDL_PREDICATE_RANGE, 12, 1, 256, 300);
+    ASSERT_EQ(fidl_filter_compile(test_case.wire_format, test_case.type, &invalid, 1, compiled,
+                                  &error),
+              ZX_ERR_INVALID_ARGS);
+    ASSERT_EQ(strcmp(error, "predicate range is empty"), 0);
+  }
+
+  END_TEST;
+}
+
+bool table_filter() {
+  BEGIN_TEST;
+
+  // Tables are filtered as the only field of a struct (see DO_X_TEST).
+  fidl::FidlStructField old_field(&example_Table_UnionWithVector_StructSandwichTable, 0u, 0u);
+  fidl::FidlStructField v1_field(&v1_example_Table_UnionWithVector_StructSandwichTable, 0u, 0u,
+                                 &old_field);
+  old_field.alt_field = &v1_field;
+  fidl::FidlCodedStruct old_struct(&old_field, 1, 16, "", nullptr);
+  fidl::FidlCodedStruct v1_struct(&v1_field, 1, 16, "", &old_struct);
+  old_struct.alt_type = &v1_struct;
+  const fidl_type old_type(old_struct);
+  const fidl_type v1_type(v1_struct);
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &old_type, table_unionwithvector_structsandwich_old,
+       sizeof(table_unionwithvector_structsandwich_old)},
+      {FIDL_WIRE_FORMAT_V1, &v1_type, table_unionwithvector_structsandwich_v1,
+       sizeof(table_unionwithvector_structsandwich_v1)},
+  };
+  for (const auto& test_case : cases) {
+    auto matches = [&](const fidl_predicate_t& predicate) {
+      return filter_matches(test_case.wire_format, test_case.type, predicate, test_case.bytes,
+                            test_case.num_bytes);
+    };
+    const uint32_t union_field[] = {0, 2};
+    const uint32_t struct_field[] = {0, 3};
+    const uint32_t absent_field[] = {0, 4};
+
+    fidl_predicate_t present = member_predicate(FIDL_PREDICATE_PRESENT, 0, 0, 0, 0);
+    present.path = {union_field, 2};
+    ASSERT_TRUE(matches(present));
+    present.path = {absent_field, 2};
+    ASSERT_TRUE(!matches(present));
+
+    fidl_predicate_t variant = member_predicate(FIDL_PREDICATE_VARIANT, 0, 0, 2, 0);
+    variant.path = {union_field, 2};
+    ASSERT_TRUE(matches(variant));
+
+    // Fields of tables are read through views; the union before the struct
+    // field is skipped.
+    fidl_predicate_t equal = member_predicate(FIDL_PREDICATE_EQUAL, 0, 2, 0x0504, 0);
+    equal.path = {struct_field, 2};
+    ASSERT_TRUE(matches(equal));
+    equal.min = 0x0604;
+    ASSERT_TRUE(!matches(equal));
+    equal.path = {absent_field, 2};
+    ASSERT_TRUE(!matches(equal));
+
+    const fidl_predicate_t predicates[] = {present, variant};
+    fidl_compiled_predicate_t compiled[2];
+    ASSERT_EQ(fidl_filter_compile(test_case.wire_format, test_case.type, predicates, 2, compiled,
+                                  nullptr),
+              ZX_OK);
+    ASSERT_EQ(compiled[1].fixed_offset, FIDL_FILTER_NO_FIXED_OFFSET);
+    const uint8_t* messages[] = {test_case.bytes, test_case.bytes};
+    const uint32_t num_bytes[] = {test_case.num_bytes, 8};
+    bool batch_matches[2];
+    fidl_filter_match_batch(&compiled[1], 1, messages, num_bytes, 2, batch_matches);
+    ASSERT_TRUE(batch_matches[0]);
+    ASSERT_TRUE(!batch_matches[1]);
+    fidl_filter_match_batch(compiled, 2, messages, num_bytes, 1, batch_matches);
+    ASSERT_TRUE(!batch_matches[0]);
+  }
+
+  END_TEST;
+}
+
+bool generated_messages_filter() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(23, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+
+      // The presence of each field, and the first byte of the struct if it is
+      // a primitive member, are the same in both wire formats.
+      uint32_t elements[64];
+      fidl_predicate_t predicates[65];
+      uint32_t num_predicates = 0;
+      fidl_compiled_predicate_t old_compiled, v1_compiled;
+      predicates[num_predicates++] = member_predicate(FIDL_PREDICATE_EQUAL, 0, 1, old_bytes[0], 0);
+      for (uint32_t index = 0; index < 64; index++) {
+        elements[index] = index;
+        predicates[num_predicates] = member_predicate(FIDL_PREDICATE_PRESENT, 0, 0, 0, 0);
+        predicates[num_predicates].path = {&elements[index], 1};
+        if (fidl_filter_compile(FIDL_WIRE_FORMAT_OLD, entry.old_type, &predicates[num_predicates],
+                                1, &old_compiled, nullptr) != ZX_OK) {
+          break;
+        }
+        num_predicates++;
+      }
+      for (uint32_t p = 0; p < num_predicates; p++) {
+        const zx_status_t status = fidl_filter_compile(
+            FIDL_WIRE_FORMAT_OLD, entry.old_type, &predicates[p], 1, &old_compiled, nullptr);
+        ASSERT_EQ(fidl_filter_compile(FIDL_WIRE_FORMAT_V1, entry.v1_type, &predicates[p], 1,
+                                      &v1_compiled, nullptr),
+                  status);
+        if (status != ZX_OK) {
+          continue;
+        }
+        bool old_match, v1_match, batch_match;
+        ASSERT_EQ(fidl_filter_match(&old_compiled, 1, old_bytes, old_num_bytes, &old_match,
+                                    nullptr),
+                  ZX_OK);
+        ASSERT_EQ(fidl_filter_match(&v1_compiled, 1, v1_bytes, v1_num_bytes, &v1_match, nullptr),
+                  ZX_OK);
+        ASSERT_EQ(old_match, v1_match);
+        const uint8_t* messages[] = {v1_bytes};
+        fidl_filter_match_batch(&v1_compiled, 1, messages, &v1_num_bytes, 1, &batch_match);
+        ASSERT_EQ(batch_match, v1_match);
+        if (p == 0) {
+          ASSERT_TRUE(old_match);
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool size5alignment4vector_columns() {
+  BEGIN_TEST;
+
+  const fidl_wire_format_t wire_formats[] = {FIDL_WIRE_FORMAT_OLD, FIDL_WIRE_FORMAT_V1};
+  const fidl_type_t* types[] = {&example_Size5Alignment4VectorTable,
+                                &v1_example_Size5Alignment4VectorTable};
+  for (int i = 0; i < 2; i++) {
+    fidl_view_t message, vector;
+    uint32_t four[2], count;
+    uint8_t one[2];
+    ASSERT_EQ(fidl_view_init(wire_formats[i], types[i], size5alignment4vector_old_and_v1,
+                             sizeof(size5alignment4vector_old_and_v1), &message, nullptr),
+              ZX_OK);
+    ASSERT_EQ(fidl_view_field(&message, 0, &vector, nullptr), ZX_OK);
+
+    fidl_column_t columns[2] = {};
+    columns[0].kind = FIDL_COLUMN_MEMBER;
+    columns[0].size = 4;
+    columns[0].data = four;
+    columns[1].kind = FIDL_COLUMN_MEMBER;
+    columns[1].offset = 4;
+    columns[1].size = 1;
+    columns[1].data = one;
+    ASSERT_EQ(fidl_view_export_columns(&vector, columns, 2, 2, &count, nullptr), ZX_OK);
+    ASSERT_EQ(count, 2u);
+    ASSERT_EQ(four[0], 0x04030201u);
+    ASSERT_EQ(four[1], 0x09080706u);
+    ASSERT_EQ(one[0], 0x05);
+    ASSERT_EQ(one[1], 0x0a);
+
+    ASSERT_EQ(fidl_view_export_columns(&vector, columns, 2, 1, &count, nullptr),
+              ZX_ERR_BUFFER_TOO_SMALL);
+    columns[1].size = 4;
+    ASSERT_EQ(fidl_view_export_columns(&vector, columns, 2, 2, &count, nullptr),
+              ZX_ERR_INVALID_ARGS);
+  }
+
+  END_TEST;
+}
+
+bool arraystruct_columns() {
+  BEGIN_TEST;
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &example_ArrayStructTable, arraystruct_old, sizeof(arraystruct_old)},
+      {FIDL_WIRE_FORMAT_V1, &v1_example_ArrayStructTable, arraystruct_v1, sizeof(arraystruct_v1)},
+  };
+  for (const auto& test_case : cases) {
+    fidl_view_t message, array;
+    uint32_t variants[3], count;
+    char prefixes[3][3];
+    ASSERT_EQ(fidl_view_init(test_case.wire_format, test_case.type, test_case.bytes,
+                             test_case.num_bytes, &message, nullptr),
+              ZX_OK);
+    ASSERT_EQ(fidl_view_field(&message, 0, &array, nullptr), ZX_OK);
+
+    // The variant of each union, and the first bytes of its string.
+    fidl_column_t columns[2] = {};
+    columns[0].kind = FIDL_COLUMN_VARIANT;
+    columns[0].field = FIDL_COLUMN_ELEMENT;
+    columns[0].data = variants;
+    columns[1].kind = FIDL_COLUMN_VARIANT_DATA;
+    columns[1].field = FIDL_COLUMN_ELEMENT;
+    columns[1].size = 3;
+    columns[1].data = prefixes;
+    ASSERT_EQ(fidl_view_export_columns(&array, columns, 2, 3, &count, nullptr), ZX_OK);
+    ASSERT_EQ(count, 3u);
+    for (uint32_t i = 0; i < count; i++) {
+      ASSERT_EQ(variants[i], 0u);
+    }
+    ASSERT_EQ(memcmp(prefixes, "onetwothr", sizeof(prefixes)), 0);
+
+    // Elements of other variants are zeroed.
+    columns[1].variant = 1;
+    ASSERT_EQ(fidl_view_export_columns(&array, columns, 2, 3, &count, nullptr), ZX_OK);
+    ASSERT_EQ(memcmp(prefixes, "\0\0\0\0\0\0\0\0\0", sizeof(prefixes)), 0);
+
+    // Arrays of union pointers are not supported.
+    ASSERT_EQ(fidl_view_field(&message, 1, &array, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_export_columns(&array, columns, 2, 3, &count, nullptr),
+              ZX_ERR_INVALID_ARGS);
+  }
+
+  END_TEST;
+}
+
+bool generated_messages_columns() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint32_t old_variants[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint32_t v1_variants[ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(29, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, num_handles;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      fidl_view_t old_message, v1_message;
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes, old_num_bytes,
+                               &old_message, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_V1, entry.v1_type, v1_bytes, v1_num_bytes,
+                               &v1_message, nullptr),
+                ZX_OK);
+
+      // Fields of the top-level struct which are vectors or arrays export the
+      // same number of elements, and the same variants if they are unions.
+      for (uint32_t index = 0;; index++) {
+        fidl_view_t old_field, v1_field;
+        const zx_status_t status = fidl_view_field(&old_message, index, &old_field, nullptr);
+        ASSERT_EQ(fidl_view_field(&v1_message, index, &v1_field, nullptr), status);
+        if (status == ZX_ERR_OUT_OF_RANGE) {
+          break;
+        }
+        if (status != ZX_OK) {
+          continue;
+        }
+        uint32_t old_count, v1_count;
+        fidl_column_t column = {};
+        column.kind = FIDL_COLUMN_VARIANT;
+        column.field = FIDL_COLUMN_ELEMENT;
+        column.data = old_variants;
+        const zx_status_t export_status = fidl_view_export_columns(
+            &old_field, &column, 1, ZX_CHANNEL_MAX_MSG_BYTES, &old_count, nullptr);
+        column.data = v1_variants;
+        ASSERT_EQ(fidl_view_export_columns(&v1_field, &column, 1, ZX_CHANNEL_MAX_MSG_BYTES,
+                                           &v1_count, nullptr),
+                  export_status);
+        if (export_status == ZX_OK) {
+          ASSERT_EQ(old_count, v1_count);
+          ASSERT_EQ(memcmp(old_variants, v1_variants, old_count * sizeof(uint32_t)), 0);
+        }
+        if (fidl_view_export_columns(&old_field, nullptr, 0, ZX_CHANNEL_MAX_MSG_BYTES,
+                                     &old_count, nullptr) == ZX_OK) {
+          ASSERT_EQ(fidl_view_export_columns(&v1_field, nullptr, 0, ZX_CHANNEL_MAX_MSG_BYTES,
+                                             &v1_count, nullptr),
+                    ZX_OK);
+          ASSERT_EQ(old_count, v1_count);
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool describe_sandwich1(void* context, const char* type_name, uint32_t key,
+                        fidl_json_field_t* out_field) {
+  static_cast<void>(context);
+  out_field->size = 4;
+  out_field->format = FIDL_JSON_FORMAT_UNSIGNED;
+  if (strcmp(type_name, "example/Sandwich1") == 0) {
+    out_field->name = key == 0 ? "before" : key == 4 ? "the_union" : key == 12 ? "after" : nullptr;
+  } else if (strcmp(type_name, "example/UnionSize8Aligned4") == 0 && key == 2) {
+    out_field->name = "variant";
+  }
+  return out_field->name != nullptr;
+}
+
+bool sandwich1_json() {
+  BEGIN_TEST;
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &example_Sandwich1Table, sandwich1_case1_old,
+       sizeof(sandwich1_case1_old)},
+      {FIDL_WIRE_FORMAT_V1, &v1_example_Sandwich1Table, sandwich1_case1_v1,
+       sizeof(sandwich1_case1_v1)},
+  };
+  for (const auto& test_case : cases) {
+    fidl_view_t message;
+    char json[128];
+    uint32_t size;
+    ASSERT_EQ(fidl_view_init(test_case.wire_format, test_case.type, test_case.bytes,
+                             test_case.num_bytes, &message, nullptr),
+              ZX_OK);
+
+    // Without names, members are keyed by their old wire format offset.
+    const char kAnonymous[] = "{\"0\":\"01020304\",\"4\":{\"2\":\"090a0b0c\"},\"12\":\"05060708\"}";
+    ASSERT_EQ(fidl_view_dump_json(&message, nullptr, nullptr, json, sizeof(json), &size, nullptr),
+              ZX_OK);
+    ASSERT_EQ(size, strlen(kAnonymous));
+    ASSERT_EQ(memcmp(json, kAnonymous, size), 0);
+
+    const char kNamed[] =
+        "{\"before\":67305985,\"the_union\":{\"variant\":202050057},\"after\":134678021}";
+    ASSERT_EQ(fidl_view_dump_json(&message, describe_sandwich1, nullptr, json, sizeof(json), &size,
+                                  nullptr),
+              ZX_OK);
+    ASSERT_EQ(size, strlen(kNamed));
+    ASSERT_EQ(memcmp(json, kNamed, size), 0);
+
+    ASSERT_EQ(fidl_view_dump_json(&message, describe_sandwich1, nullptr, json, 20, &size, nullptr),
+              ZX_ERR_BUFFER_TOO_SMALL);
+  }
+
+  END_TEST;
+}
+
+bool arraystruct_json() {
+  BEGIN_TEST;
+
+  const struct {
+    fidl_wire_format_t wire_format;
+    const fidl_type_t* type;
+    const uint8_t* bytes;
+    uint32_t num_bytes;
+  } cases[] = {
+      {FIDL_WIRE_FORMAT_OLD, &example_ArrayStructTable, arraystruct_old, sizeof(arraystruct_old)},
+      {FIDL_WIRE_FORMAT_V1, &v1_example_ArrayStructTable, arraystruct_v1, sizeof(arraystruct_v1)},
+  };
+  const char kExpected[] =
+      "{\"0\":[{\"0\":\"one\"},{\"0\":\"two\"},{\"0\":\"three\"}],"
+      "\"72\":[{\"0\":\"four\"},{\"0\":\"five\"},{\"0\":\"six\"}]}";
+  for (const auto& test_case : cases) {
+    fidl_view_t message, array;
+    char json[128];
+    uint32_t size;
+    ASSERT_EQ(fidl_view_init(test_case.wire_format, test_case.type, test_case.bytes,
+                             test_case.num_bytes, &message, nullptr),
+              ZX_OK);
+    ASSERT_EQ(fidl_view_dump_json(&message, nullptr, nullptr, json, sizeof(json), &size, nullptr),
+              ZX_OK);
+    ASSERT_EQ(size, strlen(kExpected));
+    ASSERT_EQ(memcmp(json, kExpected, size), 0);
+
+    // Views of nested objects dump just that object.
+    ASSERT_EQ(fidl_view_field(&message, 1, &array, nullptr), ZX_OK);
+    ASSERT_EQ(fidl_view_dump_json(&array, nullptr, nullptr, json, sizeof(json), &size, nullptr),
+              ZX_OK);
+    ASSERT_EQ(size, strlen("[{\"0\":\"four\"},{\"0\":\"five\"},{\"0\":\"six\"}]"));
+  }
+
+  END_TEST;
+}
+
+bool generated_messages_json() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static char old_json[8 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static char v1_json[8 * ZX_CHANNEL_MAX_MSG_BYTES];
+
+  MessageGenerator generator(31, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    for (int i = 0; i < 10; i++) {
+      uint32_t old_num_bytes, v1_num_bytes, num_handles, old_size, v1_size;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      fidl_view_t old_message, v1_message;
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_OLD, entry.old_type, old_bytes, old_num_bytes,
+                               &old_message, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_V1, entry.v1_type, v1_bytes, v1_num_bytes,
+                               &v1_message, nullptr),
+                ZX_OK);
+
+      // Both wire formats dump the same JSON.
+      ASSERT_EQ(fidl_view_dump_json(&old_message, nullptr, nullptr, old_json, sizeof(old_json),
+                                    &old_size, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_view_dump_json(&v1_message, nullptr, nullptr, v1_json, sizeof(v1_json),
+                                    &v1_size, nullptr),
+                ZX_OK);
+      ASSERT_EQ(old_size, v1_size);
+      ASSERT_EQ(memcmp(old_json, v1_json, old_size), 0);
+    }
+  }
+
+  END_TEST;
+}
+
+bool load_test_library(fidl_ir_library_t** out_library) {
+  std::ifstream file("transformer.test.fidl.json");
+  const std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  const char* error = nullptr;
+  if (fidl_ir_load(json.data(), static_cast<uint32_t>(json.size()), out_library, &error) != ZX_OK) {
+    std::cout << "loading the IR failed: " << (error ? error : "") << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Compares two coding tables, the objects they refer to (to |depth| levels),
+// and whether and where their alt types and fields link to.
+bool same_coding_table(const fidl_type_t* actual, const fidl_type_t* expected, int depth) {
+  if (actual == nullptr || expected == nullptr) {
+    return actual == expected;
+  }
+  if (actual->type_tag != expected->type_tag) {
+    return false;
+  }
+  if (depth == 0) {
+    return true;
+  }
+  auto same_name = [](const char* a, const char* b) {
+    return a == b || (a != nullptr && b != nullptr && strcmp(a, b) == 0);
+  };
+  switch (actual->type_tag) {
+    case fidl::kFidlTypePrimitive:
+      // Primitives use the interned tables.
+      return actual == expected;
+    case fidl::kFidlTypeStruct: {
+      const auto& a = actual->coded_struct;
+      const auto& b = expected->coded_struct;
+      if (a.field_count != b.field_count || a.size != b.size || !same_name(a.name, b.name) ||
+          (a.alt_type == nullptr) != (b.alt_type == nullptr) ||
+          (a.alt_type != nullptr && a.alt_type->size != b.alt_type->size)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < a.field_count; i++) {
+        const auto& field = a.fields[i];
+        const auto& expected_field = b.fields[i];
+        if (field.offset != expected_field.offset || field.padding != expected_field.padding ||
+            (field.alt_field == nullptr) != (expected_field.alt_field == nullptr) ||
+            (field.alt_field != nullptr &&
+             field.alt_field->offset != expected_field.alt_field->offset) ||
+            !same_coding_table(field.type, expected_field.type, depth - 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeStructPointer:
+      return same_coding_table(
+          reinterpret_cast<const fidl_type_t*>(
+              reinterpret_cast<const char*>(actual->coded_struct_pointer.struct_type) -
+              offsetof(fidl_type_t, coded_struct)),
+          reinterpret_cast<const fidl_type_t*>(
+              reinterpret_cast<const char*>(expected->coded_struct_pointer.struct_type) -
+              offsetof(fidl_type_t, coded_struct)),
+          depth - 1);
+    case fidl::kFidlTypeUnion: {
+      const auto& a = actual->coded_union;
+      const auto& b = expected->coded_union;
+      if (a.field_count != b.field_count || a.data_offset != b.data_offset || a.size != b.size ||
+          !same_name(a.name, b.name) || (a.alt_type == nullptr) != (b.alt_type == nullptr) ||
+          (a.alt_type != nullptr && a.alt_type->size != b.alt_type->size)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < a.field_count; i++) {
+        if (a.fields[i].padding != b.fields[i].padding ||
+            a.fields[i].xunion_ordinal != b.fields[i].xunion_ordinal ||
+            !same_coding_table(a.fields[i].type, b.fields[i].type, depth - 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeUnionPointer:
+      return same_coding_table(
+          reinterpret_cast<const fidl_type_t*>(
+              reinterpret_cast<const char*>(actual->coded_union_pointer.union_type) -
+              offsetof(fidl_type_t, coded_union)),
+          reinterpret_cast<const fidl_type_t*>(
+              reinterpret_cast<const char*>(expected->coded_union_pointer.union_type) -
+              offsetof(fidl_type_t, coded_union)),
+          depth - 1);
+    case fidl::kFidlTypeXUnion: {
+      const auto& a = actual->coded_xunion;
+      const auto& b = expected->coded_xunion;
+      if (a.field_count != b.field_count || a.nullable != b.nullable ||
+          a.strictness != b.strictness || !same_name(a.name, b.name)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < a.field_count; i++) {
+        if (a.fields[i].ordinal != b.fields[i].ordinal ||
+            !same_coding_table(a.fields[i].type, b.fields[i].type, depth - 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeTable: {
+      const auto& a = actual->coded_table;
+      const auto& b = expected->coded_table;
+      if (a.field_count != b.field_count || !same_name(a.name, b.name)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < a.field_count; i++) {
+        if (a.fields[i].ordinal != b.fields[i].ordinal ||
+            !same_coding_table(a.fields[i].type, b.fields[i].type, depth - 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case fidl::kFidlTypeHandle:
+      return actual->coded_handle.handle_subtype == expected->coded_handle.handle_subtype &&
+             actual->coded_handle.nullable == expected->coded_handle.nullable;
+    case fidl::kFidlTypeString:
+      return actual->coded_string.max_size == expected->coded_string.max_size &&
+             actual->coded_string.nullable == expected->coded_string.nullable;
+    case fidl::kFidlTypeVector: {
+      const auto& a = actual->coded_vector;
+      const auto& b = expected->coded_vector;
+      return a.max_count == b.max_count && a.element_size == b.element_size &&
+             a.nullable == b.nullable && (a.alt_type == nullptr) == (b.alt_type == nullptr) &&
+             (a.alt_type == nullptr || a.alt_type->element_size == b.alt_type->element_size) &&
+             same_coding_table(a.element, b.element, depth - 1);
+    }
+    case fidl::kFidlTypeArray: {
+      const auto& a = actual->coded_array;
+      const auto& b = expected->coded_array;
+      return a.array_size == b.array_size && a.element_size == b.element_size &&
+             (a.alt_type == nullptr) == (b.alt_type == nullptr) &&
+             (a.alt_type == nullptr || a.alt_type->array_size == b.alt_type->array_size) &&
+             same_coding_table(a.element, b.element, depth - 1);
+    }
+    default:
+      return false;
+  }
+}
+
+bool ir_matches_compiled_tables() {
+  BEGIN_TEST;
+
+  fidl_ir_library_t* library;
+  ASSERT_TRUE(load_test_library(&library));
+  for (const auto& entry : kCatalog) {
+    // Nullable xunions are only built where they are used, and the test
+    // library only uses them in the compiled-in tables.
+    if (strstr(entry.name, "NullableRef") != nullptr) {
+      continue;
+    }
+    const fidl_type_t* old_type;
+    const fidl_type_t* v1_type;
+    ASSERT_EQ(fidl_ir_lookup(library, FIDL_WIRE_FORMAT_OLD, entry.name, &old_type), ZX_OK);
+    ASSERT_EQ(fidl_ir_lookup(library, FIDL_WIRE_FORMAT_V1, entry.name, &v1_type), ZX_OK);
+    ASSERT_TRUE(same_coding_table(old_type, entry.old_type, 8));
+    ASSERT_TRUE(same_coding_table(v1_type, entry.v1_type, 8));
+  }
+
+  const fidl_type_t* type;
+  ASSERT_EQ(fidl_ir_lookup(library, FIDL_WIRE_FORMAT_V1, "example/Unknown", &type),
+            ZX_ERR_NOT_FOUND);
+
+  fidl_ir_stats_t stats;
+  fidl_ir_stats(library, &stats);
+  ASSERT_EQ(stats.num_declarations, 38u);
+  // Declarations, in both wire formats, and the types they use, once each.
+  ASSERT_TRUE(stats.num_types > 2 * stats.num_declarations);
+  ASSERT_EQ(stats.arena_size % 8, 0u);
+  ASSERT_TRUE(stats.arena_size >= stats.num_types * sizeof(fidl_type_t));
+  fidl_ir_free(library);
+
+  END_TEST;
+}
+
+bool ir_generated_messages_round_trip() {
+  BEGIN_TEST;
+
+  static uint8_t old_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t expected_v1_bytes[4 * ZX_CHANNEL_MAX_MSG_BYTES];
+  static uint8_t round_trip_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+
+  fidl_ir_library_t* library;
+  ASSERT_TRUE(load_test_library(&library));
+  MessageGenerator generator(92, 8);
+  for (const auto& entry : kCatalog) {
+    if (entry.old_type->type_tag != fidl::kFidlTypeStruct) {
+      continue;
+    }
+    const fidl_type_t* old_type;
+    const fidl_type_t* v1_type;
+    ASSERT_EQ(fidl_ir_lookup(library, FIDL_WIRE_FORMAT_OLD, entry.name, &old_type), ZX_OK);
+    ASSERT_EQ(fidl_ir_lookup(library, FIDL_WIRE_FORMAT_V1, entry.name, &v1_type), ZX_OK);
+    for (int i = 0; i < 20; i++) {
+      uint32_t old_num_bytes, num_handles, v1_num_bytes, expected_v1_num_bytes,
+          round_trip_num_bytes;
+      ASSERT_TRUE(generator.Generate(entry.old_type, old_bytes, sizeof(old_bytes), &old_num_bytes,
+                                     &num_handles));
+
+      // Loaded tables transform messages as the compiled-in ones do.
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, entry.old_type, old_bytes,
+                               old_num_bytes, expected_v1_bytes, &expected_v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_OLD_TO_V1, old_type, old_bytes, old_num_bytes,
+                               v1_bytes, &v1_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(
+          cmp_payload(v1_bytes, v1_num_bytes, expected_v1_bytes, expected_v1_num_bytes));
+      ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_V1_TO_OLD, v1_type, v1_bytes, v1_num_bytes,
+                               round_trip_bytes, &round_trip_num_bytes, nullptr),
+                ZX_OK);
+      ASSERT_TRUE(cmp_payload(round_trip_bytes, round_trip_num_bytes, old_bytes, old_num_bytes));
+    }
+  }
+  fidl_ir_free(library);
+
+  END_TEST;
+}
+
+bool ir_describe_json() {
+  BEGIN_TEST;
+
+  fidl_ir_library_t* library;
+  ASSERT_TRUE(load_test_library(&library));
+  const fidl_type_t* type;
+  ASSERT_EQ(fidl_ir_lookup(library, FIDL_WIRE_FORMAT_V1, "example/Sandwich1", &type), ZX_OK);
+  fidl_view_t message;
+  ASSERT_EQ(fidl_view_init(FIDL_WIRE_FORMAT_V1, type, sandwich1_case1_v1,
+                           sizeof(sandwich1_case1_v1), &message, nullptr),
+            ZX_OK);
+
+  // The IR names and types the members.
+  const char kExpected[] =
+      "{\"before\":67305985,\"the_union\":{\"variant\":202050057},\"after\":134678021}";
+  char json[128];
+  uint32_t size;
+  ASSERT_EQ(fidl_view_dump_json(&message, fidl_ir_describe, library, json, sizeof(json), &size,
+                                nullptr),
+            ZX_OK);
+  ASSERT_EQ(size, strlen(kExpected));
+  ASSERT_EQ(memcmp(json, kExpected, size), 0);
+  fidl_ir_free(library);
+
+  END_TEST;
+}
+
+bool ir_invalid() {
+  BEGIN_TEST;
+
+  const char kUnknownIdentifier[] =
+      "{\"declaration_order\":[\"a/S\"],\"struct_declarations\":[{\"name\":\"a/S\",\"members\":"
+      "[{\"name\":\"t\",\"type\":{\"kind\":\"identifier\",\"identifier\":\"b/T\"},"
+      "\"field_shape_old\":{\"offset\":0,\"padding\":0},"
+      "\"field_shape_v1\":{\"offset\":0,\"padding\":0}}],"
+      "\"type_shape_old\":{\"inline_size\":8,\"alignment\":8},"
+      "\"type_shape_v1\":{\"inline_size\":8,\"alignment\":8}}]}";
+  const char* inputs[] = {
+      "", "{", "[]", "{\"declaration_order\":[]", "{\"a\":1}x", "{\"a\":\"\\q\"}",
+      kUnknownIdentifier,
+  };
+  for (const char* input : inputs) {
+    fidl_ir_library_t* library;
+    const char* error = nullptr;
+    ASSERT_EQ(fidl_ir_load(input, static_cast<uint32_t>(strlen(input)), &library, &error),
+              ZX_ERR_INVALID_ARGS);
+    ASSERT_TRUE(error != nullptr);
+  }
+
+  // IR written before wire format shapes were added to it.
+  std::ifstream file("example_v1_no_ee.fidl.json");
+  const std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  ASSERT_TRUE(!json.empty());
+  fidl_ir_library_t* library;
+  const char* error = nullptr;
+  ASSERT_EQ(fidl_ir_load(json.data(), static_cast<uint32_t>(json.size()), &library, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "IR has no old and v1 type shapes"), 0);
+
+  END_TEST;
+}
+
+// A top-level struct holding a single table or xunion, as in `DO_X_TEST`.
+struct WrappedType {
+  WrappedType(const fidl_type_t* type, uint32_t size)
+      : field(type, 0u, 0u, &field),
+        coded_struct(&field, 1, size, "Wrapped", &coded_struct),
+        wrapped(coded_struct) {}
+  WrappedType(const WrappedType&) = delete;
+
+  fidl::FidlStructField field;
+  fidl::FidlCodedStruct coded_struct;
+  fidl_type wrapped;
+};
+
+bool run_evolve(const fidl_type_t* src_type, const fidl_type_t* dst_type, bool drop,
+                const uint8_t* src_bytes, uint32_t src_num_bytes, const uint8_t* expected_bytes,
+                uint32_t expected_num_bytes) {
+  BEGIN_HELPER;
+
+  uint8_t actual_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t actual_num_bytes;
+  memset(actual_bytes, 0xcc /* poison */, ZX_CHANNEL_MAX_MSG_BYTES);
+
+  fidl_evolve_options_t options = {};
+  options.drop_unknown_fields = drop;
+  const char* error = nullptr;
+  zx_status_t status =
+      fidl_transform_evolve(src_type, dst_type, &options, src_bytes, src_num_bytes, actual_bytes,
+                            &actual_num_bytes, &error);
+  if (error) {
+    printf("ERROR: %s\n", error);
+    print_trace(16);
+  }
+
+  ASSERT_EQ(status, ZX_OK);
+  ASSERT_TRUE(cmp_payload(actual_bytes, actual_num_bytes, expected_bytes, expected_num_bytes));
+
+  END_HELPER;
+}
+
+zx_status_t evolve_status(const fidl_type_t* src_type, const fidl_type_t* dst_type, bool drop,
+                          const uint8_t* src_bytes, uint32_t src_num_bytes, const char** error) {
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  fidl_evolve_options_t options = {};
+  options.drop_unknown_fields = drop;
+  return fidl_transform_evolve(src_type, dst_type, &options, src_bytes, src_num_bytes, dst_bytes,
+                               &dst_num_bytes, error);
+}
+
+bool evolve_table_fields() {
+  BEGIN_TEST;
+
+  // Table_StructWithReservedSandwich is an earlier version of
+  // Table_StructWithUint32Sandwich, whose fields 1 and 4 were reserved.
+  WrappedType older(&v1_example_Table_StructWithReservedSandwichTable, 16);
+  WrappedType newer(&v1_example_Table_StructWithUint32SandwichTable, 16);
+
+  // Unknown fields are forwarded as is, or dropped, trimming the envelopes
+  // after the last field kept.
+  ASSERT_TRUE(run_evolve(&newer.wrapped, &older.wrapped, false,
+                         table_structwithuint32sandwich_v1_and_old,
+                         sizeof(table_structwithuint32sandwich_v1_and_old),
+                         table_structwithuint32sandwich_v1_and_old,
+                         sizeof(table_structwithuint32sandwich_v1_and_old)));
+  ASSERT_TRUE(run_evolve(&newer.wrapped, &older.wrapped, true,
+                         table_structwithuint32sandwich_v1_and_old,
+                         sizeof(table_structwithuint32sandwich_v1_and_old),
+                         table_structwithreservedsandwich_v1_and_old,
+                         sizeof(table_structwithreservedsandwich_v1_and_old)));
+
+  // Fields added since are absent.
+  for (bool drop : {false, true}) {
+    ASSERT_TRUE(run_evolve(&older.wrapped, &newer.wrapped, drop,
+                           table_structwithreservedsandwich_v1_and_old,
+                           sizeof(table_structwithreservedsandwich_v1_and_old),
+                           table_structwithreservedsandwich_v1_and_old,
+                           sizeof(table_structwithreservedsandwich_v1_and_old)));
+  }
+
+  // Dropping a field which holds handles would leak them.
+  uint8_t with_handles[sizeof(table_structwithuint32sandwich_v1_and_old)];
+  memcpy(with_handles, table_structwithuint32sandwich_v1_and_old, sizeof(with_handles));
+  with_handles[0x14] = 1;  // vector<envelope>[0].num_handles
+  const char* error = nullptr;
+  ASSERT_EQ(evolve_status(&newer.wrapped, &older.wrapped, true, with_handles,
+                          sizeof(with_handles), &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "dropped field holds handles"), 0);
+
+  // Field 2 is a union in one version, and a struct in the other.
+  WrappedType unions(&v1_example_Table_UnionWithVector_StructSandwichTable, 16);
+  ASSERT_EQ(evolve_status(&unions.wrapped, &older.wrapped, false,
+                          table_unionwithvector_structsandwich_v1,
+                          sizeof(table_unionwithvector_structsandwich_v1), &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "field types differ between versions"), 0);
+
+  END_TEST;
+}
+
+bool evolve_xunion_variants() {
+  BEGIN_TEST;
+
+  // Versions of XUnionWithStruct before its variant was added, and strict.
+  const auto& coded_xunion = v1_example_XUnionWithStructTable.coded_xunion;
+  const fidl_type_t flexible_empty(
+      fidl::FidlCodedXUnion(0, nullptr, fidl::kNonnullable, "Empty", fidl::kFlexible));
+  const fidl_type_t strict_empty(
+      fidl::FidlCodedXUnion(0, nullptr, fidl::kNonnullable, "Empty", fidl::kStrict));
+  const fidl_type_t strict(fidl::FidlCodedXUnion(coded_xunion.field_count, coded_xunion.fields,
+                                                 fidl::kNonnullable, "Strict", fidl::kStrict));
+  WrappedType current(&v1_example_XUnionWithStructTable, 24);
+  WrappedType older(&flexible_empty, 24);
+  WrappedType older_strict(&strict_empty, 24);
+  WrappedType current_strict(&strict, 24);
+
+  // Variants unknown to a flexible destination are forwarded, and variants
+  // unknown to the source copied as is.
+  ASSERT_TRUE(run_evolve(&current.wrapped, &older.wrapped, true, xunionwithstruct_old_and_v1,
+                         sizeof(xunionwithstruct_old_and_v1), xunionwithstruct_old_and_v1,
+                         sizeof(xunionwithstruct_old_and_v1)));
+  ASSERT_TRUE(run_evolve(&older.wrapped, &current.wrapped, true, xunionwithstruct_old_and_v1,
+                         sizeof(xunionwithstruct_old_and_v1), xunionwithstruct_old_and_v1,
+                         sizeof(xunionwithstruct_old_and_v1)));
+  ASSERT_TRUE(run_evolve(&current.wrapped, &current_strict.wrapped, false,
+                         xunionwithstruct_old_and_v1, sizeof(xunionwithstruct_old_and_v1),
+                         xunionwithstruct_old_and_v1, sizeof(xunionwithstruct_old_and_v1)));
+
+  // Strict destinations reject them.
+  const char* error = nullptr;
+  ASSERT_EQ(evolve_status(&current.wrapped, &older_strict.wrapped, false,
+                          xunionwithstruct_old_and_v1, sizeof(xunionwithstruct_old_and_v1),
+                          &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "strict xunion has no such variant"), 0);
+  ASSERT_EQ(evolve_status(&current.wrapped, &current_strict.wrapped, false,
+                          xunionwithunknownordinal_old_and_v1,
+                          sizeof(xunionwithunknownordinal_old_and_v1), &error),
+            ZX_ERR_INVALID_ARGS);
+
+  // Envelopes of known variants must hold exactly their contents, as
+  // `fidl_transform` requires.
+  uint8_t lying[sizeof(xunionwithstruct_old_and_v1)];
+  memcpy(lying, xunionwithstruct_old_and_v1, sizeof(lying));
+  lying[8] = static_cast<uint8_t>(lying[8] + 8);  // envelope.num_bytes
+  ASSERT_EQ(evolve_status(&current.wrapped, &current.wrapped, false, lying, sizeof(lying),
+                          &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "envelope num_bytes does not match its contents"), 0);
+
+  END_TEST;
+}
+
+bool evolve_failure_path() {
+  BEGIN_TEST;
+
+  // The variant is unknown to the strict destination.
+  const fidl_type_t strict_empty(
+      fidl::FidlCodedXUnion(0, nullptr, fidl::kNonnullable, "Empty", fidl::kStrict));
+  WrappedType current(&v1_example_XUnionWithStructTable, 24);
+  WrappedType older_strict(&strict_empty, 24);
+  ASSERT_EQ(evolve_status(&current.wrapped, &older_strict.wrapped, false,
+                          xunionwithstruct_old_and_v1, sizeof(xunionwithstruct_old_and_v1),
+                          nullptr),
+            ZX_ERR_INVALID_ARGS);
+
+  // Evolve failures are recorded with their own marker, whose source is in the
+  // v1 wire format.
+  fidl_transform_failure_t failure;
+  ASSERT_TRUE(fidl_transform_last_failure(&failure));
+  ASSERT_EQ(failure.transformation, FIDL_TRANSFORMATION_EVOLVE);
+  ASSERT_TRUE(failure.type == &current.wrapped);
+  fidl_view_t message;
+  ASSERT_EQ(fidl_view_init_failure(&failure, xunionwithstruct_old_and_v1,
+                                   sizeof(xunionwithstruct_old_and_v1), &message, nullptr),
+            ZX_OK);
+  ASSERT_EQ(message.wire_format, FIDL_WIRE_FORMAT_V1);
+  char path[64];
+  uint32_t size;
+  ASSERT_EQ(fidl_view_path(&message, static_cast<uint32_t>(failure.src_offset), nullptr, nullptr,
+                           path, sizeof(path), &size, nullptr),
+            ZX_OK);
+  ASSERT_EQ(size, strlen("Wrapped.0"));
+  ASSERT_EQ(memcmp(path, "Wrapped.0", size), 0);
+
+  // It is not a transformation.
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  const char* error = nullptr;
+  ASSERT_EQ(fidl_transform(FIDL_TRANSFORMATION_EVOLVE, &current.wrapped,
+                           xunionwithstruct_old_and_v1, sizeof(xunionwithstruct_old_and_v1),
+                           dst_bytes, &dst_num_bytes, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "unsupported transformation"), 0);
+
+  // Sources which views cannot read are rejected.
+  for (fidl_transformation_t transformation :
+       {FIDL_TRANSFORMATION_NONE, FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD,
+        FIDL_TRANSFORMATION_V1_COMPACT_TO_V1}) {
+    failure.transformation = transformation;
+    ASSERT_EQ(fidl_view_init_failure(&failure, xunionwithstruct_old_and_v1,
+                                     sizeof(xunionwithstruct_old_and_v1), &message, nullptr),
+              ZX_ERR_INVALID_ARGS);
+  }
+
+  END_TEST;
+}
+
+bool detect_wire_format() {
+  BEGIN_TEST;
+
+  fidl_wire_format_t wire_format;
+  for (fidl_wire_format_t hint : {0u, FIDL_WIRE_FORMAT_OLD, FIDL_WIRE_FORMAT_V1}) {
+    ASSERT_EQ(fidl_detect_wire_format(&example_Sandwich1Table, &v1_example_Sandwich1Table, hint,
+                                      sandwich1_case1_old, sizeof(sandwich1_case1_old),
+                                      &wire_format, nullptr),
+              ZX_OK);
+    ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_OLD);
+    ASSERT_EQ(fidl_detect_wire_format(&example_Sandwich1Table, &v1_example_Sandwich1Table, hint,
+                                      sandwich1_case1_v1, sizeof(sandwich1_case1_v1),
+                                      &wire_format, nullptr),
+              ZX_OK);
+    ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_V1);
+    ASSERT_EQ(fidl_detect_wire_format(&example_Sandwich1WithOptUnionTable,
+                                      &v1_example_Sandwich1WithOptUnionTable, hint,
+                                      sandwich1_with_opt_union_absent_old,
+                                      sizeof(sandwich1_with_opt_union_absent_old), &wire_format,
+                                      nullptr),
+              ZX_OK);
+    ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_OLD);
+  }
+
+  // Tables are encoded the same in both wire formats, so the hint decides.
+  WrappedType old_table(&example_Table_StructWithUint32SandwichTable, 16);
+  WrappedType v1_table(&v1_example_Table_StructWithUint32SandwichTable, 16);
+  for (fidl_wire_format_t hint : {FIDL_WIRE_FORMAT_OLD, FIDL_WIRE_FORMAT_V1}) {
+    ASSERT_EQ(fidl_detect_wire_format(&old_table.wrapped, &v1_table.wrapped, hint,
+                                      table_structwithuint32sandwich_v1_and_old,
+                                      sizeof(table_structwithuint32sandwich_v1_and_old),
+                                      &wire_format, nullptr),
+              ZX_OK);
+    ASSERT_EQ(wire_format, hint);
+  }
+
+  // Messages truncated, or with bytes past their out-of-line objects, are in
+  // neither.
+  const char* error = nullptr;
+  ASSERT_EQ(fidl_detect_wire_format(&example_Sandwich1Table, &v1_example_Sandwich1Table, 0,
+                                    sandwich1_case1_v1, sizeof(sandwich1_case1_v1) - 8,
+                                    &wire_format, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_TRUE(error != nullptr);
+  uint8_t padded[sizeof(sandwich1_case1_v1) + 8] = {};
+  memcpy(padded, sandwich1_case1_v1, sizeof(sandwich1_case1_v1));
+  ASSERT_EQ(fidl_detect_wire_format(&example_Sandwich1Table, &v1_example_Sandwich1Table, 0,
+                                    padded, sizeof(padded), &wire_format, &error),
+            ZX_ERR_INVALID_ARGS);
+  ASSERT_EQ(strcmp(error, "message has bytes past its last out-of-line object"), 0);
+
+  END_TEST;
+}
+
+bool detect_wire_format_cached() {
+  BEGIN_TEST;
+
+  fidl_wire_format_cache_t cache = {};
+  fidl_wire_format_t wire_format;
+
+  // Ambiguous messages do not settle the wire format of the connection.
+  WrappedType old_table(&example_Table_StructWithUint32SandwichTable, 16);
+  WrappedType v1_table(&v1_example_Table_StructWithUint32SandwichTable, 16);
+  ASSERT_EQ(fidl_detect_wire_format_cached(&cache, &old_table.wrapped, &v1_table.wrapped, 0,
+                                           table_structwithuint32sandwich_v1_and_old,
+                                           sizeof(table_structwithuint32sandwich_v1_and_old),
+                                           &wire_format, nullptr),
+            ZX_OK);
+  ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_V1);
+  ASSERT_EQ(cache.num_detected, 1u);
+
+  // The first unambiguous one does, and later messages are not checked.
+  ASSERT_EQ(fidl_detect_wire_format_cached(&cache, &example_Sandwich1Table,
+                                           &v1_example_Sandwich1Table, 0, sandwich1_case1_old,
+                                           sizeof(sandwich1_case1_old), &wire_format, nullptr),
+            ZX_OK);
+  ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_OLD);
+  ASSERT_EQ(fidl_detect_wire_format_cached(&cache, &example_Sandwich1Table,
+                                           &v1_example_Sandwich1Table, 0, sandwich1_case1_v1,
+                                           sizeof(sandwich1_case1_v1), &wire_format, nullptr),
+            ZX_OK);
+  ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_OLD);
+  ASSERT_EQ(cache.num_detected, 2u);
+  ASSERT_EQ(cache.num_cached, 1u);
+
+  // Until reset after a mis-detection.
+  fidl_wire_format_cache_reset(&cache);
+  ASSERT_EQ(fidl_detect_wire_format_cached(&cache, &example_Sandwich1Table,
+                                           &v1_example_Sandwich1Table, 0, sandwich1_case1_v1,
+                                           sizeof(sandwich1_case1_v1), &wire_format, nullptr),
+            ZX_OK);
+  ASSERT_EQ(wire_format, FIDL_WIRE_FORMAT_V1);
+  ASSERT_EQ(cache.num_resets, 1u);
+
+  END_TEST;
+}
+
+bool shadow_verifier() {
+  BEGIN_TEST;
+
+  char path[] = "/tmp/shadow_verifier_test.XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_TRUE(fd >= 0);
+  close(fd);
+
+  // The source may have non-zero padding.
+  uint8_t dirty_v1[sizeof(sandwich1_case1_v1)];
+  memcpy(dirty_v1, sandwich1_case1_v1, sizeof(dirty_v1));
+  dirty_v1[4] = 0xab;  // Sandwich1.before (padding)
+  uint8_t wrong_v1[sizeof(sandwich1_case1_v1)];
+  memcpy(wrong_v1, sandwich1_case1_v1, sizeof(wrong_v1));
+  wrong_v1[32] = 0xff;  // Sandwich1.after
+
+  {
+    ShadowVerifier::Options options;
+    options.sample_every = 1;
+    options.capture_path = path;
+    ShadowVerifier verifier(options);
+    verifier.Observe(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich1Table,
+                     &v1_example_Sandwich1Table, sandwich1_case1_old, sizeof(sandwich1_case1_old),
+                     sandwich1_case1_v1, sizeof(sandwich1_case1_v1));
+    verifier.Observe(FIDL_TRANSFORMATION_V1_TO_OLD, &v1_example_Sandwich1Table,
+                     &example_Sandwich1Table, dirty_v1, sizeof(dirty_v1), sandwich1_case1_old,
+                     sizeof(sandwich1_case1_old));
+    verifier.Observe(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich1Table,
+                     &v1_example_Sandwich1Table, sandwich1_case1_old, sizeof(sandwich1_case1_old),
+                     wrong_v1, sizeof(wrong_v1));
+    verifier.Drain();
+
+    const ShadowVerifier::Stats stats = verifier.stats();
+    ASSERT_EQ(stats.observed, 3u);
+    ASSERT_EQ(stats.sampled, 3u);
+    ASSERT_EQ(stats.skipped, 0u);
+    ASSERT_EQ(stats.verified, 3u);
+    ASSERT_EQ(stats.mismatches, 1u);
+    ASSERT_EQ(stats.capture_errors, 0u);
+  }
+
+  // The mismatch is recorded as its source and output.
+  CaptureReader reader;
+  CaptureRecord record;
+  ASSERT_TRUE(reader.Open(path));
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(record.wire_format, kCaptureWireFormatOld);
+  ASSERT_TRUE(record.name == "example/Sandwich1");
+  ASSERT_TRUE(cmp_payload(record.bytes.data(), static_cast<uint32_t>(record.bytes.size()),
+                          sandwich1_case1_old, sizeof(sandwich1_case1_old)));
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(record.wire_format, kCaptureWireFormatV1);
+  ASSERT_TRUE(cmp_payload(record.bytes.data(), static_cast<uint32_t>(record.bytes.size()),
+                          wrong_v1, sizeof(wrong_v1)));
+  ASSERT_TRUE(!reader.Next(&record));
+  unlink(path);
+
+  // Only 1 in N messages are sampled.
+  ShadowVerifier::Options options;
+  options.sample_every = 2;
+  ShadowVerifier verifier(options);
+  for (int i = 0; i < 5; i++) {
+    verifier.Observe(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich1Table,
+                     &v1_example_Sandwich1Table, sandwich1_case1_old, sizeof(sandwich1_case1_old),
+                     sandwich1_case1_v1, sizeof(sandwich1_case1_v1));
+  }
+  verifier.Drain();
+  ASSERT_EQ(verifier.stats().sampled, 3u);
+  ASSERT_EQ(verifier.stats().mismatches, 0u);
+
+  END_TEST;
+}
+
+// Lists the captures (and the checkpoint) of |dir|.
+std::vector<std::string> list_dir(const std::string& dir) {
+  std::vector<std::string> names;
+  if (DIR* entries = opendir(dir.c_str())) {
+    while (const dirent* entry = readdir(entries)) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(entries);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+bool find_catalog_types(const std::string& name, const fidl_type_t** out_old_type,
+                        const fidl_type_t** out_v1_type) {
+  for (const auto& entry : kCatalog) {
+    if (name == entry.name) {
+      *out_old_type = entry.old_type;
+      *out_v1_type = entry.v1_type;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool migration_resumes() {
+  BEGIN_TEST;
+
+  char root[] = "/tmp/migration_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(root) != nullptr);
+  Migration::Options options;
+  options.src_dir = std::string(root) + "/src";
+  options.dst_dir = std::string(root) + "/dst";
+  options.threads = 2;
+  options.verify_every = 1;
+  options.find_types = find_catalog_types;
+  ASSERT_EQ(mkdir(options.src_dir.c_str(), 0777), 0);
+  const char* const kCaptures[] = {"a.cap", "b.cap", "c.cap", "d.cap", "e.cap"};
+  for (const char* name : kCaptures) {
+    CaptureWriter writer;
+    ASSERT_TRUE(writer.Open((options.src_dir + "/" + name).c_str()));
+    ASSERT_TRUE(writer.Write(kCaptureWireFormatOld, "example/Sandwich1", sandwich1_case1_old,
+                             sizeof(sandwich1_case1_old), 0));
+    ASSERT_TRUE(writer.Write(kCaptureWireFormatV1, "example/Sandwich1", sandwich1_case1_v1,
+                             sizeof(sandwich1_case1_v1), 0));
+    ASSERT_TRUE(writer.Close());
+  }
+
+  // The first job is stopped after two captures.
+  std::string failed_path;
+  std::vector<Migration::WorkerStats> stats;
+  {
+    options.max_captures = 2;
+    Migration migration(options);
+    ASSERT_TRUE(migration.Prepare(&failed_path));
+    ASSERT_EQ(migration.num_captures(), 5u);
+    ASSERT_EQ(migration.num_completed(), 0u);
+    ASSERT_EQ(migration.num_pending(), 2u);
+    migration.Run(&stats);
+    ASSERT_EQ(stats[0].captures + stats[1].captures, 2u);
+    ASSERT_EQ(stats[0].failures + stats[1].failures, 0u);
+  }
+  std::vector<std::string> dst = list_dir(options.dst_dir);
+  ASSERT_EQ(dst.size(), 3u);
+  ASSERT_TRUE(dst[0] == ".migrate-checkpoint");
+
+  // The restarted job skips the captures recorded in the checkpoint, and
+  // migrates the others.
+  {
+    options.max_captures = 0;
+    Migration migration(options);
+    ASSERT_TRUE(migration.Prepare(&failed_path));
+    ASSERT_EQ(migration.num_completed(), 2u);
+    ASSERT_EQ(migration.num_pending(), 3u);
+    migration.Run(&stats);
+    ASSERT_EQ(stats[0].captures + stats[1].captures, 3u);
+    ASSERT_EQ(stats[0].failures + stats[1].failures, 0u);
+  }
+  {
+    Migration migration(options);
+    ASSERT_TRUE(migration.Prepare(&failed_path));
+    ASSERT_EQ(migration.num_completed(), 5u);
+    ASSERT_EQ(migration.num_pending(), 0u);
+  }
+
+  // Every capture is present once, in v1, and no temporary file is left.
+  dst = list_dir(options.dst_dir);
+  ASSERT_EQ(dst.size(), 6u);
+  for (size_t i = 0; i < 5; i++) {
+    ASSERT_TRUE(dst[i + 1] == kCaptures[i]);
+    CaptureReader reader;
+    CaptureRecord record;
+    ASSERT_TRUE(reader.Open((options.dst_dir + "/" + kCaptures[i]).c_str()));
+    for (int j = 0; j < 2; j++) {
+      ASSERT_TRUE(reader.Next(&record));
+      ASSERT_EQ(record.wire_format, kCaptureWireFormatV1);
+      ASSERT_TRUE(cmp_payload(record.bytes.data(), record.bytes.size(), sandwich1_case1_v1,
+                              sizeof(sandwich1_case1_v1)));
+    }
+    ASSERT_TRUE(!reader.Next(&record));
+  }
+  std::ifstream checkpoint(options.dst_dir + "/.migrate-checkpoint");
+  std::vector<std::string> completed;
+  for (std::string line; std::getline(checkpoint, line);) {
+    completed.push_back(line);
+  }
+  ASSERT_EQ(completed.size(), 5u);
+
+  for (const auto& name : dst) {
+    unlink((options.dst_dir + "/" + name).c_str());
+  }
+  for (const char* name : kCaptures) {
+    unlink((options.src_dir + "/" + name).c_str());
+  }
+  rmdir(options.dst_dir.c_str());
+  rmdir(options.src_dir.c_str());
+  rmdir(root);
+
+  END_TEST;
+}
+
+namespace engine_selector_test {
+
+uint32_t num_counted = 0;
+
+zx_status_t CountingTransform(fidl_transformation_t transformation, const fidl_type_t* type,
+                              const uint8_t* src_bytes, uint32_t src_num_bytes,
+                              uint8_t* dst_bytes, uint32_t* out_dst_num_bytes,
+                              const char** out_error_msg) {
+  num_counted++;
+  return fidl_transform(transformation, type, src_bytes, src_num_bytes, dst_bytes,
+                        out_dst_num_bytes, out_error_msg);
+}
+
+zx_status_t FaultyTransform(fidl_transformation_t transformation, const fidl_type_t* type,
+                            const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
+                            uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  const zx_status_t status = fidl_transform(transformation, type, src_bytes, src_num_bytes,
+                                            dst_bytes, out_dst_num_bytes, out_error_msg);
+  dst_bytes[*out_dst_num_bytes - 1] ^= 1;
+  return status;
+}
+
+zx_status_t SlowTransform(fidl_transformation_t transformation, const fidl_type_t* type,
+                          const uint8_t* src_bytes, uint32_t src_num_bytes, uint8_t* dst_bytes,
+                          uint32_t* out_dst_num_bytes, const char** out_error_msg) {
+  zx_status_t status = ZX_OK;
+  for (int i = 0; i < 200; i++) {
+    status = fidl_transform(transformation, type, src_bytes, src_num_bytes, dst_bytes,
+                            out_dst_num_bytes, out_error_msg);
+  }
+  return status;
+}
+
+const TransformEngine kCountingEngine = {"counting", CountingTransform};
+const TransformEngine kFaultyEngine = {"faulty", FaultyTransform};
+const TransformEngine kSlowEngine = {"slow", SlowTransform};
+
+}  // namespace engine_selector_test
+
+bool engine_selector() {
+  BEGIN_TEST;
+
+  using namespace engine_selector_test;
+  EngineSelector::Options options;
+  options.compare_every = 2;
+  options.max_types = 1;
+  EngineSelector selector(&kTransformEngine, options);
+  uint8_t dst_bytes[ZX_CHANNEL_MAX_MSG_BYTES];
+  uint32_t dst_num_bytes;
+  const auto transform = [&]() {
+    return selector.Transform(FIDL_TRANSFORMATION_OLD_TO_V1, &example_Sandwich1Table,
+                              sandwich1_case1_old, sizeof(sandwich1_case1_old), dst_bytes,
+                              &dst_num_bytes, nullptr) == ZX_OK &&
+           cmp_payload(dst_bytes, dst_num_bytes, sandwich1_case1_v1, sizeof(sandwich1_case1_v1));
+  };
+
+  // Types are transformed with the default engine until configured.
+  ASSERT_TRUE(transform());
+  ASSERT_TRUE(selector.comparison(&example_Sandwich1Table).selected == nullptr);
+  ASSERT_TRUE(selector.Select(&example_Sandwich1Table, &kCountingEngine));
+  ASSERT_TRUE(!selector.Select(&example_Sandwich2Table, &kCountingEngine));
+  ASSERT_TRUE(transform());
+  ASSERT_EQ(num_counted, 1u);
+
+  // Every other message is compared, and the output is the selected engine's.
+  ASSERT_TRUE(selector.Compare(&example_Sandwich1Table, &kLargeTransformEngine));
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(transform());
+  }
+  ASSERT_EQ(num_counted, 5u);
+  EngineSelector::Comparison stats = selector.comparison(&example_Sandwich1Table);
+  ASSERT_TRUE(stats.selected == &kCountingEngine);
+  ASSERT_TRUE(stats.candidate == &kLargeTransformEngine);
+  ASSERT_EQ(stats.transformed, 4u);
+  ASSERT_EQ(stats.compared, 2u);
+  ASSERT_EQ(stats.mismatches, 0u);
+  uint64_t histogram_total = 0;
+  for (uint64_t count : stats.ratio_histogram) {
+    histogram_total += count;
+  }
+  ASSERT_EQ(histogram_total, 2u);
+  ASSERT_TRUE(!selector.Promote(&example_Sandwich1Table, 3));
+
+  // Candidates which disagree with the selected engine are never promoted.
+  ASSERT_TRUE(selector.Compare(&example_Sandwich1Table, &kFaultyEngine));
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(transform());
+  }
+  stats = selector.comparison(&example_Sandwich1Table);
+  ASSERT_EQ(stats.compared, 2u);
+  ASSERT_EQ(stats.mismatches, 2u);
+  ASSERT_TRUE(!selector.Promote(&example_Sandwich1Table, 1));
+
+  // Faster candidates are.
+  ASSERT_TRUE(selector.Select(&example_Sandwich1Table, &kSlowEngine));
+  ASSERT_TRUE(selector.Compare(&example_Sandwich1Table, &kTransformEngine));
+  for (int i = 0; i < 8; i++) {
+    ASSERT_TRUE(transform());
+  }
+  stats = selector.comparison(&example_Sandwich1Table);
+  ASSERT_EQ(stats.mismatches, 0u);
+  ASSERT_TRUE(stats.candidate_ns < stats.selected_ns);
+  ASSERT_TRUE(stats.ratio_histogram[0] > 0);
+  ASSERT_TRUE(selector.Promote(&example_Sandwich1Table, 4));
+  stats = selector.comparison(&example_Sandwich1Table);
+  ASSERT_TRUE(stats.selected == &kTransformEngine);
+  ASSERT_TRUE(stats.candidate == nullptr);
+
+  END_TEST;
+}
+
 BEGIN_TEST_CASE(transformer)
 RUN_TEST(sandwich1)
 RUN_TEST(sandwich1_with_opt_union_present)
@@ -1619,4 +5258,60 @@ RUN_TEST(table_unionwithvector_structsandwich)
 RUN_TEST(xunionwithstruct)
 RUN_TEST(xunionwithunknownordinal)
 RUN_TEST(arraystruct)
+RUN_TEST(trace_records_failure)
+RUN_TEST(trace_persisted_on_failure)
+RUN_TEST(explain_sandwich1)
+RUN_TEST(explain_identity)
+RUN_TEST(explain_compact)
+RUN_TEST(cost_model_fit)
+RUN_TEST(generated_messages_round_trip)
+RUN_TEST(sandwich1_compact)
+RUN_TEST(table_structwithuint32sandwich_compact)
+RUN_TEST(generated_messages_compact_round_trip)
+RUN_TEST(sandwich1_storage)
+RUN_TEST(generated_messages_storage_round_trip)
+RUN_TEST(generated_messages_large_mode)
+RUN_TEST(vector_size_overflow)
+RUN_TEST(vector_count_above_32_bits)
+RUN_TEST(sandwich1_canonical)
+RUN_TEST(generated_messages_canonical)
+RUN_TEST(structural_hash)
+RUN_TEST(transform_checksum)
+RUN_TEST(string_validation)
+RUN_TEST(sandwich1_view)
+RUN_TEST(table_view)
+RUN_TEST(arraystruct_view)
+RUN_TEST(generated_messages_view)
+RUN_TEST(table_projection)
+RUN_TEST(generated_messages_projection)
+RUN_TEST(table_index)
+RUN_TEST(generated_messages_index)
+RUN_TEST(sandwich6_case5_handles)
+RUN_TEST(handle_object_type)
+RUN_TEST(generated_messages_handles)
+RUN_TEST(sandwich6_case8_failure_path)
+RUN_TEST(sandwich6_case8_validate)
+RUN_TEST(sandwich5_truncated)
+RUN_TEST(generated_messages_validate)
+RUN_TEST(sandwich1_filter)
+RUN_TEST(table_filter)
+RUN_TEST(generated_messages_filter)
+RUN_TEST(size5alignment4vector_columns)
+RUN_TEST(arraystruct_columns)
+RUN_TEST(generated_messages_columns)
+RUN_TEST(sandwich1_json)
+RUN_TEST(arraystruct_json)
+RUN_TEST(generated_messages_json)
+RUN_TEST(ir_matches_compiled_tables)
+RUN_TEST(ir_generated_messages_round_trip)
+RUN_TEST(ir_describe_json)
+RUN_TEST(ir_invalid)
+RUN_TEST(evolve_table_fields)
+RUN_TEST(evolve_xunion_variants)
+RUN_TEST(evolve_failure_path)
+RUN_TEST(detect_wire_format)
+RUN_TEST(detect_wire_format_cached)
+RUN_TEST(shadow_verifier)
+RUN_TEST(migration_resumes)
+RUN_TEST(engine_selector)
 END_TEST_CASE(transformer)
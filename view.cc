@@ -0,0 +1,158 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/fidl/view.h>
+#include <lib/fidl/view_internal.h>
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+using fidl::internal::ToWireFormat;
+using fidl::internal::ViewedStruct;
+using fidl::internal::ViewReader;
+using fidl::internal::WireFormat;
+
+}  // namespace
+
+zx_status_t fidl_view_init(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                           const uint8_t* bytes, uint32_t num_bytes, fidl_view_t* out_view,
+                           const char** out_error_msg) {
+  WireFormat format;
+  if (!ToWireFormat(wire_format, &format)) {
+    if (out_error_msg) {
+      *out_error_msg = "unsupported wire format";
+    }
+    return ZX_ERR_INVALID_ARGS;
+  }
+  fidl_view_t message = {};
+  message.bytes = bytes;
+  message.num_bytes = num_bytes;
+  message.wire_format = wire_format;
+  ViewReader reader(message);
+  reader.Root(type, out_view);
+  return reader.Result(out_error_msg);
+}
+
+zx_status_t fidl_view_init_failure(const fidl_transform_failure_t* failure, const uint8_t* bytes,
+                                   uint32_t num_bytes, fidl_view_t* out_view,
+                                   const char** out_error_msg) {
+  switch (failure->transformation) {
+    case FIDL_TRANSFORMATION_OLD_TO_V1:
+    case FIDL_TRANSFORMATION_OLD_TO_V1_COMPACT:
+      return fidl_view_init(FIDL_WIRE_FORMAT_OLD, failure->type, bytes, num_bytes, out_view,
+                            out_error_msg);
+    case FIDL_TRANSFORMATION_V1_TO_OLD:
+    case FIDL_TRANSFORMATION_V1_TO_V1_COMPACT:
+    case FIDL_TRANSFORMATION_EVOLVE:
+      return fidl_view_init(FIDL_WIRE_FORMAT_V1, failure->type, bytes, num_bytes, out_view,
+                            out_error_msg);
+    case FIDL_TRANSFORMATION_V1_COMPACT_TO_OLD:
+    case FIDL_TRANSFORMATION_V1_COMPACT_TO_V1:
+      if (out_error_msg) {
+        *out_error_msg = "views do not read the compact v1 wire format";
+      }
+      return ZX_ERR_INVALID_ARGS;
+    default:
+      if (out_error_msg) {
+        *out_error_msg = "no source wire format for this transformation";
+      }
+      return ZX_ERR_INVALID_ARGS;
+  }
+}
+
+zx_status_t fidl_view_field(const fidl_view_t* view, uint32_t index, fidl_view_t* out_view,
+                            const char** out_error_msg) {
+  ViewReader reader(*view);
+  reader.Field(index, out_view);
+  return reader.Result(out_error_msg);
+}
+
+zx_status_t fidl_view_read(const fidl_view_t* view, uint32_t offset, void* out_data,
+                           uint32_t size, const char** out_error_msg) {
+  ViewReader reader(*view);
+  reader.ReadData(offset, out_data, size);
+  return reader.Result(out_error_msg);
+}
+
+bool fidl_view_is_present(const fidl_view_t* view) {
+  ViewReader reader(*view);
+  return reader.IsPresent();
+}
+
+zx_status_t fidl_view_variant(const fidl_view_t* view, uint32_t* out_variant,
+                              fidl_view_t* out_view, const char** out_error_msg) {
+  ViewReader reader(*view);
+  reader.Variant(out_variant, out_view);
+  return reader.Result(out_error_msg);
+}
+
+zx_status_t fidl_view_count(const fidl_view_t* view, uint32_t* out_count,
+                            const char** out_error_msg) {
+  ViewReader reader(*view);
+  reader.Count(out_count);
+  return reader.Result(out_error_msg);
+}
+
+zx_status_t fidl_view_element(const fidl_view_t* view, uint32_t index, fidl_view_t* out_view,
+                              const char** out_error_msg) {
+  ViewReader reader(*view);
+  reader.Element(index, out_view);
+  return reader.Result(out_error_msg);
+}
+
+zx_status_t fidl_view_table_field(const fidl_view_t* view, uint32_t ordinal,
+                                  fidl_view_t* out_view, const char** out_error_msg) {
+  ViewReader reader(*view);
+  reader.TableField(ordinal, out_view);
+  return reader.Result(out_error_msg);
+}
+
+zx_status_t fidl_view_materialize(const fidl_view_t* view, fidl_wire_format_t wire_format,
+                                  uint8_t* out_bytes, uint32_t* out_num_bytes,
+                                  const char** out_error_msg) {
+  WireFormat format;
+  if (!ToWireFormat(wire_format, &format)) {
+    if (out_error_msg) {
+      *out_error_msg = "unsupported wire format";
+    }
+    return ZX_ERR_INVALID_ARGS;
+  }
+  ViewReader reader(*view);
+  uint32_t end;
+  if (!reader.StructEnd(&end)) {
+    return reader.Result(out_error_msg);
+  }
+  const fidl::FidlCodedStruct& coded_struct = *ViewedStruct(view->type);
+  const uint32_t inline_size = static_cast<uint32_t>(fidl::FidlAlign(coded_struct.size));
+  const uint32_t out_of_line_size = end - view->out_of_line_offset;
+  const uint32_t num_bytes = inline_size + out_of_line_size;
+
+  // The struct is laid out as a message if its out-of-line objects follow it,
+  // as they do for the top-level struct and the targets of pointers and
+  // envelopes. Otherwise (e.g. for vector elements), the message is assembled.
+  auto assemble = [&](uint8_t* message) {
+    memcpy(message, &view->bytes[view->offset], coded_struct.size);
+    memset(&message[coded_struct.size], 0, inline_size - coded_struct.size);
+    memcpy(&message[inline_size], &view->bytes[view->out_of_line_offset], out_of_line_size);
+  };
+  if (wire_format == view->wire_format) {
+    assemble(out_bytes);
+    *out_num_bytes = num_bytes;
+    return ZX_OK;
+  }
+  const uint8_t* src_bytes = &view->bytes[view->offset];
+  std::vector<uint8_t> assembled;
+  if (view->offset + inline_size != view->out_of_line_offset) {
+    assembled.resize(num_bytes);
+    assemble(assembled.data());
+    src_bytes = assembled.data();
+  }
+  const fidl_type_t struct_type(coded_struct);
+  return fidl_transform(format == WireFormat::kOld ? FIDL_TRANSFORMATION_V1_TO_OLD
+                                                   : FIDL_TRANSFORMATION_OLD_TO_V1,
+                        &struct_type, src_bytes, num_bytes, out_bytes, out_num_bytes,
+                        out_error_msg);
+}
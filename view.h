@@ -0,0 +1,125 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_VIEW_H_
+#define LIB_FIDL_VIEW_H_
+
+#include "fidl.h"
+#include "transformer.h"
+
+// __BEGIN_CDECLS
+
+// Views read individual objects of an encoded message, in either wire format,
+// without transforming it. Consumers which only need a few fields of a large
+// message can therefore read them in place, whichever wire format the message
+// was sent in, and only transform the sub-trees they need in full (see
+// `fidl_view_materialize`).
+//
+// Finding an object only walks the objects before it in the message which have
+// out-of-line objects of their own (as their out-of-line objects precede those
+// of the object). The contents of envelopes (of tables, xunions and v1 static
+// unions) are skipped using their |num_bytes|, without walking them.
+//
+// Views do not validate the message as a whole, only what they read. Messages
+// in the compact v1 wire format must be transformed to v1 first.
+//
+// All functions below return `ZX_OK` upon success. Upon failure (and if
+// provided) they write an error message to |out_error_msg|, and return:
+//
+// - `ZX_ERR_NOT_FOUND` if the requested object is absent (e.g. an absent
+//   struct pointer, table field, or the variant of an empty xunion),
+// - `ZX_ERR_OUT_OF_RANGE` if an index is past the end of a vector or array,
+// - `ZX_ERR_INVALID_ARGS` if the request does not apply to the viewed object,
+//   or the message is malformed.
+
+// A view of one object of a message. Views are plain values, which refer to the
+// message bytes without owning them; the message must outlive them.
+typedef struct {
+  // Private.
+  const uint8_t* bytes;
+  uint32_t num_bytes;
+  fidl_wire_format_t wire_format;
+  // Coding table of the object, in |wire_format|. Null for objects without a
+  // coding table (e.g. primitive union variants), which are |size| raw bytes.
+  // Struct and union pointers are always present, and refer to the struct or
+  // union they point to.
+  const fidl_type_t* type;
+  uint32_t size;
+  // Offset of the object, and of its first out-of-line object.
+  uint32_t offset;
+  uint32_t out_of_line_offset;
+} fidl_view_t;
+
+// Stores into |out_view| a view of the message |bytes| of top-level struct
+// |type|, in |wire_format|.
+zx_status_t fidl_view_init(fidl_wire_format_t wire_format, const fidl_type_t* type,
+                           const uint8_t* bytes, uint32_t num_bytes, fidl_view_t* out_view,
+                           const char** out_error_msg);
+
+// Stores into |out_view| a view of the source |bytes| of the transformation
+// which recorded |failure|, in the wire format it was read in (v1 for
+// `FIDL_TRANSFORMATION_EVOLVE`). Fails with `ZX_ERR_INVALID_ARGS` for sources
+// in the compact v1 wire format, which views do not read, and for
+// transformations which do not fail (`FIDL_TRANSFORMATION_NONE`) or are
+// unknown.
+zx_status_t fidl_view_init_failure(const fidl_transform_failure_t* failure, const uint8_t* bytes,
+                                   uint32_t num_bytes, fidl_view_t* out_view,
+                                   const char** out_error_msg);
+
+// Stores into |out_view| a view of the |index|-th field of the viewed struct
+// which has a coding table (e.g. the second string, vector, handle, union or
+// nested struct field), counting from 0. Indices are the same in both wire
+// formats. Struct and union pointer fields are followed.
+zx_status_t fidl_view_field(const fidl_view_t* view, uint32_t index, fidl_view_t* out_view,
+                            const char** out_error_msg);
+
+// Copies |size| bytes at |offset| of the viewed object into |out_data|.
+//
+// For structs, |offset| is the offset of a primitive member (one without a
+// coding table) in the old wire format, whichever wire format the message is
+// in, and the |size| bytes must lie within primitive members.
+//
+// For strings and vectors, |offset| is within their data. For other objects,
+// |offset| is within the object.
+zx_status_t fidl_view_read(const fidl_view_t* view, uint32_t offset, void* out_data,
+                           uint32_t size, const char** out_error_msg);
+
+// Returns whether the viewed handle, string, vector or xunion is present. Other
+// objects are always present.
+bool fidl_view_is_present(const fidl_view_t* view);
+
+// Stores the variant of the viewed static union (its index, the same in both
+// wire formats) or xunion (its ordinal) into |out_variant|, and a view of its
+// data into |out_view|. The data of unknown xunion variants is viewed as raw
+// bytes.
+zx_status_t fidl_view_variant(const fidl_view_t* view, uint32_t* out_variant,
+                              fidl_view_t* out_view, const char** out_error_msg);
+
+// Stores the number of elements of the viewed string (its size), vector or
+// array into |out_count|. Absent strings and vectors have no elements.
+zx_status_t fidl_view_count(const fidl_view_t* view, uint32_t* out_count,
+                            const char** out_error_msg);
+
+// Stores into |out_view| a view of the |index|-th element of the viewed string,
+// vector or array.
+zx_status_t fidl_view_element(const fidl_view_t* view, uint32_t index, fidl_view_t* out_view,
+                              const char** out_error_msg);
+
+// Stores into |out_view| a view of the field |ordinal| of the viewed table. The
+// contents of unknown fields are viewed as raw bytes.
+zx_status_t fidl_view_table_field(const fidl_view_t* view, uint32_t ordinal,
+                                  fidl_view_t* out_view, const char** out_error_msg);
+
+// Writes the viewed struct, and the objects it refers to, into |out_bytes| as a
+// message of that struct in |wire_format|, transforming it if needed.
+//
+// Upon success, stores the size of the message into |out_num_bytes|. As with
+// `fidl_transform`, |out_bytes| must have room for the whole message.
+zx_status_t fidl_view_materialize(const fidl_view_t* view, fidl_wire_format_t wire_format,
+                                  uint8_t* out_bytes, uint32_t* out_num_bytes,
+                                  const char** out_error_msg);
+
+// __END_CDECLS
+
+#endif  // LIB_FIDL_VIEW_H_
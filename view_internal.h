@@ -0,0 +1,660 @@
+// Copyright 2019 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LIB_FIDL_VIEW_INTERNAL_H_
+#define LIB_FIDL_VIEW_INTERNAL_H_
+
+// The reader behind views (see `view.h`), shared by the modules which walk
+// messages through views. Not part of the public API.
+
+#include <cassert>
+#include <cstring>
+
+#include "transformer_internal.h"
+#include "view.h"
+
+namespace fidl {
+namespace internal {
+
+// Out-of-line objects nested deeper than this are rejected when skipped, so
+// that corrupt messages cannot exhaust the stack (see also storage.cc).
+constexpr uint32_t kViewMaxDepth = 128;
+
+inline bool ToWireFormat(fidl_wire_format_t wire_format, WireFormat* out_wire_format) {
+  switch (wire_format) {
+    case FIDL_WIRE_FORMAT_OLD:
+      *out_wire_format = WireFormat::kOld;
+      return true;
+    case FIDL_WIRE_FORMAT_V1:
+      *out_wire_format = WireFormat::kV1;
+      return true;
+  }
+  return false;
+}
+
+inline const fidl::FidlCodedStruct* ViewedStruct(const fidl_type_t* type) {
+  if (!type) {
+    return nullptr;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypeStruct:
+      return &type->coded_struct;
+    case fidl::kFidlTypeStructPointer:
+      return type->coded_struct_pointer.struct_type;
+    default:
+      return nullptr;
+  }
+}
+
+inline const fidl::FidlCodedUnion* ViewedUnion(const fidl_type_t* type) {
+  if (!type) {
+    return nullptr;
+  }
+  switch (type->type_tag) {
+    case fidl::kFidlTypeUnion:
+      return &type->coded_union;
+    case fidl::kFidlTypeUnionPointer:
+      return type->coded_union_pointer.union_type;
+    default:
+      return nullptr;
+  }
+}
+
+inline bool IsVector(const fidl_type_t* type) {
+  return type &&
+         (type->type_tag == fidl::kFidlTypeString || type->type_tag == fidl::kFidlTypeVector);
+}
+
+// Reads the objects of a message through a view, checking every read against
+// the bounds of the message. Besides the operations of `view.h`, its building
+// blocks (e.g. claiming out-of-line objects, and skipping objects) are used by
+// the other walkers over views, which report their failures through it.
+class ViewReader final {
+ public:
+  explicit ViewReader(const fidl_view_t& view)
+      : view_(view),
+        wire_format_(view.wire_format == FIDL_WIRE_FORMAT_V1 ? WireFormat::kV1
+                                                              : WireFormat::kOld) {}
+
+  bool Field(uint32_t index, fidl_view_t* out_view) {
+    const auto* coded_struct = ViewedStruct(view_.type);
+    if (!coded_struct) {
+      return Fail(ZX_ERR_INVALID_ARGS, "view is not a struct");
+    }
+    uint32_t out_of_line_offset = view_.out_of_line_offset;
+    uint32_t coded_index = 0;
+    for (uint32_t i = 0; i < coded_struct->field_count; i++) {
+      const auto& field = coded_struct->fields[i];
+      if (!field.type) {
+        continue;
+      }
+      if (coded_index++ == index) {
+        return View(field.type, InlineSize(field.type, wire_format_), view_.offset + field.offset,
+                    out_of_line_offset, out_view);
+      }
+      if (!Skip(field.type, view_.offset + field.offset, &out_of_line_offset, 0)) {
+        return false;
+      }
+    }
+    return Fail(ZX_ERR_OUT_OF_RANGE, "struct has no such field");
+  }
+
+  bool ReadData(uint32_t offset, void* out_data, uint32_t size) {
+    if (const auto* coded_struct = ViewedStruct(view_.type)) {
+      uint32_t member_offset;
+      if (!MemberOffset(*coded_struct, offset, size, &member_offset)) {
+        return false;
+      }
+      return Read(view_.offset + member_offset, out_data, size);
+    }
+    if (IsVector(view_.type)) {
+      uint32_t data_offset, data_size;
+      if (!VectorData(&data_offset, &data_size, nullptr)) {
+        return false;
+      }
+      if (static_cast<uint64_t>(offset) + size > data_size) {
+        return Fail(ZX_ERR_OUT_OF_RANGE, "read is past the end of the vector or string");
+      }
+      return Read(data_offset + offset, out_data, size);
+    }
+    if (static_cast<uint64_t>(offset) + size > view_.size) {
+      return Fail(ZX_ERR_OUT_OF_RANGE, "read is past the end of the object");
+    }
+    return Read(view_.offset + offset, out_data, size);
+  }
+
+  bool IsPresent() {
+    if (!view_.type) {
+      return true;
+    }
+    switch (view_.type->type_tag) {
+      case fidl::kFidlTypeHandle: {
+        uint32_t handle;
+        return Read(view_.offset, &handle, sizeof(handle)) && handle != FIDL_HANDLE_ABSENT;
+      }
+      case fidl::kFidlTypeString:
+      case fidl::kFidlTypeVector: {
+        uintptr_t presence;
+        return Read(view_.offset + static_cast<uint32_t>(offsetof(fidl_vector_t, data)),
+                    &presence, sizeof(presence)) &&
+               presence != FIDL_ALLOC_ABSENT;
+      }
+      case fidl::kFidlTypeXUnion: {
+        uint32_t tag;
+        return Read(view_.offset, &tag, sizeof(tag)) && tag != 0;
+      }
+      default:
+        return true;
+    }
+  }
+
+  bool Variant(uint32_t* out_variant, fidl_view_t* out_view) {
+    uint32_t out_of_line_offset = view_.out_of_line_offset;
+    const uint32_t envelope_offset =
+        view_.offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope));
+    uint32_t tag;
+    if (const auto* coded_union = ViewedUnion(view_.type)) {
+      if (!Read(view_.offset, &tag, sizeof(tag))) {
+        return false;
+      }
+      uint32_t index = tag;
+      if (wire_format_ == WireFormat::kV1) {
+        if (!VariantIndex(*coded_union, tag, &index)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "unknown static-union ordinal");
+        }
+      } else if (tag >= coded_union->field_count) {
+        return Fail(ZX_ERR_INVALID_ARGS, "invalid static-union tag");
+      }
+      *out_variant = index;
+      const fidl_type_t* type = coded_union->fields[index].type;
+      const uint32_t size = VariantSize(*coded_union, index, wire_format_);
+      if (wire_format_ == WireFormat::kV1) {
+        return Envelope(true, type, size, envelope_offset, &out_of_line_offset, out_view);
+      }
+      return View(type, size, view_.offset + coded_union->data_offset, out_of_line_offset,
+                  out_view);
+    }
+    if (!view_.type || view_.type->type_tag != fidl::kFidlTypeXUnion) {
+      return Fail(ZX_ERR_INVALID_ARGS, "view is not a union or xunion");
+    }
+    if (!Read(view_.offset, &tag, sizeof(tag))) {
+      return false;
+    }
+    if (tag == 0) {
+      return Fail(ZX_ERR_NOT_FOUND, "xunion is empty");
+    }
+    *out_variant = tag;
+    const auto* field = XUnionField(view_.type->coded_xunion, tag);
+    const fidl_type_t* type = field ? field->type : nullptr;
+    return Envelope(type != nullptr, type, type ? InlineSize(type, wire_format_) : 0,
+                    envelope_offset, &out_of_line_offset, out_view);
+  }
+
+  bool Count(uint32_t* out_count) {
+    if (view_.type && view_.type->type_tag == fidl::kFidlTypeArray) {
+      *out_count = view_.type->coded_array.array_size / view_.type->coded_array.element_size;
+      return true;
+    }
+    if (!IsVector(view_.type)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "view is not a string, vector or array");
+    }
+    uint32_t data_offset, data_size;
+    return VectorData(&data_offset, &data_size, out_count);
+  }
+
+  bool Element(uint32_t index, fidl_view_t* out_view) {
+    const fidl_type_t* element;
+    uint32_t element_size, count, data_offset;
+    uint32_t out_of_line_offset = view_.out_of_line_offset;
+    if (view_.type && view_.type->type_tag == fidl::kFidlTypeArray) {
+      const auto& coded_array = view_.type->coded_array;
+      element = coded_array.element;
+      element_size = coded_array.element_size;
+      count = coded_array.array_size / element_size;
+      data_offset = view_.offset;
+    } else if (IsVector(view_.type)) {
+      bool nullable;
+      uint32_t max_count, data_size;
+      VectorShape(view_.type, &element, &element_size, &nullable, &max_count);
+      if (!VectorData(&data_offset, &data_size, &count)) {
+        return false;
+      }
+      out_of_line_offset = data_offset + static_cast<uint32_t>(fidl::FidlAlign(data_size));
+    } else {
+      return Fail(ZX_ERR_INVALID_ARGS, "view is not a string, vector or array");
+    }
+    if (index >= count) {
+      return Fail(ZX_ERR_OUT_OF_RANGE, "index is past the end of the vector or array");
+    }
+    // Only elements with out-of-line objects need be skipped.
+    for (uint32_t i = 0; element && i < index; i++) {
+      if (!Skip(element, data_offset + i * element_size, &out_of_line_offset, 0)) {
+        return false;
+      }
+    }
+    return View(element, element ? InlineSize(element, wire_format_) : element_size,
+                data_offset + index * element_size, out_of_line_offset, out_view);
+  }
+
+  bool TableField(uint32_t ordinal, fidl_view_t* out_view) {
+    if (!view_.type || view_.type->type_tag != fidl::kFidlTypeTable) {
+      return Fail(ZX_ERR_INVALID_ARGS, "view is not a table");
+    }
+    fidl_vector_t envelopes;
+    if (!Read(view_.offset, &envelopes, sizeof(envelopes))) {
+      return false;
+    }
+    if (ordinal == 0 || ordinal > envelopes.count) {
+      return Fail(ZX_ERR_NOT_FOUND, "table field is absent");
+    }
+    uint32_t out_of_line_offset = view_.out_of_line_offset;
+    uint32_t envelopes_offset;
+    if (!Claim(static_cast<uint64_t>(envelopes.count) * sizeof(fidl_envelope_t),
+               &out_of_line_offset, &envelopes_offset)) {
+      return false;
+    }
+    // The contents of earlier envelopes are skipped by their size alone.
+    for (uint32_t i = 0; i + 1 < ordinal; i++) {
+      if (!SkipEnvelope(envelopes_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t)),
+                        &out_of_line_offset)) {
+        return false;
+      }
+    }
+    uint32_t cursor = 0;
+    const fidl_type_t* type = TableFieldType(view_.type->coded_table, ordinal, &cursor);
+    const uint32_t envelope_offset =
+        envelopes_offset + (ordinal - 1) * static_cast<uint32_t>(sizeof(fidl_envelope_t));
+    return Envelope(type != nullptr, type, type ? InlineSize(type, wire_format_) : 0,
+                    envelope_offset, &out_of_line_offset, out_view);
+  }
+
+  // Stores the end of the out-of-line objects of the viewed struct into
+  // |out_end|.
+  bool StructEnd(uint32_t* out_end) {
+    const auto* coded_struct = ViewedStruct(view_.type);
+    if (!coded_struct) {
+      return Fail(ZX_ERR_INVALID_ARGS, "view is not a struct");
+    }
+    *out_end = view_.out_of_line_offset;
+    return SkipStruct(*coded_struct, view_.offset, out_end, 0);
+  }
+
+  // Stores the root view of the message of struct |type| into |out_view|.
+  bool Root(const fidl_type_t* type, fidl_view_t* out_view) {
+    if (!type || type->type_tag != fidl::kFidlTypeStruct) {
+      return Fail(ZX_ERR_INVALID_ARGS, "top-level type must be a struct");
+    }
+    uint32_t out_of_line_offset = 0, offset;
+    return Claim(type->coded_struct.size, &out_of_line_offset, &offset) &&
+           View(type, type->coded_struct.size, offset, out_of_line_offset, out_view);
+  }
+
+  // Checks the structure of the message as a message of top-level struct
+  // |type|: presence markers, union tags and ordinals, and that its out-of-line
+  // objects (skipping the contents of envelopes) end where the message does.
+  bool Check(const fidl_type_t* type) {
+    fidl_view_t root;
+    if (!Root(type, &root)) {
+      return false;
+    }
+    uint32_t out_of_line_offset = root.out_of_line_offset;
+    if (!Skip(type, root.offset, &out_of_line_offset, 0)) {
+      return false;
+    }
+    if (out_of_line_offset != view_.num_bytes) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message has bytes past its last out-of-line object");
+    }
+    return true;
+  }
+
+  zx_status_t Result(const char** out_error_msg) const {
+    if (status_ != ZX_OK && out_error_msg) {
+      *out_error_msg = error_;
+    }
+    return status_;
+  }
+
+  // Stores into |out_view| a view of the object of |type| at |offset|, whose
+  // out-of-line objects start at |out_of_line_offset|, following pointers.
+  bool View(const fidl_type_t* type, uint32_t size, uint32_t offset, uint32_t out_of_line_offset,
+            fidl_view_t* out_view) {
+    if (type && type->type_tag == fidl::kFidlTypeStructPointer) {
+      bool present;
+      if (!ReadPresence(offset, &present)) {
+        return false;
+      }
+      if (!present) {
+        return Fail(ZX_ERR_NOT_FOUND, "struct pointer is absent");
+      }
+      size = type->coded_struct_pointer.struct_type->size;
+      if (!Claim(size, &out_of_line_offset, &offset)) {
+        return false;
+      }
+    } else if (type && type->type_tag == fidl::kFidlTypeUnionPointer) {
+      bool present;
+      if (wire_format_ == WireFormat::kV1) {
+        // Nullable static unions are inline xunions, which are empty when absent.
+        uint32_t tag;
+        if (!Read(offset, &tag, sizeof(tag))) {
+          return false;
+        }
+        present = tag != 0;
+      } else if (!ReadPresence(offset, &present)) {
+        return false;
+      }
+      if (!present) {
+        return Fail(ZX_ERR_NOT_FOUND, "union pointer is absent");
+      }
+      if (wire_format_ == WireFormat::kOld) {
+        size = type->coded_union_pointer.union_type->size;
+        if (!Claim(size, &out_of_line_offset, &offset)) {
+          return false;
+        }
+      }
+    }
+    *out_view = view_;
+    out_view->type = type;
+    out_view->size = size;
+    out_view->offset = offset;
+    out_view->out_of_line_offset = out_of_line_offset;
+    return true;
+  }
+
+  // Views the contents of the envelope at |envelope_offset|, which are |size|
+  // bytes of |type| if |known|, and are claimed from |*out_of_line_offset|.
+  bool Envelope(bool known, const fidl_type_t* type, uint32_t size, uint32_t envelope_offset,
+                uint32_t* out_of_line_offset, fidl_view_t* out_view) {
+    fidl_envelope_t envelope;
+    bool present;
+    if (!ReadEnvelope(envelope_offset, &envelope, &present)) {
+      return false;
+    }
+    if (!present) {
+      return Fail(ZX_ERR_NOT_FOUND, "envelope is absent");
+    }
+    uint32_t contents_offset;
+    if (!Claim(envelope.num_bytes, out_of_line_offset, &contents_offset)) {
+      return false;
+    }
+    if (!known) {
+      return View(nullptr, envelope.num_bytes, contents_offset, *out_of_line_offset, out_view);
+    }
+    if (size > envelope.num_bytes) {
+      return Fail(ZX_ERR_INVALID_ARGS, "envelope is smaller than its contents");
+    }
+    return View(type, size, contents_offset,
+                contents_offset + static_cast<uint32_t>(fidl::FidlAlign(size)), out_view);
+  }
+
+  // Advances |*out_of_line_offset| past the out-of-line objects of the object
+  // of |type| at |offset|.
+  bool Skip(const fidl_type_t* type, uint32_t offset, uint32_t* out_of_line_offset,
+            uint32_t depth) {
+    if (depth > kViewMaxDepth) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is too deeply nested");
+    }
+    if (!type) {
+      return true;
+    }
+
+    switch (type->type_tag) {
+      case fidl::kFidlTypePrimitive:
+      case fidl::kFidlTypeEnum:
+      case fidl::kFidlTypeBits:
+      case fidl::kFidlTypeHandle:
+        return true;
+      case fidl::kFidlTypeStruct:
+        return SkipStruct(type->coded_struct, offset, out_of_line_offset, depth);
+      case fidl::kFidlTypeStructPointer: {
+        const auto& coded_struct = *type->coded_struct_pointer.struct_type;
+        bool present;
+        uint32_t struct_offset;
+        if (!ReadPresence(offset, &present)) {
+          return false;
+        }
+        return !present || (Claim(coded_struct.size, out_of_line_offset, &struct_offset) &&
+                            SkipStruct(coded_struct, struct_offset, out_of_line_offset, depth + 1));
+      }
+      case fidl::kFidlTypeUnion:
+        return SkipUnion(type->coded_union, offset, out_of_line_offset, depth);
+      case fidl::kFidlTypeUnionPointer: {
+        const auto& coded_union = *type->coded_union_pointer.union_type;
+        if (wire_format_ == WireFormat::kV1) {
+          uint32_t tag;
+          if (!Read(offset, &tag, sizeof(tag))) {
+            return false;
+          }
+          return tag == 0 || SkipUnion(coded_union, offset, out_of_line_offset, depth);
+        }
+        bool present;
+        uint32_t union_offset;
+        if (!ReadPresence(offset, &present)) {
+          return false;
+        }
+        return !present || (Claim(coded_union.size, out_of_line_offset, &union_offset) &&
+                            SkipUnion(coded_union, union_offset, out_of_line_offset, depth + 1));
+      }
+      case fidl::kFidlTypeArray: {
+        const auto& coded_array = type->coded_array;
+        if (!coded_array.element) {
+          return true;
+        }
+        for (uint32_t element_offset = 0; element_offset < coded_array.array_size;
+             element_offset += coded_array.element_size) {
+          if (!Skip(coded_array.element, offset + element_offset, out_of_line_offset, depth)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeString:
+      case fidl::kFidlTypeVector: {
+        const fidl_type_t* element;
+        uint32_t element_size, max_count;
+        bool nullable, present;
+        VectorShape(type, &element, &element_size, &nullable, &max_count);
+        fidl_vector_t vector;
+        if (!Read(offset, &vector, sizeof(vector)) ||
+            !ReadPresence(offset + static_cast<uint32_t>(offsetof(fidl_vector_t, data)),
+                          &present)) {
+          return false;
+        }
+        if (!present) {
+          return true;
+        }
+        uint32_t data_offset;
+        if (vector.count > view_.num_bytes ||
+            !Claim(vector.count * element_size, out_of_line_offset, &data_offset)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+        }
+        for (uint32_t i = 0; element && i < vector.count; i++) {
+          if (!Skip(element, data_offset + i * element_size, out_of_line_offset, depth + 1)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeTable: {
+        fidl_vector_t envelopes;
+        uint32_t envelopes_offset;
+        if (!Read(offset, &envelopes, sizeof(envelopes))) {
+          return false;
+        }
+        if (envelopes.count > view_.num_bytes ||
+            !Claim(envelopes.count * sizeof(fidl_envelope_t), out_of_line_offset,
+                   &envelopes_offset)) {
+          return Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+        }
+        for (uint32_t i = 0; i < envelopes.count; i++) {
+          if (!SkipEnvelope(envelopes_offset + i * static_cast<uint32_t>(sizeof(fidl_envelope_t)),
+                            out_of_line_offset)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case fidl::kFidlTypeXUnion: {
+        uint32_t tag;
+        if (!Read(offset, &tag, sizeof(tag))) {
+          return false;
+        }
+        return tag == 0 ||
+               SkipEnvelope(offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                            out_of_line_offset);
+      }
+    }
+
+    assert(false && "unexpected non-exhaustive switch on fidl::FidlTypeTag");
+    return false;
+  }
+
+  bool SkipStruct(const fidl::FidlCodedStruct& coded_struct, uint32_t offset,
+                  uint32_t* out_of_line_offset, uint32_t depth) {
+    for (uint32_t i = 0; i < coded_struct.field_count; i++) {
+      const auto& field = coded_struct.fields[i];
+      if (field.type && !Skip(field.type, offset + field.offset, out_of_line_offset, depth)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool SkipUnion(const fidl::FidlCodedUnion& coded_union, uint32_t offset,
+                 uint32_t* out_of_line_offset, uint32_t depth) {
+    uint32_t tag;
+    if (!Read(offset, &tag, sizeof(tag))) {
+      return false;
+    }
+    if (wire_format_ == WireFormat::kV1) {
+      uint32_t index;
+      if (!VariantIndex(coded_union, tag, &index)) {
+        return Fail(ZX_ERR_INVALID_ARGS, "ordinal has no corresponding variant");
+      }
+      return SkipEnvelope(offset + static_cast<uint32_t>(offsetof(fidl_xunion_t, envelope)),
+                          out_of_line_offset);
+    }
+    if (tag >= coded_union.field_count) {
+      return Fail(ZX_ERR_INVALID_ARGS, "invalid static-union tag");
+    }
+    return Skip(coded_union.fields[tag].type, offset + coded_union.data_offset,
+                out_of_line_offset, depth);
+  }
+
+  // The contents of envelopes are skipped without walking them.
+  bool SkipEnvelope(uint32_t envelope_offset, uint32_t* out_of_line_offset) {
+    fidl_envelope_t envelope;
+    bool present;
+    uint32_t contents_offset;
+    return ReadEnvelope(envelope_offset, &envelope, &present) &&
+           (!present || Claim(envelope.num_bytes, out_of_line_offset, &contents_offset));
+  }
+
+  // Maps the old wire format |offset| of |size| bytes of primitive members of
+  // the viewed struct to their offset in the struct, in its wire format.
+  bool MemberOffset(const fidl::FidlCodedStruct& coded_struct, uint32_t offset, uint32_t size,
+                    uint32_t* out_offset) {
+    if (const char* error =
+            fidl::internal::MemberOffset(coded_struct, wire_format_, offset, size, out_offset)) {
+      return Fail(ZX_ERR_INVALID_ARGS, error);
+    }
+    return true;
+  }
+
+  // Locates the data of the viewed string or vector, which is its first
+  // out-of-line object. Absent strings and vectors have no data.
+  bool VectorData(uint32_t* out_offset, uint32_t* out_size, uint32_t* out_count) {
+    const fidl_type_t* element;
+    uint32_t element_size, max_count;
+    bool nullable, present;
+    VectorShape(view_.type, &element, &element_size, &nullable, &max_count);
+    fidl_vector_t vector;
+    if (!Read(view_.offset, &vector, sizeof(vector)) ||
+        !ReadPresence(view_.offset + static_cast<uint32_t>(offsetof(fidl_vector_t, data)),
+                      &present)) {
+      return false;
+    }
+    if (!present) {
+      vector.count = 0;
+    }
+    uint32_t out_of_line_offset = view_.out_of_line_offset;
+    if (vector.count > view_.num_bytes ||
+        !Claim(vector.count * element_size, &out_of_line_offset, out_offset)) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+    }
+    *out_size = static_cast<uint32_t>(vector.count * element_size);
+    if (out_count) {
+      *out_count = static_cast<uint32_t>(vector.count);
+    }
+    return true;
+  }
+
+  bool Read(uint32_t offset, void* out_data, uint32_t size) {
+    if (offset > view_.num_bytes || size > view_.num_bytes - offset) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+    }
+    memcpy(out_data, &view_.bytes[offset], size);
+    return true;
+  }
+
+  bool ReadPresence(uint32_t offset, bool* out_present) {
+    uintptr_t presence;
+    if (!Read(offset, &presence, sizeof(presence))) {
+      return false;
+    }
+    if (presence != FIDL_ALLOC_PRESENT && presence != FIDL_ALLOC_ABSENT) {
+      return Fail(ZX_ERR_INVALID_ARGS, "invalid presence marker");
+    }
+    *out_present = presence == FIDL_ALLOC_PRESENT;
+    return true;
+  }
+
+  bool ReadEnvelope(uint32_t offset, fidl_envelope_t* out_envelope, bool* out_present) {
+    if (!Read(offset, out_envelope, sizeof(*out_envelope))) {
+      return false;
+    }
+    switch (out_envelope->presence) {
+      case FIDL_ALLOC_PRESENT:
+        *out_present = true;
+        return true;
+      case FIDL_ALLOC_ABSENT:
+        *out_present = false;
+        return true;
+      case FIDL_ENVELOPE_INLINED:
+        return Fail(ZX_ERR_INVALID_ARGS, "views do not support the compact v1 wire format");
+      default:
+        return Fail(ZX_ERR_INVALID_ARGS, "invalid envelope presence");
+    }
+  }
+
+  // Claims |size| bytes of out-of-line objects at |*out_of_line_offset|.
+  bool Claim(uint64_t size, uint32_t* out_of_line_offset, uint32_t* out_offset) {
+    uint32_t new_offset;
+    if (size > view_.num_bytes ||
+        !fidl::AddOutOfLine(*out_of_line_offset, static_cast<uint32_t>(size), &new_offset) ||
+        *out_of_line_offset + size > view_.num_bytes) {
+      return Fail(ZX_ERR_INVALID_ARGS, "message is truncated");
+    }
+    *out_offset = *out_of_line_offset;
+    *out_of_line_offset = new_offset;
+    return true;
+  }
+
+  bool Fail(zx_status_t status, const char* error) {
+    status_ = status;
+    error_ = error;
+    return false;
+  }
+
+ private:
+  const fidl_view_t view_;
+  const WireFormat wire_format_;
+
+  zx_status_t status_ = ZX_OK;
+  const char* error_ = nullptr;
+};
+
+}  // namespace internal
+}  // namespace fidl
+
+#endif  // LIB_FIDL_VIEW_INTERNAL_H_